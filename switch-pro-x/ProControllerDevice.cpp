@@ -11,10 +11,24 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <string>
 
+#include <ctime>
+
+#include "capture.h"
 #include "common.h"
+#include "decode.h"
+#include "dsu.h"
+#include "mapping.h"
 #include "ProControllerDevice.h"
+#include "options.h"
+#include "profile.h"
+#include "ProControllerEmulator.h"
+#include "protocol.h"
+#include "scheduling.h"
+#include "stream.h"
 #include "switch-pro-x.h"
+#include "trace.h"
 
 //#define PRO_CONTROLLER_DEBUG_OUTPUT
 
@@ -22,111 +36,115 @@ namespace
 {
     const tstring BLUETOOTH_HID_GUID(TEXT("{00001124-0000-1000-8000-00805F9B34FB}"));
 
-    constexpr std::uint8_t PACKET_TYPE_STATUS = 0x81;
-    constexpr std::uint8_t PACKET_TYPE_CONTROLLER_DATA = 0x30;
+    constexpr DWORD TIMEOUT = 500;
+    // the controller can miss an output that follows another this closely
+    constexpr std::chrono::milliseconds CLEAR_SPACING(100);
 
-    constexpr std::uint8_t STATUS_TYPE_SERIAL = 0x01;
-    constexpr std::uint8_t STATUS_TYPE_INIT = 0x02;
+    std::atomic<unsigned int> capture_index(0);
+    std::atomic<unsigned int> device_index(0);
 
-    constexpr DWORD TIMEOUT = 500;
+    std::string CaptureFilename()
+    {
+        using std::to_string;
+        using std::time;
 
-    enum {
-        SWITCH_BUTTON_USB_MASK_A = 0x00000800,
-        SWITCH_BUTTON_USB_MASK_B = 0x00000400,
-        SWITCH_BUTTON_USB_MASK_X = 0x00000200,
-        SWITCH_BUTTON_USB_MASK_Y = 0x00000100,
-
-        SWITCH_BUTTON_USB_MASK_DPAD_UP = 0x02000000,
-        SWITCH_BUTTON_USB_MASK_DPAD_DOWN = 0x01000000,
-        SWITCH_BUTTON_USB_MASK_DPAD_LEFT = 0x08000000,
-        SWITCH_BUTTON_USB_MASK_DPAD_RIGHT = 0x04000000,
-
-        SWITCH_BUTTON_USB_MASK_PLUS = 0x00020000,
-        SWITCH_BUTTON_USB_MASK_MINUS = 0x00010000,
-        SWITCH_BUTTON_USB_MASK_HOME = 0x00100000,
-        SWITCH_BUTTON_USB_MASK_SHARE = 0x00200000,
-
-        SWITCH_BUTTON_USB_MASK_L = 0x40000000,
-        SWITCH_BUTTON_USB_MASK_ZL = 0x80000000,
-        SWITCH_BUTTON_USB_MASK_THUMB_L = 0x00080000,
-
-        SWITCH_BUTTON_USB_MASK_R = 0x00004000,
-        SWITCH_BUTTON_USB_MASK_ZR = 0x00008000,
-        SWITCH_BUTTON_USB_MASK_THUMB_R = 0x00040000,
-    };
-
-    enum
-    {
-        SWITCH_BUTTON_BLUETOOTH_MASK_A = 0x0002,
-        SWITCH_BUTTON_BLUETOOTH_MASK_B = 0x0001,
-        SWITCH_BUTTON_BLUETOOTH_MASK_X = 0x0008,
-        SWITCH_BUTTON_BLUETOOTH_MASK_Y = 0x0004,
-
-        SWITCH_BUTTON_BLUETOOTH_MASK_PLUS = 0x0200,
-        SWITCH_BUTTON_BLUETOOTH_MASK_MINUS = 0x0100,
-        SWITCH_BUTTON_BLUETOOTH_MASK_HOME = 0x1000,
-        SWITCH_BUTTON_BLUETOOTH_MASK_SHARE = 0x2000,
-
-        SWITCH_BUTTON_BLUETOOTH_MASK_L = 0x0010,
-        SWITCH_BUTTON_BLUETOOTH_MASK_ZL = 0x0040,
-        SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L = 0x0400,
-
-        SWITCH_BUTTON_BLUETOOTH_MASK_R = 0x0020,
-        SWITCH_BUTTON_BLUETOOTH_MASK_ZR = 0x0080,
-        SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R = 0x0800,
-    };
-
-#pragma pack(push, 1) 
-    typedef struct
-    {
-        std::uint8_t type;
-        union
-        {
-            struct
-            {
-                std::uint8_t type;
-                std::uint8_t serial[8];
-            } status_response;
-            struct
-            {
-                std::uint8_t timestamp;
-                std::uint32_t buttons;
-                std::uint8_t analog[6];
-            } controller_data;
-            std::uint8_t padding[63];
-        } data;
-    } ProControllerUSBPacket;
-
-    typedef struct
-    {
-        std::uint8_t report_id;
-        union
-        {
-            struct
-            {
-                std::uint16_t buttons;
-                std::uint8_t hat;
-                std::uint16_t analog[4];
-            } controller_data;
-            std::uint8_t padding[361];
-        } data;
-    } ProControllerBluetoothPacket;
-#pragma pack(pop) 
+        const auto& directory = GetOptions().capture_directory;
+
+        return directory + "\\capture-" + to_string(time(nullptr)) + "-" + to_string(capture_index++) + ".spxcap";
+    }
+
+    bool IsJoyCon(DeviceFamily family)
+    {
+        return family == DEVICE_FAMILY_JOYCON_LEFT || family == DEVICE_FAMILY_JOYCON_RIGHT;
+    }
+
+    // the encoder belongs to the sink, its thread is the only one encoding
+    FanOut::Consume MakeStreamSink(unsigned int pad)
+    {
+        using std::make_shared;
+
+        const auto encoder = make_shared<StreamEncoder>(static_cast<std::uint8_t>(pad), GetOptions().stream_redundancy);
+
+        return [encoder](const SinkReport& report) {
+            const std::uint8_t* packet;
+            const auto size = encoder->Encode(report.state, packet);
+
+            GetStreamSender()->Send(packet, size);
+        };
+    }
+}
+
+// a left and a right joy-con sharing one virtual pad. the primary plugged it in and runs the
+// mapping and submit pipeline, the other one hands its half over
+struct JoyConPair
+{
+    std::mutex mutex;
+    JoyConFusion fusion;
+    ProControllerDevice* members[2] = { nullptr, nullptr };
+    ProControllerDevice* primary = nullptr;
+    VIGEM_TARGET target;
+    // set with --stream, the pad keeps streaming as one pad when the primary leaves. whoever holds
+    // mutex is the one pushing
+    std::unique_ptr<FanOut> fanout;
+};
+
+namespace
+{
+    // every pair with at least one joy-con in it, the ones with a free side are joined first come
+    // first served
+    std::mutex pairs_mutex;
+    std::vector<std::shared_ptr<JoyConPair>> pairs;
 }
 
 ProControllerDevice::ProControllerDevice(const tstring& path)
     : counter(0)
     , Path(path)
+    , Id(device_index++)
     , handle(INVALID_HANDLE_VALUE)
+    , read_event(CreateEvent(nullptr, FALSE, FALSE, nullptr))
+    , write_event(CreateEvent(nullptr, FALSE, FALSE, nullptr))
+    , quit_event(CreateEvent(nullptr, TRUE, FALSE, nullptr))
+    , clearing_outputs(false)
+    , last_write()
     , quitting(false)
+    , removed(false)
     , last_rumble()
     , led_number(0xFF)
+    , large_motor(0)
+    , small_motor(0)
+    , motor_large_waiting(false)
+    , motor_small_waiting(false)
+    , motor_large_will_empty(false)
+    , motor_small_will_empty(false)
     , rumble_lock()
+    , waveform_rumble(GetOptions().waveform_rumble)
+    , pending_effect(-1)
+    , subcommands([this](std::uint8_t subcommand, const bytes& args) { WriteSubcommand(subcommand, args); }, &stats)
     , last_led(0xFF)
     , last_report({ 0 })
+    , connected(false)
+    , measure_latency(GetOptions().latency)
+    , rumble_request_pending(false)
+    , rumble_test_end(0)
+    , link(stats, Id)
+    , battery(stats, Id, GetOptions().battery_alerts)
+    , output_rate(stats, Id, GetOptions().output_rate_control)
+    , dsu_slot(-1)
+    , shared_slot(-1)
+    , fanout("device " + std::to_string(Id), &stats)
+    , imu_count(0)
+    , gate(GetOptions().report_gate)
+    , macros(GetMacroEngine(), GetOptions().turbos, GetOptions().macros, [this] { InjectMacroState(); })
+    , last_state()
+    , profiles(nullptr)
+    , profile(nullptr)
+    , family(DEVICE_FAMILY_PRO_CONTROLLER)
+    , decode(nullptr)
 {
     using std::cerr;
+    using std::cout;
     using std::endl;
+    using std::make_unique;
     using std::thread;
 
     handle = CreateFile(
@@ -152,46 +170,140 @@ ProControllerDevice::ProControllerDevice(const tstring& path)
         return;
     }
 
-    HIDD_ATTRIBUTES attributes;
-    attributes.Size = sizeof(attributes);
-    BOOLEAN ok = HidD_GetAttributes(handle, &attributes);
+    if (IsEmulatorPath(Path))
+    {
+        // emulated controllers talk over a message pipe, there's no HID descriptor to query
+        DWORD mode = PIPE_READMODE_MESSAGE;
+        SetNamedPipeHandleState(handle, &mode, nullptr, nullptr);
 
-    if (!ok)
+        is_bluetooth = IsEmulatorBluetoothPath(Path);
+        output_size = is_bluetooth ? BLUETOOTH_OUTPUT_REPORT_SIZE : USB_OUTPUT_REPORT_SIZE;
+        input_size = is_bluetooth ? BLUETOOTH_INPUT_REPORT_SIZE : USB_INPUT_REPORT_SIZE;
+    }
+    else if (!ReadHIDCaps())
     {
-        cerr << "Error calling HidD_GetAttributes (" << GetLastError() << ")" << endl;
         return;
     }
 
-    if (attributes.ProductID != PRO_CONTROLLER_PID || attributes.VendorID != PRO_CONTROLLER_VID)
+    decode = SelectDecoder(family, is_bluetooth ? TRANSPORT_BLUETOOTH : TRANSPORT_USB);
+
+    link.SetNominalInterval(is_bluetooth ? BLUETOOTH_REPORT_INTERVAL : USB_REPORT_INTERVAL);
+
+    if (!GetOptions().capture_directory.empty())
     {
-        // not a pro controller, fail silently
-        return;
+        const auto filename = CaptureFilename();
+        capture = make_unique<CaptureWriter>(filename, family, is_bluetooth, input_size, output_size);
+
+        if (capture->Valid())
+        {
+            cout << "CAPTURING ";
+            tcout << Path;
+            cout << " TO " << filename << endl;
+        }
     }
 
-    PHIDP_PREPARSED_DATA preparsed_data;
-    ok = HidD_GetPreparsedData(handle, &preparsed_data);
+    // the second joy-con of a pair reports into the pad the first one plugged in
+    if (!JoinPair())
+    {
+        if (!PlugTarget())
+        {
+            return;
+        }
 
-    if (!ok)
+        StartPair();
+    }
+
+    if (auto dsu = GetDsuServer())
     {
-        cerr << "Error calling HidD_GetPreparsedData (" << GetLastError() << ")" << endl;
-        return;
+        dsu_slot = dsu->Attach(is_bluetooth, serial);
     }
 
-    HIDP_CAPS caps;
-    NTSTATUS status = HidP_GetCaps(preparsed_data, &caps);
-    HidD_FreePreparsedData(preparsed_data);
+    if (auto shared = GetSharedState())
+    {
+        shared_slot = shared->Attach(Id, family, is_bluetooth);
+    }
 
-    if (status != HIDP_STATUS_SUCCESS)
+    AddSinks();
+
+    if (is_bluetooth)
     {
-        cerr << "Error calling HidP_GetCaps (" << status << ")" << endl;
-        return;
+        read_thread = thread(&ProControllerDevice::ReadThread<TRANSPORT_BLUETOOTH>, this);
+    }
+    else
+    {
+        read_thread = thread(&ProControllerDevice::ReadThread<TRANSPORT_USB>, this);
     }
 
-    output_size = caps.OutputReportByteLength;
-    input_size = caps.InputReportByteLength;
+    connected = true;
+}
 
-    // search for bluetooth hid GUID in path
-    is_bluetooth = tstring_ifind(Path, BLUETOOTH_HID_GUID) != tstring::npos;
+ProControllerDevice::~ProControllerDevice()
+{
+    BeginStop(false);
+
+    if (read_thread.joinable())
+    {
+        read_thread.join();
+    }
+
+    // timers can't resubmit once the target is gone
+    macros.Stop();
+    // the sinks finish what's queued before their slots go away
+    fanout.Stop();
+
+    if (dsu_slot >= 0)
+    {
+        GetDsuServer()->Detach(dsu_slot);
+    }
+
+    if (shared_slot >= 0)
+    {
+        GetSharedState()->Detach(shared_slot);
+    }
+
+    // a paired joy-con leaves the pad plugged in while its partner is still there
+    const bool pad_in_use = pair && LeavePair();
+
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(handle);
+    }
+
+    if (connected && !pad_in_use)
+    {
+        vigem_unregister_xusb_notification(XUSBCallback, ViGEm_Target);
+        vigem_target_unplug(&ViGEm_Target);
+    }
+
+    for (const auto event : { read_event, write_event, quit_event })
+    {
+        if (event != nullptr)
+        {
+            CloseHandle(event);
+        }
+    }
+}
+
+void ProControllerDevice::BeginStop(bool _removed)
+{
+    // only ever set, the destructor stopping a removed controller again mustn't undo it
+    if (_removed)
+    {
+        removed = true;
+    }
+
+    quitting = true;
+
+    if (quit_event != nullptr)
+    {
+        SetEvent(quit_event);
+    }
+}
+
+bool ProControllerDevice::PlugTarget()
+{
+    using std::cerr;
+    using std::endl;
 
     VIGEM_TARGET_INIT(&ViGEm_Target);
 
@@ -205,7 +317,7 @@ ProControllerDevice::ProControllerDevice(const tstring& path)
     {
         cerr << "error creating controller: " << ret << endl;
 
-        return;
+        return false;
     }
 
     ret = vigem_register_xusb_notification(XUSBCallback, ViGEm_Target);
@@ -215,473 +327,872 @@ ProControllerDevice::ProControllerDevice(const tstring& path)
         cerr << "error creating notification callback: " << ret << endl;
         vigem_target_unplug(&ViGEm_Target);
 
-        return;
+        return false;
     }
 
-    if (is_bluetooth)
+    return true;
+}
+
+bool ProControllerDevice::JoinPair()
+{
+    using std::cout;
+    using std::endl;
+    using std::find_if;
+    using std::lock_guard;
+    using std::mutex;
+
+    if (!GetOptions().joycon_pair || !IsJoyCon(family))
     {
-        read_thread = thread(&ProControllerDevice::BluetoothReadThread, this);
+        return false;
     }
-    else
+
+    lock_guard<mutex> lk(pairs_mutex);
+
+    const auto side = JoyConSide(family);
+    auto it = find_if(pairs.begin(), pairs.end(), [side](const auto& p) { return !p->members[side]; });
+
+    if (it == pairs.end())
     {
-        read_thread = thread(&ProControllerDevice::USBReadThread, this);
+        return false;
     }
 
-    connected = true;
+    pair = *it;
+
+    lock_guard<mutex> pair_lk(pair->mutex);
+    pair->members[side] = this;
+    ViGEm_Target = pair->target;
+
+    cout << "PAIRING " << DeviceFamilyName(family) << " WITH ";
+    tcout << pair->members[1 - side]->Path;
+    cout << endl;
+
+    return true;
 }
 
-ProControllerDevice::~ProControllerDevice()
+void ProControllerDevice::StartPair()
 {
-    quitting = true;
+    using std::lock_guard;
+    using std::make_shared;
+    using std::make_unique;
+    using std::mutex;
+    using std::to_string;
 
-    if (read_thread.joinable())
+    if (!GetOptions().joycon_pair || !IsJoyCon(family))
     {
-        read_thread.join();
+        return;
     }
 
-    if (handle != INVALID_HANDLE_VALUE)
+    lock_guard<mutex> lk(pairs_mutex);
+
+    pair = make_shared<JoyConPair>();
+    pair->members[JoyConSide(family)] = this;
+    pair->primary = this;
+    pair->target = ViGEm_Target;
+
+    if (GetStreamSender())
     {
-        CloseHandle(handle);
+        // nothing outlives the pair to count its drops in, FanOut::Drops still has them
+        pair->fanout = make_unique<FanOut>("pair " + to_string(Id), nullptr);
+        pair->fanout->AddSink("stream", SINK_REPORT_PAD, DEVICE_COUNTER_STREAM_DROPS, MakeStreamSink(Id));
     }
 
-    if (connected)
+    pairs.push_back(pair);
+}
+
+bool ProControllerDevice::LeavePair()
+{
+    using std::lock_guard;
+    using std::mutex;
+    using std::remove;
+
+    lock_guard<mutex> lk(pairs_mutex);
+    lock_guard<mutex> pair_lk(pair->mutex);
+
+    const auto side = JoyConSide(family);
+    const auto partner = pair->members[1 - side];
+    pair->members[side] = nullptr;
+
+    if (!partner)
     {
-        vigem_unregister_xusb_notification(XUSBCallback, ViGEm_Target);
-        vigem_target_unplug(&ViGEm_Target);
+        pairs.erase(remove(pairs.begin(), pairs.end(), pair), pairs.end());
+        return false;
     }
+
+    if (pair->primary == this)
+    {
+        // the pad stays plugged in and the partner's pipeline carries on from the last report.
+        // the partner's macro timers submit without the pair lock, only under its submit_mutex
+        {
+            lock_guard<mutex> submit_lk(partner->submit_mutex);
+            partner->last_report = last_report;
+        }
+
+        pair->primary = partner;
+    }
+
+    // release this half now instead of on the partner's next report
+    partner->SubmitPairedState(pair->fusion.Remove(family));
+
+    return true;
 }
 
-void ProControllerDevice::USBReadThread()
+template <Transport Link>
+void ProControllerDevice::ReadThread()
 {
-    using std::cout;
-    using std::endl;
+    using std::to_string;
+    using std::uint8_t;
     using std::chrono::steady_clock;
-    using std::int8_t;
-    using std::int_fast64_t;
 
+    TraceThreadName("device " + to_string(Id) + (Link == TRANSPORT_USB ? " usb read" : " bluetooth read"));
+    IoThreadScheduling scheduling(GetOptions().io_scheduling);
+
+    // usb needs a handshake before the controller sends anything, and over bluetooth every
+    // controller starts out in its simple hid mode and has to be switched to full reports, which
+    // carry the timer, battery and IMU. either is sent again until the first controller data
+    // arrives. the IMU is switched on along with the input mode, both subcommands go out at once
+    // instead of the second waiting on the first's reply
+    bytes handshake;
     bool first_control = false;
 
+    if constexpr (Link == TRANSPORT_USB)
+    {
+        handshake = { 0x80, 0x01 };
+
+        WriteData(handshake);
+    }
+    else
     {
-        bytes data = { 0x80, 0x01 };
-        WriteData(data);
+        subcommands.Request(SUBCOMMAND_SET_INPUT_MODE, { PACKET_TYPE_CONTROLLER_DATA }, nullptr);
+
+        if (HasImu(family))
+        {
+            subcommands.Request(SUBCOMMAND_ENABLE_IMU, { 0x01 }, nullptr);
+        }
     }
 
     while (!quitting)
     {
+        subcommands.Poll(steady_clock::now());
+
         const auto data = ReadData();
 
         if (!data)
         {
+            if (!first_control && !quitting)
+            {
+                if constexpr (Link == TRANSPORT_USB)
+                {
+                    WriteData(handshake);
+                    stats.Increment(DEVICE_COUNTER_HANDSHAKE_RETRIES);
+                }
+                else if (!subcommands.Pending(SUBCOMMAND_SET_INPUT_MODE))
+                {
+                    // the engine gave up on it, start over
+                    subcommands.Request(SUBCOMMAND_SET_INPUT_MODE, { PACKET_TYPE_CONTROLLER_DATA }, nullptr);
+                    stats.Increment(DEVICE_COUNTER_HANDSHAKE_RETRIES);
+                }
+            }
+
+            continue;
+        }
+
+        if (first_control)
+        {
+            HandleLEDAndVibration();
+        }
+
+        if (!data->empty() && data->front() == PACKET_TYPE_SUBCOMMAND_REPLY)
+        {
+            subcommands.HandleReply(data->data(), data->size(), read_time);
+
+            // a reply stands in for an input report, it starts with the same timer, battery,
+            // button and stick bytes, only without motion. skipping it would look like a drop to
+            // the link analyzer and back off the rumble output
+            if (data->size() > SUBCOMMAND_REPLY_ACK_OFFSET)
+            {
+                bytes input(data->begin(), data->begin() + SUBCOMMAND_REPLY_ACK_OFFSET);
+                input.front() = PACKET_TYPE_CONTROLLER_DATA;
+                HandleControllerData(input);
+            }
+
             continue;
         }
 
-        const auto hid_payload = reinterpret_cast<const ProControllerUSBPacket *>(data->data());
+        if constexpr (Link == TRANSPORT_USB)
+        {
+            const auto hid_payload = reinterpret_cast<const ProControllerUSBPacket *>(data->data());
+
+            if (hid_payload->type == PACKET_TYPE_STATUS)
+            {
+                switch (hid_payload->data.status_response.type)
+                {
+                case STATUS_TYPE_SERIAL:
+                {
+                    handshake = { 0x80, 0x02 };
+                    WriteData(handshake);
+                    break;
+                }
+                case STATUS_TYPE_INIT:
+                {
+                    handshake = { 0x80, 0x04 };
+                    WriteData(handshake);
+                    break;
+                }
+                }
+
+                continue;
+            }
+        }
+
+        if (HandleControllerData(*data) && !first_control)
+        {
+            last_rumble = steady_clock::now();
+            first_control = true;
+
+            // usb only takes subcommands once the handshake is through
+            if (Link == TRANSPORT_USB && HasImu(family))
+            {
+                subcommands.Request(SUBCOMMAND_ENABLE_IMU, { 0x01 }, nullptr);
+            }
+        }
+    }
+
+    // nothing reads replies anymore
+    subcommands.Cancel();
+
+    if (!removed)
+    {
+        ClearLEDAndVibration();
+    }
+}
+
+void ProControllerDevice::HandleLEDAndVibration()
+{
+    using std::memory_order_relaxed;
+    using std::chrono::steady_clock;
+    using std::uint8_t;
+    using std::lock_guard;
+    using std::optional;
+    using std::nullopt;
+
+    const auto now = steady_clock::now();
+    auto interval = steady_clock::duration(OUTPUT_BASE_INTERVAL);
+
+    if (waveform_rumble)
+    {
+        lock_guard<spinlock> lk(rumble_lock);
+
+        const int effect = pending_effect.exchange(-1, memory_order_relaxed);
+
+        if (effect >= 0)
+        {
+            waveform.Play(RumbleEffects()[effect]);
+        }
+
+        waveform.SetTarget(large_motor, small_motor);
+
+        // a packet per report while the waveform moves, reports come every 15ms give or take
+        if (waveform.Busy())
+        {
+            interval = RUMBLE_PACKET_PERIOD - RUMBLE_SAMPLE_PERIOD;
+        }
+    }
+
+    if (now > last_rumble + interval)
+    {
+        TraceSpan span("led/rumble", Id);
+
+        // control pipe rumble tests are ended from here, the read thread is always running anyway
+        const auto test_end = rumble_test_end.load(memory_order_relaxed);
+
+        if (test_end != 0 && now.time_since_epoch().count() >= test_end)
+        {
+            rumble_test_end.store(0, memory_order_relaxed);
+            SetRumbleAndLED(0, 0, led_number);
+        }
+
+        if (led_number != last_led)
+        {
+            subcommands.Request(SUBCOMMAND_SET_PLAYER_LIGHTS, { static_cast<uint8_t>(1 << led_number) }, nullptr);
+            subcommands.Poll(now);
+
+            last_led = led_number;
+        }
+        else
+        {
+            bytes buf = { OUTPUT_TYPE_RUMBLE, 0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00 };
+            optional<steady_clock::time_point> rumble_request;
+            bool busy = false;
+            bool send;
+
+            {
+                lock_guard<spinlock> lk(rumble_lock);
+
+                if (waveform_rumble)
+                {
+                    // one plain frame for the three steps, the steps of a skipped packet are lost,
+                    // the envelope doesn't wait for them
+                    RumbleSample samples[RUMBLE_SAMPLES_PER_PACKET];
+                    waveform.SetTarget(large_motor, small_motor);
+                    busy = waveform.Busy();
+                    waveform.Render(samples, RUMBLE_SAMPLES_PER_PACKET);
+                    EncodeRumblePacket(samples, RUMBLE_SAMPLES_PER_PACKET, &buf[2]);
+                }
+                else
+                {
+                    // discovered through trial and error, seem to be good enough
+                    // NOTE: xinput left/right motors are actually functionally different, not for directional rumble
+                    if (large_motor != 0)
+                    {
+                        buf[2] = 0x80;
+                        buf[3] = 0x20;
+                        buf[4] = 0x62;
+                        buf[5] = large_motor >> 2;
+                    }
+
+                    if (small_motor != 0)
+                    {
+                        buf[6] = 0x98;
+                        buf[7] = 0x20;
+                        buf[8] = 0x62;
+                        buf[9] = small_motor >> 2;
+                    }
+                }
+
+                // a skipped packet leaves the motors as they are for the next tick
+                send = output_rate.ShouldSend(&buf[2], busy, now);
+
+                if (send)
+                {
+                    if (motor_large_will_empty)
+                    {
+                        large_motor = 0;
+                        motor_large_will_empty = false;
+                    }
+
+                    if (motor_small_will_empty)
+                    {
+                        small_motor = 0;
+                        motor_small_will_empty = false;
+                    }
+
+                    motor_large_waiting = false;
+                    motor_small_waiting = false;
+
+                    rumble_request = rumble_request_pending ? optional<steady_clock::time_point>(rumble_request_time) : nullopt;
+                    rumble_request_pending = false;
+                }
+            }
+
+            if (send)
+            {
+                buf[1] = static_cast<uint8_t>(counter++ & 0x0F);
+                WriteData(buf);
+                stats.Increment(DEVICE_COUNTER_RUMBLE_SENT);
+
+                if (rumble_request)
+                {
+                    latency.Record(LATENCY_STAGE_RUMBLE_TOTAL, steady_clock::now() - *rumble_request);
+                }
+            }
+        }
+
+        last_rumble = now;
+    }
+}
+
+void ProControllerDevice::ClearLEDAndVibration()
+{
+    using std::this_thread::sleep_until;
+
+    clearing_outputs = true;
+
+    // only as long as the last output needs, usually that went out a while ago
+    sleep_until(last_write + CLEAR_SPACING);
+
+    {
+        // stop haptic feedback
+        bytes buf = { 0x10, static_cast<uint8_t>(counter++ & 0x0F), 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00 };
+        WriteData(buf);
+    }
+
+    sleep_until(last_write + CLEAR_SPACING);
+
+    // turn off LED, past the engine since nobody is left to read the reply
+    WriteSubcommand(SUBCOMMAND_SET_PLAYER_LIGHTS, { 0x00 });
+}
+
+void ProControllerDevice::WriteSubcommand(std::uint8_t subcommand, const bytes& args)
+{
+    using std::uint8_t;
+
+    // neutral rumble data ahead of the subcommand
+    bytes buf = { OUTPUT_TYPE_SUBCOMMAND, static_cast<uint8_t>(counter++ & 0x0F), 0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40, subcommand };
+    buf.insert(buf.end(), args.begin(), args.end());
+
+    WriteData(buf);
+}
+
+std::future<SubcommandReply> ProControllerDevice::SendSubcommand(std::uint8_t subcommand, const std::vector<std::uint8_t>& args)
+{
+    return subcommands.Request(subcommand, args);
+}
+
+bool ProControllerDevice::HandleControllerData(const bytes& data)
+{
+    using std::defer_lock;
+    using std::mutex;
+    using std::unique_lock;
+    using std::chrono::steady_clock;
+
+    TraceSpan span("decode", Id);
+    ControllerState state;
+
+    if (!decode(data.data(), data.size(), state))
+    {
+        return false;
+    }
+
+    const auto dropped = link.Record(read_time, state.timed, state.timer);
+    output_rate.RecordInput(dropped, read_time);
+    battery.Record(state.power);
+
+    // everything downstream works from when the controller sampled the report, not when we read it
+    state.time = state.timed ? clock.Update(read_time, state.timer) : read_time;
+    imu_count = DecodeImuSamples(data.data(), data.size(), state.time, imu_samples.data());
+
+    // the filter settings come with the profile, so a reload retunes them on the next report.
+    // the macro timers resolve the profile too, under submit_mutex
+    bool filter_sticks;
+    OneEuroParams filter_params;
 
-        if (first_control)
-        {
-            HandleLEDAndVibration();
-        }
+    {
+        unique_lock<mutex> profile_lk(submit_mutex, defer_lock);
 
-        switch (hid_payload->type)
-        {
-        case PACKET_TYPE_STATUS:
+        if (macros.Enabled())
         {
-            switch (hid_payload->data.status_response.type)
-            {
-            case STATUS_TYPE_SERIAL:
-            {
-                bytes payload = { 0x80, 0x02 };
-                WriteData(payload);
-                break;
-            }
-            case STATUS_TYPE_INIT:
-            {
-                bytes payload = { 0x80, 0x04 };
-                WriteData(payload);
-                break;
-            }
-            }
-            break;
+            profile_lk.lock();
         }
-        case PACKET_TYPE_CONTROLLER_DATA:
-        {
-            if (!first_control)
-            {
-                last_rumble = steady_clock::now();
-                first_control = true;
-            }
-
-            const auto& analog = hid_payload->data.controller_data.analog;
-            const auto& buttons = hid_payload->data.controller_data.buttons;
 
-            int8_t lx = (((analog[1] & 0x0F) << 4) | ((analog[0] & 0xF0) >> 4)) + 127;
-            int8_t ly = analog[2] + 127;
-            int8_t rx = (((analog[4] & 0x0F) << 4) | ((analog[3] & 0xF0) >> 4)) + 127;
-            int8_t ry = analog[5] + 127;
+        const auto& profile = CurrentProfile();
+        filter_sticks = profile.filter_sticks;
+        filter_params = profile.stick_filter;
+    }
 
-#ifdef PRO_CONTROLLER_DEBUG_OUTPUT
-            cout << "A: " << !!(buttons & SWITCH_BUTTON_USB_MASK_A) << ", ";
-            cout << "B: " << !!(buttons & SWITCH_BUTTON_USB_MASK_B) << ", ";
-            cout << "X: " << !!(buttons & SWITCH_BUTTON_USB_MASK_X) << ", ";
-            cout << "Y: " << !!(buttons & SWITCH_BUTTON_USB_MASK_Y) << ", ";
+    if (filter_sticks)
+    {
+        stick_filter.Apply(filter_params, state);
+    }
 
-            cout << "DU: " << !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_UP) << ", ";
-            cout << "DD: " << !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_DOWN) << ", ";
-            cout << "DL: " << !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_LEFT) << ", ";
-            cout << "DR: " << !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_RIGHT) << ", ";
+    // each joy-con of a pair keeps its own DSU and shared state slot, emulators expect their
+    // motion separately
+    SinkReport sink_report;
+    sink_report.contents = SINK_REPORT_DEVICE;
+    sink_report.raw_size = 0;
+    sink_report.read_time = read_time;
+    sink_report.state = state;
+    sink_report.imu_samples = imu_samples;
+    sink_report.imu_count = imu_count;
 
-            cout << "P: " << !!(buttons & SWITCH_BUTTON_USB_MASK_PLUS) << ", ";
-            cout << "M: " << !!(buttons & SWITCH_BUTTON_USB_MASK_MINUS) << ", ";
-            cout << "H: " << !!(buttons & SWITCH_BUTTON_USB_MASK_HOME) << ", ";
-            cout << "S: " << !!(buttons & SWITCH_BUTTON_USB_MASK_SHARE) << ", ";
+    unique_lock<mutex> pair_lk;
 
-            cout << "L: " << !!(buttons & SWITCH_BUTTON_USB_MASK_L) << ", ";
-            cout << "ZL: " << !!(buttons & SWITCH_BUTTON_USB_MASK_ZL) << ", ";
-            cout << "TL: " << !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_L) << ", ";
+    if (pair)
+    {
+        // both halves go through the primary's pipeline, one report at a time
+        pair_lk = unique_lock<mutex>(pair->mutex);
+        state = pair->fusion.Update(family, state);
 
-            cout << "R: " << !!(buttons & SWITCH_BUTTON_USB_MASK_R) << ", ";
-            cout << "ZR: " << !!(buttons & SWITCH_BUTTON_USB_MASK_ZR) << ", ";
-            cout << "TR: " << !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_R) << ", ";
+        if (pair->primary != this)
+        {
+            span.End();
+            pair->primary->SubmitPairedState(state);
+            fanout.Push(sink_report);
+            return true;
+        }
+    }
 
-            cout << "LX: " << +lx << ", ";
-            cout << "LY: " << +ly << ", ";
+    // the state before turbo, macros and mapping, the receiving end of a stream applies its own
+    const auto pad_state = state;
 
-            cout << "RX: " << +rx << ", ";
-            cout << "RY: " << +ry;
+    unique_lock<mutex> lk(submit_mutex, defer_lock);
 
-            cout << endl;
-#endif
+    if (macros.Enabled())
+    {
+        macros.Update(state.buttons, state.time);
 
-            XUSB_REPORT report = { 0 };
+        lk.lock();
+        last_state = state;
+        state.buttons = macros.Apply(state.buttons);
+    }
 
-            // assign a/b/x/y so they match the positions on the xbox layout
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_A) ? XUSB_GAMEPAD_B : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_B) ? XUSB_GAMEPAD_A : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_X) ? XUSB_GAMEPAD_Y : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_Y) ? XUSB_GAMEPAD_X : 0;
+    const auto& mapping = CurrentProfile().mapping;
 
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_UP) ? XUSB_GAMEPAD_DPAD_UP : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_DOWN) ? XUSB_GAMEPAD_DPAD_DOWN : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_LEFT) ? XUSB_GAMEPAD_DPAD_LEFT : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_RIGHT) ? XUSB_GAMEPAD_DPAD_RIGHT : 0;
+    if (!measure_latency)
+    {
+        const auto report = MapToXUSB(state, mapping);
+        span.End();
 
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_PLUS) ? XUSB_GAMEPAD_START : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_MINUS) ? XUSB_GAMEPAD_BACK : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_HOME) ? XUSB_GAMEPAD_GUIDE : 0;
+        HandleController(report);
+        PushSinkReports(sink_report, pad_state);
+        return true;
+    }
 
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_L) ? XUSB_GAMEPAD_LEFT_SHOULDER : 0;
-            report.bLeftTrigger = !!(buttons & SWITCH_BUTTON_USB_MASK_ZL) * 0xFF;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_L) ? XUSB_GAMEPAD_LEFT_THUMB : 0;
+    const auto decoded = steady_clock::now();
+    const auto report = MapToXUSB(state, mapping);
+    const auto mapped = steady_clock::now();
+    span.End();
 
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_R) ? XUSB_GAMEPAD_RIGHT_SHOULDER : 0;
-            report.bRightTrigger = !!(buttons & SWITCH_BUTTON_USB_MASK_ZR) * 0xFF;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_R) ? XUSB_GAMEPAD_RIGHT_THUMB : 0;
+    latency.Record(LATENCY_STAGE_DECODE, decoded - read_time);
+    latency.Record(LATENCY_STAGE_MAP, mapped - decoded);
 
-            constexpr int_fast64_t SCALE_X_MIN = -100;
-            constexpr int_fast64_t SCALE_X_MAX = 85;
-            constexpr int_fast64_t SCALE_Y_MIN = -100;
-            constexpr int_fast64_t SCALE_Y_MAX = 90;
+    if (HandleController(report))
+    {
+        const auto submitted = steady_clock::now();
 
-            report.sThumbLX = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, lx);
-            report.sThumbLY = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, ly);
-            report.sThumbRX = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, rx);
-            report.sThumbRY = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, ry);
+        latency.Record(LATENCY_STAGE_SUBMIT, submitted - mapped);
+        latency.Record(LATENCY_STAGE_INPUT_TOTAL, submitted - read_time);
 
-            HandleController(report);
-            break;
-        }
+        if (state.timed)
+        {
+            latency.Record(LATENCY_STAGE_CAPTURE_TOTAL, submitted - state.time);
         }
     }
 
-    ClearLEDAndVibration();
+    PushSinkReports(sink_report, pad_state);
+    return true;
 }
 
-void ProControllerDevice::BluetoothReadThread()
+bool ProControllerDevice::HandleController(const XUSB_REPORT& report)
 {
-    using std::cout;
+    using std::cerr;
     using std::endl;
-    using std::int16_t;
-    using std::int_fast64_t;
+    using std::chrono::steady_clock;
 
-    while (!quitting)
+    if (report == last_report)
     {
-        const auto data = ReadData();
+        stats.Increment(DEVICE_COUNTER_DEDUPED);
+        return false;
+    }
 
-        if (!data)
-        {
-            continue;
-        }
+    const auto now = steady_clock::now();
 
+    if (gate.Enabled() && !gate.Pass(last_report, report, now))
+    {
+        stats.Increment(DEVICE_COUNTER_SUPPRESSED);
+        return false;
+    }
 
-        const auto hid_payload = reinterpret_cast<const ProControllerBluetoothPacket *>(data->data());
+    stats.Increment(DEVICE_COUNTER_SUBMITTED);
 
-        HandleLEDAndVibration();
+    TraceSpan span("submit", Id);
+    auto ret = vigem_xusb_submit_report(ViGEm_Target, report);
+    span.End();
 
-        if (hid_payload->report_id == 0x3F)
-        {
+    if (!VIGEM_SUCCESS(ret))
+    {
+        cerr << "error sending report: " << ret << endl;
 
-            const auto& analog = hid_payload->data.controller_data.analog;
-            const auto& hat = hid_payload->data.controller_data.hat;
-            const auto& buttons = hid_payload->data.controller_data.buttons;
+        quitting = true;
+    }
 
-            int16_t lx = analog[0] + 32767;
-            int16_t ly = analog[1] + 32767;
-            int16_t rx = analog[2] + 32767;
-            int16_t ry = analog[3] + 32767;
+    last_report = report;
+    gate.Submitted(now);
+    submitted.Store({ report, now });
 
-#ifdef PRO_CONTROLLER_DEBUG_OUTPUT
-            cout << "A: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_A) << ", ";
-            cout << "B: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_B) << ", ";
-            cout << "X: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_X) << ", ";
-            cout << "Y: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_Y) << ", ";
+    return true;
+}
+
+void ProControllerDevice::SubmitPairedState(ControllerState state)
+{
+    using std::lock_guard;
+    using std::mutex;
 
-            cout << "P: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_PLUS) << ", ";
-            cout << "M: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_MINUS) << ", ";
-            cout << "H: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_HOME) << ", ";
-            cout << "S: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_SHARE) << ", ";
+    if (quitting)
+    {
+        return;
+    }
 
-            cout << "L: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_L) << ", ";
-            cout << "ZL: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZL) << ", ";
-            cout << "TL: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L) << ", ";
+    if (macros.Enabled())
+    {
+        macros.Update(state.buttons, state.time);
+    }
 
-            cout << "R: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_R) << ", ";
-            cout << "ZR: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZR) << ", ";
-            cout << "TR: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R) << ", ";
+    lock_guard<mutex> lk(submit_mutex);
 
-            cout << "DPAD: " << +hat << ", ";
+    TraceSpan span("pair", Id);
+    last_state = state;
+    state.buttons = macros.Apply(state.buttons);
 
-            cout << "LX: " << +lx << ", ";
-            cout << "LY: " << +ly << ", ";
+    HandleController(MapToXUSB(state, CurrentProfile().mapping));
+    span.End();
 
-            cout << "RX: " << +rx << ", ";
-            cout << "RY: " << +ry;
+    PushPadState(last_state);
+}
 
-            cout << endl;
-#endif
+void ProControllerDevice::AddSinks()
+{
+    if (capture)
+    {
+        fanout.AddSink("capture", SINK_REPORT_RAW, DEVICE_COUNTER_CAPTURE_DROPS, [this](const SinkReport& report) {
+            capture->Record(report.raw_direction, report.raw, report.raw_size, report.read_time);
+        });
+    }
 
-            XUSB_REPORT report = { 0 };
+    if (dsu_slot >= 0)
+    {
+        fanout.AddSink("dsu", SINK_REPORT_DEVICE, DEVICE_COUNTER_DSU_DROPS, [slot = dsu_slot](const SinkReport& report) {
+            GetDsuServer()->Publish(slot, report.state, report.imu_samples.data(), report.imu_count);
+        });
+    }
 
-            // assign a/b/x/y so they match the positions on the xbox layout
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_A) ? XUSB_GAMEPAD_B : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_B) ? XUSB_GAMEPAD_A : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_X) ? XUSB_GAMEPAD_Y : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_Y) ? XUSB_GAMEPAD_X : 0;
+    if (shared_slot >= 0)
+    {
+        fanout.AddSink("shared state", SINK_REPORT_DEVICE, DEVICE_COUNTER_SHARED_STATE_DROPS, [slot = shared_slot](const SinkReport& report) {
+            GetSharedState()->Publish(slot, report.state, report.imu_samples.data(), report.imu_count);
+        });
+    }
 
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_PLUS) ? XUSB_GAMEPAD_START : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_MINUS) ? XUSB_GAMEPAD_BACK : 0;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_HOME) ? XUSB_GAMEPAD_GUIDE : 0;
+    // one stream per virtual pad, a pair streams from its own fan-out
+    if (GetStreamSender() && !pair)
+    {
+        fanout.AddSink("stream", SINK_REPORT_PAD, DEVICE_COUNTER_STREAM_DROPS, MakeStreamSink(Id));
+    }
+}
 
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_L) ? XUSB_GAMEPAD_LEFT_SHOULDER : 0;
-            report.bLeftTrigger = !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZL) * 0xFF;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L) ? XUSB_GAMEPAD_LEFT_THUMB : 0;
+void ProControllerDevice::PushSinkReports(SinkReport& report, const ControllerState& pad_state)
+{
+    // a lone controller's pad state is its own, so one report carries both
+    if (pair)
+    {
+        PushPadState(pad_state);
+    }
+    else
+    {
+        report.contents |= SINK_REPORT_PAD;
+    }
 
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_R) ? XUSB_GAMEPAD_RIGHT_SHOULDER : 0;
-            report.bRightTrigger = !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZR) * 0xFF;
-            report.wButtons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R) ? XUSB_GAMEPAD_RIGHT_THUMB : 0;
+    fanout.Push(report);
+}
 
-            switch (hat)
-            {
-            case 0x00:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_UP;
-                break;
-            }
-            case 0x01:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_RIGHT;
-                break;
-            }
-            case 0x02:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_RIGHT;
-                break;
-            }
-            case 0x03:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_RIGHT | XUSB_GAMEPAD_DPAD_DOWN;
-                break;
-            }
-            case 0x04:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_DOWN;
-                break;
-            }
-            case 0x05:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_DOWN | XUSB_GAMEPAD_DPAD_LEFT;
-                break;
-            }
-            case 0x06:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_LEFT;
-                break;
-            }
-            case 0x07:
-            {
-                report.wButtons |= XUSB_GAMEPAD_DPAD_LEFT | XUSB_GAMEPAD_DPAD_UP;
-                break;
-            }
-            }
+void ProControllerDevice::PushPadState(const ControllerState& state)
+{
+    // only called under the pair's mutex, which makes its holder the one producer
+    if (!pair->fanout)
+    {
+        return;
+    }
 
-            constexpr int_fast64_t SCALE_X_MIN = -25000;
-            constexpr int_fast64_t SCALE_X_MAX = 22000;
-            constexpr int_fast64_t SCALE_Y_MIN = -25000;
-            constexpr int_fast64_t SCALE_Y_MAX = 23000;
+    SinkReport report;
+    report.contents = SINK_REPORT_PAD;
+    report.raw_size = 0;
+    report.read_time = state.time;
+    report.state = state;
+    report.imu_count = 0;
 
-            report.sThumbLX = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, lx);
-            report.sThumbLY = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, -ly);
-            report.sThumbRX = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, rx);
-            report.sThumbRY = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, -ry);
+    pair->fanout->Push(report);
+}
 
-            HandleController(report);
-        }
+void ProControllerDevice::PushRaw(std::uint8_t direction, const bytes& data, std::chrono::steady_clock::time_point time)
+{
+    using std::copy_n;
+    using std::min;
+
+    if (!fanout.Wants(SINK_REPORT_RAW))
+    {
+        return;
     }
 
-    ClearLEDAndVibration();
+    SinkReport report;
+    report.contents = SINK_REPORT_RAW;
+    report.raw_direction = direction;
+    report.raw_size = static_cast<std::uint16_t>(min(data.size(), SINK_RAW_REPORT_SIZE));
+    report.read_time = time;
+    report.imu_count = 0;
+    copy_n(data.begin(), report.raw_size, report.raw);
+
+    fanout.Push(report);
 }
 
-void ProControllerDevice::HandleLEDAndVibration()
+void ProControllerDevice::InjectMacroState()
 {
-    using std::chrono::steady_clock;
-    using std::chrono::milliseconds;
-    using std::uint8_t;
     using std::lock_guard;
+    using std::mutex;
 
-    const auto now = steady_clock::now();
+    lock_guard<mutex> lk(submit_mutex);
 
-    if (now > last_rumble + milliseconds(100))
+    if (quitting)
     {
-        if (led_number != last_led)
-        {
-            bytes buf = { 0x01, static_cast<uint8_t>(counter++ & 0x0F), 0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40, 0x30, static_cast<uint8_t>(1 << led_number) };
-            WriteData(buf);
+        return;
+    }
 
-            last_led = led_number;
-        }
-        else
-        {
-            bytes buf = { 0x10, static_cast<uint8_t>(counter++ & 0x0F), 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00 };
+    TraceSpan span("macro", Id);
+    auto state = last_state;
+    state.buttons = macros.Apply(state.buttons);
 
-            {
-                lock_guard<spinlock> lk(rumble_lock);
+    HandleController(MapToXUSB(state, CurrentProfile().mapping));
+}
 
-                // discovered through trial and error, seem to be good enough
-                // NOTE: xinput left/right motors are actually functionally different, not for directional rumble
-                if (large_motor != 0)
-                {
-                    buf[2] = 0x80;
-                    buf[3] = 0x20;
-                    buf[4] = 0x62;
-                    buf[5] = large_motor >> 2;
-                }
+const Profile& ProControllerDevice::CurrentProfile()
+{
+    // the active set only changes when the profile file is reloaded
+    const auto& active = ActiveProfiles();
 
-                if (small_motor != 0)
-                {
-                    buf[6] = 0x98;
-                    buf[7] = 0x20;
-                    buf[8] = 0x62;
-                    buf[9] = small_motor >> 2;
-                }
+    if (&active != profiles)
+    {
+        profiles = &active;
+        profile = &active.Find(serial);
+        gate.SetParams(profile->gate);
+    }
 
-                if (motor_large_will_empty)
-                {
-                    large_motor = 0;
-                    motor_large_will_empty = false;
-                }
+    return *profile;
+}
 
-                if (motor_small_will_empty)
-                {
-                    small_motor = 0;
-                    motor_small_will_empty = false;
-                }
+bool ProControllerDevice::ReadHIDCaps()
+{
+    using std::cerr;
+    using std::endl;
 
-                motor_large_waiting = false;
-                motor_small_waiting = false;
-            }
+    HIDD_ATTRIBUTES attributes;
+    attributes.Size = sizeof(attributes);
+    BOOLEAN ok = HidD_GetAttributes(handle, &attributes);
 
-            WriteData(buf);
-        }
+    if (!ok)
+    {
+        cerr << "Error calling HidD_GetAttributes (" << GetLastError() << ")" << endl;
+        return false;
+    }
 
-        last_rumble = now;
+    // search for bluetooth hid GUID in path
+    is_bluetooth = tstring_ifind(Path, BLUETOOTH_HID_GUID) != tstring::npos;
+
+    if (attributes.VendorID != PRO_CONTROLLER_VID || !FamilyFromProductId(attributes.ProductID, is_bluetooth, family))
+    {
+        // not a controller we support, fail silently
+        return false;
     }
-}
 
-void ProControllerDevice::ClearLEDAndVibration()
-{
-    using std::this_thread::sleep_for;
-    using std::chrono::milliseconds;
+    PHIDP_PREPARSED_DATA preparsed_data;
+    ok = HidD_GetPreparsedData(handle, &preparsed_data);
+
+    if (!ok)
+    {
+        cerr << "Error calling HidD_GetPreparsedData (" << GetLastError() << ")" << endl;
+        return false;
+    }
 
-    sleep_for(milliseconds(100));
+    HIDP_CAPS caps;
+    NTSTATUS status = HidP_GetCaps(preparsed_data, &caps);
+    HidD_FreePreparsedData(preparsed_data);
 
+    if (status != HIDP_STATUS_SUCCESS)
     {
-        // stop haptic feedback
-        bytes buf = { 0x10, static_cast<uint8_t>(counter++ & 0x0F), 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00 };
-        WriteData(buf);
+        cerr << "Error calling HidP_GetCaps (" << status << ")" << endl;
+        return false;
     }
 
-    sleep_for(milliseconds(100));
+    output_size = caps.OutputReportByteLength;
+    input_size = caps.InputReportByteLength;
+
+    // profiles can be picked per controller by this, over bluetooth it's the mac address
+    WCHAR serial_number[128] = { 0 };
 
+    if (HidD_GetSerialNumberString(handle, serial_number, sizeof(serial_number) - sizeof(WCHAR)))
     {
-        // turn off LED
-        bytes buf = { 0x01, static_cast<uint8_t>(counter++ & 0x0F), 0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40, 0x30, 0x00 };
-        WriteData(buf);
+        serial = to_utf8(serial_number);
     }
+
+    return true;
+}
+
+bool ProControllerDevice::Valid() {
+    return connected;
 }
 
-void ProControllerDevice::HandleController(const XUSB_REPORT& report)
+bool ProControllerDevice::IsBluetooth() const
 {
-    using std::cerr;
-    using std::endl;
+    return is_bluetooth;
+}
 
-    if (report != last_report)
-    {
-        auto ret = vigem_xusb_submit_report(ViGEm_Target, report);
+DeviceFamily ProControllerDevice::Family() const
+{
+    return family;
+}
 
-        if (!VIGEM_SUCCESS(ret))
-        {
-            cerr << "error sending report: " << ret << endl;
+const std::string& ProControllerDevice::Serial() const
+{
+    return serial;
+}
 
-            quitting = true;
-        }
-      
-        last_report = report;
-    }
+const LatencyStats& ProControllerDevice::Latency() const
+{
+    return latency;
+}
+
+const DeviceStats& ProControllerDevice::Stats() const
+{
+    return stats;
+}
+
+const LinkAnalyzer& ProControllerDevice::Link() const
+{
+    return link;
 }
 
-std::int16_t ProControllerDevice::ScaleJoystick(std::int_fast64_t src_min, std::int_fast64_t src_max, std::int16_t val)
+const ClockSync& ProControllerDevice::Clock() const
 {
-    using std::int16_t;
-    using std::int_fast64_t;
-    using std::clamp;
-    using std::numeric_limits;
+    return clock;
+}
 
-    typedef numeric_limits<int16_t> int16_limts;
+const BatteryMonitor& ProControllerDevice::Battery() const
+{
+    return battery;
+}
 
-    constexpr int_fast64_t DST_MIN = int16_limts::min();
-    constexpr int_fast64_t DST_MAX = int16_limts::max();
-    constexpr int_fast64_t DST_RNG = DST_MAX - DST_MIN;
+bool ProControllerDevice::IsPaired() const
+{
+    return pair != nullptr;
+}
 
-    const int_fast64_t src_rng = src_max - src_min;
+SubmittedReport ProControllerDevice::LastSubmitted() const
+{
+    return submitted.Load();
+}
 
-    auto new_val = (((val - src_min) * DST_RNG) / src_rng) + DST_MIN;
+void ProControllerDevice::TestRumble(UCHAR _large_motor, UCHAR _small_motor, std::chrono::milliseconds duration)
+{
+    using std::memory_order_relaxed;
+    using std::chrono::steady_clock;
 
-    return static_cast<int16_t>(clamp(new_val, DST_MIN, DST_MAX));
+    SetRumbleAndLED(_large_motor, _small_motor, led_number);
+    rumble_test_end.store((steady_clock::now() + duration).time_since_epoch().count(), memory_order_relaxed);
 }
 
-bool ProControllerDevice::Valid() {
-    return connected;
+bool ProControllerDevice::PlayRumbleEffect(int effect)
+{
+    using std::memory_order_relaxed;
+
+    if (!waveform_rumble)
+    {
+        return false;
+    }
+
+    pending_effect.store(effect, memory_order_relaxed);
+
+    return true;
 }
 
 std::optional<ProControllerDevice::bytes> ProControllerDevice::ReadData()
 {
     using std::cerr;
     using std::endl;
+    using std::chrono::steady_clock;
 
+    TraceSpan wait_span("read wait", Id);
     bytes buf(input_size);
 
     DWORD bytesRead = 0;
     OVERLAPPED ol = { 0 };
-    ol.hEvent = CreateEvent(nullptr, FALSE, FALSE, TEXT(""));
+    ol.hEvent = read_event;
 
     if (!ReadFile(handle, buf.data(), static_cast<DWORD>(buf.size()), &bytesRead, &ol))
     {
@@ -689,7 +1200,9 @@ std::optional<ProControllerDevice::bytes> ProControllerDevice::ReadData()
 
         if (read_err == ERROR_IO_PENDING)
         {
-            auto waitObject = WaitForSingleObject(ol.hEvent, TIMEOUT);
+            // stopping sets the quit event, so the thread doesn't sit out the timeout first
+            HANDLE waits[2] = { read_event, quit_event };
+            auto waitObject = WaitForMultipleObjects(2, waits, FALSE, TIMEOUT);
 
             if (waitObject == WAIT_OBJECT_0)
             {
@@ -702,12 +1215,19 @@ std::optional<ProControllerDevice::bytes> ProControllerDevice::ReadData()
                         cerr << "Read failed (" << err << ")" << endl;
                     }
 
+                    stats.Increment(DEVICE_COUNTER_READ_ERRORS);
+
                     return {};
                 }
             }
             else
             {
-                cerr << "Read failed (" << waitObject << ")" << endl;
+                if (waitObject != WAIT_OBJECT_0 + 1)
+                {
+                    cerr << "Read failed (" << waitObject << ")" << endl;
+
+                    stats.Increment(waitObject == WAIT_TIMEOUT ? DEVICE_COUNTER_READ_TIMEOUTS : DEVICE_COUNTER_READ_ERRORS);
+                }
 
                 // could have timed out, cancel the IO if possible
                 if (CancelIo(handle))
@@ -728,13 +1248,22 @@ std::optional<ProControllerDevice::bytes> ProControllerDevice::ReadData()
                 cerr << "Read failed (" << read_err << ")" << endl;
             }
 
+            stats.Increment(DEVICE_COUNTER_READ_ERRORS);
+
             return {};
         }
     }
 
-    CloseHandle(ol.hEvent);
+    wait_span.End();
+
+    TraceSpan complete_span("read complete", Id);
+
+    read_time = steady_clock::now();
 
     buf.resize(bytesRead);
+    stats.Increment(DEVICE_COUNTER_REPORTS);
+
+    PushRaw(CAPTURE_DIRECTION_INPUT, buf, read_time);
 
     return buf;
 }
@@ -744,6 +1273,12 @@ void ProControllerDevice::WriteData(const bytes& data)
     using std::cerr;
     using std::endl;
     using std::copy;
+    using std::chrono::steady_clock;
+
+    TraceSpan span("write", Id);
+    const bool timed = measure_latency || output_rate.Enabled();
+    const auto write_start = timed ? steady_clock::now() : steady_clock::time_point();
+    bool stalled = false;
 
     bytes buf;
 
@@ -757,9 +1292,11 @@ void ProControllerDevice::WriteData(const bytes& data)
         buf = data;
     }
 
+    PushRaw(CAPTURE_DIRECTION_OUTPUT, buf, steady_clock::now());
+
     DWORD tmp;
     OVERLAPPED ol = { 0 };
-    ol.hEvent = CreateEvent(nullptr, FALSE, FALSE, TEXT(""));
+    ol.hEvent = write_event;
 
     if (!WriteFile(handle, buf.data(), static_cast<DWORD>(buf.size()), &tmp, &ol))
     {
@@ -767,7 +1304,8 @@ void ProControllerDevice::WriteData(const bytes& data)
 
         if (write_err == ERROR_IO_PENDING)
         {
-            auto waitObject = WaitForSingleObject(ol.hEvent, TIMEOUT);
+            HANDLE waits[2] = { write_event, quit_event };
+            auto waitObject = WaitForMultipleObjects(clearing_outputs ? 1 : 2, waits, FALSE, TIMEOUT);
 
             if (waitObject == WAIT_OBJECT_0) {
                 if (!GetOverlappedResult(handle, &ol, &tmp, TRUE)) {
@@ -777,11 +1315,19 @@ void ProControllerDevice::WriteData(const bytes& data)
                     {
                         cerr << "Write failed (" << GetLastError() << ")" << endl;
                     }
+
+                    stats.Increment(DEVICE_COUNTER_WRITE_ERRORS);
                 }
             }
             else
             {
-                cerr << "Write failed (" << waitObject << ")" << endl;
+                if (waitObject != WAIT_OBJECT_0 + 1)
+                {
+                    cerr << "Write failed (" << waitObject << ")" << endl;
+
+                    stats.Increment(waitObject == WAIT_TIMEOUT ? DEVICE_COUNTER_WRITE_STALLS : DEVICE_COUNTER_WRITE_ERRORS);
+                    stalled = waitObject == WAIT_TIMEOUT;
+                }
 
                 // could have timed out, cancel the IO if possible
                 if (CancelIo(handle))
@@ -799,17 +1345,57 @@ void ProControllerDevice::WriteData(const bytes& data)
             {
                 cerr << "Write failed (" << write_err << ")" << endl;
             }
+
+            stats.Increment(DEVICE_COUNTER_WRITE_ERRORS);
         }
     }
 
-    CloseHandle(ol.hEvent);
+    last_write = steady_clock::now();
+
+    if (timed)
+    {
+        const auto completion = last_write - write_start;
+
+        // a bluetooth write completes once it's on the air, so a slow one means a busy link
+        output_rate.RecordWrite(completion, stalled);
+
+        if (measure_latency)
+        {
+            latency.Record(LATENCY_STAGE_WRITE, completion);
+        }
+    }
 }
 
 void ProControllerDevice::HandleXUSBCallback(UCHAR _large_motor, UCHAR _small_motor, UCHAR _led_number)
+{
+    using std::lock_guard;
+    using std::mutex;
+
+    // the pad of a pair rumbles and lights up both joy-cons
+    if (pair)
+    {
+        lock_guard<mutex> lk(pair->mutex);
+
+        for (const auto member : pair->members)
+        {
+            if (member)
+            {
+                member->SetRumbleAndLED(_large_motor, _small_motor, _led_number);
+            }
+        }
+
+        return;
+    }
+
+    SetRumbleAndLED(_large_motor, _small_motor, _led_number);
+}
+
+void ProControllerDevice::SetRumbleAndLED(UCHAR _large_motor, UCHAR _small_motor, UCHAR _led_number)
 {
     using std::cout;
     using std::endl;
     using std::lock_guard;
+    using std::chrono::steady_clock;
 
 #ifdef PRO_CONTROLLER_DEBUG_OUTPUT
     cout << "XUSB CALLBACK (";
@@ -842,6 +1428,12 @@ void ProControllerDevice::HandleXUSBCallback(UCHAR _large_motor, UCHAR _small_mo
             motor_small_will_empty = false;
         }
         motor_small_waiting = true;
+
+        if (measure_latency && !rumble_request_pending)
+        {
+            rumble_request_time = steady_clock::now();
+            rumble_request_pending = true;
+        }
     }
 
     led_number = _led_number;
@@ -855,6 +1447,7 @@ bool ProControllerDevice::CheckIOError(DWORD err)
     {
     case ERROR_DEVICE_NOT_CONNECTED:
     case ERROR_OPERATION_ABORTED:
+    case ERROR_BROKEN_PIPE:
     {
         // not fatal
         ret = false;
@@ -4,16 +4,47 @@
 
 #include <ViGEmUM.h>
 
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include <cstdint>
 
+#include "battery.h"
+#include "capture.h"
+#include "clock_sync.h"
 #include "common.h"
+#include "decode.h"
+#include "fanout.h"
+#include "filter.h"
+#include "fusion.h"
+#include "gate.h"
+#include "latency.h"
+#include "link.h"
+#include "macro.h"
+#include "output_rate.h"
+#include "profile.h"
+#include "seqlock.h"
+#include "shared_state.h"
+#include "stats.h"
+#include "subcommand.h"
+#include "waveform.h"
+
+struct JoyConPair;
+
+struct SubmittedReport
+{
+    XUSB_REPORT report;
+    // default constructed until the first submit
+    std::chrono::steady_clock::time_point time;
+};
 
 class ProControllerDevice
 {
@@ -22,27 +53,72 @@ public:
     ~ProControllerDevice();
 
     bool Valid();
+    bool IsBluetooth() const;
+    DeviceFamily Family() const;
+    // empty for emulated controllers
+    const std::string& Serial() const;
+    const LatencyStats& Latency() const;
+    const DeviceStats& Stats() const;
+    const LinkAnalyzer& Link() const;
+    const ClockSync& Clock() const;
+    const BatteryMonitor& Battery() const;
+    bool IsPaired() const;
+    // the report the virtual controller has now, safe to call from any thread
+    SubmittedReport LastSubmitted() const;
+    // runs the motors like an XUSB callback would, and stops them again after duration
+    void TestRumble(UCHAR _large_motor, UCHAR _small_motor, std::chrono::milliseconds duration);
+    // plays one of RumbleEffects on top of the game's rumble, false unless waveform rumble is on
+    bool PlayRumbleEffect(int effect);
+    // queues a subcommand for the read thread to send, safe to call from any thread but the read
+    // thread itself, which has to use the callback form on subcommands
+    std::future<SubcommandReply> SendSubcommand(std::uint8_t subcommand, const std::vector<std::uint8_t>& args);
     void HandleXUSBCallback(UCHAR _large_motor, UCHAR _small_motor, UCHAR _led_number);
+    // wakes the read thread and lets it wind down without waiting for it, the destructor finishes
+    // the job. a removed controller isn't sent the LED and rumble clear, it's gone anyway
+    void BeginStop(bool _removed);
 
     // used for identification, so make them public
     VIGEM_TARGET ViGEm_Target;
     const tstring Path;
+    // unique for the lifetime of the process, used by the control pipe
+    const unsigned int Id;
 
 private:
     using bytes = std::vector<std::uint8_t>;
 
-    void USBReadThread();
-    void BluetoothReadThread();
+    bool ReadHIDCaps();
+    template <Transport Link> void ReadThread();
     void HandleLEDAndVibration();
     void ClearLEDAndVibration();
-    void HandleController(const XUSB_REPORT& report);
+    bool HandleControllerData(const bytes& data);
+    bool HandleController(const XUSB_REPORT& report);
+    void InjectMacroState();
+    void SubmitPairedState(ControllerState state);
+    void AddSinks();
+    void PushSinkReports(SinkReport& report, const ControllerState& pad_state);
+    void PushPadState(const ControllerState& state);
+    void PushRaw(std::uint8_t direction, const bytes& data, std::chrono::steady_clock::time_point time);
+    bool PlugTarget();
+    bool JoinPair();
+    void StartPair();
+    bool LeavePair();
+    void SetRumbleAndLED(UCHAR _large_motor, UCHAR _small_motor, UCHAR _led_number);
+    void WriteSubcommand(std::uint8_t subcommand, const bytes& args);
+    const Profile& CurrentProfile();
     std::optional<bytes> ReadData();
     void WriteData(const bytes& data);
     bool CheckIOError(DWORD err);
-    std::int16_t ScaleJoystick(std::int_fast64_t src_min, std::int_fast64_t src_max, std::int16_t val);
 
     std::uint8_t counter;
     HANDLE handle;
+    // reused by every read and write, all of them come from the read thread
+    HANDLE read_event;
+    HANDLE write_event;
+    // manual reset, set by BeginStop so a pending read or write doesn't sit out its timeout
+    HANDLE quit_event;
+    // the clear sequence writes after the quit event is set, and mustn't be cut short by it
+    bool clearing_outputs;
+    std::chrono::steady_clock::time_point last_write;
     USHORT output_size;
     USHORT input_size;
     std::chrono::steady_clock::time_point last_rumble;
@@ -56,11 +132,72 @@ private:
     bool motor_small_will_empty;
     spinlock rumble_lock;
 
+    // set with --waveform-rumble, motor changes then ramp in 5ms steps and effects can play
+    const bool waveform_rumble;
+    RumbleWaveform waveform;
+    // the effect the control pipe asked for, -1 once the read thread has picked it up
+    std::atomic<int> pending_effect;
+
+    // every 0x01 output goes through here, replies are matched by subcommand id
+    SubcommandEngine subcommands;
+
+    std::unique_ptr<CaptureWriter> capture;
+
+    const bool measure_latency;
+    LatencyStats latency;
+    std::chrono::steady_clock::time_point read_time;
+    std::chrono::steady_clock::time_point rumble_request_time;
+    bool rumble_request_pending;
+    // steady_clock ticks when a control pipe rumble test ends, 0 if none is running
+    std::atomic<std::chrono::steady_clock::rep> rumble_test_end;
+
+    DeviceStats stats;
+    LinkAnalyzer link;
+    BatteryMonitor battery;
+    OutputRateControl output_rate;
+    // -1 without a DSU server or when all its slots are taken
+    int dsu_slot;
+    // the same for --shared-state
+    int shared_slot;
+    // capture, DSU, shared state and stream each read from here on their own thread, only the
+    // virtual pad is submitted inline. a pair streams through the pair's fan-out instead
+    FanOut fanout;
+    ClockSync clock;
+
+    // samples from the last full report, timestamped in the host domain
+    std::array<ImuSample, IMU_SAMPLES_PER_REPORT> imu_samples;
+    std::size_t imu_count;
+
+    // read thread only, the parameters come from the current profile
+    StickFilter stick_filter;
+
+    ReportGate gate;
+
+    // turbo and macro timers resubmit last_state from the engine thread, submit_mutex keeps
+    // them and the read thread from submitting at the same time
+    MacroPlayer macros;
+    std::mutex submit_mutex;
+    ControllerState last_state;
+
+    // the profile set this controller last looked itself up in, and what it found there
+    const ProfileSet* profiles;
+    const Profile* profile;
+    std::string serial;
+
+    // set for joy-cons in pairing mode, the pair's primary owns the virtual pad and submits for both
+    std::shared_ptr<JoyConPair> pair;
+
     bool connected;
     std::atomic<bool> quitting;
+    std::atomic<bool> removed;
     std::thread read_thread;
 
     bool is_bluetooth;
+    DeviceFamily family;
+    // specialized for the family and transport when the device is opened
+    DecodeFunction decode;
     UCHAR last_led = 0xFF;
+    // written under submit_mutex, LeavePair hands it over to a joy-con partner
     XUSB_REPORT last_report;
+    Seqlock<SubmittedReport> submitted;
 };
@@ -0,0 +1,640 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "common.h"
+#include "ProControllerEmulator.h"
+#include "protocol.h"
+
+namespace
+{
+    const tstring EMULATOR_PIPE_PREFIX(TEXT("\\\\.\\pipe\\switch-pro-x-emulator-"));
+    const tstring EMULATOR_BLUETOOTH_TAG(TEXT("-bt-"));
+
+    constexpr std::uint16_t STICK_CENTER = 0x800;
+
+    // full battery, pro controller, plus the USB powered bit when wired
+    constexpr std::uint8_t BATTERY_CONNECTION_BLUETOOTH = 0x80;
+    constexpr std::uint8_t BATTERY_CONNECTION_USB = 0x81;
+
+    const EmulatorInputFrame NEUTRAL_FRAME = { std::chrono::milliseconds(0), 0, { STICK_CENTER, STICK_CENTER, STICK_CENTER, STICK_CENTER } };
+
+    struct ButtonName
+    {
+        const char* name;
+        std::uint32_t mask;
+    };
+
+    const ButtonName BUTTON_NAMES[] = {
+        { "A", SWITCH_BUTTON_USB_MASK_A },
+        { "B", SWITCH_BUTTON_USB_MASK_B },
+        { "X", SWITCH_BUTTON_USB_MASK_X },
+        { "Y", SWITCH_BUTTON_USB_MASK_Y },
+        { "UP", SWITCH_BUTTON_USB_MASK_DPAD_UP },
+        { "DOWN", SWITCH_BUTTON_USB_MASK_DPAD_DOWN },
+        { "LEFT", SWITCH_BUTTON_USB_MASK_DPAD_LEFT },
+        { "RIGHT", SWITCH_BUTTON_USB_MASK_DPAD_RIGHT },
+        { "PLUS", SWITCH_BUTTON_USB_MASK_PLUS },
+        { "MINUS", SWITCH_BUTTON_USB_MASK_MINUS },
+        { "HOME", SWITCH_BUTTON_USB_MASK_HOME },
+        { "SHARE", SWITCH_BUTTON_USB_MASK_SHARE },
+        { "L", SWITCH_BUTTON_USB_MASK_L },
+        { "ZL", SWITCH_BUTTON_USB_MASK_ZL },
+        { "LS", SWITCH_BUTTON_USB_MASK_THUMB_L },
+        { "R", SWITCH_BUTTON_USB_MASK_R },
+        { "ZR", SWITCH_BUTTON_USB_MASK_ZR },
+        { "RS", SWITCH_BUTTON_USB_MASK_THUMB_R },
+    };
+
+    bool ParseButtons(const std::string& text, std::uint32_t& buttons)
+    {
+        using std::string;
+        using std::find_if;
+        using std::begin;
+        using std::end;
+
+        buttons = 0;
+
+        if (text == "-")
+        {
+            return true;
+        }
+
+        string::size_type pos = 0;
+
+        while (pos <= text.size())
+        {
+            auto next = text.find('+', pos);
+
+            if (next == string::npos)
+            {
+                next = text.size();
+            }
+
+            const auto name = text.substr(pos, next - pos);
+            auto it = find_if(begin(BUTTON_NAMES), end(BUTTON_NAMES), [&name](const auto& b) { return name == b.name; });
+
+            if (it == end(BUTTON_NAMES))
+            {
+                return false;
+            }
+
+            buttons |= it->mask;
+            pos = next + 1;
+        }
+
+        return true;
+    }
+
+    std::uint8_t ButtonsToHat(std::uint32_t buttons)
+    {
+        // indexed by up | right << 1 | down << 2 | left << 3, opposing directions cancel out
+        constexpr std::uint8_t HAT_TABLE[16] = {
+            SWITCH_HAT_NEUTRAL, SWITCH_HAT_UP, SWITCH_HAT_RIGHT, SWITCH_HAT_UP_RIGHT,
+            SWITCH_HAT_DOWN, SWITCH_HAT_NEUTRAL, SWITCH_HAT_DOWN_RIGHT, SWITCH_HAT_RIGHT,
+            SWITCH_HAT_LEFT, SWITCH_HAT_UP_LEFT, SWITCH_HAT_NEUTRAL, SWITCH_HAT_UP,
+            SWITCH_HAT_DOWN_LEFT, SWITCH_HAT_LEFT, SWITCH_HAT_DOWN, SWITCH_HAT_NEUTRAL,
+        };
+
+        const unsigned int index =
+            (!!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_UP) << 0) |
+            (!!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_RIGHT) << 1) |
+            (!!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_DOWN) << 2) |
+            (!!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_LEFT) << 3);
+
+        return HAT_TABLE[index];
+    }
+
+    std::uint16_t ButtonsToBluetooth(std::uint32_t buttons)
+    {
+        std::uint16_t ret = 0;
+
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_A) ? SWITCH_BUTTON_BLUETOOTH_MASK_A : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_B) ? SWITCH_BUTTON_BLUETOOTH_MASK_B : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_X) ? SWITCH_BUTTON_BLUETOOTH_MASK_X : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_Y) ? SWITCH_BUTTON_BLUETOOTH_MASK_Y : 0;
+
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_PLUS) ? SWITCH_BUTTON_BLUETOOTH_MASK_PLUS : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_MINUS) ? SWITCH_BUTTON_BLUETOOTH_MASK_MINUS : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_HOME) ? SWITCH_BUTTON_BLUETOOTH_MASK_HOME : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_SHARE) ? SWITCH_BUTTON_BLUETOOTH_MASK_SHARE : 0;
+
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_L) ? SWITCH_BUTTON_BLUETOOTH_MASK_L : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_ZL) ? SWITCH_BUTTON_BLUETOOTH_MASK_ZL : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_L) ? SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L : 0;
+
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_R) ? SWITCH_BUTTON_BLUETOOTH_MASK_R : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_ZR) ? SWITCH_BUTTON_BLUETOOTH_MASK_ZR : 0;
+        ret |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_R) ? SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R : 0;
+
+        return ret;
+    }
+}
+
+bool LoadEmulatorScript(const std::string& filename, std::vector<EmulatorInputFrame>& timeline)
+{
+    using std::cerr;
+    using std::endl;
+    using std::ifstream;
+    using std::istringstream;
+    using std::string;
+    using std::chrono::milliseconds;
+
+    ifstream file(filename);
+
+    if (!file)
+    {
+        cerr << "error opening emulator script " << filename << endl;
+        return false;
+    }
+
+    timeline.clear();
+
+    string line;
+    unsigned int line_number = 0;
+
+    // each line is "<time in ms> <buttons joined with + or -> [lx ly rx ry]"
+    while (getline(file, line))
+    {
+        line_number++;
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        istringstream in(line);
+        long long time;
+        string buttons;
+        EmulatorInputFrame frame = NEUTRAL_FRAME;
+
+        if (!(in >> time >> buttons) || !ParseButtons(buttons, frame.buttons))
+        {
+            cerr << filename << ":" << line_number << ": invalid timeline entry" << endl;
+            return false;
+        }
+
+        for (auto& axis : frame.analog)
+        {
+            unsigned int value;
+
+            if (!(in >> value))
+            {
+                break;
+            }
+
+            axis = static_cast<std::uint16_t>(std::min(value, 0xFFFu));
+        }
+
+        if (!timeline.empty() && time < timeline.back().time.count())
+        {
+            cerr << filename << ":" << line_number << ": timeline entries must be in order" << endl;
+            return false;
+        }
+
+        frame.time = milliseconds(time);
+        timeline.push_back(frame);
+    }
+
+    return true;
+}
+
+bool IsEmulatorPath(const tstring& path)
+{
+    return tstring_ifind(path, EMULATOR_PIPE_PREFIX) == 0;
+}
+
+bool IsEmulatorBluetoothPath(const tstring& path)
+{
+    return IsEmulatorPath(path) && tstring_ifind(path, EMULATOR_BLUETOOTH_TAG) != tstring::npos;
+}
+
+ProControllerEmulator::ProControllerEmulator(const EmulatorConfig& _config, unsigned int index)
+    : Path(EMULATOR_PIPE_PREFIX + (_config.bluetooth ? TEXT("bt-") : TEXT("usb-")) + to_tstring(index))
+    , config(_config)
+    , pipe(INVALID_HANDLE_VALUE)
+    , quit_event(nullptr)
+    , quitting(false)
+    , frame_index(0)
+    , streaming(_config.bluetooth)
+    , full_reports(false)
+    , radio(_config.airtime)
+    , rng(index)
+{
+    using std::cerr;
+    using std::endl;
+    using std::thread;
+
+    const DWORD input_size = config.bluetooth ? BLUETOOTH_INPUT_REPORT_SIZE : USB_INPUT_REPORT_SIZE;
+    const DWORD output_size = config.bluetooth ? BLUETOOTH_OUTPUT_REPORT_SIZE : USB_OUTPUT_REPORT_SIZE;
+
+    pipe = CreateNamedPipe(
+        Path.c_str(),
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT,
+        1,
+        input_size * 64,
+        output_size * 64,
+        0,
+        nullptr);
+
+    if (pipe == INVALID_HANDLE_VALUE)
+    {
+        cerr << "error creating emulator pipe ";
+        tcerr << Path;
+        cerr << " (" << GetLastError() << ")" << endl;
+
+        return;
+    }
+
+    quit_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    emulator_thread = thread(&ProControllerEmulator::EmulatorThread, this);
+}
+
+ProControllerEmulator::~ProControllerEmulator()
+{
+    quitting = true;
+
+    if (quit_event != nullptr)
+    {
+        SetEvent(quit_event);
+    }
+
+    if (emulator_thread.joinable())
+    {
+        emulator_thread.join();
+    }
+
+    if (pipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(pipe);
+    }
+
+    if (quit_event != nullptr)
+    {
+        CloseHandle(quit_event);
+    }
+}
+
+bool ProControllerEmulator::Valid()
+{
+    return pipe != INVALID_HANDLE_VALUE;
+}
+
+void ProControllerEmulator::EmulatorThread()
+{
+    using std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::chrono::milliseconds;
+    using std::uniform_int_distribution;
+    using std::uniform_real_distribution;
+
+    if (!ConnectHost())
+    {
+        return;
+    }
+
+    const auto interval = config.bluetooth ? BLUETOOTH_REPORT_INTERVAL : USB_REPORT_INTERVAL;
+    uniform_real_distribution<double> loss_dist(0.0, 100.0);
+    uniform_int_distribution<long long> jitter_dist(0, config.jitter.count());
+
+    start = steady_clock::now();
+    auto next_nominal = start + interval;
+    auto next_send = next_nominal;
+
+    bytes in_buf;
+    OVERLAPPED read_ol = { 0 };
+    read_ol.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    bool reading = StartRead(read_ol, in_buf);
+
+    while (!quitting && reading)
+    {
+        const auto now = steady_clock::now();
+        DWORD timeout = 0;
+
+        if (next_send > now)
+        {
+            // round up so we never wake before the report is due
+            timeout = static_cast<DWORD>(duration_cast<milliseconds>(next_send - now + milliseconds(1) - microseconds(1)).count());
+        }
+
+        HANDLE handles[2] = { read_ol.hEvent, quit_event };
+        auto waitObject = WaitForMultipleObjects(2, handles, FALSE, timeout);
+
+        if (waitObject == WAIT_OBJECT_0)
+        {
+            DWORD bytesRead = 0;
+
+            if (!GetOverlappedResult(pipe, &read_ol, &bytesRead, FALSE))
+            {
+                // host closed its end
+                break;
+            }
+
+            in_buf.resize(bytesRead);
+            radio.Output(steady_clock::now());
+            HandleOutput(in_buf);
+
+            reading = StartRead(read_ol, in_buf);
+        }
+        else if (waitObject == WAIT_OBJECT_0 + 1)
+        {
+            break;
+        }
+        else if (waitObject == WAIT_TIMEOUT)
+        {
+            const auto send_time = steady_clock::now();
+
+            if (streaming && loss_dist(rng) >= config.loss && !radio.InputLost(send_time))
+            {
+                SendInputReport(send_time);
+            }
+
+            // jitter only delays individual reports, the nominal rate stays the same
+            next_nominal += interval;
+
+            if (next_nominal < send_time)
+            {
+                next_nominal = send_time + interval;
+            }
+
+            next_send = next_nominal + microseconds(jitter_dist(rng));
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    CancelIo(pipe);
+
+    if (reading)
+    {
+        DWORD tmp;
+        GetOverlappedResult(pipe, &read_ol, &tmp, TRUE);
+    }
+
+    CloseHandle(read_ol.hEvent);
+}
+
+bool ProControllerEmulator::ConnectHost()
+{
+    using std::cerr;
+    using std::endl;
+
+    OVERLAPPED ol = { 0 };
+    ol.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    bool ret = true;
+
+    if (!ConnectNamedPipe(pipe, &ol))
+    {
+        auto err = GetLastError();
+
+        if (err == ERROR_IO_PENDING)
+        {
+            HANDLE handles[2] = { ol.hEvent, quit_event };
+            auto waitObject = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+
+            if (waitObject != WAIT_OBJECT_0)
+            {
+                CancelIo(pipe);
+                DWORD tmp;
+                GetOverlappedResult(pipe, &ol, &tmp, TRUE);
+                ret = false;
+            }
+        }
+        else if (err != ERROR_PIPE_CONNECTED)
+        {
+            cerr << "Emulator connect failed (" << err << ")" << endl;
+            ret = false;
+        }
+    }
+
+    CloseHandle(ol.hEvent);
+
+    return ret;
+}
+
+bool ProControllerEmulator::StartRead(OVERLAPPED& ol, bytes& buf)
+{
+    buf.resize(USB_OUTPUT_REPORT_SIZE);
+    ResetEvent(ol.hEvent);
+
+    if (!ReadFile(pipe, buf.data(), static_cast<DWORD>(buf.size()), nullptr, &ol))
+    {
+        auto err = GetLastError();
+
+        // ERROR_MORE_DATA still signals the event, the tail of the message is dropped
+        if (err != ERROR_IO_PENDING && err != ERROR_MORE_DATA)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ProControllerEmulator::HandleOutput(const bytes& data)
+{
+    if (data.size() < 2)
+    {
+        return;
+    }
+
+    switch (data[0])
+    {
+    case PACKET_TYPE_USB_COMMAND:
+    {
+        if (config.bluetooth)
+        {
+            break;
+        }
+
+        switch (data[1])
+        {
+        case STATUS_TYPE_SERIAL:
+        {
+            // connection status followed by a made up MAC address
+            bytes buf = { PACKET_TYPE_STATUS, STATUS_TYPE_SERIAL, 0x00, 0x03, 0x5E, 0x1F, 0x00, 0x00, 0x00, 0x01 };
+            WritePacket(buf);
+            break;
+        }
+        case STATUS_TYPE_INIT:
+        {
+            bytes buf = { PACKET_TYPE_STATUS, STATUS_TYPE_INIT };
+            WritePacket(buf);
+            break;
+        }
+        case STATUS_TYPE_START:
+        {
+            streaming = true;
+            full_reports = true;
+            break;
+        }
+        }
+        break;
+    }
+    case OUTPUT_TYPE_SUBCOMMAND:
+    {
+        if (data.size() < 11)
+        {
+            break;
+        }
+
+        const auto subcommand = data[10];
+
+        if (subcommand == SUBCOMMAND_SET_INPUT_MODE && data.size() > 11)
+        {
+            full_reports = data[11] == PACKET_TYPE_CONTROLLER_DATA;
+        }
+
+        SendSubcommandReply(subcommand);
+        break;
+    }
+    case OUTPUT_TYPE_RUMBLE:
+    default:
+    {
+        // rumble has no reply
+        break;
+    }
+    }
+}
+
+void ProControllerEmulator::SendInputReport(std::chrono::steady_clock::time_point now)
+{
+    bytes buf(config.bluetooth ? BLUETOOTH_INPUT_REPORT_SIZE : USB_INPUT_REPORT_SIZE);
+
+    if (full_reports)
+    {
+        buf[0] = PACKET_TYPE_CONTROLLER_DATA;
+        FillControllerData(buf, now);
+    }
+    else
+    {
+        const auto& frame = CurrentFrame(now);
+        const auto bt_buttons = ButtonsToBluetooth(frame.buttons);
+
+        buf[0] = PACKET_TYPE_SIMPLE_CONTROLLER_DATA;
+        buf[1] = static_cast<std::uint8_t>(bt_buttons & 0xFF);
+        buf[2] = static_cast<std::uint8_t>(bt_buttons >> 8);
+        buf[3] = ButtonsToHat(frame.buttons);
+
+        for (int i = 0; i < 4; i++)
+        {
+            // stretch 12-bit to 16-bit, the simple report is centered on 0x8000
+            const std::uint16_t value = static_cast<std::uint16_t>((frame.analog[i] << 4) | (frame.analog[i] >> 8));
+            buf[4 + i * 2] = static_cast<std::uint8_t>(value & 0xFF);
+            buf[5 + i * 2] = static_cast<std::uint8_t>(value >> 8);
+        }
+    }
+
+    WritePacket(buf);
+}
+
+void ProControllerEmulator::SendSubcommandReply(std::uint8_t subcommand)
+{
+    using std::chrono::steady_clock;
+
+    bytes buf(config.bluetooth ? BLUETOOTH_INPUT_REPORT_SIZE : USB_INPUT_REPORT_SIZE);
+
+    buf[0] = PACKET_TYPE_SUBCOMMAND_REPLY;
+    FillControllerData(buf, steady_clock::now());
+    buf[13] = 0x80;
+    buf[14] = subcommand;
+
+    WritePacket(buf);
+}
+
+void ProControllerEmulator::FillControllerData(bytes& buf, std::chrono::steady_clock::time_point now)
+{
+    const auto& frame = CurrentFrame(now);
+
+    buf[1] = static_cast<std::uint8_t>(((now - start) / CONTROLLER_TIMER_TICK) & 0xFF);
+    buf[2] = config.bluetooth ? BATTERY_CONNECTION_BLUETOOTH : BATTERY_CONNECTION_USB;
+    buf[3] = static_cast<std::uint8_t>((frame.buttons >> 8) & 0xFF);
+    buf[4] = static_cast<std::uint8_t>((frame.buttons >> 16) & 0xFF);
+    buf[5] = static_cast<std::uint8_t>((frame.buttons >> 24) & 0xFF);
+
+    for (int i = 0; i < 2; i++)
+    {
+        const auto x = frame.analog[i * 2];
+        const auto y = frame.analog[i * 2 + 1];
+
+        buf[6 + i * 3] = static_cast<std::uint8_t>(x & 0xFF);
+        buf[7 + i * 3] = static_cast<std::uint8_t>(((x >> 8) & 0x0F) | ((y & 0x0F) << 4));
+        buf[8 + i * 3] = static_cast<std::uint8_t>(y >> 4);
+    }
+}
+
+const EmulatorInputFrame& ProControllerEmulator::CurrentFrame(std::chrono::steady_clock::time_point now)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    const auto& timeline = config.timeline;
+
+    if (timeline.empty())
+    {
+        return NEUTRAL_FRAME;
+    }
+
+    auto elapsed = duration_cast<milliseconds>(now - start);
+    const auto length = timeline.back().time;
+
+    if (config.loop && length.count() > 0)
+    {
+        elapsed %= length;
+
+        // wrapped around, start scanning from the beginning again
+        if (elapsed < timeline[frame_index].time)
+        {
+            frame_index = 0;
+        }
+    }
+
+    while (frame_index + 1 < timeline.size() && timeline[frame_index + 1].time <= elapsed)
+    {
+        frame_index++;
+    }
+
+    if (timeline[frame_index].time > elapsed)
+    {
+        return NEUTRAL_FRAME;
+    }
+
+    return timeline[frame_index];
+}
+
+void ProControllerEmulator::WritePacket(const bytes& data)
+{
+    DWORD tmp;
+    OVERLAPPED ol = { 0 };
+    ol.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    if (!WriteFile(pipe, data.data(), static_cast<DWORD>(data.size()), &tmp, &ol))
+    {
+        if (GetLastError() == ERROR_IO_PENDING)
+        {
+            // host isn't reading, only wait until we're told to quit
+            HANDLE handles[2] = { ol.hEvent, quit_event };
+
+            if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+            {
+                CancelIo(pipe);
+            }
+
+            GetOverlappedResult(pipe, &ol, &tmp, TRUE);
+        }
+    }
+
+    CloseHandle(ol.hEvent);
+}
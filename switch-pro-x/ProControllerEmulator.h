@@ -0,0 +1,109 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "common.h"
+
+struct EmulatorInputFrame
+{
+    // offset from the start of the timeline
+    std::chrono::milliseconds time;
+    // SWITCH_BUTTON_USB_MASK_* bits
+    std::uint32_t buttons;
+    // lx, ly, rx, ry as 12-bit values, 0x800 is centered
+    std::uint16_t analog[4];
+};
+
+struct EmulatorConfig
+{
+    bool bluetooth = false;
+    bool loop = true;
+    std::vector<EmulatorInputFrame> timeline;
+    // percentage of input reports that never make it to the host
+    double loss = 0.0;
+    // maximum extra delay added to each input report
+    std::chrono::microseconds jitter{ 0 };
+    // how long each output report keeps the simulated radio busy
+    std::chrono::microseconds airtime{ 0 };
+};
+
+// one radio carrying both directions, like a crowded bluetooth channel. every output report takes
+// its airtime after whatever is queued already, and an input report due while the radio is busy
+// never makes it
+class EmulatorAirtime
+{
+public:
+    EmulatorAirtime(std::chrono::microseconds _airtime)
+        : airtime(_airtime)
+        , busy_until()
+    {
+    }
+
+    // when the output report is through
+    std::chrono::steady_clock::time_point Output(std::chrono::steady_clock::time_point now)
+    {
+        busy_until = (busy_until > now ? busy_until : now) + airtime;
+        return busy_until;
+    }
+
+    bool InputLost(std::chrono::steady_clock::time_point now) const
+    {
+        return now < busy_until;
+    }
+
+private:
+    const std::chrono::microseconds airtime;
+    std::chrono::steady_clock::time_point busy_until;
+};
+
+bool LoadEmulatorScript(const std::string& filename, std::vector<EmulatorInputFrame>& timeline);
+bool IsEmulatorPath(const tstring& path);
+bool IsEmulatorBluetoothPath(const tstring& path);
+
+// software pro controller that serves the USB or bluetooth protocol over a message pipe,
+// ProControllerDevice opens Path the same way it opens a real HID device
+class ProControllerEmulator
+{
+public:
+    ProControllerEmulator(const EmulatorConfig& config, unsigned int index);
+    ~ProControllerEmulator();
+
+    bool Valid();
+
+    const tstring Path;
+
+private:
+    using bytes = std::vector<std::uint8_t>;
+
+    void EmulatorThread();
+    bool ConnectHost();
+    bool StartRead(OVERLAPPED& ol, bytes& buf);
+    void HandleOutput(const bytes& data);
+    void SendInputReport(std::chrono::steady_clock::time_point now);
+    void SendSubcommandReply(std::uint8_t subcommand);
+    void FillControllerData(bytes& buf, std::chrono::steady_clock::time_point now);
+    const EmulatorInputFrame& CurrentFrame(std::chrono::steady_clock::time_point now);
+    void WritePacket(const bytes& data);
+
+    const EmulatorConfig config;
+    HANDLE pipe;
+    HANDLE quit_event;
+    std::thread emulator_thread;
+    std::atomic<bool> quitting;
+
+    std::chrono::steady_clock::time_point start;
+    std::size_t frame_index;
+    bool streaming;
+    bool full_reports;
+    EmulatorAirtime radio;
+    std::mt19937 rng;
+};
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include <cctype>
+
+#include "battery.h"
+#include "decode.h"
+
+namespace
+{
+    // above every level, nothing alerted yet
+    constexpr std::uint8_t NOT_ALERTED = 0xFF;
+
+    struct LevelName
+    {
+        const char* name;
+        std::uint8_t level;
+    };
+
+    const LevelName LEVEL_NAMES[] = {
+        { "empty", BATTERY_EMPTY },
+        { "critical", BATTERY_CRITICAL },
+        { "low", BATTERY_LOW },
+        { "medium", BATTERY_MEDIUM },
+        { "full", BATTERY_FULL },
+    };
+}
+
+PowerStatus DecodePowerStatus(std::uint8_t status)
+{
+    PowerStatus power;
+
+    power.level = (status >> 4) & 0x0E;
+    power.charging = (status & 0x10) != 0;
+    power.external_power = (status & 0x01) != 0;
+    power.connection = (status >> 1) & 0x03;
+
+    return power;
+}
+
+const char* BatteryLevelName(std::uint8_t level)
+{
+    for (const auto& entry : LEVEL_NAMES)
+    {
+        if (entry.level == level)
+        {
+            return entry.name;
+        }
+    }
+
+    return "unknown";
+}
+
+std::string DescribePowerStatus(std::uint8_t status)
+{
+    using std::string;
+
+    if (status == POWER_STATUS_UNKNOWN)
+    {
+        return "unknown";
+    }
+
+    const auto power = DecodePowerStatus(status);
+    string text = BatteryLevelName(power.level);
+
+    if (power.charging)
+    {
+        text += ", charging";
+    }
+
+    if (power.external_power)
+    {
+        text += ", externally powered";
+    }
+
+    return text;
+}
+
+bool ParseBatteryLevels(const char* arg, std::vector<std::uint8_t>& levels)
+{
+    using std::string;
+
+    const string text(arg);
+    levels.clear();
+
+    if (text == "none")
+    {
+        return true;
+    }
+
+    string::size_type pos = 0;
+
+    while (pos <= text.size())
+    {
+        auto next = text.find(',', pos);
+
+        if (next == string::npos)
+        {
+            next = text.size();
+        }
+
+        const auto name = text.substr(pos, next - pos);
+        bool found = false;
+
+        for (const auto& entry : LEVEL_NAMES)
+        {
+            if (name == entry.name)
+            {
+                levels.push_back(entry.level);
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            return false;
+        }
+
+        pos = next + 1;
+    }
+
+    return true;
+}
+
+BatteryMonitor::BatteryMonitor(DeviceStats& _stats, unsigned int _id, const std::vector<std::uint8_t>& _alert_levels)
+    : stats(_stats)
+    , id(_id)
+    , alert_levels(_alert_levels)
+    , last_status(POWER_STATUS_UNKNOWN)
+    , alerted_level(NOT_ALERTED)
+    , status(POWER_STATUS_UNKNOWN)
+{
+}
+
+std::uint8_t BatteryMonitor::Status() const
+{
+    return status.load(std::memory_order_relaxed);
+}
+
+void BatteryMonitor::Changed(std::uint8_t _status)
+{
+    using std::cout;
+    using std::endl;
+    using std::string;
+    using std::toupper;
+    using std::transform;
+
+    last_status = _status;
+    status.store(_status, std::memory_order_relaxed);
+
+    const auto power = DecodePowerStatus(_status);
+
+    // the level only really goes back up while charging, so that's what rearms the alerts and
+    // a reading that wobbles between two levels only alerts once
+    if (power.charging)
+    {
+        alerted_level = NOT_ALERTED;
+        return;
+    }
+
+    auto crossed = alerted_level;
+
+    for (const auto level : alert_levels)
+    {
+        if (power.level <= level && level < crossed)
+        {
+            crossed = level;
+        }
+    }
+
+    if (crossed == alerted_level)
+    {
+        return;
+    }
+
+    alerted_level = crossed;
+    stats.Increment(DEVICE_COUNTER_BATTERY_ALERTS);
+
+    string name = BatteryLevelName(power.level);
+    transform(name.begin(), name.end(), name.begin(), [](char c) { return static_cast<char>(toupper(c)); });
+
+    cout << "BATTERY " << name << " ON DEVICE " << id << endl;
+}
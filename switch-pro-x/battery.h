@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "stats.h"
+
+// battery levels in the high nibble of the status byte, the low bit of the nibble is set while
+// charging
+enum : std::uint8_t
+{
+    BATTERY_EMPTY = 0,
+    BATTERY_CRITICAL = 2,
+    BATTERY_LOW = 4,
+    BATTERY_MEDIUM = 6,
+    BATTERY_FULL = 8,
+};
+
+struct PowerStatus
+{
+    // one of BATTERY_*
+    std::uint8_t level;
+    bool charging;
+    // running off the switch or usb instead of the battery
+    bool external_power;
+    // 0 for a pro controller or a joy-con in the charging grip, 3 for a joy-con on its own
+    std::uint8_t connection;
+};
+
+PowerStatus DecodePowerStatus(std::uint8_t status);
+const char* BatteryLevelName(std::uint8_t level);
+// like "low, charging", or "unknown" for POWER_STATUS_UNKNOWN
+std::string DescribePowerStatus(std::uint8_t status);
+// comma separated level names, or none
+bool ParseBatteryLevels(const char* arg, std::vector<std::uint8_t>& levels);
+
+// follows the status byte every full report carries, so the battery costs no extra I/O. alerts are
+// only printed when the level first drops to one of the alert levels, and charging rearms them.
+// Record is only called from the read thread.
+class BatteryMonitor
+{
+public:
+    BatteryMonitor(DeviceStats& _stats, unsigned int _id, const std::vector<std::uint8_t>& _alert_levels);
+
+    void Record(std::uint8_t _status)
+    {
+        // almost every report repeats the last status
+        if (_status != last_status)
+        {
+            Changed(_status);
+        }
+    }
+
+    // POWER_STATUS_UNKNOWN until the first full report
+    std::uint8_t Status() const;
+
+private:
+    void Changed(std::uint8_t _status);
+
+    DeviceStats& stats;
+    const unsigned int id;
+    const std::vector<std::uint8_t> alert_levels;
+
+    std::uint8_t last_status;
+    // the lowest alert level already printed
+    std::uint8_t alerted_level;
+    std::atomic<std::uint8_t> status;
+};
@@ -0,0 +1,2371 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "benchmark.h"
+#include "common.h"
+#include "decode.h"
+#include "dsu.h"
+#include "fanout.h"
+#include "filter.h"
+#include "fusion.h"
+#include "gate.h"
+#include "macro.h"
+#include "mapping.h"
+#include "output_rate.h"
+#include "protocol.h"
+#include "ProControllerEmulator.h"
+#include "shared_state.h"
+#include "stream.h"
+#include "subcommand.h"
+#include "timer_wheel.h"
+#include "waveform.h"
+
+namespace
+{
+    using bytes = std::vector<std::uint8_t>;
+
+    // inputs cycle through this many different reports in the batched variants
+    constexpr std::size_t BATCH_SIZE = 1024;
+    constexpr std::chrono::milliseconds MIN_RUN_TIME(200);
+
+    // keeps results alive so the kernels can't be optimized away
+    volatile std::uint64_t benchmark_sink;
+
+    std::string benchmark_filter;
+
+    bool Selected(const std::string& name)
+    {
+        return name.find(benchmark_filter) != std::string::npos;
+    }
+
+    // calls op(i) for i in [0, iterations) until MIN_RUN_TIME has passed and prints the cost of one call
+    template <typename Op>
+    void RunBenchmark(const std::string& name, Op&& op)
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::left;
+        using std::right;
+        using std::setprecision;
+        using std::setw;
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+        using std::chrono::steady_clock;
+
+        if (!Selected(name))
+        {
+            return;
+        }
+
+        std::uint64_t iterations = 1024;
+        steady_clock::duration elapsed;
+
+        for (;;)
+        {
+            const auto start = steady_clock::now();
+
+            for (std::uint64_t i = 0; i < iterations; i++)
+            {
+                op(static_cast<std::size_t>(i));
+            }
+
+            elapsed = steady_clock::now() - start;
+
+            if (elapsed >= MIN_RUN_TIME)
+            {
+                break;
+            }
+
+            iterations *= 2;
+        }
+
+        const auto ns = static_cast<double>(duration_cast<nanoseconds>(elapsed).count()) / iterations;
+
+        cout << left << setw(32) << name << right << fixed << setprecision(2);
+        cout << setw(12) << ns << " ns/report";
+        cout << setw(16) << setprecision(0) << (ns > 0 ? 1e9 / ns : 0.0) << " reports/s" << endl;
+    }
+
+    std::vector<bytes> MakePackets(std::uint8_t type, std::size_t size, std::size_t count)
+    {
+        using std::mt19937;
+        using std::uniform_int_distribution;
+
+        mt19937 rng(count);
+        uniform_int_distribution<int> dist(0, 0xFF);
+        std::vector<bytes> packets(count, bytes(size));
+
+        // the decoders only look at the type, every other byte can be anything
+        for (auto& packet : packets)
+        {
+            for (auto& b : packet)
+            {
+                b = static_cast<std::uint8_t>(dist(rng));
+            }
+
+            packet[0] = type;
+        }
+
+        return packets;
+    }
+
+    template <typename Decode>
+    void BenchmarkDecode(const std::string& name, Decode decode, const std::vector<bytes>& packets)
+    {
+        const auto& single = packets[0];
+        ControllerState state;
+
+        RunBenchmark(name + " single", [&](std::size_t) {
+            decode(single.data(), single.size(), state);
+            benchmark_sink = state.buttons;
+        });
+
+        RunBenchmark(name + " batched", [&](std::size_t i) {
+            const auto& packet = packets[i % BATCH_SIZE];
+            decode(packet.data(), packet.size(), state);
+            benchmark_sink = state.buttons;
+        });
+    }
+
+    void BenchmarkKernels()
+    {
+        using std::int16_t;
+        using std::int_fast64_t;
+        using std::mt19937;
+        using std::uniform_int_distribution;
+
+        mt19937 rng(1);
+
+        const auto usb_packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, BATCH_SIZE);
+        const auto bt_packets = MakePackets(PACKET_TYPE_SIMPLE_CONTROLLER_DATA, BLUETOOTH_INPUT_REPORT_SIZE, BATCH_SIZE);
+        const auto full_bt_packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, BLUETOOTH_INPUT_REPORT_SIZE, BATCH_SIZE);
+
+        // one per DecodeReport specialization, called through the pointer SelectDecoder hands out. the
+        // joy-cons and the snes controller are bluetooth only
+        BenchmarkDecode("decode usb", SelectDecoder(DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_USB), usb_packets);
+        BenchmarkDecode("decode bluetooth", SelectDecoder(DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_BLUETOOTH), full_bt_packets);
+        BenchmarkDecode("decode bluetooth simple", DecodeSimpleBluetoothReport, bt_packets);
+        BenchmarkDecode("decode joy-con l", SelectDecoder(DEVICE_FAMILY_JOYCON_LEFT, TRANSPORT_BLUETOOTH), full_bt_packets);
+        BenchmarkDecode("decode joy-con r", SelectDecoder(DEVICE_FAMILY_JOYCON_RIGHT, TRANSPORT_BLUETOOTH), full_bt_packets);
+        BenchmarkDecode("decode snes", SelectDecoder(DEVICE_FAMILY_SNES_CONTROLLER, TRANSPORT_BLUETOOTH), full_bt_packets);
+
+        std::vector<int16_t> axes(BATCH_SIZE);
+        std::vector<std::uint8_t> hats(BATCH_SIZE);
+        std::vector<ControllerState> states(BATCH_SIZE);
+        std::vector<XUSB_REPORT> reports(BATCH_SIZE);
+        const auto& plan = DefaultMappingPlan();
+
+        uniform_int_distribution<int> axis_dist(-32768, 32767);
+        uniform_int_distribution<int> hat_dist(0, 8);
+        uniform_int_distribution<std::uint32_t> button_dist(0, 0x3FFFF);
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            axes[i] = static_cast<int16_t>(axis_dist(rng));
+            hats[i] = static_cast<std::uint8_t>(hat_dist(rng));
+            states[i] = { button_dist(rng), axes[i], axes[(i + 1) % BATCH_SIZE], axes[(i + 2) % BATCH_SIZE], axes[(i + 3) % BATCH_SIZE] };
+        }
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            reports[i] = MapToXUSB(states[i], plan);
+        }
+
+        constexpr int_fast64_t SCALE_MIN = -25000;
+        constexpr int_fast64_t SCALE_MAX = 22000;
+
+        RunBenchmark("scale joystick single", [&](std::size_t) {
+            benchmark_sink = ScaleJoystick(SCALE_MIN, SCALE_MAX, axes[0]);
+        });
+
+        RunBenchmark("scale joystick batched", [&](std::size_t i) {
+            benchmark_sink = ScaleJoystick(SCALE_MIN, SCALE_MAX, axes[i % BATCH_SIZE]);
+        });
+
+        RunBenchmark("hat decode single", [&](std::size_t) {
+            benchmark_sink = DecodeHat(hats[0]);
+        });
+
+        RunBenchmark("hat decode batched", [&](std::size_t i) {
+            benchmark_sink = DecodeHat(hats[i % BATCH_SIZE]);
+        });
+
+        RunBenchmark("button mapping single", [&](std::size_t) {
+            benchmark_sink = MapToXUSB(states[0], plan).wButtons;
+        });
+
+        RunBenchmark("button mapping batched", [&](std::size_t i) {
+            benchmark_sink = MapToXUSB(states[i % BATCH_SIZE], plan).wButtons;
+        });
+
+        // the common case in HandleController is an unchanged report
+        RunBenchmark("report dedupe equal", [&](std::size_t i) {
+            const auto& report = reports[i % BATCH_SIZE];
+            benchmark_sink = report == report;
+        });
+
+        RunBenchmark("report dedupe batched", [&](std::size_t i) {
+            benchmark_sink = reports[i % BATCH_SIZE] == reports[(i + 1) % BATCH_SIZE];
+        });
+
+        const ReportGate gate({ { 256, 256, 256, 256 }, 32, std::chrono::milliseconds(50) });
+        const auto now = std::chrono::steady_clock::now();
+
+        RunBenchmark("report gate batched", [&](std::size_t i) {
+            benchmark_sink = gate.Pass(reports[i % BATCH_SIZE], reports[(i + 1) % BATCH_SIZE], now);
+        });
+
+        // a joy-con pair's reports arrive interleaved, each one merged with the other side's last
+        JoyConFusion fusion;
+
+        for (auto& state : states)
+        {
+            state.time = now;
+        }
+
+        RunBenchmark("joy-con fusion batched", [&](std::size_t i) {
+            const auto family = i & 1 ? DEVICE_FAMILY_JOYCON_RIGHT : DEVICE_FAMILY_JOYCON_LEFT;
+            benchmark_sink = fusion.Update(family, states[i % BATCH_SIZE]).buttons;
+        });
+    }
+
+    // reports until the output covers 90% of a step, 1 is as fast as any filter can be
+    int StepResponseReports(const OneEuroParams& params, std::int16_t step, std::int32_t dt_us)
+    {
+        OneEuroFilter filter;
+
+        for (int i = 0; i < 100; i++)
+        {
+            filter.Filter(params, 0, dt_us);
+        }
+
+        int reports = 1;
+
+        while (filter.Filter(params, step, dt_us) < step * 9 / 10 && reports < 1000)
+        {
+            reports++;
+        }
+
+        return reports;
+    }
+
+    // rms of uniform resting noise going into and coming out of the filter
+    std::pair<double, double> NoiseRms(const OneEuroParams& params, std::int32_t dt_us)
+    {
+        using std::mt19937;
+        using std::sqrt;
+        using std::uniform_int_distribution;
+
+        OneEuroFilter filter;
+        mt19937 rng(1);
+        uniform_int_distribution<int> noise(-256, 256);
+
+        double in = 0.0;
+        double out = 0.0;
+        constexpr int SAMPLES = 10000;
+
+        for (int i = 0; i < SAMPLES; i++)
+        {
+            const auto value = static_cast<std::int16_t>(noise(rng));
+            const auto filtered = filter.Filter(params, value, dt_us);
+
+            in += static_cast<double>(value) * value;
+            out += static_cast<double>(filtered) * filtered;
+        }
+
+        return { sqrt(in / SAMPLES), sqrt(out / SAMPLES) };
+    }
+
+    void MeasureStepResponse(const OneEuroParams& params, std::int16_t step, std::int32_t dt_us)
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::setprecision;
+
+        const int reports = StepResponseReports(params, step, dt_us);
+
+        cout << fixed << setprecision(1);
+        cout << "  step " << step << " at " << dt_us / 1000.0 << "ms reports: 90% after " << reports << " report(s), ";
+        cout << (reports - 1) * dt_us / 1000.0 << "ms added" << endl;
+    }
+
+    void MeasureNoise(const OneEuroParams& params, std::int32_t dt_us)
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::setprecision;
+
+        const auto rms = NoiseRms(params, dt_us);
+
+        cout << fixed << setprecision(1);
+        cout << "  resting noise at " << dt_us / 1000.0 << "ms reports: rms ";
+        cout << rms.first << " in, " << rms.second << " out" << endl;
+    }
+
+    void BenchmarkFilter()
+    {
+        using std::cout;
+        using std::endl;
+        using std::int16_t;
+        using std::int32_t;
+        using std::mt19937;
+        using std::uniform_int_distribution;
+        using std::chrono::microseconds;
+
+        const auto params = MakeOneEuroParams(DEFAULT_STICK_FILTER_CUTOFF, DEFAULT_STICK_FILTER_BETA, DEFAULT_STICK_FILTER_DERIVATIVE_CUTOFF);
+        constexpr int32_t DT_US = 8000;
+
+        mt19937 rng(2);
+        uniform_int_distribution<int> axis_dist(-32768, 32767);
+        std::vector<int16_t> axes(BATCH_SIZE);
+        std::vector<ControllerState> states(BATCH_SIZE);
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            axes[i] = static_cast<int16_t>(axis_dist(rng));
+        }
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            states[i] = { 0, axes[i], axes[(i + 1) % BATCH_SIZE], axes[(i + 2) % BATCH_SIZE], axes[(i + 3) % BATCH_SIZE] };
+        }
+
+        OneEuroFilter filter;
+        StickFilter stick_filter;
+
+        RunBenchmark("one euro filter single", [&](std::size_t) {
+            benchmark_sink = filter.Filter(params, axes[0], DT_US);
+        });
+
+        RunBenchmark("one euro filter batched", [&](std::size_t i) {
+            benchmark_sink = filter.Filter(params, axes[i % BATCH_SIZE], DT_US);
+        });
+
+        RunBenchmark("stick filter batched", [&](std::size_t i) {
+            auto state = states[i % BATCH_SIZE];
+            state.time += microseconds(DT_US * static_cast<std::int64_t>(i));
+            stick_filter.Apply(params, state);
+            benchmark_sink = state.lx;
+        });
+
+        if (!Selected("one euro filter response"))
+        {
+            return;
+        }
+
+        cout << "one euro filter response with default parameters:" << endl;
+
+        for (const int32_t dt_us : { 8000, 15000 })
+        {
+            for (const int16_t step : { 1000, 8000, 30000 })
+            {
+                MeasureStepResponse(params, step, dt_us);
+            }
+
+            MeasureNoise(params, dt_us);
+        }
+    }
+
+    constexpr std::size_t MACRO_CONTROLLERS = 16;
+
+    // MACRO_CONTROLLERS controllers holding turbo buttons and firing macros through engine while
+    // every core is busy decoding. returns how many states the timers injected
+    std::uint64_t SimulateMacroLoad(MacroEngine& engine, std::chrono::seconds run_time)
+    {
+        using std::atomic;
+        using std::make_unique;
+        using std::thread;
+        using std::unique_ptr;
+        using std::vector;
+        using std::chrono::milliseconds;
+        using std::chrono::steady_clock;
+        using std::this_thread::sleep_until;
+
+        const vector<TurboConfig> turbos = { { CONTROLLER_BUTTON_A, std::chrono::microseconds(1000000 / 60) } };
+        const vector<MacroConfig> macros = {
+            { CONTROLLER_BUTTON_ZL, { { CONTROLLER_BUTTON_B, milliseconds(20) }, { 0, milliseconds(15) }, { CONTROLLER_BUTTON_B | CONTROLLER_BUTTON_X, milliseconds(30) } } },
+        };
+
+        const auto packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, BATCH_SIZE);
+        atomic<std::uint64_t> injected(0);
+        atomic<bool> done(false);
+
+        vector<unique_ptr<MacroPlayer>> players;
+
+        for (std::size_t i = 0; i < MACRO_CONTROLLERS; i++)
+        {
+            auto& player = players.emplace_back();
+            player = make_unique<MacroPlayer>(&engine, turbos, macros, [&, i] {
+                ControllerState state = { players[i]->Apply(CONTROLLER_BUTTON_A) };
+                benchmark_sink = MapToXUSB(state, DefaultMappingPlan()).wButtons;
+                injected++;
+            });
+        }
+
+        vector<thread> threads;
+
+        // simulated read threads, offset so their reports don't all land at once
+        for (std::size_t i = 0; i < MACRO_CONTROLLERS; i++)
+        {
+            threads.emplace_back([&, i] {
+                ControllerState state;
+                auto next = steady_clock::now() + milliseconds(i);
+                std::size_t report = 0;
+
+                while (!done)
+                {
+                    sleep_until(next);
+
+                    const auto now = steady_clock::now();
+                    const auto& packet = packets[report % BATCH_SIZE];
+                    DecodeUSBReport(packet.data(), packet.size(), state);
+
+                    // turbo held for 400ms of every 500, the macro fired every 250
+                    std::uint32_t buttons = report % 63 < 50 ? CONTROLLER_BUTTON_A : 0;
+                    buttons |= report % 31 < 2 ? CONTROLLER_BUTTON_ZL : 0;
+
+                    players[i]->Update(buttons, now);
+                    benchmark_sink = MapToXUSB(state, DefaultMappingPlan()).wButtons;
+
+                    next += USB_REPORT_INTERVAL;
+                    report++;
+                }
+            });
+        }
+
+        for (unsigned int i = 0; i < thread::hardware_concurrency(); i++)
+        {
+            threads.emplace_back([&] {
+                ControllerState state;
+                std::size_t report = 0;
+
+                while (!done)
+                {
+                    const auto& packet = packets[report++ % BATCH_SIZE];
+                    DecodeUSBReport(packet.data(), packet.size(), state);
+                    benchmark_sink = state.buttons;
+                }
+            });
+        }
+
+        sleep_until(steady_clock::now() + run_time);
+        done = true;
+
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+
+        players.clear();
+
+        return injected;
+    }
+
+    // reports how late the timers ran under SimulateMacroLoad
+    void BenchmarkMacros()
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::setprecision;
+        using std::thread;
+        using std::chrono::seconds;
+
+        if (!Selected("macro scheduling"))
+        {
+            return;
+        }
+
+        constexpr seconds RUN_TIME(5);
+
+        MacroEngine engine(IoSchedulingConfig{});
+
+        if (!engine.Valid())
+        {
+            return;
+        }
+
+        const auto injected = SimulateMacroLoad(engine, RUN_TIME);
+
+        const auto& lateness = engine.Lateness();
+        const auto us = [](std::uint64_t ns) { return ns / 1000.0; };
+
+        cout << "macro scheduling with " << MACRO_CONTROLLERS << " controllers and " << thread::hardware_concurrency() << " busy threads:" << endl;
+        cout << fixed << setprecision(1);
+        cout << "  " << lateness.Count() << " timers, " << injected / RUN_TIME.count() << " injected states/s" << endl;
+        cout << "  lateness p50 " << us(lateness.Percentile(50.0)) << "us, p99 " << us(lateness.Percentile(99.0));
+        cout << "us, p99.9 " << us(lateness.Percentile(99.9)) << "us, max " << us(lateness.Max()) << "us" << endl;
+    }
+
+    // decoded states and IMU samples of the random reports, which all have motion in them
+    void MakeDsuInputs(std::vector<ControllerState>& states, std::vector<std::array<ImuSample, IMU_SAMPLES_PER_REPORT>>& samples)
+    {
+        using std::chrono::steady_clock;
+
+        const auto packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, BATCH_SIZE);
+        states.resize(BATCH_SIZE);
+        samples.resize(BATCH_SIZE);
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            DecodeUSBReport(packets[i].data(), packets[i].size(), states[i]);
+            DecodeImuSamples(packets[i].data(), packets[i].size(), steady_clock::now(), samples[i].data());
+        }
+    }
+
+    // publishes reports to slot at the usb rate while client receives them, each stamped as if
+    // sampled right before it's published. false if the client never got subscribed
+    bool SimulateDsuLoopback(DsuServer& server, int slot, DsuTestClient& client, std::vector<ControllerState>& states,
+        std::vector<std::array<ImuSample, IMU_SAMPLES_PER_REPORT>>& samples, std::size_t reports)
+    {
+        using std::atomic;
+        using std::thread;
+        using std::chrono::milliseconds;
+        using std::chrono::seconds;
+        using std::chrono::steady_clock;
+        using std::this_thread::sleep_until;
+
+        // the server thread has to see the subscription before anything is sent to it
+        client.Subscribe();
+        const auto subscribed = steady_clock::now() + seconds(1);
+
+        while (client.Packets() == 0 && steady_clock::now() < subscribed)
+        {
+            server.Publish(slot, states[0], samples[0].data(), 0);
+            client.Receive(milliseconds(10));
+        }
+
+        if (client.Packets() == 0)
+        {
+            return false;
+        }
+
+        client.Reset();
+
+        atomic<bool> done(false);
+        thread receiver([&] {
+            // until everything sent has arrived or been lost
+            while (client.Receive(milliseconds(100)) || !done)
+            {
+            }
+        });
+
+        auto next = steady_clock::now();
+
+        for (std::size_t i = 0; i < reports; i++)
+        {
+            sleep_until(next);
+
+            auto& sample = samples[i % BATCH_SIZE].back();
+            sample.time = steady_clock::now();
+            server.Publish(slot, states[i % BATCH_SIZE], samples[i % BATCH_SIZE].data(), IMU_SAMPLES_PER_REPORT);
+
+            next += USB_REPORT_INTERVAL;
+        }
+
+        done = true;
+        receiver.join();
+
+        return true;
+    }
+
+    void BenchmarkDsu()
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::setprecision;
+        using std::vector;
+
+        if (!Selected("dsu"))
+        {
+            return;
+        }
+
+        constexpr std::size_t REPORTS = 500;
+
+        DsuServer server(0);
+
+        if (!server.Valid())
+        {
+            return;
+        }
+
+        vector<ControllerState> states;
+        vector<std::array<ImuSample, IMU_SAMPLES_PER_REPORT>> samples;
+        MakeDsuInputs(states, samples);
+
+        const int slot = server.Attach(false, "");
+
+        // packet building and CRC alone, nobody is subscribed yet
+        RunBenchmark("dsu publish no clients", [&](std::size_t i) {
+            server.Publish(slot, states[i % BATCH_SIZE], samples[i % BATCH_SIZE].data(), IMU_SAMPLES_PER_REPORT);
+        });
+
+        if (!Selected("dsu loopback"))
+        {
+            return;
+        }
+
+        DsuTestClient client(server.Port());
+
+        if (!client.Valid() || !SimulateDsuLoopback(server, slot, client, states, samples, REPORTS))
+        {
+            return;
+        }
+
+        server.Detach(slot);
+
+        const auto& latency = client.Latency();
+
+        cout << "dsu loopback, " << REPORTS << " reports at the usb rate:" << endl;
+        cout << fixed << setprecision(1);
+        cout << "  " << client.Packets() << " delivered, " << client.Corrupt() << " corrupt" << endl;
+        cout << "  publish to arrival p50 " << latency.Percentile(50.0) / 1000 << "us, p99 " << latency.Percentile(99.0) / 1000;
+        cout << "us, max " << latency.Max() / 1000 << "us" << endl;
+    }
+
+    bool SameStreamState(const ControllerState& a, const ControllerState& b)
+    {
+        return a.buttons == b.buttons && a.lx == b.lx && a.ly == b.ly && a.rx == b.rx && a.ry == b.ry && a.power == b.power;
+    }
+
+    // what arrived has to be the sent states in order with some missing
+    bool InOrder(const std::vector<ControllerState>& states, const std::vector<ControllerState>& received)
+    {
+        std::size_t sent = 0;
+
+        for (const auto& state : received)
+        {
+            while (sent < states.size() && !SameStreamState(states[sent], state))
+            {
+                sent++;
+            }
+
+            if (sent == states.size())
+            {
+                return false;
+            }
+
+            sent++;
+        }
+
+        return true;
+    }
+
+    // sends every state through a lossy loopback stream and checks what comes out the other end
+    void MeasureStreamLoss(const std::vector<ControllerState>& states, std::size_t redundancy, double loss, double reorder)
+    {
+        using std::cout;
+        using std::endl;
+        using std::vector;
+        using std::chrono::microseconds;
+        using std::chrono::milliseconds;
+        using std::chrono::steady_clock;
+        using std::this_thread::sleep_for;
+        using std::this_thread::sleep_until;
+
+        vector<ControllerState> received;
+        std::uint64_t recovered;
+        std::uint64_t lost;
+
+        {
+            StreamReceiver receiver(UDP_LOOPBACK, 0, [&](std::uint8_t, const ControllerState& state) {
+                received.push_back(state);
+            });
+
+            StreamSender sender({ UDP_LOOPBACK, receiver.Port() }, loss, reorder);
+
+            if (!receiver.Valid() || !sender.Valid())
+            {
+                return;
+            }
+
+            StreamEncoder encoder(0, redundancy);
+            auto next = steady_clock::now();
+
+            for (const auto& state : states)
+            {
+                sleep_until(next);
+
+                const std::uint8_t* packet;
+                const auto size = encoder.Encode(state, packet);
+                sender.Send(packet, size);
+
+                next += microseconds(500);
+            }
+
+            sleep_for(milliseconds(100));
+            recovered = receiver.Stats().recovered;
+            lost = receiver.Stats().lost;
+        }
+
+        const bool in_order = InOrder(states, received);
+
+        cout << "  redundancy " << redundancy << ": " << received.size() << " of " << states.size() << " states, ";
+        cout << recovered << " recovered, " << lost << " lost, " << (in_order ? "in order" : "OUT OF ORDER") << endl;
+    }
+
+    void BenchmarkStream()
+    {
+        using std::cout;
+        using std::endl;
+        using std::vector;
+
+        const auto packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, BATCH_SIZE);
+        vector<ControllerState> states(BATCH_SIZE);
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            DecodeUSBReport(packets[i].data(), packets[i].size(), states[i]);
+        }
+
+        StreamEncoder encoder(0, STREAM_DEFAULT_REDUNDANCY);
+        const std::uint8_t* packet = nullptr;
+        std::size_t packet_bytes = 0;
+
+        RunBenchmark("stream encode", [&](std::size_t i) {
+            packet_bytes += encoder.Encode(states[i % BATCH_SIZE], packet);
+        });
+
+        // a stream of every state, decoded over and over from a fresh decoder each pass
+        vector<bytes> encoded;
+        StreamEncoder batch_encoder(0, STREAM_DEFAULT_REDUNDANCY);
+
+        for (const auto& state : states)
+        {
+            const auto size = batch_encoder.Encode(state, packet);
+            encoded.emplace_back(packet, packet + size);
+        }
+
+        std::unique_ptr<StreamDecoder> decoder;
+
+        RunBenchmark("stream decode", [&](std::size_t i) {
+            if (i % BATCH_SIZE == 0)
+            {
+                decoder = std::make_unique<StreamDecoder>([](std::uint8_t, const ControllerState& state) { benchmark_sink = state.buttons; });
+            }
+
+            decoder->Decode(encoded[i % BATCH_SIZE].data(), encoded[i % BATCH_SIZE].size());
+        });
+
+        if (!Selected("stream loopback"))
+        {
+            return;
+        }
+
+        std::size_t total_bytes = 0;
+
+        for (const auto& p : encoded)
+        {
+            total_bytes += p.size();
+        }
+
+        cout << "stream loopback with 10% loss and 10% reordering, " << total_bytes / encoded.size() << " bytes per packet:" << endl;
+
+        for (std::size_t redundancy : { std::size_t(1), STREAM_DEFAULT_REDUNDANCY })
+        {
+            MeasureStreamLoss(states, redundancy, 10.0, 10.0);
+        }
+    }
+
+    void BenchmarkSharedState()
+    {
+        using std::atomic;
+        using std::cout;
+        using std::endl;
+        using std::thread;
+        using std::vector;
+        using std::chrono::milliseconds;
+        using std::chrono::steady_clock;
+
+        if (!Selected("shared state"))
+        {
+            return;
+        }
+
+        SharedStatePublisher publisher;
+        SharedStateReader reader;
+
+        if (!publisher.Valid() || !reader.Valid())
+        {
+            return;
+        }
+
+        const auto packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, BATCH_SIZE);
+        vector<ControllerState> states(BATCH_SIZE);
+        vector<std::array<ImuSample, IMU_SAMPLES_PER_REPORT>> samples(BATCH_SIZE);
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            DecodeUSBReport(packets[i].data(), packets[i].size(), states[i]);
+            DecodeImuSamples(packets[i].data(), packets[i].size(), steady_clock::now(), samples[i].data());
+        }
+
+        const int slot = publisher.Attach(0, DEVICE_FAMILY_PRO_CONTROLLER, false);
+
+        RunBenchmark("shared state publish", [&](std::size_t i) {
+            publisher.Publish(slot, states[i % BATCH_SIZE], samples[i % BATCH_SIZE].data(), IMU_SAMPLES_PER_REPORT);
+        });
+
+        RunBenchmark("shared state read", [&](std::size_t) {
+            SharedControllerState state;
+            reader.Read(slot, state);
+            benchmark_sink = state.buttons;
+        });
+
+        if (!Selected("shared state contended"))
+        {
+            return;
+        }
+
+        // every field follows from the buttons, so a snapshot mixing two reports shows
+        ControllerState first = {};
+        first.ry = static_cast<std::int16_t>(~0u);
+        publisher.Publish(slot, first, nullptr, 0);
+
+        atomic<bool> done(false);
+        thread writer([&] {
+            ControllerState state = {};
+
+            for (std::uint32_t n = 1; !done; n++)
+            {
+                state.buttons = n;
+                state.lx = static_cast<std::int16_t>(n);
+                state.ry = static_cast<std::int16_t>(~n);
+                publisher.Publish(slot, state, nullptr, 0);
+            }
+        });
+
+        std::uint64_t reads = 0;
+        std::uint64_t torn = 0;
+        std::uint64_t missed = 0;
+        const auto end = steady_clock::now() + milliseconds(500);
+
+        while (steady_clock::now() < end)
+        {
+            SharedControllerState state;
+
+            if (!reader.Read(slot, state))
+            {
+                missed++;
+                continue;
+            }
+
+            const auto n = state.buttons;
+            torn += state.lx != static_cast<std::int16_t>(n) || state.ry != static_cast<std::int16_t>(~n);
+            reads++;
+        }
+
+        done = true;
+        writer.join();
+        publisher.Detach(slot);
+
+        cout << "shared state contended, one writer publishing as fast as it can:" << endl;
+        cout << "  " << reads << " reads in 500ms, " << missed << " gave up after retrying, " << torn << " torn" << endl;
+    }
+
+    // a report every 125us like a usb controller into a sink that keeps up, and optionally one that
+    // takes 1ms per report. the push times should look the same either way
+    void MeasureSlowSink(const std::vector<SinkReport>& reports, bool with_slow)
+    {
+        using std::atomic;
+        using std::cout;
+        using std::endl;
+        using std::sort;
+        using std::vector;
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        using std::chrono::milliseconds;
+        using std::chrono::nanoseconds;
+        using std::chrono::steady_clock;
+        using std::this_thread::sleep_for;
+
+        constexpr std::size_t PUSHES = 2048;
+        const auto interval = microseconds(125);
+
+        FanOut fanout("benchmark", nullptr);
+        atomic<std::uint64_t> fast(0);
+        atomic<std::uint64_t> slow(0);
+
+        fanout.AddSink("fast", SINK_REPORT_DEVICE, DEVICE_COUNTER_DSU_DROPS, [&](const SinkReport&) {
+            fast++;
+        });
+
+        if (with_slow)
+        {
+            fanout.AddSink("slow", SINK_REPORT_DEVICE, DEVICE_COUNTER_STREAM_DROPS, [&](const SinkReport&) {
+                sleep_for(milliseconds(1));
+                slow++;
+            });
+        }
+
+        vector<std::int64_t> push_ns;
+        push_ns.reserve(PUSHES);
+        auto next = steady_clock::now();
+
+        for (std::size_t i = 0; i < PUSHES; i++)
+        {
+            while (steady_clock::now() < next)
+            {
+            }
+
+            next += interval;
+
+            const auto start = steady_clock::now();
+            fanout.Push(reports[i % reports.size()]);
+            push_ns.push_back(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+        }
+
+        fanout.Stop();
+        sort(push_ns.begin(), push_ns.end());
+
+        cout << "fan-out " << (with_slow ? "with" : "without") << " a slow sink, " << PUSHES << " reports every 125us:" << endl;
+        cout << "  push p50 " << push_ns[PUSHES / 2] << "ns, p99 " << push_ns[PUSHES * 99 / 100] << "ns, max " << push_ns.back() << "ns" << endl;
+        cout << "  fast sink got " << fast << ", " << fanout.Drops("fast") << " dropped" << endl;
+
+        if (with_slow)
+        {
+            cout << "  slow sink got " << slow << ", " << fanout.Drops("slow") << " dropped" << endl;
+        }
+    }
+
+    void BenchmarkFanOut()
+    {
+        using std::atomic;
+        using std::vector;
+        using std::chrono::steady_clock;
+
+        if (!Selected("fan-out"))
+        {
+            return;
+        }
+
+        const auto packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, BATCH_SIZE);
+        vector<SinkReport> reports(BATCH_SIZE);
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            auto& report = reports[i];
+            report.contents = SINK_REPORT_DEVICE | SINK_REPORT_PAD;
+            report.raw_size = 0;
+            report.read_time = steady_clock::now();
+            DecodeUSBReport(packets[i].data(), packets[i].size(), report.state);
+            report.imu_count = DecodeImuSamples(packets[i].data(), packets[i].size(), report.read_time, report.imu_samples.data());
+        }
+
+        {
+            FanOut fanout("benchmark", nullptr);
+
+            // what the read thread pays when no output besides the virtual pad is configured
+            RunBenchmark("fan-out push no sinks", [&](std::size_t i) {
+                fanout.Push(reports[i % BATCH_SIZE]);
+            });
+        }
+
+        {
+            FanOut fanout("benchmark", nullptr);
+            atomic<std::uint64_t> consumed(0);
+
+            for (const auto name : { "dsu", "shared state", "stream" })
+            {
+                fanout.AddSink(name, SINK_REPORT_DEVICE, DEVICE_COUNTER_DSU_DROPS, [&](const SinkReport& report) {
+                    consumed.fetch_add(report.state.buttons & 1, std::memory_order_relaxed);
+                });
+            }
+
+            RunBenchmark("fan-out push three sinks", [&](std::size_t i) {
+                fanout.Push(reports[i % BATCH_SIZE]);
+            });
+        }
+
+        if (!Selected("fan-out slow sink"))
+        {
+            return;
+        }
+
+        MeasureSlowSink(reports, false);
+        MeasureSlowSink(reports, true);
+    }
+
+    // a controller that answers each subcommand one round trip after it was sent and loses some of
+    // them, in simulated time polled every millisecond like reports would wake the read thread.
+    // returns how long the handshake took on average
+    double MeasureHandshake(std::size_t depth, double loss, std::uint64_t& retries)
+    {
+        using std::mt19937;
+        using std::uniform_real_distribution;
+        using std::vector;
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        using std::chrono::milliseconds;
+        using std::chrono::steady_clock;
+
+        constexpr int RUNS = 200;
+        const auto round_trip = milliseconds(15);
+        const std::uint8_t handshake[] = { SUBCOMMAND_SET_INPUT_MODE, SUBCOMMAND_ENABLE_IMU, SUBCOMMAND_SET_PLAYER_LIGHTS };
+
+        struct Reply
+        {
+            steady_clock::time_point arrival;
+            std::uint8_t subcommand;
+        };
+
+        mt19937 rng(static_cast<unsigned int>(depth));
+        uniform_real_distribution<double> chance(0.0, 100.0);
+        DeviceStats stats;
+        steady_clock::time_point now;
+        vector<Reply> replies;
+        double total_us = 0;
+
+        SubcommandEngine engine([&](std::uint8_t subcommand, const bytes&) {
+            if (chance(rng) >= loss)
+            {
+                replies.push_back({ now + round_trip, subcommand });
+            }
+        }, &stats, depth);
+
+        for (int run = 0; run < RUNS; run++)
+        {
+            const auto start = now;
+            std::size_t done = 0;
+
+            for (const auto subcommand : handshake)
+            {
+                engine.Request(subcommand, {}, [&](const SubcommandReply&) {
+                    done++;
+                });
+            }
+
+            while (done < sizeof(handshake))
+            {
+                engine.Poll(now);
+                now += milliseconds(1);
+
+                for (std::size_t i = 0; i < replies.size();)
+                {
+                    if (replies[i].arrival > now)
+                    {
+                        i++;
+                        continue;
+                    }
+
+                    bytes reply(USB_INPUT_REPORT_SIZE);
+                    reply[0] = PACKET_TYPE_SUBCOMMAND_REPLY;
+                    reply[SUBCOMMAND_REPLY_ACK_OFFSET] = 0x80;
+                    reply[SUBCOMMAND_REPLY_ID_OFFSET] = replies[i].subcommand;
+                    engine.HandleReply(reply.data(), reply.size(), now);
+
+                    replies.erase(replies.begin() + i);
+                }
+            }
+
+            total_us += static_cast<double>(duration_cast<microseconds>(now - start).count());
+
+            // late replies to retried attempts don't carry over into the next run
+            now += milliseconds(100);
+            replies.clear();
+        }
+
+        retries = stats.Get(DEVICE_COUNTER_SUBCOMMAND_RETRIES);
+
+        return total_us / RUNS / 1000.0;
+    }
+
+    void BenchmarkSubcommands()
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::setprecision;
+        using std::chrono::steady_clock;
+
+        if (!Selected("subcommand"))
+        {
+            return;
+        }
+
+        SubcommandEngine engine([](std::uint8_t, const bytes&) {}, nullptr);
+        bytes reply(USB_INPUT_REPORT_SIZE);
+        reply[0] = PACKET_TYPE_SUBCOMMAND_REPLY;
+        reply[SUBCOMMAND_REPLY_ACK_OFFSET] = 0x80;
+        reply[SUBCOMMAND_REPLY_ID_OFFSET] = SUBCOMMAND_SET_PLAYER_LIGHTS;
+
+        // the bookkeeping for one subcommand, from the request to its callback
+        RunBenchmark("subcommand round trip", [&](std::size_t i) {
+            engine.Request(SUBCOMMAND_SET_PLAYER_LIGHTS, { static_cast<std::uint8_t>(i) }, [](const SubcommandReply& result) {
+                benchmark_sink = result.status;
+            });
+
+            const auto now = steady_clock::now();
+            engine.Poll(now);
+            engine.HandleReply(reply.data(), reply.size(), now);
+        });
+
+        if (!Selected("subcommand handshake"))
+        {
+            return;
+        }
+
+        cout << "subcommand handshake, input mode, IMU and player lights with a 15ms round trip:" << endl;
+        cout << fixed << setprecision(1);
+
+        for (const double loss : { 0.0, 10.0 })
+        {
+            std::uint64_t strict_retries;
+            std::uint64_t pipelined_retries;
+            const auto strict = MeasureHandshake(1, loss, strict_retries);
+            const auto pipelined = MeasureHandshake(SUBCOMMAND_PIPELINE_DEPTH, loss, pipelined_retries);
+
+            cout << "  " << loss << "% loss: one at a time " << strict << "ms (" << strict_retries << " retries in 200 runs)";
+            cout << ", pipelined " << pipelined << "ms (" << pipelined_retries << " retries)" << endl;
+        }
+    }
+    // four bluetooth pads sharing one radio, simulated for a minute: each sends input reports every
+    // 15ms and gets a rumble tick every 100ms, and every output keeps the radio busy for 4ms the way
+    // --emulate-airtime does. prints how many input reports made it and how many outputs were sent
+    void MeasureOutputRate(bool control, bool rumbling)
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::setprecision;
+        using std::unique_ptr;
+        using std::vector;
+        using std::chrono::microseconds;
+        using std::chrono::milliseconds;
+        using std::chrono::seconds;
+        using std::chrono::steady_clock;
+
+        constexpr std::size_t PADS = 4;
+        const auto duration = seconds(60);
+
+        struct Pad
+        {
+            unique_ptr<DeviceStats> stats;
+            unique_ptr<OutputRateControl> rate;
+            steady_clock::time_point next_input;
+            steady_clock::time_point next_output;
+            std::uint64_t missing;
+            std::uint64_t delivered;
+            std::uint64_t outputs;
+        };
+
+        EmulatorAirtime radio(microseconds(4000));
+        vector<Pad> pads(PADS);
+        steady_clock::time_point now;
+
+        for (std::size_t i = 0; i < PADS; i++)
+        {
+            auto& pad = pads[i];
+            pad.stats.reset(new DeviceStats());
+            pad.rate.reset(new OutputRateControl(*pad.stats, static_cast<unsigned int>(i), control));
+            // spread out like independently connected controllers would be
+            pad.next_input = now + microseconds(3700 * i);
+            pad.next_output = now + microseconds(23000 * i);
+            pad.missing = 0;
+            pad.delivered = 0;
+            pad.outputs = 0;
+        }
+
+        const auto end = now + duration;
+        std::uint64_t tick = 0;
+
+        for (; now < end; now += microseconds(250))
+        {
+            for (auto& pad : pads)
+            {
+                if (now >= pad.next_input)
+                {
+                    pad.next_input += BLUETOOTH_REPORT_INTERVAL;
+
+                    if (radio.InputLost(now))
+                    {
+                        pad.missing++;
+                    }
+                    else
+                    {
+                        pad.rate->RecordInput(pad.missing, now);
+                        pad.delivered++;
+                        pad.missing = 0;
+                    }
+                }
+
+                if (now >= pad.next_output)
+                {
+                    pad.next_output += OUTPUT_BASE_INTERVAL;
+                    tick++;
+
+                    // a game shaking the controller with a magnitude that keeps changing
+                    std::uint8_t rumble[OUTPUT_RUMBLE_SIZE] = { 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00 };
+
+                    if (rumbling)
+                    {
+                        rumble[1] = 0x20;
+                        rumble[2] = 0x62;
+                        rumble[3] = static_cast<std::uint8_t>(0x20 + tick % 0x20);
+                    }
+
+                    if (pad.rate->ShouldSend(rumble, false, now))
+                    {
+                        const auto done = radio.Output(now);
+                        pad.rate->RecordWrite(done - now, false);
+                        pad.outputs++;
+                    }
+                }
+            }
+        }
+
+        std::uint64_t delivered = 0;
+        std::uint64_t outputs = 0;
+
+        for (const auto& pad : pads)
+        {
+            delivered += pad.delivered;
+            outputs += pad.outputs;
+        }
+
+        const auto expected = static_cast<double>(PADS) * (duration / BLUETOOTH_REPORT_INTERVAL);
+
+        cout << "  " << (rumbling ? "rumbling" : "idle") << ", rate control " << (control ? "on: " : "off:");
+        cout << fixed << setprecision(1) << " " << 100.0 * delivered / expected << "% of input reports delivered, ";
+        cout << outputs << " outputs sent" << endl;
+    }
+
+    void BenchmarkOutputRate()
+    {
+        using std::cout;
+        using std::endl;
+
+        if (!Selected("output rate"))
+        {
+            return;
+        }
+
+        cout << "output rate, four bluetooth pads on one radio with 4ms of airtime per output:" << endl;
+
+        for (const bool rumbling : { false, true })
+        {
+            MeasureOutputRate(false, rumbling);
+            MeasureOutputRate(true, rumbling);
+        }
+    }
+    using RumblePacket = std::array<std::uint8_t, OUTPUT_RUMBLE_SIZE>;
+
+    // renders an effect the way the read thread would into packets, and returns how far each
+    // packet is from the loudest of the effect's steps it stands for. under 4 if nothing but the
+    // frame's 6 bit amplitude rounds it
+    int RenderEffectPackets(const RumbleEffect& effect, std::vector<RumblePacket>& packets)
+    {
+        using std::abs;
+        using std::max;
+        using std::min;
+
+        RumbleWaveform waveform;
+        waveform.Play(effect);
+
+        int worst = 0;
+
+        for (std::size_t first = 0; waveform.Busy(); first += RUMBLE_SAMPLES_PER_PACKET)
+        {
+            RumbleSample samples[RUMBLE_SAMPLES_PER_PACKET];
+            auto& rumble = packets.emplace_back();
+
+            waveform.Render(samples, RUMBLE_SAMPLES_PER_PACKET);
+            EncodeRumblePacket(samples, RUMBLE_SAMPLES_PER_PACKET, rumble.data());
+            const auto decoded = DecodeRumblePacket(rumble.data());
+
+            RumbleSample peak = { 0, 0 };
+
+            for (auto i = first; i < min(first + RUMBLE_SAMPLES_PER_PACKET, effect.samples.size()); i++)
+            {
+                peak.large = max(peak.large, effect.samples[i].large);
+                peak.small = max(peak.small, effect.samples[i].small);
+            }
+
+            worst = max(worst, abs(decoded.large - peak.large));
+            worst = max(worst, abs(decoded.small - peak.small));
+        }
+
+        return worst;
+    }
+
+    constexpr int RUMBLE_STEP_TOLERANCE = 3;
+
+    // prints how many packets an effect took and how far they are from its loudest steps
+    void RenderEffect(const RumbleEffect& effect, bool dump)
+    {
+        using std::cout;
+        using std::dec;
+        using std::endl;
+        using std::hex;
+        using std::setfill;
+        using std::setw;
+        using std::vector;
+
+        vector<RumblePacket> packets;
+        const int worst = RenderEffectPackets(effect, packets);
+
+        if (dump)
+        {
+            for (const auto& rumble : packets)
+            {
+                cout << "    ";
+
+                for (const auto byte : rumble)
+                {
+                    cout << " " << hex << setw(2) << setfill('0') << +byte;
+                }
+
+                cout << dec << setfill(' ') << endl;
+            }
+        }
+
+        cout << "  " << effect.name << ": " << effect.samples.size() << " steps in " << packets.size() << " packets, off by up to " << worst;
+        cout << (worst > RUMBLE_STEP_TOLERANCE ? " (MISMATCH)" : "") << endl;
+    }
+
+    // an xinput motor going from off to full and back 100ms later, sent the old way once per
+    // 100ms tick and as a waveform. prints what the controller ends up playing in 5ms steps, it
+    // holds each plain frame until the next one
+    void RenderStep()
+    {
+        using std::cout;
+        using std::endl;
+        using std::setw;
+
+        RumbleWaveform waveform;
+        std::size_t packets = 0;
+
+        cout << "  step on the large motor, 5ms per column:" << endl;
+        cout << "    100ms ticks:";
+
+        for (int i = 0; i < 40; i++)
+        {
+            cout << setw(4) << (i < 20 ? 255 : 0);
+        }
+
+        cout << endl << "    waveform:   ";
+
+        for (int i = 0; i < 40; i += RUMBLE_SAMPLES_PER_PACKET)
+        {
+            RumbleSample samples[RUMBLE_SAMPLES_PER_PACKET];
+
+            waveform.SetTarget(i < 20 ? 255 : 0, 0);
+            // steady output is left to the 100ms tick
+            packets += waveform.Busy() ? 1 : 0;
+            waveform.Render(samples, RUMBLE_SAMPLES_PER_PACKET);
+
+            std::uint8_t rumble[OUTPUT_RUMBLE_SIZE];
+            EncodeRumblePacket(samples, RUMBLE_SAMPLES_PER_PACKET, rumble);
+            const auto played = DecodeRumblePacket(rumble);
+
+            for (std::size_t j = 0; j < RUMBLE_SAMPLES_PER_PACKET && i + j < 40; j++)
+            {
+                cout << setw(4) << +played.large;
+            }
+        }
+
+        cout << endl << "    " << packets << " extra packets for the ramps, sent between the 100ms ticks" << endl;
+    }
+
+    void BenchmarkWaveform()
+    {
+        using std::cout;
+        using std::endl;
+
+        std::uint8_t rumble[OUTPUT_RUMBLE_SIZE];
+        RumbleSample samples[RUMBLE_SAMPLES_PER_PACKET] = { { 0, 255 }, { 40, 128 }, { 80, 0 } };
+
+        RunBenchmark("waveform encode", [&](std::uint64_t i) {
+            samples[0].large = static_cast<std::uint8_t>(i);
+            EncodeRumblePacket(samples, RUMBLE_SAMPLES_PER_PACKET, rumble);
+            benchmark_sink = rumble[1];
+        });
+
+        RunBenchmark("waveform render", [&](std::uint64_t i) {
+            static RumbleWaveform waveform;
+            waveform.SetTarget(static_cast<std::uint8_t>(i >> 3), 0);
+            waveform.Render(samples, RUMBLE_SAMPLES_PER_PACKET);
+            benchmark_sink = samples[2].large;
+        });
+
+        if (!Selected("waveform effects"))
+        {
+            return;
+        }
+
+        cout << "waveform effects, rendered to packets and decoded again:" << endl;
+
+        for (const auto& effect : RumbleEffects())
+        {
+            RenderEffect(effect, effect.samples.size() <= 2 * RUMBLE_SAMPLES_PER_PACKET);
+        }
+
+        RenderStep();
+    }
+    // stands in for a device read thread whose controller stopped sending: every read waits out
+    // the 500ms timeout. the clear at the end is the two spaced LED and rumble writes
+    struct TeardownThread
+    {
+        HANDLE read_event;
+        HANDLE quit_event;
+        std::atomic<bool> quitting;
+        bool wakeable;
+        bool clear;
+        std::chrono::steady_clock::time_point last_write;
+        std::thread thread;
+
+        TeardownThread(bool _wakeable, bool _clear)
+            : read_event(CreateEvent(nullptr, FALSE, FALSE, nullptr))
+            , quit_event(CreateEvent(nullptr, TRUE, FALSE, nullptr))
+            , quitting(false)
+            , wakeable(_wakeable)
+            , clear(_clear)
+            , last_write(std::chrono::steady_clock::now())
+            , thread(&TeardownThread::Run, this)
+        {
+        }
+
+        ~TeardownThread()
+        {
+            CloseHandle(read_event);
+            CloseHandle(quit_event);
+        }
+
+        void Run()
+        {
+            using std::this_thread::sleep_for;
+            using std::this_thread::sleep_until;
+            using std::chrono::milliseconds;
+
+            HANDLE waits[2] = { read_event, quit_event };
+
+            while (!quitting)
+            {
+                WaitForMultipleObjects(wakeable ? 2 : 1, waits, FALSE, 500);
+            }
+
+            if (!clear)
+            {
+                return;
+            }
+
+            // the old sequence slept a fixed 100ms before each write, the new one only until the
+            // last write is 100ms old
+            if (wakeable)
+            {
+                sleep_until(last_write + milliseconds(100));
+                last_write = std::chrono::steady_clock::now();
+                sleep_until(last_write + milliseconds(100));
+            }
+            else
+            {
+                sleep_for(milliseconds(100));
+                sleep_for(milliseconds(100));
+            }
+        }
+
+        void Stop()
+        {
+            quitting = true;
+
+            if (wakeable)
+            {
+                SetEvent(quit_event);
+            }
+        }
+    };
+
+    // time from asking pads controllers to stop until the last thread is gone. sequential stops
+    // and joins one controller after the other, the way the controller list used to be cleared
+    double MeasureTeardown(std::size_t pads, bool wakeable, bool clear, bool sequential, std::mt19937& rng)
+    {
+        using std::unique_ptr;
+        using std::uniform_int_distribution;
+        using std::vector;
+        using std::chrono::duration;
+        using std::chrono::milliseconds;
+        using std::chrono::steady_clock;
+        using std::this_thread::sleep_for;
+
+        vector<unique_ptr<TeardownThread>> threads;
+
+        for (std::size_t i = 0; i < pads; i++)
+        {
+            threads.emplace_back(new TeardownThread(wakeable, clear));
+        }
+
+        // somewhere in the middle of a read wait
+        sleep_for(milliseconds(uniform_int_distribution<int>(150, 450)(rng)));
+
+        const auto start = steady_clock::now();
+
+        for (auto& thread : threads)
+        {
+            thread->Stop();
+
+            if (sequential)
+            {
+                thread->thread.join();
+            }
+        }
+
+        for (auto& thread : threads)
+        {
+            if (thread->thread.joinable())
+            {
+                thread->thread.join();
+            }
+        }
+
+        const duration<double, std::milli> elapsed = steady_clock::now() - start;
+
+        return elapsed.count();
+    }
+
+    void BenchmarkTeardown()
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::mt19937;
+        using std::setprecision;
+
+        if (!Selected("teardown"))
+        {
+            return;
+        }
+
+        mt19937 rng(7);
+
+        cout << "teardown of read threads whose controllers stopped reporting, ms until all are gone:" << endl;
+
+        for (const std::size_t pads : { 1, 4 })
+        {
+            const double before = MeasureTeardown(pads, false, true, true, rng);
+            const double exit = MeasureTeardown(pads, true, true, false, rng);
+            const double removal = MeasureTeardown(pads, true, false, true, rng);
+
+            cout << fixed << setprecision(1) << "  " << pads << (pads == 1 ? " controller: " : " controllers:");
+            cout << " timed out waits and fixed clears " << before << ", quit event at exit " << exit << ", removal " << removal << endl;
+        }
+    }
+
+    int self_test_failures;
+
+    // prints one line per check, so a failing run shows what failed and not just that something did
+    void Check(const std::string& name, bool ok, const std::string& detail)
+    {
+        using std::cout;
+        using std::endl;
+
+        cout << (ok ? "PASS " : "FAIL ") << name;
+
+        if (!ok)
+        {
+            cout << ": " << detail;
+            self_test_failures++;
+        }
+
+        cout << endl;
+    }
+
+    // the decoders as they were before they became templates per family and transport, kept to
+    // check the specializations against
+    bool ReferenceDecodeUSBReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+    {
+        using std::int8_t;
+        using std::int_fast64_t;
+
+        const auto hid_payload = reinterpret_cast<const ProControllerUSBPacket *>(data);
+
+        if (size < 12 || hid_payload->type != PACKET_TYPE_CONTROLLER_DATA)
+        {
+            return false;
+        }
+
+        const auto& analog = hid_payload->data.controller_data.analog;
+        const auto& buttons = hid_payload->data.controller_data.buttons;
+
+        int8_t lx = (((analog[1] & 0x0F) << 4) | ((analog[0] & 0xF0) >> 4)) + 127;
+        int8_t ly = analog[2] + 127;
+        int8_t rx = (((analog[4] & 0x0F) << 4) | ((analog[3] & 0xF0) >> 4)) + 127;
+        int8_t ry = analog[5] + 127;
+
+        state.timed = true;
+        state.timer = hid_payload->data.controller_data.timestamp;
+
+        state.buttons = 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_A) ? CONTROLLER_BUTTON_A : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_B) ? CONTROLLER_BUTTON_B : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_X) ? CONTROLLER_BUTTON_X : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_Y) ? CONTROLLER_BUTTON_Y : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_UP) ? CONTROLLER_BUTTON_DPAD_UP : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_DOWN) ? CONTROLLER_BUTTON_DPAD_DOWN : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_LEFT) ? CONTROLLER_BUTTON_DPAD_LEFT : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_RIGHT) ? CONTROLLER_BUTTON_DPAD_RIGHT : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_PLUS) ? CONTROLLER_BUTTON_PLUS : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_MINUS) ? CONTROLLER_BUTTON_MINUS : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_HOME) ? CONTROLLER_BUTTON_HOME : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_SHARE) ? CONTROLLER_BUTTON_SHARE : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_L) ? CONTROLLER_BUTTON_L : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_ZL) ? CONTROLLER_BUTTON_ZL : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_L) ? CONTROLLER_BUTTON_THUMB_L : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_R) ? CONTROLLER_BUTTON_R : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_ZR) ? CONTROLLER_BUTTON_ZR : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_R) ? CONTROLLER_BUTTON_THUMB_R : 0;
+
+        constexpr int_fast64_t SCALE_X_MIN = -100;
+        constexpr int_fast64_t SCALE_X_MAX = 85;
+        constexpr int_fast64_t SCALE_Y_MIN = -100;
+        constexpr int_fast64_t SCALE_Y_MAX = 90;
+
+        state.lx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, lx);
+        state.ly = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, ly);
+        state.rx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, rx);
+        state.ry = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, ry);
+
+        return true;
+    }
+
+    bool ReferenceDecodeBluetoothReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+    {
+        using std::int16_t;
+        using std::int_fast64_t;
+
+        const auto hid_payload = reinterpret_cast<const ProControllerBluetoothPacket *>(data);
+
+        if (size < 12 || hid_payload->report_id != PACKET_TYPE_SIMPLE_CONTROLLER_DATA)
+        {
+            return false;
+        }
+
+        const auto& analog = hid_payload->data.controller_data.analog;
+        const auto& hat = hid_payload->data.controller_data.hat;
+        const auto& buttons = hid_payload->data.controller_data.buttons;
+
+        int16_t lx = analog[0] + 32767;
+        int16_t ly = analog[1] + 32767;
+        int16_t rx = analog[2] + 32767;
+        int16_t ry = analog[3] + 32767;
+
+        state.timed = false;
+        state.timer = 0;
+
+        state.buttons = DecodeHat(hat);
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_A) ? CONTROLLER_BUTTON_A : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_B) ? CONTROLLER_BUTTON_B : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_X) ? CONTROLLER_BUTTON_X : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_Y) ? CONTROLLER_BUTTON_Y : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_PLUS) ? CONTROLLER_BUTTON_PLUS : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_MINUS) ? CONTROLLER_BUTTON_MINUS : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_HOME) ? CONTROLLER_BUTTON_HOME : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_SHARE) ? CONTROLLER_BUTTON_SHARE : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_L) ? CONTROLLER_BUTTON_L : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZL) ? CONTROLLER_BUTTON_ZL : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L) ? CONTROLLER_BUTTON_THUMB_L : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_R) ? CONTROLLER_BUTTON_R : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZR) ? CONTROLLER_BUTTON_ZR : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R) ? CONTROLLER_BUTTON_THUMB_R : 0;
+
+        constexpr int_fast64_t SCALE_X_MIN = -25000;
+        constexpr int_fast64_t SCALE_X_MAX = 22000;
+        constexpr int_fast64_t SCALE_Y_MIN = -25000;
+        constexpr int_fast64_t SCALE_Y_MAX = 23000;
+
+        state.lx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, lx);
+        state.ly = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, -ly);
+        state.rx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, rx);
+        state.ry = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, -ry);
+
+        return true;
+    }
+
+    // what the reference full report decoder gives, cut down to the half and sticks a family has
+    ControllerState RestrictToFamily(DeviceFamily family, ControllerState state)
+    {
+        constexpr std::uint32_t RIGHT_BUTTONS = CONTROLLER_BUTTON_A | CONTROLLER_BUTTON_B | CONTROLLER_BUTTON_X | CONTROLLER_BUTTON_Y |
+            CONTROLLER_BUTTON_PLUS | CONTROLLER_BUTTON_HOME | CONTROLLER_BUTTON_R | CONTROLLER_BUTTON_ZR | CONTROLLER_BUTTON_THUMB_R;
+
+        if (!HasRightHalf(family))
+        {
+            state.buttons &= ~RIGHT_BUTTONS;
+            state.rx = 0;
+            state.ry = 0;
+        }
+
+        if (!HasLeftHalf(family))
+        {
+            state.buttons &= RIGHT_BUTTONS;
+            state.lx = 0;
+            state.ly = 0;
+        }
+
+        if (!HasSticks(family))
+        {
+            state.buttons &= ~(CONTROLLER_BUTTON_THUMB_L | CONTROLLER_BUTTON_THUMB_R);
+            state.lx = 0;
+            state.ly = 0;
+            state.rx = 0;
+            state.ry = 0;
+        }
+
+        return state;
+    }
+
+    bool SameDecode(bool a_ok, const ControllerState& a, bool b_ok, const ControllerState& b)
+    {
+        if (a_ok != b_ok)
+        {
+            return false;
+        }
+
+        return !a_ok || (a.buttons == b.buttons && a.lx == b.lx && a.ly == b.ly && a.rx == b.rx && a.ry == b.ry && a.timed == b.timed && a.timer == b.timer);
+    }
+
+    // every specialization against the reference decoders on random packets, mostly of the types
+    // they decode and a few of any type
+    void TestDecoders()
+    {
+        using std::mt19937;
+        using std::to_string;
+        using std::uniform_int_distribution;
+
+        constexpr std::size_t PACKETS = 1000000;
+
+        struct Case
+        {
+            const char* name;
+            DecodeFunction decode;
+            DecodeFunction reference;
+            DeviceFamily family;
+            std::uint8_t type;
+            std::size_t size;
+            std::size_t mismatches;
+        };
+
+        Case cases[] = {
+            { "pro controller usb", SelectDecoder(DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_USB), ReferenceDecodeUSBReport, DEVICE_FAMILY_PRO_CONTROLLER, PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, 0 },
+            { "pro controller bluetooth", SelectDecoder(DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_BLUETOOTH), ReferenceDecodeUSBReport, DEVICE_FAMILY_PRO_CONTROLLER, PACKET_TYPE_CONTROLLER_DATA, BLUETOOTH_INPUT_REPORT_SIZE, 0 },
+            { "pro controller bluetooth simple", DecodeSimpleBluetoothReport, ReferenceDecodeBluetoothReport, DEVICE_FAMILY_PRO_CONTROLLER, PACKET_TYPE_SIMPLE_CONTROLLER_DATA, BLUETOOTH_INPUT_REPORT_SIZE, 0 },
+            { "joy-con (l)", SelectDecoder(DEVICE_FAMILY_JOYCON_LEFT, TRANSPORT_BLUETOOTH), ReferenceDecodeUSBReport, DEVICE_FAMILY_JOYCON_LEFT, PACKET_TYPE_CONTROLLER_DATA, BLUETOOTH_INPUT_REPORT_SIZE, 0 },
+            { "joy-con (r)", SelectDecoder(DEVICE_FAMILY_JOYCON_RIGHT, TRANSPORT_BLUETOOTH), ReferenceDecodeUSBReport, DEVICE_FAMILY_JOYCON_RIGHT, PACKET_TYPE_CONTROLLER_DATA, BLUETOOTH_INPUT_REPORT_SIZE, 0 },
+            { "snes controller", SelectDecoder(DEVICE_FAMILY_SNES_CONTROLLER, TRANSPORT_BLUETOOTH), ReferenceDecodeUSBReport, DEVICE_FAMILY_SNES_CONTROLLER, PACKET_TYPE_CONTROLLER_DATA, BLUETOOTH_INPUT_REPORT_SIZE, 0 },
+        };
+
+        mt19937 rng(5);
+        uniform_int_distribution<int> byte_dist(0, 0xFF);
+        bytes packet(BLUETOOTH_INPUT_REPORT_SIZE);
+
+        for (std::size_t i = 0; i < PACKETS; i++)
+        {
+            for (auto& b : packet)
+            {
+                b = static_cast<std::uint8_t>(byte_dist(rng));
+            }
+
+            for (auto& c : cases)
+            {
+                const auto first = packet[0];
+
+                if (i % 16 != 0)
+                {
+                    packet[0] = c.type;
+                }
+
+                ControllerState actual = {};
+                ControllerState expected = {};
+                const bool actual_ok = c.decode(packet.data(), c.size, actual);
+                const bool expected_ok = c.reference(packet.data(), c.size, expected);
+
+                c.mismatches += SameDecode(actual_ok, actual, expected_ok, RestrictToFamily(c.family, expected)) ? 0 : 1;
+                packet[0] = first;
+            }
+        }
+
+        for (const auto& c : cases)
+        {
+            Check(std::string("decoder ") + c.name + " matches the reference", c.decode != nullptr && c.mismatches == 0,
+                to_string(c.mismatches) + " of " + to_string(PACKETS) + " random packets decoded differently");
+        }
+    }
+
+    // the lag on step inputs and the noise left at rest, with the default parameters at the usb
+    // and bluetooth report rates
+    void TestFilter()
+    {
+        using std::int16_t;
+        using std::int32_t;
+        using std::to_string;
+
+        const auto params = MakeOneEuroParams(DEFAULT_STICK_FILTER_CUTOFF, DEFAULT_STICK_FILTER_BETA, DEFAULT_STICK_FILTER_DERIVATIVE_CUTOFF);
+
+        for (const int32_t dt_us : { 8000, 15000 })
+        {
+            const auto rate = " at " + to_string(dt_us / 1000) + "ms";
+
+            // a flick passes straight through, a slow move lags a few reports at most
+            const std::pair<int16_t, int> limits[] = { { 30000, 1 }, { 8000, 2 }, { 1000, 6 } };
+
+            for (const auto& limit : limits)
+            {
+                const int reports = StepResponseReports(params, limit.first, dt_us);
+                Check("one euro step " + to_string(limit.first) + rate, reports <= limit.second,
+                    to_string(reports) + " reports to 90%, at most " + to_string(limit.second) + " allowed");
+            }
+
+            const auto rms = NoiseRms(params, dt_us);
+            Check("one euro resting noise" + rate, rms.second < rms.first / 2,
+                "rms " + to_string(rms.first) + " in, " + to_string(rms.second) + " out");
+        }
+    }
+    // every timer fires exactly once, in the first Advance that reaches its deadline, and
+    // cancelled ones never. deadlines reach into every level of the wheel
+    void TestTimerWheel()
+    {
+        using std::mt19937;
+        using std::to_string;
+        using std::uniform_int_distribution;
+        using std::vector;
+        using std::chrono::microseconds;
+        using std::chrono::steady_clock;
+
+        constexpr std::size_t TIMERS = 5000;
+        constexpr std::int64_t SPAN_US = 20000000;
+
+        const auto start = steady_clock::now();
+        TimerWheel wheel(start);
+        mt19937 rng(3);
+        uniform_int_distribution<std::int64_t> deadline_dist(0, SPAN_US);
+        uniform_int_distribution<std::int64_t> step_dist(1, 3000);
+
+        vector<int> fired(TIMERS, 0);
+        vector<std::uint64_t> ids(TIMERS);
+        steady_clock::time_point now = start;
+        steady_clock::time_point previous = start;
+        std::size_t early = 0;
+        std::size_t late = 0;
+        std::size_t repeats = 0;
+
+        for (std::size_t i = 0; i < TIMERS; i++)
+        {
+            ids[i] = wheel.Schedule(start + microseconds(deadline_dist(rng)), nullptr, [&, i](steady_clock::time_point deadline) {
+                early += now < deadline ? 1 : 0;
+                late += previous >= deadline ? 1 : 0;
+                fired[i]++;
+            });
+        }
+
+        // a turbo style timer that keeps rescheduling itself every 16ms
+        std::function<void(steady_clock::time_point)> repeat = [&](steady_clock::time_point deadline) {
+            repeats++;
+            wheel.Schedule(deadline + microseconds(16000), nullptr, repeat);
+        };
+
+        wheel.Schedule(start + microseconds(16000), nullptr, repeat);
+
+        for (std::size_t i = 0; i < TIMERS; i += 10)
+        {
+            wheel.Cancel(ids[i]);
+        }
+
+        while (now < start + microseconds(SPAN_US + 1000))
+        {
+            previous = now;
+            now += microseconds(step_dist(rng));
+            wheel.Advance(now);
+        }
+
+        std::size_t missing = 0;
+        std::size_t doubled = 0;
+        std::size_t cancelled = 0;
+
+        for (std::size_t i = 0; i < TIMERS; i++)
+        {
+            if (i % 10 == 0)
+            {
+                cancelled += fired[i];
+            }
+            else
+            {
+                missing += fired[i] == 0 ? 1 : 0;
+                doubled += fired[i] > 1 ? 1 : 0;
+            }
+        }
+
+        const auto expected_repeats = static_cast<std::size_t>((now - start) / microseconds(16000));
+
+        Check("timer wheel fires every timer once", missing == 0 && doubled == 0, to_string(missing) + " never fired, " + to_string(doubled) + " fired twice");
+        Check("timer wheel never fires early", early == 0, to_string(early) + " fired before their deadline");
+        Check("timer wheel never fires late", late == 0, to_string(late) + " were due in an earlier Advance");
+        Check("timer wheel cancel", cancelled == 0, to_string(cancelled) + " cancelled timers fired");
+        Check("timer wheel rescheduling from a callback", repeats == expected_repeats, to_string(repeats) + " repeats, " + to_string(expected_repeats) + " expected");
+
+        // a timer with a period under one tick while every Advance jumps several ticks, so it's
+        // rescheduled into the slot that is being processed. it has to catch up within the same
+        // Advance, and nothing due may be left behind for the engine thread to spin on
+        TimerWheel fast_wheel(start);
+        const auto period = microseconds(100);
+        std::size_t fast_fires = 0;
+        std::size_t stuck = 0;
+
+        std::function<void(steady_clock::time_point)> fast = [&](steady_clock::time_point deadline) {
+            fast_fires++;
+            fast_wheel.Schedule(deadline + period, nullptr, fast);
+        };
+
+        fast_wheel.Schedule(start + period, nullptr, fast);
+        now = start;
+
+        for (int i = 0; i < 2000; i++)
+        {
+            now += microseconds(2000 + step_dist(rng) % 1000);
+            fast_wheel.Advance(now);
+            stuck += fast_wheel.NextDeadline() <= now ? 1 : 0;
+        }
+
+        const auto expected_fast = static_cast<std::size_t>((now - start) / period);
+
+        Check("timer wheel catches up on sub-tick rescheduling", fast_fires == expected_fast && stuck == 0,
+            to_string(fast_fires) + " fires, " + to_string(expected_fast) + " expected, " + to_string(stuck) + " Advances left a due timer behind");
+    }
+
+    // the engine thread under the same load as the benchmark, held to the sub-millisecond accuracy
+    // the high resolution timer is there for
+    void TestMacroScheduling()
+    {
+        using std::to_string;
+        using std::chrono::seconds;
+
+        MacroEngine engine(IoSchedulingConfig{});
+
+        if (!engine.Valid())
+        {
+            Check("macro scheduling under load", false, "the engine couldn't be started");
+            return;
+        }
+
+        const auto injected = SimulateMacroLoad(engine, seconds(2));
+        const auto p99 = engine.Lateness().Percentile(99.0);
+
+        Check("macro scheduling under load", injected > 0 && p99 < 1000000, to_string(injected) + " states injected, p99 lateness " + to_string(p99 / 1000) + "us");
+    }
+    // every report published over loopback arrives intact and with its motion data
+    void TestDsu()
+    {
+        using std::to_string;
+        using std::vector;
+
+        constexpr std::size_t REPORTS = 200;
+
+        DsuServer server(0);
+        DsuTestClient client(server.Port());
+
+        if (!server.Valid() || !client.Valid())
+        {
+            Check("dsu loopback", false, "couldn't open the sockets");
+            return;
+        }
+
+        vector<ControllerState> states;
+        vector<std::array<ImuSample, IMU_SAMPLES_PER_REPORT>> samples;
+        MakeDsuInputs(states, samples);
+
+        const int slot = server.Attach(false, "");
+
+        if (!SimulateDsuLoopback(server, slot, client, states, samples, REPORTS))
+        {
+            Check("dsu loopback", false, "the client never got subscribed");
+            return;
+        }
+
+        server.Detach(slot);
+
+        Check("dsu loopback delivers every report", client.Packets() == REPORTS && client.Corrupt() == 0,
+            to_string(client.Packets()) + " of " + to_string(REPORTS) + " delivered, " + to_string(client.Corrupt()) + " corrupt");
+        Check("dsu loopback carries motion", client.Motionless() == 0, to_string(client.Motionless()) + " packets without motion");
+    }
+    struct StreamChannelResult
+    {
+        std::vector<ControllerState> received;
+        std::uint64_t recovered;
+        std::uint64_t lost;
+    };
+
+    // the stream encoder and decoder with a seeded lossy channel in between, the same drop and
+    // hold back rules as StreamSender's. burst packets from burst_start are dropped on top of
+    // that, and the last packet always arrives so the final state can be compared
+    StreamChannelResult RunStreamChannel(const std::vector<ControllerState>& states, std::size_t redundancy, double loss, double reorder, std::size_t burst_start, std::size_t burst)
+    {
+        using std::mt19937;
+        using std::uniform_real_distribution;
+
+        StreamChannelResult result;
+        StreamDecoder decoder([&](std::uint8_t, const ControllerState& state) { result.received.push_back(state); });
+        StreamEncoder encoder(0, redundancy);
+
+        mt19937 rng(4);
+        uniform_real_distribution<double> percent(0.0, 100.0);
+        bytes held;
+
+        for (std::size_t i = 0; i < states.size(); i++)
+        {
+            const std::uint8_t* packet;
+            const auto size = encoder.Encode(states[i], packet);
+            const bool last = i + 1 == states.size();
+
+            if (!last && (percent(rng) < loss || (i >= burst_start && i < burst_start + burst)))
+            {
+                continue;
+            }
+
+            if (!last && held.empty() && percent(rng) < reorder)
+            {
+                held.assign(packet, packet + size);
+                continue;
+            }
+
+            decoder.Decode(packet, size);
+
+            if (!held.empty())
+            {
+                decoder.Decode(held.data(), held.size());
+                held.clear();
+            }
+        }
+
+        result.recovered = decoder.Stats().recovered;
+        result.lost = decoder.Stats().lost;
+
+        return result;
+    }
+
+    void TestStream()
+    {
+        using std::to_string;
+        using std::vector;
+
+        const auto packets = MakePackets(PACKET_TYPE_CONTROLLER_DATA, USB_INPUT_REPORT_SIZE, BATCH_SIZE);
+        vector<ControllerState> states(BATCH_SIZE);
+
+        for (std::size_t i = 0; i < BATCH_SIZE; i++)
+        {
+            DecodeUSBReport(packets[i].data(), packets[i].size(), states[i]);
+        }
+
+        // every frame is either applied or counted as lost, the one a reordered packet's partner
+        // never arrives for excepted
+        const auto accounted = [&](const StreamChannelResult& result) {
+            const auto total = result.received.size() + result.lost;
+            return total + 1 >= states.size() && total <= states.size();
+        };
+
+        const auto single = RunStreamChannel(states, 1, 10.0, 10.0, 0, 0);
+        const auto lossy = RunStreamChannel(states, STREAM_DEFAULT_REDUNDANCY, 10.0, 10.0, 0, 0);
+
+        Check("stream applies states in order under loss", InOrder(states, lossy.received) && accounted(lossy),
+            to_string(lossy.received.size()) + " applied and " + to_string(lossy.lost) + " lost of " + to_string(states.size()));
+        // three packets in a row have to go missing to lose a frame, instead of any one
+        Check("stream recovers lost packets from redundancy", lossy.recovered > 0 && lossy.lost * 4 < single.lost,
+            to_string(lossy.recovered) + " recovered and " + to_string(lossy.lost) + " lost, " + to_string(single.lost) + " lost without redundancy");
+
+        // longer than the redundancy, so only the next keyframe gets the receiver going again
+        const auto burst = RunStreamChannel(states, STREAM_DEFAULT_REDUNDANCY, 0.0, 0.0, 500, 8);
+
+        Check("stream heals a burst at the next keyframe", InOrder(states, burst.received) && accounted(burst) && burst.lost > 0 && burst.lost < STREAM_KEYFRAME_INTERVAL,
+            to_string(burst.lost) + " frames lost after a burst of 8 packets");
+        Check("stream ends on the last state sent", !burst.received.empty() && SameStreamState(burst.received.back(), states.back()) &&
+            !lossy.received.empty() && SameStreamState(lossy.received.back(), states.back()), "the final state doesn't match");
+
+        // a sender restarted halfway starts its sequence over, the receiver has to follow it from
+        // its first packet instead of waiting for the old sequence to be passed
+        vector<ControllerState> restarted;
+        StreamDecoder decoder([&](std::uint8_t, const ControllerState& state) { restarted.push_back(state); });
+
+        for (std::size_t half = 0; half < 2; half++)
+        {
+            StreamEncoder encoder(0, STREAM_DEFAULT_REDUNDANCY);
+
+            for (std::size_t i = half * BATCH_SIZE / 2; i < (half + 1) * BATCH_SIZE / 2; i++)
+            {
+                const std::uint8_t* packet;
+                const auto size = encoder.Encode(states[i], packet);
+                decoder.Decode(packet, size);
+            }
+        }
+
+        Check("stream follows a restarted sender", restarted.size() == states.size() && InOrder(states, restarted),
+            to_string(restarted.size()) + " of " + to_string(states.size()) + " applied across the restart");
+    }
+    // a sink that falls behind only counts the reports it subscribes to as dropped, however many
+    // others went through the ring in the meantime
+    void TestFanOut()
+    {
+        using std::atomic;
+        using std::to_string;
+        using std::chrono::milliseconds;
+        using std::this_thread::sleep_for;
+
+        const auto run = [](std::uint8_t flood, std::uint64_t& got, std::uint64_t& drops) {
+            FanOut fanout("self-test", nullptr);
+            atomic<bool> blocked(false);
+            atomic<bool> released(false);
+            atomic<std::uint64_t> consumed(0);
+
+            fanout.AddSink("device", SINK_REPORT_DEVICE, DEVICE_COUNTER_DSU_DROPS, [&](const SinkReport&) {
+                blocked = true;
+
+                while (!released)
+                {
+                    sleep_for(milliseconds(1));
+                }
+
+                consumed++;
+            });
+            fanout.AddSink("raw", SINK_REPORT_RAW, DEVICE_COUNTER_CAPTURE_DROPS, [](const SinkReport&) {});
+
+            SinkReport report = {};
+            report.contents = SINK_REPORT_DEVICE;
+            fanout.Push(report);
+
+            while (!blocked)
+            {
+                sleep_for(milliseconds(1));
+            }
+
+            // laps the blocked sink twice over
+            report.contents = flood;
+
+            for (std::size_t i = 0; i < SINK_RING_SIZE * 2; i++)
+            {
+                fanout.Push(report);
+            }
+
+            report.contents = SINK_REPORT_DEVICE;
+            fanout.Push(report);
+
+            released = true;
+            fanout.Stop();
+
+            got = consumed;
+            drops = fanout.Drops("device");
+        };
+
+        std::uint64_t got;
+        std::uint64_t drops;
+
+        run(SINK_REPORT_RAW, got, drops);
+        Check("fan-out doesn't count other sinks' reports as drops", got == 2 && drops == 0,
+            to_string(got) + " consumed and " + to_string(drops) + " dropped of 2 device reports among " + to_string(SINK_RING_SIZE * 2) + " raw ones");
+
+        run(SINK_REPORT_DEVICE, got, drops);
+        Check("fan-out counts every report a lapped sink missed", got + drops == SINK_RING_SIZE * 2 + 2 && drops > 0,
+            to_string(got) + " consumed and " + to_string(drops) + " dropped of " + to_string(SINK_RING_SIZE * 2 + 2));
+    }
+
+    // a backed off controller still sends every step of a waveform, and holds back idle repeats
+    void TestOutputRate()
+    {
+        using std::to_string;
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        using std::chrono::steady_clock;
+
+        DeviceStats stats;
+        OutputRateControl rate(stats, 0, true);
+        steady_clock::time_point now;
+
+        // half the input reports missing for a second backs it off once
+        for (const auto end = now + milliseconds(1100); now < end; now += milliseconds(15))
+        {
+            rate.RecordInput(1, now);
+        }
+
+        const auto interval = rate.Interval();
+        Check("output rate backs off when reports go missing", interval > steady_clock::duration(OUTPUT_BASE_INTERVAL),
+            "interval " + to_string(duration_cast<milliseconds>(interval).count()) + "ms");
+
+        constexpr int PACKETS = 20;
+        int busy_sent = 0;
+        int idle_sent = 0;
+
+        for (int i = 0; i < PACKETS; i++, now += milliseconds(15))
+        {
+            const std::uint8_t rumble[OUTPUT_RUMBLE_SIZE] = { 0x80, 0x20, 0x62, static_cast<std::uint8_t>(i), 0x80, 0x00, 0x00, 0x00 };
+            busy_sent += rate.ShouldSend(rumble, true, now) ? 1 : 0;
+        }
+
+        for (int i = 0; i < PACKETS; i++, now += milliseconds(15))
+        {
+            const std::uint8_t rumble[OUTPUT_RUMBLE_SIZE] = { 0x80, 0x20, 0x62, 0x20, 0x80, 0x00, 0x00, 0x00 };
+            idle_sent += rate.ShouldSend(rumble, false, now) ? 1 : 0;
+        }
+
+        const auto idle_allowed = static_cast<int>(milliseconds(15) * PACKETS / interval) + 1;
+
+        Check("output rate sends every waveform step while backed off", busy_sent == PACKETS,
+            to_string(busy_sent) + " of " + to_string(PACKETS) + " sent");
+        Check("output rate holds back idle repeats while backed off", idle_sent <= idle_allowed,
+            to_string(idle_sent) + " of " + to_string(PACKETS) + " sent, at most " + to_string(idle_allowed) + " allowed");
+    }
+
+    // the quit event has to cut the read wait short, and the clears at exit have to overlap.
+    // the limits leave room for a loaded machine, the timed out waits take seconds
+    void TestTeardown()
+    {
+        using std::mt19937;
+        using std::to_string;
+
+        constexpr std::size_t PADS = 4;
+
+        mt19937 rng(7);
+        const double exit = MeasureTeardown(PADS, true, true, false, rng);
+        const double removal = MeasureTeardown(PADS, true, false, true, rng);
+
+        // two clear writes 100ms apart, once for all of them
+        Check("teardown at exit clears controllers in parallel", exit < 300.0, to_string(exit) + "ms for " + to_string(PADS) + " controllers");
+        Check("teardown on removal doesn't wait out reads", removal < 50.0, to_string(removal) + "ms for " + to_string(PADS) + " controllers");
+    }
+
+    std::string HexBytes(const std::uint8_t* data, std::size_t size)
+    {
+        using std::hex;
+        using std::setfill;
+        using std::setw;
+        using std::ostringstream;
+
+        ostringstream out;
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            out << (i == 0 ? "" : " ") << hex << setw(2) << setfill('0') << +data[i];
+        }
+
+        return out.str();
+    }
+
+    // the encoder against fixed packets, not just against its own decoder: the bytes the rumble
+    // code always sent and real controllers play
+    void TestWaveform()
+    {
+        using std::equal;
+        using std::to_string;
+        using std::vector;
+
+        struct Vector
+        {
+            const char* name;
+            RumbleSample samples[RUMBLE_SAMPLES_PER_PACKET];
+            std::uint8_t rumble[OUTPUT_RUMBLE_SIZE];
+        };
+
+        const Vector vectors[] = {
+            { "silence", { { 0, 0 }, { 0, 0 }, { 0, 0 } }, { 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00 } },
+            { "plain large", { { 0x80, 0 }, { 0x80, 0 }, { 0x80, 0 } }, { 0x80, 0x20, 0x62, 0x20, 0x80, 0x00, 0x00, 0x00 } },
+            { "plain both", { { 0xFF, 0xFF }, { 0xFF, 0xFF }, { 0xFF, 0xFF } }, { 0x80, 0x20, 0x62, 0x3F, 0x98, 0x20, 0x62, 0x3F } },
+            // a plain frame only holds one step, the loudest of each motor
+            { "the loudest of three steps", { { 0, 255 }, { 128, 128 }, { 255, 0 } }, { 0x80, 0x20, 0x62, 0x3F, 0x98, 0x20, 0x62, 0x3F } },
+        };
+
+        for (const auto& v : vectors)
+        {
+            std::uint8_t rumble[OUTPUT_RUMBLE_SIZE];
+            EncodeRumblePacket(v.samples, RUMBLE_SAMPLES_PER_PACKET, rumble);
+
+            Check(std::string("waveform encodes ") + v.name, equal(rumble, rumble + OUTPUT_RUMBLE_SIZE, v.rumble),
+                HexBytes(rumble, OUTPUT_RUMBLE_SIZE) + ", expected " + HexBytes(v.rumble, OUTPUT_RUMBLE_SIZE));
+        }
+
+        for (const auto& effect : RumbleEffects())
+        {
+            vector<RumblePacket> packets;
+            const int worst = RenderEffectPackets(effect, packets);
+
+            Check(std::string("waveform effect ") + effect.name, worst <= RUMBLE_STEP_TOLERANCE,
+                "packets off by up to " + to_string(worst) + " from the effect's loudest steps, at most " + to_string(RUMBLE_STEP_TOLERANCE) + " allowed");
+        }
+    }
+}
+
+int RunBenchmarks(const std::string& filter)
+{
+    benchmark_filter = filter;
+
+    BenchmarkKernels();
+    BenchmarkFilter();
+    BenchmarkMacros();
+    BenchmarkDsu();
+    BenchmarkStream();
+    BenchmarkSharedState();
+    BenchmarkFanOut();
+    BenchmarkSubcommands();
+    BenchmarkOutputRate();
+    BenchmarkWaveform();
+    BenchmarkTeardown();
+
+    return 0;
+}
+
+int RunSelfTests()
+{
+    using std::cout;
+    using std::endl;
+
+    self_test_failures = 0;
+
+    TestDecoders();
+    TestFilter();
+    TestTimerWheel();
+    TestMacroScheduling();
+    TestDsu();
+    TestStream();
+    TestFanOut();
+    TestOutputRate();
+    TestWaveform();
+    TestTeardown();
+
+    if (self_test_failures != 0)
+    {
+        cout << self_test_failures << " check(s) failed" << endl;
+
+        return 1;
+    }
+
+    cout << "all checks passed" << endl;
+
+    return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+// microbenchmarks for the per-report kernels, only runs the ones whose name contains filter
+int RunBenchmarks(const std::string& filter);
+// checks the behavior the benchmarks only print against fixed limits, returns nonzero when any fails
+int RunSelfTests();
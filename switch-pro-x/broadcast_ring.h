@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "seqlock.h"
+
+// one producer, any number of consumers that each keep their own cursor. the producer never waits:
+// a consumer that falls more than Size entries behind loses the oldest ones and is told how many
+template <typename T, std::size_t Size>
+class BroadcastRing
+{
+    static_assert((Size & (Size - 1)) == 0, "the ring size has to be a power of two");
+
+public:
+    BroadcastRing()
+        : head(0)
+    {
+    }
+
+    // only from one thread at a time
+    void Push(const T& value)
+    {
+        using std::memory_order_relaxed;
+        using std::memory_order_release;
+
+        const auto index = head.load(memory_order_relaxed);
+        entries[index % Size].Store({ index, value });
+        head.store(index + 1, memory_order_release);
+    }
+
+    // the index the next Push gets, a consumer starting here only sees what comes after
+    std::uint64_t Head() const
+    {
+        return head.load(std::memory_order_acquire);
+    }
+
+    // the entry at cursor and true, or false once the consumer has caught up. entries that were
+    // overwritten before the consumer got to them are skipped and added to dropped
+    bool Next(std::uint64_t& cursor, T& value, std::uint64_t& dropped) const
+    {
+        using std::memory_order_acquire;
+
+        for (;;)
+        {
+            const auto end = head.load(memory_order_acquire);
+
+            if (cursor == end)
+            {
+                return false;
+            }
+
+            if (end - cursor > Size)
+            {
+                dropped += end - cursor - Size;
+                cursor = end - Size;
+            }
+
+            Entry entry;
+
+            // a write racing this read can only be the producer lapping the consumer
+            if (entries[cursor % Size].TryLoad(entry) && entry.index == cursor)
+            {
+                value = entry.value;
+                cursor++;
+
+                return true;
+            }
+
+            dropped++;
+            cursor++;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::uint64_t index;
+        T value;
+    };
+
+    std::atomic<std::uint64_t> head;
+    std::array<Seqlock<Entry>, Size> entries;
+};
@@ -0,0 +1,259 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <cstring>
+
+#include "capture.h"
+
+namespace
+{
+    constexpr char CAPTURE_MAGIC[8] = { 'S', 'P', 'X', 'C', 'A', 'P', 'T', 0 };
+    // version 2 added the device family
+    constexpr std::uint32_t CAPTURE_VERSION = 2;
+
+    // flushed from the capture sink once this much has been buffered, off the read thread
+    constexpr std::size_t CAPTURE_FLUSH_SIZE = 64 * 1024;
+
+    constexpr std::size_t AlignRecord(std::size_t size)
+    {
+        return (size + 7) & ~static_cast<std::size_t>(7);
+    }
+}
+
+CaptureWriter::CaptureWriter(const std::string& filename, DeviceFamily family, bool bluetooth, std::uint16_t input_size, std::uint16_t output_size)
+    : file(INVALID_HANDLE_VALUE)
+    , start(std::chrono::steady_clock::now())
+{
+    using std::cerr;
+    using std::endl;
+    using std::copy;
+    using std::begin;
+    using std::end;
+
+    file = CreateFileA(
+        filename.c_str(),
+        GENERIC_WRITE,
+        FILE_SHARE_READ,
+        nullptr,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        cerr << "error creating capture file " << filename << " (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    CaptureFileHeader header = { 0 };
+    copy(begin(CAPTURE_MAGIC), end(CAPTURE_MAGIC), header.magic);
+    header.version = CAPTURE_VERSION;
+    header.flags = bluetooth ? CAPTURE_FLAG_BLUETOOTH : 0;
+    header.input_size = input_size;
+    header.output_size = output_size;
+    header.family = static_cast<std::uint8_t>(family);
+
+    buffer.reserve(CAPTURE_FLUSH_SIZE + sizeof(CaptureRecordHeader) + 0x10000);
+
+    const auto header_bytes = reinterpret_cast<const std::uint8_t*>(&header);
+    buffer.insert(buffer.end(), header_bytes, header_bytes + sizeof(header));
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        Flush();
+        CloseHandle(file);
+    }
+}
+
+bool CaptureWriter::Valid()
+{
+    return file != INVALID_HANDLE_VALUE;
+}
+
+void CaptureWriter::Record(std::uint8_t direction, const std::uint8_t* data, std::size_t size, std::chrono::steady_clock::time_point time)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::min;
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    CaptureRecordHeader record = { 0 };
+    record.timestamp = static_cast<std::uint64_t>(duration_cast<nanoseconds>(time - start).count());
+    record.length = static_cast<std::uint16_t>(min<std::size_t>(size, 0xFFFF));
+    record.direction = direction;
+
+    const auto record_bytes = reinterpret_cast<const std::uint8_t*>(&record);
+    const auto offset = buffer.size();
+
+    buffer.insert(buffer.end(), record_bytes, record_bytes + sizeof(record));
+    buffer.insert(buffer.end(), data, data + record.length);
+    buffer.resize(offset + AlignRecord(sizeof(record) + record.length));
+
+    if (buffer.size() >= CAPTURE_FLUSH_SIZE)
+    {
+        Flush();
+    }
+}
+
+void CaptureWriter::Flush()
+{
+    using std::cerr;
+    using std::endl;
+
+    if (buffer.empty())
+    {
+        return;
+    }
+
+    DWORD written;
+
+    if (!WriteFile(file, buffer.data(), static_cast<DWORD>(buffer.size()), &written, nullptr))
+    {
+        cerr << "Capture write failed (" << GetLastError() << ")" << endl;
+    }
+
+    buffer.clear();
+}
+
+CaptureReader::CaptureReader(const std::string& filename)
+    : file(INVALID_HANDLE_VALUE)
+    , mapping(nullptr)
+    , view(nullptr)
+    , size(0)
+    , offset(sizeof(CaptureFileHeader))
+{
+    using std::cerr;
+    using std::endl;
+    using std::memcmp;
+
+    file = CreateFileA(
+        filename.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        cerr << "error opening capture file " << filename << " (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    LARGE_INTEGER file_size;
+
+    if (!GetFileSizeEx(file, &file_size) || static_cast<ULONGLONG>(file_size.QuadPart) < sizeof(CaptureFileHeader))
+    {
+        cerr << filename << " is not a capture file" << endl;
+        return;
+    }
+
+    mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mapping == nullptr)
+    {
+        cerr << "error mapping capture file " << filename << " (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    view = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (view == nullptr)
+    {
+        cerr << "error mapping capture file " << filename << " (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    size = static_cast<std::size_t>(file_size.QuadPart);
+
+    const auto header = reinterpret_cast<const CaptureFileHeader*>(view);
+
+    const bool known_version = header->version == 1 || (header->version == CAPTURE_VERSION && header->family < DEVICE_FAMILY_COUNT);
+
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || !known_version)
+    {
+        cerr << filename << " is not a supported capture file" << endl;
+
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+}
+
+CaptureReader::~CaptureReader()
+{
+    if (view != nullptr)
+    {
+        UnmapViewOfFile(view);
+    }
+
+    if (mapping != nullptr)
+    {
+        CloseHandle(mapping);
+    }
+
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file);
+    }
+}
+
+bool CaptureReader::Valid()
+{
+    return view != nullptr;
+}
+
+bool CaptureReader::Bluetooth()
+{
+    return !!(reinterpret_cast<const CaptureFileHeader*>(view)->flags & CAPTURE_FLAG_BLUETOOTH);
+}
+
+DeviceFamily CaptureReader::Family()
+{
+    const auto header = reinterpret_cast<const CaptureFileHeader*>(view);
+
+    return header->version == 1 ? DEVICE_FAMILY_PRO_CONTROLLER : static_cast<DeviceFamily>(header->family);
+}
+
+bool CaptureReader::Next(Record& record)
+{
+    using std::chrono::nanoseconds;
+
+    if (offset + sizeof(CaptureRecordHeader) > size)
+    {
+        return false;
+    }
+
+    const auto header = reinterpret_cast<const CaptureRecordHeader*>(view + offset);
+
+    // a capture that was cut off mid-record just ends early
+    if (offset + sizeof(CaptureRecordHeader) + header->length > size)
+    {
+        return false;
+    }
+
+    record.timestamp = nanoseconds(header->timestamp);
+    record.direction = header->direction;
+    record.data = view + offset + sizeof(CaptureRecordHeader);
+    record.size = header->length;
+
+    offset += AlignRecord(sizeof(CaptureRecordHeader) + header->length);
+
+    return true;
+}
+
+void CaptureReader::Rewind()
+{
+    offset = sizeof(CaptureFileHeader);
+}
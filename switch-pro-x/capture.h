@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "family.h"
+
+// capture files are a fixed header followed by records appended in arrival order,
+// every record starts on an 8 byte boundary so the file can be mapped and walked in place
+#pragma pack(push, 1)
+struct CaptureFileHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+    std::uint16_t input_size;
+    std::uint16_t output_size;
+    // a DeviceFamily, version 1 files are all pro controllers
+    std::uint8_t family;
+    std::uint8_t reserved[11];
+};
+
+struct CaptureRecordHeader
+{
+    // nanoseconds since the capture was started, from steady_clock
+    std::uint64_t timestamp;
+    std::uint16_t length;
+    std::uint8_t direction;
+    std::uint8_t reserved[5];
+};
+#pragma pack(pop)
+
+enum : std::uint8_t
+{
+    CAPTURE_DIRECTION_INPUT = 0,
+    CAPTURE_DIRECTION_OUTPUT = 1,
+};
+
+enum : std::uint32_t
+{
+    CAPTURE_FLAG_BLUETOOTH = 0x00000001,
+};
+
+// not thread safe, only the device's capture sink records
+class CaptureWriter
+{
+public:
+    CaptureWriter(const std::string& filename, DeviceFamily family, bool bluetooth, std::uint16_t input_size, std::uint16_t output_size);
+    ~CaptureWriter();
+
+    bool Valid();
+    // time is when the report was read or written, the sink gets to it a little later
+    void Record(std::uint8_t direction, const std::uint8_t* data, std::size_t size, std::chrono::steady_clock::time_point time);
+
+private:
+    void Flush();
+
+    HANDLE file;
+    std::chrono::steady_clock::time_point start;
+    std::vector<std::uint8_t> buffer;
+};
+
+class CaptureReader
+{
+public:
+    struct Record
+    {
+        std::chrono::nanoseconds timestamp;
+        std::uint8_t direction;
+        const std::uint8_t* data;
+        std::size_t size;
+    };
+
+    CaptureReader(const std::string& filename);
+    ~CaptureReader();
+
+    bool Valid();
+    bool Bluetooth();
+    DeviceFamily Family();
+    bool Next(Record& record);
+    void Rewind();
+
+private:
+    HANDLE file;
+    HANDLE mapping;
+    const std::uint8_t* view;
+    std::size_t size;
+    std::size_t offset;
+};
@@ -0,0 +1,208 @@
+#include <algorithm>
+
+#include <cmath>
+
+#include "clock_sync.h"
+#include "protocol.h"
+
+namespace
+{
+    constexpr std::chrono::seconds SYNC_WINDOW(1);
+    // drift is fitted over this many windows
+    constexpr std::size_t SYNC_WINDOWS = 30;
+    // real crystals are within a few hundred ppm, anything past this means the timer restarted
+    constexpr double MAX_DRIFT = 1000e-6;
+
+    constexpr auto TIMER_PERIOD = CONTROLLER_TIMER_TICK * 256;
+
+    double Nanoseconds(std::chrono::steady_clock::duration value)
+    {
+        using std::chrono::duration;
+        using std::nano;
+
+        return duration<double, nano>(value).count();
+    }
+}
+
+std::uint64_t UnwrapTimer(std::uint8_t previous, std::uint8_t timer, std::chrono::steady_clock::duration host_interval)
+{
+    const std::uint8_t ticks = timer - previous;
+    const std::chrono::steady_clock::duration controller_interval = CONTROLLER_TIMER_TICK * ticks;
+    std::uint64_t wraps = 0;
+
+    if (host_interval > controller_interval + TIMER_PERIOD / 2)
+    {
+        wraps = static_cast<std::uint64_t>((host_interval - controller_interval + TIMER_PERIOD / 2) / TIMER_PERIOD);
+    }
+
+    return ticks + wraps * 256;
+}
+
+ClockSync::ClockSync()
+{
+    Reset();
+}
+
+void ClockSync::Reset()
+{
+    started = false;
+    last_timer = 0;
+    ticks = 0;
+    window_valid = false;
+    window_min = { 0.0, 0.0 };
+    windows.clear();
+    offset = 0.0;
+    drift = 0.0;
+    error_bound = 0.0;
+    Publish();
+}
+
+std::chrono::steady_clock::time_point ClockSync::Update(std::chrono::steady_clock::time_point received, std::uint8_t timer)
+{
+    using std::min;
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::chrono::steady_clock;
+    using std::llround;
+
+    if (!started)
+    {
+        started = true;
+        epoch = received;
+        window_start = received;
+    }
+    else
+    {
+        ticks += UnwrapTimer(last_timer, timer, received - last_received);
+    }
+
+    last_timer = timer;
+    last_received = received;
+
+    const double controller = Nanoseconds(CONTROLLER_TIMER_TICK * ticks);
+    const double sample_offset = Nanoseconds(received - epoch) - controller;
+
+    if (!window_valid || sample_offset < window_min.offset)
+    {
+        window_min = { controller, sample_offset };
+        window_valid = true;
+    }
+
+    if (received - window_start >= SYNC_WINDOW)
+    {
+        windows.push_back(window_min);
+
+        if (windows.size() > SYNC_WINDOWS)
+        {
+            windows.pop_front();
+        }
+
+        window_start = received;
+        window_valid = false;
+
+        Fit();
+    }
+
+    // until the first window is done the best we have is the lowest offset seen so far
+    const double mapped = windows.empty() ? controller + window_min.offset : controller + offset + drift * controller;
+    const auto capture = epoch + duration_cast<steady_clock::duration>(nanoseconds(llround(mapped)));
+
+    // the report can't have been produced after it arrived
+    return min(capture, received);
+}
+
+void ClockSync::Fit()
+{
+    using std::abs;
+    using std::max;
+    using std::min;
+
+    const auto n = static_cast<double>(windows.size());
+
+    if (windows.size() < 2)
+    {
+        offset = windows.back().offset;
+        drift = 0.0;
+        error_bound = 0.0;
+        Publish();
+
+        return;
+    }
+
+    double mean_x = 0.0;
+    double mean_y = 0.0;
+
+    for (const auto& window : windows)
+    {
+        mean_x += window.controller / n;
+        mean_y += window.offset / n;
+    }
+
+    double sxx = 0.0;
+    double sxy = 0.0;
+
+    for (const auto& window : windows)
+    {
+        sxx += (window.controller - mean_x) * (window.controller - mean_x);
+        sxy += (window.controller - mean_x) * (window.offset - mean_y);
+    }
+
+    const double slope = sxx > 0.0 ? sxy / sxx : 0.0;
+
+    if (abs(slope) > MAX_DRIFT)
+    {
+        // keep only the newest window and start fitting again
+        const auto last = windows.back();
+        windows.clear();
+        windows.push_back(last);
+
+        offset = last.offset;
+        drift = 0.0;
+        error_bound = 0.0;
+        Publish();
+
+        return;
+    }
+
+    drift = slope;
+    offset = mean_y - slope * mean_x;
+
+    // shift the line down onto the lowest minimum so it stays a lower envelope
+    double lowest = 0.0;
+    double highest = 0.0;
+
+    for (const auto& window : windows)
+    {
+        const auto residual = window.offset - (offset + drift * window.controller);
+        lowest = min(lowest, residual);
+        highest = max(highest, residual);
+    }
+
+    offset += lowest;
+    error_bound = highest - lowest;
+    Publish();
+}
+
+void ClockSync::Publish()
+{
+    using std::memory_order_relaxed;
+
+    published_synced.store(windows.size() >= 2, memory_order_relaxed);
+    published_drift.store(drift, memory_order_relaxed);
+    published_error_bound.store(error_bound, memory_order_relaxed);
+}
+
+bool ClockSync::Synced() const
+{
+    return published_synced.load(std::memory_order_relaxed);
+}
+
+double ClockSync::Drift() const
+{
+    return published_drift.load(std::memory_order_relaxed) * 1e6;
+}
+
+std::chrono::nanoseconds ClockSync::ErrorBound() const
+{
+    return std::chrono::nanoseconds(static_cast<long long>(published_error_bound.load(std::memory_order_relaxed)));
+}
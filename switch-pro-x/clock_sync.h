@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+
+#include <cstdint>
+
+// ticks the timer byte advanced from previous to timer, the byte wraps every 1.28s so
+// the host interval is used to work out how many wraps happened in a long gap
+std::uint64_t UnwrapTimer(std::uint8_t previous, std::uint8_t timer, std::chrono::steady_clock::duration host_interval);
+
+// maps the controller's timer onto steady_clock, Update is only called from the read thread. every report gives host - controller time,
+// which is the transport delay plus timer rounding; the minimum of each window is the
+// lower envelope of that, and a line fitted through the window minimums gives offset and drift.
+// the constant part of the transport delay can't be seen from one direction, so mapped times are
+// when the report would have arrived over an otherwise idle link.
+class ClockSync
+{
+public:
+    ClockSync();
+
+    // returns the estimated host time at which the controller produced the report
+    std::chrono::steady_clock::time_point Update(std::chrono::steady_clock::time_point received, std::uint8_t timer);
+
+    bool Synced() const;
+    // in parts per million, positive when the controller's clock runs slow
+    double Drift() const;
+    // largest distance of a window minimum from the fitted line
+    std::chrono::nanoseconds ErrorBound() const;
+
+private:
+    struct Window
+    {
+        double controller;
+        double offset;
+    };
+
+    void Fit();
+    void Reset();
+    void Publish();
+
+    bool started;
+    std::uint8_t last_timer;
+    std::uint64_t ticks;
+    std::chrono::steady_clock::time_point epoch;
+    std::chrono::steady_clock::time_point last_received;
+
+    std::chrono::steady_clock::time_point window_start;
+    bool window_valid;
+    Window window_min;
+    std::deque<Window> windows;
+
+    // host = epoch + controller + offset + drift * controller, all in nanoseconds
+    double offset;
+    double drift;
+    double error_bound;
+
+    // copies for other threads
+    std::atomic<bool> published_synced;
+    std::atomic<double> published_drift;
+    std::atomic<double> published_error_bound;
+};
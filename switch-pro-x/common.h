@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <string>
+#include <thread>
 #include <iostream>
 #include <algorithm>
 
@@ -20,11 +21,13 @@ namespace
 #ifdef UNICODE
     using tstring = std::wstring;
     constexpr auto& ttolower = std::towlower;
+    template <typename T> tstring to_tstring(T val) { return std::to_wstring(val); }
     auto& tcout = std::wcout;
     auto& tcerr = std::wcerr;
 #else
     using tstring = std::string;
     constexpr auto& ttolower = std::tolower;
+    template <typename T> tstring to_tstring(T val) { return std::to_string(val); }
     auto& tcout = std::cout;
     auto& tcerr = std::cerr;
 #endif
@@ -61,6 +64,24 @@ namespace
         }
     }
 
+    inline std::string to_utf8(const std::wstring& str)
+    {
+        const auto length = static_cast<int>(str.size());
+        const auto size = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), length, nullptr, 0, nullptr, nullptr);
+        std::string ret(size, '\0');
+
+        WideCharToMultiByte(CP_UTF8, 0, str.c_str(), length, &ret[0], size, nullptr, nullptr);
+
+        return ret;
+    }
+
+#ifndef UNICODE
+    inline std::string to_utf8(const std::string& str)
+    {
+        return str;
+    }
+#endif
+
     inline bool operator==(const XUSB_REPORT& lhs, const XUSB_REPORT& rhs)
     {
         return
@@ -97,8 +118,13 @@ namespace
         void lock()
         {
             using std::memory_order_acquire;
+            using std::this_thread::yield;
 
-            while (lck.test_and_set(memory_order_acquire));
+            // give the holder the cpu instead of spinning, it may have a lower priority on the same core
+            while (lck.test_and_set(memory_order_acquire))
+            {
+                yield();
+            }
         }
 
         void unlock()
@@ -0,0 +1,484 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <cstring>
+
+#include "common.h"
+#include "control.h"
+#include "options.h"
+#include "profile.h"
+#include "ProControllerDevice.h"
+#include "switch-pro-x.h"
+#include "trace.h"
+#include "waveform.h"
+
+namespace
+{
+    template <typename T>
+    void Append(std::vector<std::uint8_t>& buf, const T& value)
+    {
+        const auto value_bytes = reinterpret_cast<const std::uint8_t*>(&value);
+        buf.insert(buf.end(), value_bytes, value_bytes + sizeof(value));
+    }
+}
+
+ControlServer::ControlServer()
+    : pipe(INVALID_HANDLE_VALUE)
+    , quit_event(nullptr)
+    , quitting(false)
+    , shutdown_requested(false)
+{
+    using std::cerr;
+    using std::endl;
+    using std::thread;
+
+    pipe = CreateNamedPipe(
+        CONTROL_PIPE_NAME,
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1,
+        CONTROL_MAX_MESSAGE,
+        CONTROL_MAX_MESSAGE,
+        0,
+        nullptr);
+
+    if (pipe == INVALID_HANDLE_VALUE)
+    {
+        cerr << "error creating control pipe (" << GetLastError() << ")" << endl;
+
+        return;
+    }
+
+    quit_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    server_thread = thread(&ControlServer::ServerThread, this);
+}
+
+ControlServer::~ControlServer()
+{
+    quitting = true;
+
+    if (quit_event != nullptr)
+    {
+        SetEvent(quit_event);
+    }
+
+    if (server_thread.joinable())
+    {
+        server_thread.join();
+    }
+
+    if (pipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(pipe);
+    }
+
+    if (quit_event != nullptr)
+    {
+        CloseHandle(quit_event);
+    }
+}
+
+bool ControlServer::Valid()
+{
+    return pipe != INVALID_HANDLE_VALUE;
+}
+
+void ControlServer::ServerThread()
+{
+    OVERLAPPED ol = { 0 };
+    ol.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    bytes request(CONTROL_MAX_MESSAGE);
+
+    while (!quitting && Connect(ol))
+    {
+        // a client can keep the pipe open and poll as often as it likes
+        while (!quitting)
+        {
+            DWORD transferred = 0;
+
+            request.resize(CONTROL_MAX_MESSAGE);
+
+            if (!Complete(ReadFile(pipe, request.data(), static_cast<DWORD>(request.size()), nullptr, &ol), ol, transferred))
+            {
+                break;
+            }
+
+            request.resize(transferred);
+            const auto response = HandleRequest(request);
+
+            if (!Complete(WriteFile(pipe, response.data(), static_cast<DWORD>(response.size()), nullptr, &ol), ol, transferred))
+            {
+                break;
+            }
+
+            if (shutdown_requested)
+            {
+                RequestShutdown();
+            }
+        }
+
+        DisconnectNamedPipe(pipe);
+    }
+
+    CloseHandle(ol.hEvent);
+}
+
+bool ControlServer::Connect(OVERLAPPED& ol)
+{
+    using std::cerr;
+    using std::endl;
+
+    if (ConnectNamedPipe(pipe, &ol))
+    {
+        return true;
+    }
+
+    auto err = GetLastError();
+
+    if (err == ERROR_PIPE_CONNECTED)
+    {
+        return true;
+    }
+
+    if (err != ERROR_IO_PENDING)
+    {
+        cerr << "Control connect failed (" << err << ")" << endl;
+        return false;
+    }
+
+    DWORD tmp;
+
+    return Complete(FALSE, ol, tmp);
+}
+
+bool ControlServer::Complete(BOOL started, OVERLAPPED& ol, DWORD& transferred)
+{
+    if (!started && GetLastError() != ERROR_IO_PENDING)
+    {
+        return false;
+    }
+
+    HANDLE handles[2] = { ol.hEvent, quit_event };
+    auto waitObject = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+
+    if (waitObject != WAIT_OBJECT_0)
+    {
+        CancelIo(pipe);
+        GetOverlappedResult(pipe, &ol, &transferred, TRUE);
+
+        return false;
+    }
+
+    return !!GetOverlappedResult(pipe, &ol, &transferred, FALSE);
+}
+
+ControlServer::bytes ControlServer::HandleRequest(const bytes& request)
+{
+    using std::memcpy;
+
+    ControlResponseHeader header = { 0 };
+    bytes response(sizeof(header));
+
+    if (request.size() < sizeof(ControlRequest))
+    {
+        header.status = CONTROL_STATUS_BAD_REQUEST;
+    }
+    else
+    {
+        header.opcode = reinterpret_cast<const ControlRequest*>(request.data())->opcode;
+
+        switch (header.opcode)
+        {
+        case CONTROL_OP_STATS:
+        {
+            header.count = AppendStats(response);
+            break;
+        }
+        case CONTROL_OP_LINK:
+        {
+            header.count = AppendLink(response);
+            break;
+        }
+        case CONTROL_OP_DEVICES:
+        {
+            header.count = AppendDevices(response);
+            break;
+        }
+        case CONTROL_OP_STATE:
+        {
+            header.count = AppendState(response);
+            break;
+        }
+        case CONTROL_OP_PROFILE:
+        {
+            header.status = LoadProfile(request);
+            break;
+        }
+        case CONTROL_OP_RUMBLE:
+        {
+            header.status = TestRumble(request);
+            break;
+        }
+        case CONTROL_OP_RUMBLE_EFFECT:
+        {
+            header.status = PlayRumbleEffect(request);
+            break;
+        }
+        case CONTROL_OP_SHUTDOWN:
+        {
+            // only once the answer is out, shutting down stops this thread
+            shutdown_requested = true;
+            break;
+        }
+        case CONTROL_OP_TRACE_START:
+        case CONTROL_OP_TRACE_STOP:
+        {
+            TraceEnable(header.opcode == CONTROL_OP_TRACE_START);
+            break;
+        }
+        case CONTROL_OP_TRACE_DUMP:
+        {
+            header.status = TraceDump(GetOptions().trace_file) ? CONTROL_STATUS_OK : CONTROL_STATUS_FAILED;
+            break;
+        }
+        default:
+        {
+            header.status = CONTROL_STATUS_UNKNOWN_OP;
+            break;
+        }
+        }
+    }
+
+    memcpy(response.data(), &header, sizeof(header));
+
+    return response;
+}
+
+std::uint16_t ControlServer::AppendStats(bytes& response)
+{
+    using std::min;
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+
+    std::uint16_t count = 0;
+
+    VisitControllers([&](const ProControllerDevice& device) {
+        const auto path = to_utf8(device.Path);
+        const auto path_length = min<std::size_t>(path.size(), 0xFFFF);
+
+        if (response.size() + sizeof(ControlDeviceStats) + path_length > CONTROL_MAX_MESSAGE)
+        {
+            return;
+        }
+
+        const auto& stats = device.Stats();
+
+        ControlDeviceStats record = { 0 };
+        record.id = device.Id;
+        record.bluetooth = device.IsBluetooth() ? 1 : 0;
+        record.power = device.Battery().Status();
+        record.path_length = static_cast<std::uint16_t>(path_length);
+        record.uptime = static_cast<std::uint64_t>(duration_cast<nanoseconds>(stats.Uptime()).count());
+
+        for (int i = 0; i < DEVICE_COUNTER_COUNT; i++)
+        {
+            record.counters[i] = stats.Get(static_cast<DeviceCounter>(i));
+        }
+
+        Append(response, record);
+        response.insert(response.end(), path.begin(), path.begin() + path_length);
+        count++;
+    });
+
+    return count;
+}
+
+std::uint16_t ControlServer::AppendLink(bytes& response)
+{
+    using std::min;
+
+    std::uint16_t count = 0;
+
+    VisitControllers([&](const ProControllerDevice& device) {
+        if (response.size() + sizeof(ControlLinkStats) > CONTROL_MAX_MESSAGE)
+        {
+            return;
+        }
+
+        const auto summary = device.Link().Summary();
+        const auto& clock = device.Clock();
+
+        ControlLinkStats record = { 0 };
+        record.id = device.Id;
+        record.bluetooth = device.IsBluetooth() ? 1 : 0;
+        record.timed = summary.timed ? 1 : 0;
+        record.degraded = summary.degraded ? 1 : 0;
+        record.rate = static_cast<std::uint32_t>(summary.rate * 1000.0);
+        record.nominal_rate = static_cast<std::uint32_t>(summary.nominal_rate * 1000.0);
+        record.synced = clock.Synced() ? 1 : 0;
+        record.drift = static_cast<std::int32_t>(clock.Drift() * 1000.0);
+        record.clock_error = static_cast<std::uint32_t>(min<long long>(clock.ErrorBound().count(), 0xFFFFFFFF));
+        record.dropped = summary.dropped;
+        record.duplicated = summary.duplicated;
+        record.interval_p50 = summary.interval_p50;
+        record.interval_p99 = summary.interval_p99;
+        record.interval_max = summary.interval_max;
+        record.jitter_p50 = summary.jitter_p50;
+        record.jitter_p99 = summary.jitter_p99;
+        record.jitter_max = summary.jitter_max;
+
+        Append(response, record);
+        count++;
+    });
+
+    return count;
+}
+
+std::uint16_t ControlServer::AppendDevices(bytes& response)
+{
+    using std::min;
+
+    std::uint16_t count = 0;
+
+    VisitControllers([&](const ProControllerDevice& device) {
+        const auto path = to_utf8(device.Path);
+        const auto& serial = device.Serial();
+        const auto path_length = min<std::size_t>(path.size(), 0xFFFF);
+        const auto serial_length = min<std::size_t>(serial.size(), 0xFFFF);
+
+        if (response.size() + sizeof(ControlDeviceInfo) + serial_length + path_length > CONTROL_MAX_MESSAGE)
+        {
+            return;
+        }
+
+        ControlDeviceInfo record = { 0 };
+        record.id = device.Id;
+        record.family = static_cast<std::uint8_t>(device.Family());
+        record.bluetooth = device.IsBluetooth() ? 1 : 0;
+        record.power = device.Battery().Status();
+        record.paired = device.IsPaired() ? 1 : 0;
+        record.serial_length = static_cast<std::uint16_t>(serial_length);
+        record.path_length = static_cast<std::uint16_t>(path_length);
+
+        Append(response, record);
+        response.insert(response.end(), serial.begin(), serial.begin() + serial_length);
+        response.insert(response.end(), path.begin(), path.begin() + path_length);
+        count++;
+    });
+
+    return count;
+}
+
+std::uint16_t ControlServer::AppendState(bytes& response)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::chrono::steady_clock;
+
+    std::uint16_t count = 0;
+    const auto now = steady_clock::now();
+
+    VisitControllers([&](const ProControllerDevice& device) {
+        if (response.size() + sizeof(ControlDeviceState) > CONTROL_MAX_MESSAGE)
+        {
+            return;
+        }
+
+        // a copy out of the device's seqlock, the read thread never waits for it
+        const auto submitted = device.LastSubmitted();
+
+        ControlDeviceState record = { 0 };
+        record.id = device.Id;
+        record.buttons = submitted.report.wButtons;
+        record.left_trigger = submitted.report.bLeftTrigger;
+        record.right_trigger = submitted.report.bRightTrigger;
+        record.lx = submitted.report.sThumbLX;
+        record.ly = submitted.report.sThumbLY;
+        record.rx = submitted.report.sThumbRX;
+        record.ry = submitted.report.sThumbRY;
+
+        if (submitted.time != steady_clock::time_point())
+        {
+            record.age = static_cast<std::uint64_t>(duration_cast<nanoseconds>(now - submitted.time).count());
+        }
+
+        Append(response, record);
+        count++;
+    });
+
+    return count;
+}
+
+std::uint8_t ControlServer::LoadProfile(const bytes& request)
+{
+    using std::string;
+
+    const string file(request.begin() + sizeof(ControlRequest), request.end());
+
+    if (file.empty())
+    {
+        return CONTROL_STATUS_BAD_REQUEST;
+    }
+
+    // the new set is published atomically, controllers pick it up on their next report
+    return LoadProfiles(file) ? CONTROL_STATUS_OK : CONTROL_STATUS_FAILED;
+}
+
+std::uint8_t ControlServer::TestRumble(const bytes& request)
+{
+    using std::memcpy;
+    using std::chrono::milliseconds;
+
+    ControlRumbleRequest rumble;
+
+    if (request.size() != sizeof(ControlRequest) + sizeof(rumble))
+    {
+        return CONTROL_STATUS_BAD_REQUEST;
+    }
+
+    memcpy(&rumble, request.data() + sizeof(ControlRequest), sizeof(rumble));
+
+    const bool found = VisitController(rumble.id, [&](ProControllerDevice& device) {
+        device.TestRumble(rumble.large_motor, rumble.small_motor, milliseconds(rumble.duration_ms));
+    });
+
+    return found ? CONTROL_STATUS_OK : CONTROL_STATUS_BAD_REQUEST;
+}
+
+std::uint8_t ControlServer::PlayRumbleEffect(const bytes& request)
+{
+    using std::memcpy;
+
+    ControlRumbleEffectRequest effect;
+
+    if (request.size() != sizeof(ControlRequest) + sizeof(effect))
+    {
+        return CONTROL_STATUS_BAD_REQUEST;
+    }
+
+    memcpy(&effect, request.data() + sizeof(ControlRequest), sizeof(effect));
+
+    if (effect.effect >= RumbleEffects().size())
+    {
+        return CONTROL_STATUS_BAD_REQUEST;
+    }
+
+    bool played = false;
+
+    const bool found = VisitController(effect.id, [&](ProControllerDevice& device) {
+        played = device.PlayRumbleEffect(effect.effect);
+    });
+
+    if (!found)
+    {
+        return CONTROL_STATUS_BAD_REQUEST;
+    }
+
+    return played ? CONTROL_STATUS_OK : CONTROL_STATUS_FAILED;
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "stats.h"
+
+// local control endpoint, every request and response is a single pipe message so the
+// framing comes for free. a response starts with ControlResponseHeader followed by count records.
+#define CONTROL_PIPE_NAME TEXT("\\\\.\\pipe\\switch-pro-x")
+
+enum : std::uint8_t
+{
+    // one ControlDeviceStats per connected controller
+    CONTROL_OP_STATS = 0x01,
+    // no records, the tracer state changes or the trace file is written
+    CONTROL_OP_TRACE_START = 0x02,
+    CONTROL_OP_TRACE_STOP = 0x03,
+    CONTROL_OP_TRACE_DUMP = 0x04,
+    // one ControlLinkStats per connected controller
+    CONTROL_OP_LINK = 0x05,
+    // one ControlDeviceInfo per connected controller
+    CONTROL_OP_DEVICES = 0x06,
+    // one ControlDeviceState per connected controller
+    CONTROL_OP_STATE = 0x07,
+    // the request is followed by the UTF-8 path of a profile file to load, no records
+    CONTROL_OP_PROFILE = 0x08,
+    // the request is followed by a ControlRumbleRequest, no records
+    CONTROL_OP_RUMBLE = 0x09,
+    // no records, the daemon exits after answering
+    CONTROL_OP_SHUTDOWN = 0x0A,
+    // the request is followed by a ControlRumbleEffectRequest, no records
+    CONTROL_OP_RUMBLE_EFFECT = 0x0B,
+};
+
+enum : std::uint8_t
+{
+    CONTROL_STATUS_OK = 0,
+    CONTROL_STATUS_UNKNOWN_OP = 1,
+    CONTROL_STATUS_BAD_REQUEST = 2,
+    CONTROL_STATUS_FAILED = 3,
+};
+
+constexpr std::size_t CONTROL_MAX_MESSAGE = 64 * 1024;
+
+#pragma pack(push, 1)
+struct ControlRequest
+{
+    std::uint8_t opcode;
+    std::uint8_t reserved[3];
+};
+
+struct ControlResponseHeader
+{
+    std::uint8_t opcode;
+    std::uint8_t status;
+    std::uint16_t count;
+};
+
+// followed by path_length bytes of UTF-8 device path
+struct ControlDeviceStats
+{
+    std::uint32_t id;
+    std::uint8_t bluetooth;
+    // status byte of the last full report, POWER_STATUS_UNKNOWN before the first one
+    std::uint8_t power;
+    std::uint16_t path_length;
+    std::uint64_t uptime;
+    std::uint64_t counters[DEVICE_COUNTER_COUNT];
+};
+
+// followed by serial_length bytes of serial and path_length bytes of device path, both UTF-8
+struct ControlDeviceInfo
+{
+    std::uint32_t id;
+    // DeviceFamily
+    std::uint8_t family;
+    std::uint8_t bluetooth;
+    std::uint8_t power;
+    // a joy-con sharing its virtual controller with its partner
+    std::uint8_t paired;
+    std::uint16_t serial_length;
+    std::uint16_t path_length;
+};
+
+// the last report submitted to the virtual controller
+struct ControlDeviceState
+{
+    std::uint32_t id;
+    // XUSB_BUTTON bits
+    std::uint16_t buttons;
+    std::uint8_t left_trigger;
+    std::uint8_t right_trigger;
+    std::int16_t lx;
+    std::int16_t ly;
+    std::int16_t rx;
+    std::int16_t ry;
+    // nanoseconds since it was submitted, 0 if nothing was yet
+    std::uint64_t age;
+};
+
+// motor strengths like the XUSB callback gets them, turned off again after duration
+struct ControlRumbleRequest
+{
+    std::uint32_t id;
+    std::uint8_t large_motor;
+    std::uint8_t small_motor;
+    std::uint16_t duration_ms;
+};
+
+// one of RumbleEffects, played on a controller running with --waveform-rumble
+struct ControlRumbleEffectRequest
+{
+    std::uint32_t id;
+    std::uint8_t effect;
+    std::uint8_t reserved[3];
+};
+
+// durations in nanoseconds, rates in millihertz, all over the last complete analysis window
+struct ControlLinkStats
+{
+    std::uint32_t id;
+    std::uint8_t bluetooth;
+    std::uint8_t timed;
+    std::uint8_t degraded;
+    std::uint8_t synced;
+    std::uint32_t rate;
+    std::uint32_t nominal_rate;
+    // controller clock drift in parts per billion and the error bound of the fit
+    std::int32_t drift;
+    std::uint32_t clock_error;
+    std::uint64_t dropped;
+    std::uint64_t duplicated;
+    std::uint64_t interval_p50;
+    std::uint64_t interval_p99;
+    std::uint64_t interval_max;
+    std::uint64_t jitter_p50;
+    std::uint64_t jitter_p99;
+    std::uint64_t jitter_max;
+};
+#pragma pack(pop)
+
+// serves one client at a time from its own thread, it only ever reads device counters
+// so the read threads are never blocked by a query
+class ControlServer
+{
+public:
+    ControlServer();
+    ~ControlServer();
+
+    bool Valid();
+
+private:
+    using bytes = std::vector<std::uint8_t>;
+
+    void ServerThread();
+    bool Connect(OVERLAPPED& ol);
+    bool Complete(BOOL started, OVERLAPPED& ol, DWORD& transferred);
+    bytes HandleRequest(const bytes& request);
+    std::uint16_t AppendStats(bytes& response);
+    std::uint16_t AppendLink(bytes& response);
+    std::uint16_t AppendDevices(bytes& response);
+    std::uint16_t AppendState(bytes& response);
+    std::uint8_t LoadProfile(const bytes& request);
+    std::uint8_t TestRumble(const bytes& request);
+    std::uint8_t PlayRumbleEffect(const bytes& request);
+
+    HANDLE pipe;
+    HANDLE quit_event;
+    std::thread server_thread;
+    std::atomic<bool> quitting;
+    bool shutdown_requested;
+};
@@ -0,0 +1,469 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <limits>
+
+#include "common.h"
+#include "decode.h"
+#include "protocol.h"
+
+//#define PRO_CONTROLLER_DEBUG_OUTPUT
+
+namespace
+{
+    struct ButtonName
+    {
+        const char* name;
+        std::uint32_t button;
+    };
+
+    const ButtonName BUTTON_NAMES[] = {
+        { "A", CONTROLLER_BUTTON_A },
+        { "B", CONTROLLER_BUTTON_B },
+        { "X", CONTROLLER_BUTTON_X },
+        { "Y", CONTROLLER_BUTTON_Y },
+        { "UP", CONTROLLER_BUTTON_DPAD_UP },
+        { "DOWN", CONTROLLER_BUTTON_DPAD_DOWN },
+        { "LEFT", CONTROLLER_BUTTON_DPAD_LEFT },
+        { "RIGHT", CONTROLLER_BUTTON_DPAD_RIGHT },
+        { "PLUS", CONTROLLER_BUTTON_PLUS },
+        { "MINUS", CONTROLLER_BUTTON_MINUS },
+        { "HOME", CONTROLLER_BUTTON_HOME },
+        { "SHARE", CONTROLLER_BUTTON_SHARE },
+        { "L", CONTROLLER_BUTTON_L },
+        { "ZL", CONTROLLER_BUTTON_ZL },
+        { "LS", CONTROLLER_BUTTON_THUMB_L },
+        { "R", CONTROLLER_BUTTON_R },
+        { "ZR", CONTROLLER_BUTTON_ZR },
+        { "RS", CONTROLLER_BUTTON_THUMB_R },
+    };
+
+    // the 0x30 layout is the same over usb and bluetooth, a joy-con fills in its half of it
+    template <DeviceFamily Family>
+    inline bool DecodeFullReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+    {
+        using std::int8_t;
+        using std::int_fast64_t;
+
+        const auto hid_payload = reinterpret_cast<const ProControllerUSBPacket *>(data);
+
+        if (size < 12 || hid_payload->type != PACKET_TYPE_CONTROLLER_DATA)
+        {
+            return false;
+        }
+
+        const auto& analog = hid_payload->data.controller_data.analog;
+        const auto& buttons = hid_payload->data.controller_data.buttons;
+
+        state.timed = true;
+        state.timer = hid_payload->data.controller_data.timestamp;
+        state.power = data[2];
+
+        state.buttons = 0;
+
+        if constexpr (HasRightHalf(Family))
+        {
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_A) ? CONTROLLER_BUTTON_A : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_B) ? CONTROLLER_BUTTON_B : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_X) ? CONTROLLER_BUTTON_X : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_Y) ? CONTROLLER_BUTTON_Y : 0;
+
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_PLUS) ? CONTROLLER_BUTTON_PLUS : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_HOME) ? CONTROLLER_BUTTON_HOME : 0;
+
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_R) ? CONTROLLER_BUTTON_R : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_ZR) ? CONTROLLER_BUTTON_ZR : 0;
+        }
+
+        if constexpr (HasLeftHalf(Family))
+        {
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_UP) ? CONTROLLER_BUTTON_DPAD_UP : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_DOWN) ? CONTROLLER_BUTTON_DPAD_DOWN : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_LEFT) ? CONTROLLER_BUTTON_DPAD_LEFT : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_DPAD_RIGHT) ? CONTROLLER_BUTTON_DPAD_RIGHT : 0;
+
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_MINUS) ? CONTROLLER_BUTTON_MINUS : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_SHARE) ? CONTROLLER_BUTTON_SHARE : 0;
+
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_L) ? CONTROLLER_BUTTON_L : 0;
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_ZL) ? CONTROLLER_BUTTON_ZL : 0;
+        }
+
+        constexpr int_fast64_t SCALE_X_MIN = -100;
+        constexpr int_fast64_t SCALE_X_MAX = 85;
+        constexpr int_fast64_t SCALE_Y_MIN = -100;
+        constexpr int_fast64_t SCALE_Y_MAX = 90;
+
+        state.lx = 0;
+        state.ly = 0;
+        state.rx = 0;
+        state.ry = 0;
+
+        if constexpr (HasSticks(Family) && HasLeftHalf(Family))
+        {
+            int8_t lx = (((analog[1] & 0x0F) << 4) | ((analog[0] & 0xF0) >> 4)) + 127;
+            int8_t ly = analog[2] + 127;
+
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_L) ? CONTROLLER_BUTTON_THUMB_L : 0;
+            state.lx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, lx);
+            state.ly = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, ly);
+        }
+
+        if constexpr (HasSticks(Family) && HasRightHalf(Family))
+        {
+            int8_t rx = (((analog[4] & 0x0F) << 4) | ((analog[3] & 0xF0) >> 4)) + 127;
+            int8_t ry = analog[5] + 127;
+
+            state.buttons |= !!(buttons & SWITCH_BUTTON_USB_MASK_THUMB_R) ? CONTROLLER_BUTTON_THUMB_R : 0;
+            state.rx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, rx);
+            state.ry = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, ry);
+        }
+
+#ifdef PRO_CONTROLLER_DEBUG_OUTPUT
+        std::cout << DeviceFamilyName(Family) << ": buttons " << std::hex << state.buttons << std::dec;
+        std::cout << ", LX: " << state.lx << ", LY: " << state.ly << ", RX: " << state.rx << ", RY: " << state.ry << std::endl;
+#endif
+
+        return true;
+    }
+
+    // what a bluetooth pro controller sends before it's switched to full reports
+    inline bool DecodeSimpleReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+    {
+        using std::cout;
+        using std::endl;
+        using std::int16_t;
+        using std::int_fast64_t;
+
+        const auto hid_payload = reinterpret_cast<const ProControllerBluetoothPacket *>(data);
+
+        if (size < 12 || hid_payload->report_id != PACKET_TYPE_SIMPLE_CONTROLLER_DATA)
+        {
+            return false;
+        }
+
+        const auto& analog = hid_payload->data.controller_data.analog;
+        const auto& hat = hid_payload->data.controller_data.hat;
+        const auto& buttons = hid_payload->data.controller_data.buttons;
+
+        int16_t lx = analog[0] + 32767;
+        int16_t ly = analog[1] + 32767;
+        int16_t rx = analog[2] + 32767;
+        int16_t ry = analog[3] + 32767;
+
+#ifdef PRO_CONTROLLER_DEBUG_OUTPUT
+            cout << "A: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_A) << ", ";
+            cout << "B: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_B) << ", ";
+            cout << "X: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_X) << ", ";
+            cout << "Y: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_Y) << ", ";
+
+            cout << "P: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_PLUS) << ", ";
+            cout << "M: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_MINUS) << ", ";
+            cout << "H: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_HOME) << ", ";
+            cout << "S: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_SHARE) << ", ";
+
+            cout << "L: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_L) << ", ";
+            cout << "ZL: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZL) << ", ";
+            cout << "TL: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L) << ", ";
+
+            cout << "R: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_R) << ", ";
+            cout << "ZR: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZR) << ", ";
+            cout << "TR: " << !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R) << ", ";
+
+            cout << "DPAD: " << +hat << ", ";
+
+            cout << "LX: " << +lx << ", ";
+            cout << "LY: " << +ly << ", ";
+
+            cout << "RX: " << +rx << ", ";
+            cout << "RY: " << +ry;
+
+            cout << endl;
+#endif
+
+        state.timed = false;
+        state.timer = 0;
+        state.power = POWER_STATUS_UNKNOWN;
+
+        state.buttons = DecodeHat(hat);
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_A) ? CONTROLLER_BUTTON_A : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_B) ? CONTROLLER_BUTTON_B : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_X) ? CONTROLLER_BUTTON_X : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_Y) ? CONTROLLER_BUTTON_Y : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_PLUS) ? CONTROLLER_BUTTON_PLUS : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_MINUS) ? CONTROLLER_BUTTON_MINUS : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_HOME) ? CONTROLLER_BUTTON_HOME : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_SHARE) ? CONTROLLER_BUTTON_SHARE : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_L) ? CONTROLLER_BUTTON_L : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZL) ? CONTROLLER_BUTTON_ZL : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L) ? CONTROLLER_BUTTON_THUMB_L : 0;
+
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_R) ? CONTROLLER_BUTTON_R : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_ZR) ? CONTROLLER_BUTTON_ZR : 0;
+        state.buttons |= !!(buttons & SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R) ? CONTROLLER_BUTTON_THUMB_R : 0;
+
+        constexpr int_fast64_t SCALE_X_MIN = -25000;
+        constexpr int_fast64_t SCALE_X_MAX = 22000;
+        constexpr int_fast64_t SCALE_Y_MIN = -25000;
+        constexpr int_fast64_t SCALE_Y_MAX = 23000;
+
+        state.lx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, lx);
+        state.ly = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, -ly);
+        state.rx = ScaleJoystick(SCALE_X_MIN, SCALE_X_MAX, rx);
+        state.ry = ScaleJoystick(SCALE_Y_MIN, SCALE_Y_MAX, -ry);
+
+        return true;
+    }
+}
+
+template <DeviceFamily Family, Transport Link>
+bool DecodeReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+{
+    return DecodeFullReport<Family>(data, size, state);
+}
+
+template bool DecodeReport<DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_USB>(const std::uint8_t*, std::size_t, ControllerState&);
+template bool DecodeReport<DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_BLUETOOTH>(const std::uint8_t*, std::size_t, ControllerState&);
+template bool DecodeReport<DEVICE_FAMILY_JOYCON_LEFT, TRANSPORT_BLUETOOTH>(const std::uint8_t*, std::size_t, ControllerState&);
+template bool DecodeReport<DEVICE_FAMILY_JOYCON_RIGHT, TRANSPORT_BLUETOOTH>(const std::uint8_t*, std::size_t, ControllerState&);
+template bool DecodeReport<DEVICE_FAMILY_SNES_CONTROLLER, TRANSPORT_BLUETOOTH>(const std::uint8_t*, std::size_t, ControllerState&);
+
+DecodeFunction SelectDecoder(DeviceFamily family, Transport transport)
+{
+    if (transport == TRANSPORT_USB)
+    {
+        return family == DEVICE_FAMILY_PRO_CONTROLLER ? DecodeReport<DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_USB> : nullptr;
+    }
+
+    switch (family)
+    {
+    case DEVICE_FAMILY_PRO_CONTROLLER:
+        return DecodeReport<DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_BLUETOOTH>;
+    case DEVICE_FAMILY_JOYCON_LEFT:
+        return DecodeReport<DEVICE_FAMILY_JOYCON_LEFT, TRANSPORT_BLUETOOTH>;
+    case DEVICE_FAMILY_JOYCON_RIGHT:
+        return DecodeReport<DEVICE_FAMILY_JOYCON_RIGHT, TRANSPORT_BLUETOOTH>;
+    case DEVICE_FAMILY_SNES_CONTROLLER:
+        return DecodeReport<DEVICE_FAMILY_SNES_CONTROLLER, TRANSPORT_BLUETOOTH>;
+    default:
+        return nullptr;
+    }
+}
+
+bool DecodeUSBReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+{
+    return DecodeReport<DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_USB>(data, size, state);
+}
+
+bool DecodeBluetoothReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+{
+    return DecodeReport<DEVICE_FAMILY_PRO_CONTROLLER, TRANSPORT_BLUETOOTH>(data, size, state);
+}
+
+bool DecodeSimpleBluetoothReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+{
+    return DecodeSimpleReport(data, size, state);
+}
+
+bool FamilyFromProductId(std::uint16_t product_id, bool bluetooth, DeviceFamily& family)
+{
+    switch (product_id)
+    {
+    case PRO_CONTROLLER_PID:
+        family = DEVICE_FAMILY_PRO_CONTROLLER;
+        return true;
+    case JOYCON_LEFT_PID:
+        family = DEVICE_FAMILY_JOYCON_LEFT;
+        return bluetooth;
+    case JOYCON_RIGHT_PID:
+        family = DEVICE_FAMILY_JOYCON_RIGHT;
+        return bluetooth;
+    case SNES_CONTROLLER_PID:
+        family = DEVICE_FAMILY_SNES_CONTROLLER;
+        return bluetooth;
+    default:
+        return false;
+    }
+}
+
+const char* DeviceFamilyName(DeviceFamily family)
+{
+    switch (family)
+    {
+    case DEVICE_FAMILY_PRO_CONTROLLER:
+        return "PRO CONTROLLER";
+    case DEVICE_FAMILY_JOYCON_LEFT:
+        return "JOY-CON (L)";
+    case DEVICE_FAMILY_JOYCON_RIGHT:
+        return "JOY-CON (R)";
+    case DEVICE_FAMILY_SNES_CONTROLLER:
+        return "SNES CONTROLLER";
+    default:
+        return "UNKNOWN CONTROLLER";
+    }
+}
+
+std::size_t DecodeImuSamples(const std::uint8_t* data, std::size_t size, std::chrono::steady_clock::time_point time, ImuSample* samples)
+{
+    using std::int16_t;
+
+    constexpr std::size_t IMU_OFFSET = 13;
+    constexpr std::size_t IMU_SAMPLE_SIZE = 12;
+
+    if (size < IMU_OFFSET + IMU_SAMPLE_SIZE * IMU_SAMPLES_PER_REPORT || data[0] != PACKET_TYPE_CONTROLLER_DATA)
+    {
+        return 0;
+    }
+
+    for (std::size_t i = 0; i < IMU_SAMPLES_PER_REPORT; i++)
+    {
+        const auto sample = data + IMU_OFFSET + i * IMU_SAMPLE_SIZE;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            samples[i].accel[axis] = static_cast<int16_t>(sample[axis * 2] | (sample[axis * 2 + 1] << 8));
+            samples[i].gyro[axis] = static_cast<int16_t>(sample[6 + axis * 2] | (sample[7 + axis * 2] << 8));
+        }
+
+        samples[i].time = time - CONTROLLER_TIMER_TICK * (IMU_SAMPLES_PER_REPORT - 1 - i);
+    }
+
+    return IMU_SAMPLES_PER_REPORT;
+}
+
+std::uint32_t DecodeHat(std::uint8_t hat)
+{
+    std::uint32_t ret = 0;
+
+    switch (hat)
+    {
+    case SWITCH_HAT_UP:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_UP;
+        break;
+    }
+    case SWITCH_HAT_UP_RIGHT:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_UP | CONTROLLER_BUTTON_DPAD_RIGHT;
+        break;
+    }
+    case SWITCH_HAT_RIGHT:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_RIGHT;
+        break;
+    }
+    case SWITCH_HAT_DOWN_RIGHT:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_RIGHT | CONTROLLER_BUTTON_DPAD_DOWN;
+        break;
+    }
+    case SWITCH_HAT_DOWN:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_DOWN;
+        break;
+    }
+    case SWITCH_HAT_DOWN_LEFT:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_DOWN | CONTROLLER_BUTTON_DPAD_LEFT;
+        break;
+    }
+    case SWITCH_HAT_LEFT:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_LEFT;
+        break;
+    }
+    case SWITCH_HAT_UP_LEFT:
+    {
+        ret = CONTROLLER_BUTTON_DPAD_LEFT | CONTROLLER_BUTTON_DPAD_UP;
+        break;
+    }
+    }
+
+    return ret;
+}
+
+std::int16_t ScaleJoystick(std::int_fast64_t src_min, std::int_fast64_t src_max, std::int16_t val)
+{
+    using std::int16_t;
+    using std::int_fast64_t;
+    using std::clamp;
+    using std::numeric_limits;
+
+    typedef numeric_limits<int16_t> int16_limts;
+
+    constexpr int_fast64_t DST_MIN = int16_limts::min();
+    constexpr int_fast64_t DST_MAX = int16_limts::max();
+    constexpr int_fast64_t DST_RNG = DST_MAX - DST_MIN;
+
+    const int_fast64_t src_rng = src_max - src_min;
+
+    auto new_val = (((val - src_min) * DST_RNG) / src_rng) + DST_MIN;
+
+    return static_cast<int16_t>(clamp(new_val, DST_MIN, DST_MAX));
+}
+
+bool ParseButtonNames(const std::string& text, std::uint32_t& buttons)
+{
+    using std::string;
+    using std::find_if;
+    using std::begin;
+    using std::end;
+
+    buttons = 0;
+
+    if (text == "-")
+    {
+        return true;
+    }
+
+    string::size_type pos = 0;
+
+    while (pos <= text.size())
+    {
+        auto next = text.find('+', pos);
+
+        if (next == string::npos)
+        {
+            next = text.size();
+        }
+
+        const auto name = text.substr(pos, next - pos);
+        auto it = find_if(begin(BUTTON_NAMES), end(BUTTON_NAMES), [&](const auto& b) { return name == b.name; });
+
+        if (it == end(BUTTON_NAMES))
+        {
+            return false;
+        }
+
+        buttons |= it->button;
+        pos = next + 1;
+    }
+
+    return true;
+}
+
+std::string FormatButtonNames(std::uint32_t buttons)
+{
+    using std::string;
+
+    string text;
+
+    for (const auto& b : BUTTON_NAMES)
+    {
+        if (buttons & b.button)
+        {
+            text += text.empty() ? "" : "+";
+            text += b.name;
+        }
+    }
+
+    return text.empty() ? "-" : text;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <chrono>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "family.h"
+
+// transport independent button bits, filled in by the decoders
+enum : std::uint32_t
+{
+    CONTROLLER_BUTTON_A = 0x00000001,
+    CONTROLLER_BUTTON_B = 0x00000002,
+    CONTROLLER_BUTTON_X = 0x00000004,
+    CONTROLLER_BUTTON_Y = 0x00000008,
+
+    CONTROLLER_BUTTON_DPAD_UP = 0x00000010,
+    CONTROLLER_BUTTON_DPAD_DOWN = 0x00000020,
+    CONTROLLER_BUTTON_DPAD_LEFT = 0x00000040,
+    CONTROLLER_BUTTON_DPAD_RIGHT = 0x00000080,
+
+    CONTROLLER_BUTTON_PLUS = 0x00000100,
+    CONTROLLER_BUTTON_MINUS = 0x00000200,
+    CONTROLLER_BUTTON_HOME = 0x00000400,
+    CONTROLLER_BUTTON_SHARE = 0x00000800,
+
+    CONTROLLER_BUTTON_L = 0x00001000,
+    CONTROLLER_BUTTON_ZL = 0x00002000,
+    CONTROLLER_BUTTON_THUMB_L = 0x00004000,
+
+    CONTROLLER_BUTTON_R = 0x00008000,
+    CONTROLLER_BUTTON_ZR = 0x00010000,
+    CONTROLLER_BUTTON_THUMB_R = 0x00020000,
+};
+
+constexpr std::size_t CONTROLLER_BUTTON_COUNT = 18;
+
+struct ControllerState
+{
+    std::uint32_t buttons;
+    // scaled to the xinput range
+    std::int16_t lx;
+    std::int16_t ly;
+    std::int16_t rx;
+    std::int16_t ry;
+    // the controller's free-running timer, only full reports carry it
+    bool timed;
+    std::uint8_t timer;
+    // battery and connection status byte, also only in full reports, see battery.h
+    std::uint8_t power;
+    // host time the controller sampled this report, filled in by the device from its clock sync
+    std::chrono::steady_clock::time_point time;
+};
+
+// what power holds when the report didn't carry it, the battery nibble never goes this high
+constexpr std::uint8_t POWER_STATUS_UNKNOWN = 0xFF;
+
+// full reports carry the last three IMU samples, 5ms apart
+constexpr std::size_t IMU_SAMPLES_PER_REPORT = 3;
+
+struct ImuSample
+{
+    // raw sensor units, x y z
+    std::int16_t accel[3];
+    std::int16_t gyro[3];
+    std::chrono::steady_clock::time_point time;
+};
+
+// all of these return false if the packet doesn't carry controller data
+using DecodeFunction = bool (*)(const std::uint8_t* data, std::size_t size, ControllerState& state);
+
+// one decoder per family and transport with everything the family doesn't have compiled out,
+// instantiated in decode.cpp for the combinations SelectDecoder can return
+template <DeviceFamily Family, Transport Link>
+bool DecodeReport(const std::uint8_t* data, std::size_t size, ControllerState& state);
+
+// picked once when a device connects, nullptr if the family can't use that transport
+DecodeFunction SelectDecoder(DeviceFamily family, Transport transport);
+
+// the pro controller specializations
+bool DecodeUSBReport(const std::uint8_t* data, std::size_t size, ControllerState& state);
+bool DecodeBluetoothReport(const std::uint8_t* data, std::size_t size, ControllerState& state);
+// the simple 0x3F reports a bluetooth pro controller sends until it's switched to full reports,
+// older captures hold nothing else
+bool DecodeSimpleBluetoothReport(const std::uint8_t* data, std::size_t size, ControllerState& state);
+
+// fills samples oldest first and returns how many the report had, time is the capture time of the
+// report which belongs to the newest sample
+std::size_t DecodeImuSamples(const std::uint8_t* data, std::size_t size, std::chrono::steady_clock::time_point time, ImuSample* samples);
+
+std::uint32_t DecodeHat(std::uint8_t hat);
+std::int16_t ScaleJoystick(std::int_fast64_t src_min, std::int_fast64_t src_max, std::int16_t val);
+
+// CONTROLLER_BUTTON_* names like A, ZL or PLUS joined by +, or - for none
+bool ParseButtonNames(const std::string& text, std::uint32_t& buttons);
+// the other way around
+std::string FormatButtonNames(std::uint32_t buttons);
@@ -0,0 +1,707 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+#include <cstring>
+
+#include "battery.h"
+#include "dsu.h"
+
+namespace
+{
+    constexpr std::uint16_t DSU_PROTOCOL_VERSION = 1001;
+    constexpr std::size_t DSU_HEADER_SIZE = 16;
+    constexpr std::size_t DSU_MAX_REQUEST_SIZE = 1024;
+    // the shared beginning every slot related message starts its payload with
+    constexpr std::size_t DSU_SLOT_INFO_SIZE = 11;
+
+    enum DsuMessageType : std::uint32_t
+    {
+        DSU_MESSAGE_VERSION = 0x100000,
+        DSU_MESSAGE_INFO = 0x100001,
+        DSU_MESSAGE_DATA = 0x100002,
+    };
+
+    enum DsuSubscription : std::uint8_t
+    {
+        DSU_SUBSCRIBE_SLOT = 0x01,
+        DSU_SUBSCRIBE_MAC = 0x02,
+    };
+
+    // offsets into a data packet, after the header and message type
+    constexpr std::size_t DSU_DATA_BATTERY = 30;
+    constexpr std::size_t DSU_DATA_PACKET_NUMBER = 32;
+    constexpr std::size_t DSU_DATA_BUTTONS = 36;
+    constexpr std::size_t DSU_DATA_STICKS = 40;
+    constexpr std::size_t DSU_DATA_ANALOG_BUTTONS = 44;
+    constexpr std::size_t DSU_DATA_MOTION_TIMESTAMP = 68;
+    constexpr std::size_t DSU_DATA_ACCEL = 76;
+    constexpr std::size_t DSU_DATA_GYRO = 88;
+
+    // the pro controller's IMU defaults, +-8g and +-2000dps
+    constexpr float ACCEL_G_PER_UNIT = 1.0f / 4096.0f;
+    constexpr float GYRO_DPS_PER_UNIT = 0.070f;
+
+    const std::array<std::uint32_t, 256> CRC_TABLE = [] {
+        std::array<std::uint32_t, 256> table = {};
+
+        for (std::uint32_t i = 0; i < table.size(); i++)
+        {
+            std::uint32_t crc = i;
+
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            }
+
+            table[i] = crc;
+        }
+
+        return table;
+    }();
+
+    std::uint32_t Crc32(const std::uint8_t* data, std::size_t size)
+    {
+        std::uint32_t crc = 0xFFFFFFFF;
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            crc = CRC_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+
+        return ~crc;
+    }
+
+    // the protocol is little endian like us, so these are plain copies
+    template <typename T>
+    void Put(std::uint8_t* buf, T value)
+    {
+        std::memcpy(buf, &value, sizeof(value));
+    }
+
+    template <typename T>
+    T Get(const std::uint8_t* buf)
+    {
+        T value;
+        std::memcpy(&value, buf, sizeof(value));
+        return value;
+    }
+
+    void WriteHeader(std::uint8_t* buf, const char* magic, std::size_t size, std::uint32_t id, std::uint32_t type)
+    {
+        std::memcpy(buf, magic, 4);
+        Put<std::uint16_t>(buf + 4, DSU_PROTOCOL_VERSION);
+        Put<std::uint16_t>(buf + 6, static_cast<std::uint16_t>(size - DSU_HEADER_SIZE));
+        Put<std::uint32_t>(buf + 8, 0);
+        Put<std::uint32_t>(buf + 12, id);
+        Put<std::uint32_t>(buf + 16, type);
+    }
+
+    // the CRC covers the whole message with its own field zeroed
+    void Seal(std::uint8_t* buf, std::size_t size)
+    {
+        Put<std::uint32_t>(buf + 8, 0);
+        Put<std::uint32_t>(buf + 8, Crc32(buf, size));
+    }
+
+    bool CheckMessage(const std::uint8_t* data, std::size_t size, const char* magic)
+    {
+        if (size < DSU_HEADER_SIZE + 4 || std::memcmp(data, magic, 4) != 0)
+        {
+            return false;
+        }
+
+        if (Get<std::uint16_t>(data + 4) != DSU_PROTOCOL_VERSION || Get<std::uint16_t>(data + 6) > size - DSU_HEADER_SIZE)
+        {
+            return false;
+        }
+
+        std::uint8_t copy[DSU_MAX_REQUEST_SIZE];
+        const auto checked = std::min<std::size_t>(size, DSU_HEADER_SIZE + Get<std::uint16_t>(data + 6));
+
+        if (checked > sizeof(copy))
+        {
+            return false;
+        }
+
+        std::memcpy(copy, data, checked);
+        Put<std::uint32_t>(copy + 8, 0);
+
+        return Crc32(copy, checked) == Get<std::uint32_t>(data + 8);
+    }
+
+    std::uint8_t DsuBattery(std::uint8_t power)
+    {
+        if (power == POWER_STATUS_UNKNOWN)
+        {
+            return 0x00;
+        }
+
+        const auto status = DecodePowerStatus(power);
+
+        if (status.charging)
+        {
+            return status.level >= BATTERY_FULL ? 0xEF : 0xEE;
+        }
+
+        switch (status.level)
+        {
+        case BATTERY_FULL:
+            return 0x05;
+        case BATTERY_MEDIUM:
+            return 0x03;
+        case BATTERY_LOW:
+            return 0x02;
+        default:
+            return 0x01;
+        }
+    }
+
+    std::uint8_t StickAxis(std::int16_t value)
+    {
+        return static_cast<std::uint8_t>((value >> 8) + 128);
+    }
+
+    // 12 hex digits, with or without separators, otherwise a made up address from the slot
+    void MacFromSerial(const std::string& serial, std::size_t slot, std::uint8_t mac[6])
+    {
+        std::uint8_t parsed[6] = {};
+        std::size_t digits = 0;
+
+        for (const char c : serial)
+        {
+            int nibble;
+
+            if (c >= '0' && c <= '9')
+            {
+                nibble = c - '0';
+            }
+            else if (c >= 'a' && c <= 'f')
+            {
+                nibble = c - 'a' + 10;
+            }
+            else if (c >= 'A' && c <= 'F')
+            {
+                nibble = c - 'A' + 10;
+            }
+            else if (c == ':' || c == '-')
+            {
+                continue;
+            }
+            else
+            {
+                digits = 0;
+                break;
+            }
+
+            if (digits == 12)
+            {
+                digits = 0;
+                break;
+            }
+
+            parsed[digits / 2] = static_cast<std::uint8_t>(parsed[digits / 2] << 4 | nibble);
+            digits++;
+        }
+
+        if (digits == 12)
+        {
+            std::memcpy(mac, parsed, 6);
+        }
+        else
+        {
+            const std::uint8_t fallback[6] = { 0, 0, 0, 0, 0, static_cast<std::uint8_t>(slot + 1) };
+            std::memcpy(mac, fallback, 6);
+        }
+    }
+
+    std::uint64_t TimestampMicroseconds(std::chrono::steady_clock::time_point time)
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+
+        return duration_cast<microseconds>(time.time_since_epoch()).count();
+    }
+}
+
+DsuServer::DsuServer(std::uint16_t _port)
+    : socket(UDP_LOOPBACK, _port)
+    , server_id(static_cast<std::uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count()))
+    , slots()
+    , clients()
+    , quitting(false)
+{
+    using std::thread;
+
+    if (!socket.Valid())
+    {
+        return;
+    }
+
+    server_thread = thread(&DsuServer::ServerThread, this);
+}
+
+DsuServer::~DsuServer()
+{
+    quitting = true;
+
+    if (server_thread.joinable())
+    {
+        server_thread.join();
+    }
+}
+
+bool DsuServer::Valid() const
+{
+    return socket.Valid();
+}
+
+std::uint16_t DsuServer::Port() const
+{
+    return socket.Port();
+}
+
+int DsuServer::Attach(bool bluetooth, const std::string& serial)
+{
+    using std::lock_guard;
+
+    lock_guard<spinlock> lk(lock);
+
+    for (std::size_t i = 0; i < slots.size(); i++)
+    {
+        auto& slot = slots[i];
+
+        if (slot.connected)
+        {
+            continue;
+        }
+
+        slot.connected = true;
+        slot.bluetooth = bluetooth;
+        slot.packet_number = 0;
+        MacFromSerial(serial, i, slot.mac);
+
+        // everything but the report itself stays the same for as long as the controller is attached
+        auto packet = slot.packet.data();
+        slot.packet.fill(0);
+        WriteHeader(packet, "DSUS", slot.packet.size(), server_id, DSU_MESSAGE_DATA);
+        FillSlotInfo(packet + DSU_HEADER_SIZE + 4, i);
+        packet[DSU_HEADER_SIZE + 4 + DSU_SLOT_INFO_SIZE] = 1;
+
+        return static_cast<int>(i);
+    }
+
+    return -1;
+}
+
+void DsuServer::Detach(int slot)
+{
+    using std::lock_guard;
+
+    lock_guard<spinlock> lk(lock);
+    slots[slot].connected = false;
+}
+
+void DsuServer::Publish(int slot, const ControllerState& state, const ImuSample* samples, std::size_t sample_count)
+{
+    using std::array;
+    using std::lock_guard;
+    using std::chrono::steady_clock;
+
+    // only this slot's sink thread writes its packet, the lock is just for the client table
+    auto packet = slots[slot].packet.data();
+    const auto buttons = state.buttons;
+
+    packet[DSU_DATA_BATTERY] = DsuBattery(state.power);
+    Put<std::uint32_t>(packet + DSU_DATA_PACKET_NUMBER, slots[slot].packet_number++);
+
+    packet[DSU_DATA_BUTTONS] = static_cast<std::uint8_t>(
+        (buttons & CONTROLLER_BUTTON_DPAD_LEFT ? 0x80 : 0) |
+        (buttons & CONTROLLER_BUTTON_DPAD_DOWN ? 0x40 : 0) |
+        (buttons & CONTROLLER_BUTTON_DPAD_RIGHT ? 0x20 : 0) |
+        (buttons & CONTROLLER_BUTTON_DPAD_UP ? 0x10 : 0) |
+        (buttons & CONTROLLER_BUTTON_PLUS ? 0x08 : 0) |
+        (buttons & CONTROLLER_BUTTON_THUMB_R ? 0x04 : 0) |
+        (buttons & CONTROLLER_BUTTON_THUMB_L ? 0x02 : 0) |
+        (buttons & CONTROLLER_BUTTON_MINUS ? 0x01 : 0));
+    packet[DSU_DATA_BUTTONS + 1] = static_cast<std::uint8_t>(
+        (buttons & CONTROLLER_BUTTON_Y ? 0x80 : 0) |
+        (buttons & CONTROLLER_BUTTON_B ? 0x40 : 0) |
+        (buttons & CONTROLLER_BUTTON_A ? 0x20 : 0) |
+        (buttons & CONTROLLER_BUTTON_X ? 0x10 : 0) |
+        (buttons & CONTROLLER_BUTTON_R ? 0x08 : 0) |
+        (buttons & CONTROLLER_BUTTON_L ? 0x04 : 0) |
+        (buttons & CONTROLLER_BUTTON_ZR ? 0x02 : 0) |
+        (buttons & CONTROLLER_BUTTON_ZL ? 0x01 : 0));
+    packet[DSU_DATA_BUTTONS + 2] = buttons & CONTROLLER_BUTTON_HOME ? 1 : 0;
+    packet[DSU_DATA_BUTTONS + 3] = buttons & CONTROLLER_BUTTON_SHARE ? 1 : 0;
+
+    packet[DSU_DATA_STICKS] = StickAxis(state.lx);
+    packet[DSU_DATA_STICKS + 1] = StickAxis(state.ly);
+    packet[DSU_DATA_STICKS + 2] = StickAxis(state.rx);
+    packet[DSU_DATA_STICKS + 3] = StickAxis(state.ry);
+
+    // dpad left down right up, then Y B A X, R L ZR ZL, all digital here
+    const std::uint32_t analog_buttons[] = {
+        CONTROLLER_BUTTON_DPAD_LEFT, CONTROLLER_BUTTON_DPAD_DOWN, CONTROLLER_BUTTON_DPAD_RIGHT, CONTROLLER_BUTTON_DPAD_UP,
+        CONTROLLER_BUTTON_Y, CONTROLLER_BUTTON_B, CONTROLLER_BUTTON_A, CONTROLLER_BUTTON_X,
+        CONTROLLER_BUTTON_R, CONTROLLER_BUTTON_L, CONTROLLER_BUTTON_ZR, CONTROLLER_BUTTON_ZL,
+    };
+
+    for (std::size_t i = 0; i < 12; i++)
+    {
+        packet[DSU_DATA_ANALOG_BUTTONS + i] = buttons & analog_buttons[i] ? 0xFF : 0x00;
+    }
+
+    // DSU only has room for one sample, so the newest one. its axes are the DS4's: x right, y up
+    // and z towards the player, where the controller's are x towards the player, y left and z up
+    if (sample_count > 0)
+    {
+        const auto& sample = samples[sample_count - 1];
+
+        Put<std::uint64_t>(packet + DSU_DATA_MOTION_TIMESTAMP, TimestampMicroseconds(sample.time));
+        Put<float>(packet + DSU_DATA_ACCEL, -sample.accel[1] * ACCEL_G_PER_UNIT);
+        Put<float>(packet + DSU_DATA_ACCEL + 4, sample.accel[2] * ACCEL_G_PER_UNIT);
+        Put<float>(packet + DSU_DATA_ACCEL + 8, -sample.accel[0] * ACCEL_G_PER_UNIT);
+        Put<float>(packet + DSU_DATA_GYRO, -sample.gyro[1] * GYRO_DPS_PER_UNIT);
+        Put<float>(packet + DSU_DATA_GYRO + 4, sample.gyro[2] * GYRO_DPS_PER_UNIT);
+        Put<float>(packet + DSU_DATA_GYRO + 8, -sample.gyro[0] * GYRO_DPS_PER_UNIT);
+    }
+    else
+    {
+        Put<std::uint64_t>(packet + DSU_DATA_MOTION_TIMESTAMP, TimestampMicroseconds(state.time));
+    }
+
+    Seal(packet, DSU_DATA_PACKET_SIZE);
+
+    // copy out who to send to, so a slow send never holds up the server thread or the other slots
+    array<UdpEndpoint, DSU_MAX_CLIENTS> targets;
+    std::size_t target_count = 0;
+    const auto now = steady_clock::now();
+
+    {
+        lock_guard<spinlock> lk(lock);
+
+        for (const auto& client : clients)
+        {
+            if (Subscribed(client, slot, now))
+            {
+                targets[target_count++] = client.endpoint;
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < target_count; i++)
+    {
+        socket.Send(packet, DSU_DATA_PACKET_SIZE, targets[i]);
+    }
+}
+
+void DsuServer::ServerThread()
+{
+    using std::chrono::milliseconds;
+
+    std::uint8_t request[DSU_MAX_REQUEST_SIZE];
+
+    while (!quitting)
+    {
+        // wakes up now and then to notice quitting
+        if (!socket.WaitReadable(milliseconds(250)))
+        {
+            continue;
+        }
+
+        UdpEndpoint from;
+        const auto size = socket.Receive(request, sizeof(request), from);
+
+        if (size > 0)
+        {
+            HandleRequest(request, size, from);
+        }
+    }
+}
+
+void DsuServer::HandleRequest(const std::uint8_t* data, std::size_t size, const UdpEndpoint& from)
+{
+    using std::lock_guard;
+
+    if (!CheckMessage(data, size, "DSUC"))
+    {
+        return;
+    }
+
+    const auto type = Get<std::uint32_t>(data + DSU_HEADER_SIZE);
+    const auto payload = data + DSU_HEADER_SIZE + 4;
+    const auto payload_size = size - DSU_HEADER_SIZE - 4;
+
+    if (type == DSU_MESSAGE_VERSION)
+    {
+        std::uint8_t reply[DSU_HEADER_SIZE + 4 + 2];
+        WriteHeader(reply, "DSUS", sizeof(reply), server_id, DSU_MESSAGE_VERSION);
+        Put<std::uint16_t>(reply + DSU_HEADER_SIZE + 4, DSU_PROTOCOL_VERSION);
+        Seal(reply, sizeof(reply));
+        socket.Send(reply, sizeof(reply), from);
+    }
+    else if (type == DSU_MESSAGE_INFO && payload_size >= 4)
+    {
+        // one reply per slot asked about, a count followed by that many slot numbers
+        const auto count = std::min<std::size_t>(Get<std::int32_t>(payload) < 0 ? 0 : Get<std::int32_t>(payload), payload_size - 4);
+
+        for (std::size_t i = 0; i < count; i++)
+        {
+            const std::size_t slot = payload[4 + i];
+
+            if (slot >= DSU_SLOTS)
+            {
+                continue;
+            }
+
+            std::uint8_t reply[DSU_HEADER_SIZE + 4 + DSU_SLOT_INFO_SIZE + 1] = {};
+            WriteHeader(reply, "DSUS", sizeof(reply), server_id, DSU_MESSAGE_INFO);
+
+            {
+                lock_guard<spinlock> lk(lock);
+                FillSlotInfo(reply + DSU_HEADER_SIZE + 4, slot);
+            }
+
+            Seal(reply, sizeof(reply));
+            socket.Send(reply, sizeof(reply), from);
+        }
+    }
+    else if (type == DSU_MESSAGE_DATA && payload_size >= 8)
+    {
+        Subscribe(payload, from);
+    }
+}
+
+void DsuServer::Subscribe(const std::uint8_t* request, const UdpEndpoint& from)
+{
+    using std::lock_guard;
+    using std::chrono::steady_clock;
+
+    const auto now = steady_clock::now();
+
+    lock_guard<spinlock> lk(lock);
+
+    Client* entry = nullptr;
+
+    for (auto& client : clients)
+    {
+        if (client.endpoint.address == from.address && client.endpoint.port == from.port)
+        {
+            entry = &client;
+            break;
+        }
+
+        // lapsed subscriptions are reused as well as free ones
+        if (!entry && (client.endpoint.address == 0 || now - client.last_request > DSU_SUBSCRIPTION_TIMEOUT))
+        {
+            entry = &client;
+        }
+    }
+
+    if (!entry)
+    {
+        return;
+    }
+
+    entry->endpoint = from;
+    entry->flags = request[0];
+    entry->slot = request[1];
+    std::memcpy(entry->mac, request + 2, sizeof(entry->mac));
+    entry->last_request = now;
+}
+
+bool DsuServer::Subscribed(const Client& client, std::size_t slot, std::chrono::steady_clock::time_point now) const
+{
+    if (client.endpoint.address == 0 || now - client.last_request > DSU_SUBSCRIPTION_TIMEOUT)
+    {
+        return false;
+    }
+
+    if (client.flags == 0)
+    {
+        return true;
+    }
+
+    return ((client.flags & DSU_SUBSCRIBE_SLOT) && client.slot == slot) ||
+        ((client.flags & DSU_SUBSCRIBE_MAC) && std::memcmp(client.mac, slots[slot].mac, sizeof(client.mac)) == 0);
+}
+
+std::size_t DsuServer::FillSlotInfo(std::uint8_t* buf, std::size_t slot) const
+{
+    const auto& info = slots[slot];
+
+    buf[0] = static_cast<std::uint8_t>(slot);
+
+    if (!info.connected)
+    {
+        std::memset(buf + 1, 0, DSU_SLOT_INFO_SIZE - 1);
+        return DSU_SLOT_INFO_SIZE;
+    }
+
+    // connected, full gyro, then usb or bluetooth
+    buf[1] = 2;
+    buf[2] = 2;
+    buf[3] = info.bluetooth ? 2 : 1;
+    std::memcpy(buf + 4, info.mac, sizeof(info.mac));
+    // the battery is kept up to date in the data packet, info replies borrow it from there
+    buf[10] = info.packet[DSU_DATA_BATTERY];
+
+    return DSU_SLOT_INFO_SIZE;
+}
+
+DsuTestClient::DsuTestClient(std::uint16_t _port)
+    : socket(UDP_LOOPBACK, 0)
+    , port(_port)
+    , packets(0)
+    , corrupt(0)
+    , motionless(0)
+{
+}
+
+bool DsuTestClient::Valid() const
+{
+    return socket.Valid();
+}
+
+void DsuTestClient::Subscribe()
+{
+    // flags 0 is every slot, slot and mac are ignored
+    std::uint8_t request[DSU_HEADER_SIZE + 4 + 8] = {};
+    WriteHeader(request, "DSUC", sizeof(request), 0, DSU_MESSAGE_DATA);
+    Seal(request, sizeof(request));
+
+    socket.Send(request, sizeof(request), { UDP_LOOPBACK, port });
+}
+
+bool DsuTestClient::Receive(std::chrono::milliseconds timeout)
+{
+    using std::all_of;
+    using std::chrono::steady_clock;
+
+    if (!socket.WaitReadable(timeout))
+    {
+        return false;
+    }
+
+    std::uint8_t packet[DSU_MAX_REQUEST_SIZE];
+    UdpEndpoint from;
+    const auto size = socket.Receive(packet, sizeof(packet), from);
+    const auto now = TimestampMicroseconds(steady_clock::now());
+
+    if (size == 0)
+    {
+        return true;
+    }
+
+    if (!CheckMessage(packet, size, "DSUS"))
+    {
+        corrupt++;
+        return true;
+    }
+
+    if (size != DSU_DATA_PACKET_SIZE || Get<std::uint32_t>(packet + DSU_HEADER_SIZE) != DSU_MESSAGE_DATA)
+    {
+        return true;
+    }
+
+    // the sample time is on the same steady clock, so this is sensor sample to arrival
+    const auto sampled = Get<std::uint64_t>(packet + DSU_DATA_MOTION_TIMESTAMP);
+    latency.Record(now > sampled ? (now - sampled) * 1000 : 0);
+    packets++;
+
+    // the IMU only reports once it's been switched on, until then the samples are zeros
+    const auto motion = packet + DSU_DATA_ACCEL;
+    motionless += all_of(motion, packet + DSU_DATA_GYRO + 12, [](std::uint8_t b) { return b == 0; }) ? 1 : 0;
+
+    return true;
+}
+
+const LatencyHistogram& DsuTestClient::Latency() const
+{
+    return latency;
+}
+
+std::uint64_t DsuTestClient::Packets() const
+{
+    return packets;
+}
+
+std::uint64_t DsuTestClient::Corrupt() const
+{
+    return corrupt;
+}
+
+std::uint64_t DsuTestClient::Motionless() const
+{
+    return motionless;
+}
+
+void DsuTestClient::Reset()
+{
+    latency.Reset();
+    packets = 0;
+    corrupt = 0;
+    motionless = 0;
+}
+
+int RunDsuClient(std::uint16_t port)
+{
+    using std::cout;
+    using std::endl;
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    using std::chrono::seconds;
+    using std::chrono::steady_clock;
+
+    DsuTestClient client(port);
+
+    if (!client.Valid())
+    {
+        return 1;
+    }
+
+    cout << "listening to the DSU server on port " << port << ", ctrl+c to stop" << endl;
+
+    while (true)
+    {
+        const auto end = steady_clock::now() + seconds(1);
+
+        client.Reset();
+        client.Subscribe();
+
+        for (auto now = steady_clock::now(); now < end; now = steady_clock::now())
+        {
+            client.Receive(duration_cast<milliseconds>(end - now) + milliseconds(1));
+        }
+
+        const auto& latency = client.Latency();
+
+        cout << client.Packets() << " packets/s";
+
+        if (client.Packets() > 0)
+        {
+            cout << ", sample to arrival p50 " << latency.Percentile(50.0) / 1000 << "us"
+                << " p99 " << latency.Percentile(99.0) / 1000 << "us"
+                << " max " << latency.Max() / 1000 << "us";
+        }
+
+        if (client.Corrupt() > 0)
+        {
+            cout << ", " << client.Corrupt() << " corrupt";
+        }
+
+        if (client.Motionless() > 0)
+        {
+            cout << ", " << client.Motionless() << " without motion";
+        }
+
+        cout << endl;
+    }
+}
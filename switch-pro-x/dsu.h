@@ -0,0 +1,116 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common.h"
+#include "decode.h"
+#include "latency.h"
+#include "udp.h"
+
+// cemuhook's DSU protocol, the usual way emulators get motion data. every message is one UDP
+// datagram with a CRC32 protected header, clients ask for controller data and have to keep
+// asking or their subscription runs out
+constexpr std::uint16_t DSU_DEFAULT_PORT = 26760;
+constexpr std::size_t DSU_SLOTS = 4;
+constexpr std::size_t DSU_MAX_CLIENTS = 16;
+constexpr std::chrono::seconds DSU_SUBSCRIPTION_TIMEOUT(5);
+constexpr std::size_t DSU_DATA_PACKET_SIZE = 100;
+
+// serves the DSU protocol on localhost. the server thread answers version, info and subscription
+// requests, and each controller's DSU sink thread sends its own data packets from a buffer set aside
+// for its slot, once per report to every client subscribed to it
+class DsuServer
+{
+public:
+    // port 0 picks a free one, see Port
+    explicit DsuServer(std::uint16_t _port);
+    ~DsuServer();
+
+    bool Valid() const;
+    std::uint16_t Port() const;
+
+    // a free slot for a controller, or -1 if all of them are taken
+    int Attach(bool bluetooth, const std::string& serial);
+    void Detach(int slot);
+    // only called from the sink thread of the controller that has the slot
+    void Publish(int slot, const ControllerState& state, const ImuSample* samples, std::size_t sample_count);
+
+private:
+    struct Slot
+    {
+        bool connected;
+        bool bluetooth;
+        std::uint8_t mac[6];
+        std::uint32_t packet_number;
+        std::array<std::uint8_t, DSU_DATA_PACKET_SIZE> packet;
+    };
+
+    struct Client
+    {
+        // zero address for a free entry
+        UdpEndpoint endpoint;
+        // 0 for every slot, otherwise bit 1 for the one in slot and bit 2 for the one with mac
+        std::uint8_t flags;
+        std::uint8_t slot;
+        std::uint8_t mac[6];
+        std::chrono::steady_clock::time_point last_request;
+    };
+
+    void ServerThread();
+    void HandleRequest(const std::uint8_t* data, std::size_t size, const UdpEndpoint& from);
+    void Subscribe(const std::uint8_t* request, const UdpEndpoint& from);
+    bool Subscribed(const Client& client, std::size_t slot, std::chrono::steady_clock::time_point now) const;
+    std::size_t FillSlotInfo(std::uint8_t* buf, std::size_t slot) const;
+
+    UdpSocket socket;
+    const std::uint32_t server_id;
+
+    // the client table and the slots' connection info, never held across a send
+    mutable spinlock lock;
+    std::array<Slot, DSU_SLOTS> slots;
+    std::array<Client, DSU_MAX_CLIENTS> clients;
+
+    std::atomic<bool> quitting;
+    std::thread server_thread;
+};
+
+// subscribes to every slot of a DSU server and measures how long data packets take from the
+// controller's sample time to arriving, used by --dsu-client and the loopback benchmark
+class DsuTestClient
+{
+public:
+    explicit DsuTestClient(std::uint16_t _port);
+
+    bool Valid() const;
+    // has to be repeated within DSU_SUBSCRIPTION_TIMEOUT
+    void Subscribe();
+    // false if nothing arrived within timeout
+    bool Receive(std::chrono::milliseconds timeout);
+
+    const LatencyHistogram& Latency() const;
+    std::uint64_t Packets() const;
+    std::uint64_t Corrupt() const;
+    // data packets whose accelerometer and gyro are all zero, which a real controller never sends
+    std::uint64_t Motionless() const;
+    void Reset();
+
+private:
+    UdpSocket socket;
+    const std::uint16_t port;
+    LatencyHistogram latency;
+    std::uint64_t packets;
+    std::uint64_t corrupt;
+    std::uint64_t motionless;
+};
+
+// prints delivery latency and packet rate of a running server every second
+int RunDsuClient(std::uint16_t port);
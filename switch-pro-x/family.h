@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// nintendo pads that speak the same input report protocol
+enum DeviceFamily
+{
+    DEVICE_FAMILY_PRO_CONTROLLER,
+    DEVICE_FAMILY_JOYCON_LEFT,
+    DEVICE_FAMILY_JOYCON_RIGHT,
+    DEVICE_FAMILY_SNES_CONTROLLER,
+
+    DEVICE_FAMILY_COUNT
+};
+
+enum Transport
+{
+    TRANSPORT_USB,
+    TRANSPORT_BLUETOOTH,
+};
+
+namespace
+{
+    constexpr std::uint16_t JOYCON_LEFT_PID = 0x2006;
+    constexpr std::uint16_t JOYCON_RIGHT_PID = 0x2007;
+    constexpr std::uint16_t SNES_CONTROLLER_PID = 0x2017;
+}
+
+// what each family has, used to compile the unused parts out of its decoder. a joy-con is decoded
+// as its half of the full layout, so a left and a right one add up to a pro controller
+constexpr bool HasLeftHalf(DeviceFamily family)
+{
+    return family != DEVICE_FAMILY_JOYCON_RIGHT;
+}
+
+constexpr bool HasRightHalf(DeviceFamily family)
+{
+    return family != DEVICE_FAMILY_JOYCON_LEFT;
+}
+
+constexpr bool HasSticks(DeviceFamily family)
+{
+    return family != DEVICE_FAMILY_SNES_CONTROLLER;
+}
+
+constexpr bool HasImu(DeviceFamily family)
+{
+    return family != DEVICE_FAMILY_SNES_CONTROLLER;
+}
+
+// false for anything we don't know how to talk to, only the pro controller works over usb
+bool FamilyFromProductId(std::uint16_t product_id, bool bluetooth, DeviceFamily& family);
+// as shown in the connect and disconnect messages
+const char* DeviceFamilyName(DeviceFamily family);
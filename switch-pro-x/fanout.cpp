@@ -0,0 +1,193 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <iostream>
+
+#include <cstring>
+
+#include "fanout.h"
+#include "trace.h"
+
+FanOut::FanOut(const std::string& _owner, DeviceStats* _stats)
+    : owner(_owner)
+    , stats(_stats)
+    , wanted(0)
+    , staging(std::make_unique<Entry>())
+    , quitting(false)
+{
+}
+
+FanOut::~FanOut()
+{
+    Stop();
+}
+
+void FanOut::AddSink(const char* name, std::uint8_t contents, DeviceCounter drop_counter, Consume consume)
+{
+    using std::cerr;
+    using std::endl;
+    using std::make_unique;
+    using std::thread;
+
+    if (sinks.size() == MAX_SINKS)
+    {
+        cerr << owner << " has no room for the " << name << " sink" << endl;
+        return;
+    }
+
+    auto sink = make_unique<Sink>();
+    sink->name = name;
+    sink->index = sinks.size();
+    sink->contents = contents;
+    sink->drop_counter = drop_counter;
+    sink->consume = consume;
+    sink->wake_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    sink->sleeping = false;
+    sink->drops = 0;
+    sink->start = ring.Head();
+    staging->wanted[sink->index] = 0;
+    sink->thread = thread(&FanOut::SinkThread, this, std::ref(*sink));
+
+    wanted |= contents;
+    sinks.push_back(std::move(sink));
+}
+
+bool FanOut::Wants(std::uint8_t contents) const
+{
+    return (wanted & contents) != 0;
+}
+
+void FanOut::Push(const SinkReport& report)
+{
+    using std::atomic_thread_fence;
+    using std::memory_order_seq_cst;
+
+    if (!Wants(report.contents))
+    {
+        return;
+    }
+
+    staging->report = report;
+
+    for (const auto& sink : sinks)
+    {
+        staging->wanted[sink->index] += (sink->contents & report.contents) ? 1 : 0;
+    }
+
+    ring.Push(*staging);
+
+    // pairs with the fence in SinkThread, either the sink sees the new head or we see it sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (auto& sink : sinks)
+    {
+        if ((sink->contents & report.contents) && sink->sleeping.exchange(false))
+        {
+            SetEvent(sink->wake_event);
+        }
+    }
+}
+
+void FanOut::Stop()
+{
+    if (quitting.exchange(true))
+    {
+        return;
+    }
+
+    for (auto& sink : sinks)
+    {
+        SetEvent(sink->wake_event);
+    }
+
+    for (auto& sink : sinks)
+    {
+        if (sink->thread.joinable())
+        {
+            sink->thread.join();
+        }
+
+        if (sink->wake_event != nullptr)
+        {
+            CloseHandle(sink->wake_event);
+            sink->wake_event = nullptr;
+        }
+    }
+}
+
+std::uint64_t FanOut::Drops(const char* name) const
+{
+    using std::strcmp;
+
+    for (const auto& sink : sinks)
+    {
+        if (strcmp(sink->name, name) == 0)
+        {
+            return sink->drops;
+        }
+    }
+
+    return 0;
+}
+
+void FanOut::SinkThread(Sink& sink)
+{
+    using std::atomic_thread_fence;
+    using std::memory_order_seq_cst;
+
+    TraceThreadName(owner + " " + sink.name + " sink");
+
+    std::uint64_t cursor = sink.start;
+    // big enough to not want it on the stack of every iteration
+    auto entry = std::make_unique<Entry>();
+    // how many reports this sink wanted up to the last entry it looked at
+    std::uint32_t handled = 0;
+
+    for (;;)
+    {
+        std::uint64_t dropped = 0;
+        // the ring counts every entry it skips, whether this sink would have taken it or not
+        std::uint64_t skipped = 0;
+
+        while (ring.Next(cursor, *entry, skipped))
+        {
+            const bool taken = (entry->report.contents & sink.contents) != 0;
+            const auto wanted = entry->wanted[sink.index];
+
+            dropped += wanted - handled - (taken ? 1 : 0);
+            handled = wanted;
+
+            if (taken)
+            {
+                sink.consume(entry->report);
+            }
+        }
+
+        if (dropped > 0)
+        {
+            sink.drops += dropped;
+
+            if (stats)
+            {
+                stats->Increment(sink.drop_counter, dropped);
+            }
+        }
+
+        // everything pushed before Stop has been handled
+        if (quitting)
+        {
+            break;
+        }
+
+        sink.sleeping = true;
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (ring.Head() != cursor)
+        {
+            sink.sleeping = false;
+            continue;
+        }
+
+        WaitForSingleObject(sink.wake_event, INFINITE);
+    }
+}
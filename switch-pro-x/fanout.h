@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "broadcast_ring.h"
+#include "decode.h"
+#include "stats.h"
+
+enum SinkReportContents : std::uint8_t
+{
+    // the bytes read from or written to the device, controller data or not
+    SINK_REPORT_RAW = 0x01,
+    // the device's own decoded and filtered state, with its IMU samples
+    SINK_REPORT_DEVICE = 0x02,
+    // what the virtual pad was given, merged for joy-con pairs, before turbo and macros
+    SINK_REPORT_PAD = 0x04,
+};
+
+// the largest report in either direction, bluetooth HID reads always return this much
+constexpr std::size_t SINK_RAW_REPORT_SIZE = 362;
+constexpr std::size_t SINK_RING_SIZE = 128;
+
+struct SinkReport
+{
+    std::uint8_t contents;
+    // CAPTURE_DIRECTION_* of the raw bytes
+    std::uint8_t raw_direction;
+    std::uint16_t raw_size;
+    // when the raw bytes were read or written
+    std::chrono::steady_clock::time_point read_time;
+    ControllerState state;
+    std::array<ImuSample, IMU_SAMPLES_PER_REPORT> imu_samples;
+    std::size_t imu_count;
+    std::uint8_t raw[SINK_RAW_REPORT_SIZE];
+};
+
+// hands one device's reports to every output besides the virtual pad, each on its own thread
+// behind a broadcast ring. the read thread submits to the virtual pad first and only then pushes
+// here, which never waits, so a slow sink falls behind and drops reports instead of holding up
+// the controller
+class FanOut
+{
+public:
+    using Consume = std::function<void(const SinkReport& report)>;
+
+    // drops are also counted in stats if it's given
+    FanOut(const std::string& _owner, DeviceStats* _stats);
+    ~FanOut();
+
+    // before the first Push, contents is what the sink wants to see. at most MAX_SINKS
+    void AddSink(const char* name, std::uint8_t contents, DeviceCounter drop_counter, Consume consume);
+    // true if some sink wants any of contents, so the report isn't worth filling in otherwise
+    bool Wants(std::uint8_t contents) const;
+    // only from one thread at a time
+    void Push(const SinkReport& report);
+    // lets every sink finish what was pushed and joins them, Push must not be called anymore.
+    // the drop counts stay readable
+    void Stop();
+
+    std::uint64_t Drops(const char* name) const;
+
+private:
+    // enough for capture, dsu, shared state and stream
+    static constexpr std::size_t MAX_SINKS = 8;
+
+    // what goes through the ring. wanted holds, per sink, how many reports it wanted up to and
+    // including this one, so a sink that was lapped only counts the skipped reports it would
+    // have taken as drops
+    struct Entry
+    {
+        SinkReport report;
+        std::array<std::uint32_t, MAX_SINKS> wanted;
+    };
+
+    struct Sink
+    {
+        const char* name;
+        std::size_t index;
+        std::uint8_t contents;
+        DeviceCounter drop_counter;
+        Consume consume;
+        HANDLE wake_event;
+        // where the sink starts reading, it sees everything pushed after it was added
+        std::uint64_t start;
+        // set before the sink waits, so Push only signals sinks that went to sleep
+        std::atomic<bool> sleeping;
+        std::atomic<std::uint64_t> drops;
+        std::thread thread;
+    };
+
+    void SinkThread(Sink& sink);
+
+    const std::string owner;
+    DeviceStats* const stats;
+    std::uint8_t wanted;
+    // only touched by Push, it's copied into the ring from here
+    std::unique_ptr<Entry> staging;
+    BroadcastRing<Entry, SINK_RING_SIZE> ring;
+    std::vector<std::unique_ptr<Sink>> sinks;
+    std::atomic<bool> quitting;
+};
@@ -0,0 +1,105 @@
+#include <algorithm>
+
+#include <cmath>
+
+#include "filter.h"
+
+namespace
+{
+    // 1 / (2 pi) in microseconds per millihertz: tau_us = TAU_SCALE / cutoff_mhz
+    constexpr std::int64_t TAU_SCALE = 159154943;
+
+    // reports further apart than this restart the filter instead of smoothing across the gap
+    constexpr std::int32_t MAX_DT_US = 100000;
+
+    // smoothing factor for one step of dt_us at cutoff_mhz, 16 fractional bits
+    std::int64_t Alpha(std::int64_t cutoff_mhz, std::int32_t dt_us)
+    {
+        using std::max;
+
+        const auto tau_us = TAU_SCALE / max<std::int64_t>(cutoff_mhz, 1);
+
+        return (static_cast<std::int64_t>(dt_us) << 16) / (dt_us + tau_us);
+    }
+}
+
+OneEuroParams MakeOneEuroParams(double min_cutoff_hz, double beta_hz_per_unit, double derivative_cutoff_hz)
+{
+    using std::lround;
+
+    OneEuroParams params;
+    params.min_cutoff = static_cast<std::uint32_t>(lround(min_cutoff_hz * 1e3));
+    params.beta = static_cast<std::uint32_t>(lround(beta_hz_per_unit * 1e6));
+    params.derivative_cutoff = static_cast<std::uint32_t>(lround(derivative_cutoff_hz * 1e3));
+
+    return params;
+}
+
+OneEuroFilter::OneEuroFilter()
+{
+    Reset();
+}
+
+void OneEuroFilter::Reset()
+{
+    started = false;
+    value_q8 = 0;
+    speed = 0;
+}
+
+std::int16_t OneEuroFilter::Filter(const OneEuroParams& params, std::int16_t value, std::int32_t dt_us)
+{
+    using std::int32_t;
+    using std::int64_t;
+
+    const int32_t input_q8 = static_cast<int32_t>(value) * 256;
+
+    if (!started || dt_us <= 0 || dt_us > MAX_DT_US)
+    {
+        started = true;
+        value_q8 = input_q8;
+        speed = 0;
+
+        return value;
+    }
+
+    // speed of the raw input relative to the last output, smoothed at the derivative cutoff
+    const int64_t raw_speed = (static_cast<int64_t>(input_q8 - value_q8) * 1000000 / dt_us) / 256;
+    speed += ((raw_speed - speed) * Alpha(params.derivative_cutoff, dt_us)) >> 16;
+
+    const int64_t abs_speed = speed < 0 ? -speed : speed;
+    const int64_t cutoff = params.min_cutoff + (static_cast<int64_t>(params.beta) * abs_speed) / 1000;
+
+    value_q8 += static_cast<int32_t>((static_cast<int64_t>(input_q8 - value_q8) * Alpha(cutoff, dt_us)) >> 16);
+
+    // round to nearest when dropping the fraction
+    return static_cast<std::int16_t>((value_q8 + 128) >> 8);
+}
+
+StickFilter::StickFilter()
+    : has_last(false)
+{
+}
+
+void StickFilter::Apply(const OneEuroParams& params, ControllerState& state)
+{
+    using std::min;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::int32_t dt_us = 0;
+
+    if (has_last)
+    {
+        const auto dt = duration_cast<microseconds>(state.time - last_time).count();
+        dt_us = static_cast<std::int32_t>(min<long long>(dt, MAX_DT_US + 1));
+    }
+
+    has_last = true;
+    last_time = state.time;
+
+    state.lx = axes[0].Filter(params, state.lx, dt_us);
+    state.ly = axes[1].Filter(params, state.ly, dt_us);
+    state.rx = axes[2].Filter(params, state.rx, dt_us);
+    state.ry = axes[3].Filter(params, state.ry, dt_us);
+}
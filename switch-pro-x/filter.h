@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+
+#include <cstdint>
+
+#include "decode.h"
+
+// One Euro filter parameters in the integer units the filter works in
+struct OneEuroParams
+{
+    // cutoff at rest in millihertz, lower removes more jitter
+    std::uint32_t min_cutoff;
+    // cutoff added per unit/s of stick speed in microhertz, higher lags less during fast motion
+    std::uint32_t beta;
+    // cutoff for the speed estimate in millihertz
+    std::uint32_t derivative_cutoff;
+};
+
+constexpr double DEFAULT_STICK_FILTER_CUTOFF = 1.0;
+constexpr double DEFAULT_STICK_FILTER_BETA = 0.001;
+constexpr double DEFAULT_STICK_FILTER_DERIVATIVE_CUTOFF = 1.0;
+
+OneEuroParams MakeOneEuroParams(double min_cutoff_hz, double beta_hz_per_unit, double derivative_cutoff_hz);
+
+// adaptive low-pass filter (Casiez et al., 2012) in fixed point: a low cutoff while the
+// input is still so noise around a resting position is smoothed out, rising with speed so
+// fast motion passes through with almost no lag
+class OneEuroFilter
+{
+public:
+    OneEuroFilter();
+
+    std::int16_t Filter(const OneEuroParams& params, std::int16_t value, std::int32_t dt_us);
+    void Reset();
+
+private:
+    bool started;
+    // filtered value with 8 fractional bits
+    std::int32_t value_q8;
+    // filtered speed in units/s
+    std::int64_t speed;
+};
+
+// filters all four stick axes of a controller, dt comes from the report capture times
+class StickFilter
+{
+public:
+    StickFilter();
+
+    void Apply(const OneEuroParams& params, ControllerState& state);
+
+private:
+    OneEuroFilter axes[4];
+    bool has_last;
+    std::chrono::steady_clock::time_point last_time;
+};
@@ -0,0 +1,61 @@
+#include "fusion.h"
+
+namespace
+{
+    const ControllerState NEUTRAL_HALF = {};
+}
+
+std::size_t JoyConSide(DeviceFamily family)
+{
+    return family == DEVICE_FAMILY_JOYCON_LEFT ? 0 : 1;
+}
+
+JoyConFusion::JoyConFusion()
+    : halves()
+    , present()
+{
+}
+
+ControllerState JoyConFusion::Update(DeviceFamily family, const ControllerState& state)
+{
+    const auto side = JoyConSide(family);
+
+    halves[side] = state;
+    present[side] = true;
+
+    return Merge(side);
+}
+
+ControllerState JoyConFusion::Remove(DeviceFamily family)
+{
+    const auto side = JoyConSide(family);
+
+    present[side] = false;
+
+    return Merge(1 - side);
+}
+
+ControllerState JoyConFusion::Merge(std::size_t side) const
+{
+    const auto& own = halves[side];
+    const auto& other = halves[1 - side];
+
+    // the other half can be newer than this report if its controller sampled later, that's fine,
+    // it's only dropped once it's fallen well behind
+    const bool other_live = present[1 - side] && own.time - other.time <= JOYCON_HALF_STALE_AFTER;
+
+    const auto& left = side == 0 ? own : (other_live ? other : NEUTRAL_HALF);
+    const auto& right = side == 1 ? own : (other_live ? other : NEUTRAL_HALF);
+
+    // timing comes from the report that triggered the merge
+    ControllerState merged = own;
+
+    // each decoder only fills in its own half, so the buttons never overlap
+    merged.buttons = left.buttons | right.buttons;
+    merged.lx = left.lx;
+    merged.ly = left.ly;
+    merged.rx = right.rx;
+    merged.ry = right.ry;
+
+    return merged;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+
+#include <cstddef>
+
+#include "decode.h"
+
+// a half that hasn't reported for this long, by its controller's timer, is treated as released
+// and centered so nothing sticks while a joy-con drops out
+constexpr std::chrono::milliseconds JOYCON_HALF_STALE_AFTER(100);
+
+// 0 for the left joy-con, 1 for the right one
+std::size_t JoyConSide(DeviceFamily family);
+
+// combines the reports of a left and a right joy-con into one controller state. each report's time
+// is already on the host clock through its own joy-con's clock sync, which is how the two
+// independent timers are lined up
+class JoyConFusion
+{
+public:
+    JoyConFusion();
+
+    // stores the half a joy-con of this family reported and returns it merged with the other half,
+    // so either side going out never waits for the other side's next report
+    ControllerState Update(DeviceFamily family, const ControllerState& state);
+    // forgets a side that went away and returns the remaining side's last state on its own
+    ControllerState Remove(DeviceFamily family);
+
+private:
+    ControllerState Merge(std::size_t side) const;
+
+    ControllerState halves[2];
+    bool present[2];
+};
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <limits>
+
+#include <cstdlib>
+
+#include "gate.h"
+
+namespace
+{
+    bool AxisPass(std::int16_t last, std::int16_t value, std::int16_t threshold)
+    {
+        using std::abs;
+        using std::numeric_limits;
+
+        if (value == last)
+        {
+            return false;
+        }
+
+        // center and full deflection are always exact, so a released stick never sticks just off center
+        if (value == 0 || value == numeric_limits<std::int16_t>::max() || value == numeric_limits<std::int16_t>::min())
+        {
+            return true;
+        }
+
+        return abs(static_cast<int>(value) - last) >= threshold;
+    }
+
+    bool TriggerPass(std::uint8_t last, std::uint8_t value, std::uint8_t threshold)
+    {
+        using std::abs;
+
+        if (value == last)
+        {
+            return false;
+        }
+
+        if (value == 0 || value == 0xFF)
+        {
+            return true;
+        }
+
+        return abs(static_cast<int>(value) - last) >= threshold;
+    }
+
+    bool AnyThreshold(const ReportGateParams& params)
+    {
+        using std::any_of;
+
+        return any_of(params.stick_threshold.begin(), params.stick_threshold.end(), [](auto t) { return t > 1; }) || params.trigger_threshold > 1;
+    }
+}
+
+ReportGate::ReportGate(const ReportGateParams& _params)
+    : params(_params)
+    , enabled(AnyThreshold(_params))
+{
+}
+
+void ReportGate::SetParams(const ReportGateParams& _params)
+{
+    params = _params;
+    enabled = AnyThreshold(_params);
+}
+
+bool ReportGate::Enabled() const
+{
+    return enabled;
+}
+
+bool ReportGate::Pass(const XUSB_REPORT& last, const XUSB_REPORT& report, std::chrono::steady_clock::time_point now) const
+{
+    if (report.wButtons != last.wButtons)
+    {
+        return true;
+    }
+
+    if (now - last_submit >= params.max_staleness)
+    {
+        return true;
+    }
+
+    return
+        AxisPass(last.sThumbLX, report.sThumbLX, params.stick_threshold[0]) ||
+        AxisPass(last.sThumbLY, report.sThumbLY, params.stick_threshold[1]) ||
+        AxisPass(last.sThumbRX, report.sThumbRX, params.stick_threshold[2]) ||
+        AxisPass(last.sThumbRY, report.sThumbRY, params.stick_threshold[3]) ||
+        TriggerPass(last.bLeftTrigger, report.bLeftTrigger, params.trigger_threshold) ||
+        TriggerPass(last.bRightTrigger, report.bRightTrigger, params.trigger_threshold);
+}
+
+void ReportGate::Submitted(std::chrono::steady_clock::time_point now)
+{
+    last_submit = now;
+}
+
+bool ParseStickThresholds(const char* arg, std::array<std::int16_t, 4>& thresholds)
+{
+    using std::strtol;
+
+    const char* pos = arg;
+
+    for (std::size_t i = 0; i < thresholds.size(); i++)
+    {
+        char* end;
+        const auto value = strtol(pos, &end, 10);
+
+        if (end == pos || value < 0 || value > 0x7FFF)
+        {
+            return false;
+        }
+
+        thresholds[i] = static_cast<std::int16_t>(value);
+
+        if (*end == '\0')
+        {
+            // one value for every axis
+            if (i == 0)
+            {
+                thresholds.fill(thresholds[0]);
+                return true;
+            }
+
+            return i == thresholds.size() - 1;
+        }
+
+        if (*end != ',')
+        {
+            return false;
+        }
+
+        pos = end + 1;
+    }
+
+    return false;
+}
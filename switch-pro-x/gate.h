@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <array>
+#include <chrono>
+
+#include <cstdint>
+
+struct ReportGateParams
+{
+    // a stick axis has to move this far from the last submitted value, lx ly rx ry
+    std::array<std::int16_t, 4> stick_threshold;
+    std::uint8_t trigger_threshold;
+    // smaller changes still go out once the last submit is this old
+    std::chrono::milliseconds max_staleness;
+};
+
+// decides whether a changed report is worth a vigem_xusb_submit_report call. buttons always pass,
+// analog values only once they leave a hysteresis band around what the driver last saw.
+class ReportGate
+{
+public:
+    explicit ReportGate(const ReportGateParams& _params);
+
+    void SetParams(const ReportGateParams& _params);
+    bool Enabled() const;
+    bool Pass(const XUSB_REPORT& last, const XUSB_REPORT& report, std::chrono::steady_clock::time_point now) const;
+    void Submitted(std::chrono::steady_clock::time_point now);
+
+private:
+    ReportGateParams params;
+    bool enabled;
+    std::chrono::steady_clock::time_point last_submit;
+};
+
+// a single value for every axis, or lx,ly,rx,ry separated by commas
+bool ParseStickThresholds(const char* arg, std::array<std::int16_t, 4>& thresholds);
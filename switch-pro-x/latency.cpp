@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+#include <cmath>
+
+#include "latency.h"
+
+namespace
+{
+    const char* STAGE_NAMES[LATENCY_STAGE_COUNT] = {
+        "decode",
+        "map",
+        "submit",
+        "input total",
+        "capture total",
+        "rumble total",
+        "write",
+    };
+
+    unsigned int HighestBit(std::uint64_t val)
+    {
+        unsigned int ret = 0;
+
+        for (unsigned int step = 32; step > 0; step >>= 1)
+        {
+            if (val >= (1ull << step))
+            {
+                val >>= step;
+                ret += step;
+            }
+        }
+
+        return ret;
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+std::size_t LatencyHistogram::BucketIndex(std::uint64_t ns)
+{
+    using std::min;
+
+    ns = min<std::uint64_t>(ns, (1ull << MAX_VALUE_BITS) - 1);
+
+    if (ns < SUB_BUCKETS)
+    {
+        return static_cast<std::size_t>(ns);
+    }
+
+    // ns >> shift lands in [SUB_BUCKETS, 2 * SUB_BUCKETS)
+    const auto shift = HighestBit(ns) - SUB_BUCKET_BITS;
+
+    return static_cast<std::size_t>((shift + 1) * SUB_BUCKETS + ((ns >> shift) - SUB_BUCKETS));
+}
+
+std::uint64_t LatencyHistogram::BucketUpperBound(std::size_t index)
+{
+    if (index < SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    const auto shift = index / SUB_BUCKETS - 1;
+    const auto sub = index % SUB_BUCKETS;
+
+    return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(std::uint64_t ns)
+{
+    using std::memory_order_relaxed;
+
+    buckets[BucketIndex(ns)].fetch_add(1, memory_order_relaxed);
+    count.fetch_add(1, memory_order_relaxed);
+
+    auto current = max.load(memory_order_relaxed);
+
+    while (ns > current && !max.compare_exchange_weak(current, ns, memory_order_relaxed));
+}
+
+std::uint64_t LatencyHistogram::Count() const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::Max() const
+{
+    return max.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::Percentile(double percentile) const
+{
+    using std::ceil;
+    using std::memory_order_relaxed;
+    using std::min;
+
+    const auto total = Count();
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    // round up so p99.9 of 1000 samples is the 999th smallest
+    auto target = static_cast<std::uint64_t>(ceil(percentile / 100.0 * total));
+    target = min<std::uint64_t>(total, target == 0 ? 1 : target);
+
+    std::uint64_t seen = 0;
+
+    for (std::size_t i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += buckets[i].load(memory_order_relaxed);
+
+        if (seen >= target)
+        {
+            return min<std::uint64_t>(BucketUpperBound(i), Max());
+        }
+    }
+
+    return Max();
+}
+
+void LatencyHistogram::Reset()
+{
+    using std::memory_order_relaxed;
+
+    for (auto& bucket : buckets)
+    {
+        bucket.store(0, memory_order_relaxed);
+    }
+
+    count.store(0, memory_order_relaxed);
+    max.store(0, memory_order_relaxed);
+}
+
+void LatencyStats::Record(LatencyStage stage, std::chrono::steady_clock::duration duration)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+
+    const auto ns = duration_cast<nanoseconds>(duration).count();
+
+    stages[stage].Record(ns > 0 ? static_cast<std::uint64_t>(ns) : 0);
+}
+
+bool LatencyStats::Empty() const
+{
+    using std::all_of;
+
+    return all_of(stages.begin(), stages.end(), [](const auto& h) { return h.Count() == 0; });
+}
+
+void LatencyStats::Print(std::ostream& out) const
+{
+    using std::endl;
+    using std::fixed;
+    using std::left;
+    using std::right;
+    using std::setprecision;
+    using std::setw;
+
+    const auto us = [](std::uint64_t ns) { return ns / 1000.0; };
+
+    out << "  " << left << setw(14) << "stage" << right << setw(10) << "count";
+    out << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "p99.9 us" << setw(12) << "max us" << endl;
+
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++)
+    {
+        const auto& h = stages[i];
+
+        if (h.Count() == 0)
+        {
+            continue;
+        }
+
+        out << "  " << left << setw(14) << STAGE_NAMES[i] << right << setw(10) << h.Count() << fixed << setprecision(1);
+        out << setw(12) << us(h.Percentile(50.0));
+        out << setw(12) << us(h.Percentile(99.0));
+        out << setw(12) << us(h.Percentile(99.9));
+        out << setw(12) << us(h.Max()) << endl;
+    }
+}
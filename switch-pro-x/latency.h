@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+#include <cstddef>
+#include <cstdint>
+
+// HDR style log-linear histogram of nanosecond values, each power of two is split into
+// SUB_BUCKETS linear buckets so the relative error stays around 3% over the whole range.
+// Recording only does relaxed atomic increments, so any thread can record or read at any time.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void Record(std::uint64_t ns);
+    std::uint64_t Count() const;
+    std::uint64_t Max() const;
+    std::uint64_t Percentile(double percentile) const;
+    void Reset();
+
+private:
+    static constexpr unsigned int SUB_BUCKET_BITS = 5;
+    static constexpr std::uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    // values past 2^40ns (about 18 minutes) are clamped into the last bucket
+    static constexpr unsigned int MAX_VALUE_BITS = 40;
+    static constexpr std::size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static std::size_t BucketIndex(std::uint64_t ns);
+    static std::uint64_t BucketUpperBound(std::size_t index);
+
+    std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> buckets;
+    std::atomic<std::uint64_t> count;
+    std::atomic<std::uint64_t> max;
+};
+
+enum LatencyStage
+{
+    // read completion to decoded state
+    LATENCY_STAGE_DECODE,
+    // decoded state to xinput report
+    LATENCY_STAGE_MAP,
+    // vigem_xusb_submit_report call
+    LATENCY_STAGE_SUBMIT,
+    // read completion to submit returning, only for reports that were submitted
+    LATENCY_STAGE_INPUT_TOTAL,
+    // estimated controller sample time to submit returning, includes the transport
+    LATENCY_STAGE_CAPTURE_TOTAL,
+    // HandleXUSBCallback to the rumble packet being written
+    LATENCY_STAGE_RUMBLE_TOTAL,
+    // WriteData call
+    LATENCY_STAGE_WRITE,
+
+    LATENCY_STAGE_COUNT
+};
+
+class LatencyStats
+{
+public:
+    void Record(LatencyStage stage, std::chrono::steady_clock::duration duration);
+    bool Empty() const;
+    void Print(std::ostream& out) const;
+
+private:
+    std::array<LatencyHistogram, LATENCY_STAGE_COUNT> stages;
+};
@@ -0,0 +1,184 @@
+#include <iostream>
+
+#include "clock_sync.h"
+#include "link.h"
+#include "protocol.h"
+
+namespace
+{
+    constexpr std::chrono::seconds LINK_WINDOW(5);
+
+    // a link delivering less than this share of its nominal rate is reported as degraded
+    constexpr double DEGRADED_RATE = 0.9;
+
+    std::uint64_t Nanoseconds(std::chrono::steady_clock::duration duration)
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+
+        const auto ns = duration_cast<nanoseconds>(duration).count();
+
+        return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+    }
+}
+
+LinkAnalyzer::LinkAnalyzer(DeviceStats& _stats, unsigned int _id)
+    : stats(_stats)
+    , id(_id)
+    , nominal_interval(USB_REPORT_INTERVAL)
+    , has_last(false)
+    , last_timed(false)
+    , last_timer(0)
+    , window_reports(0)
+    , window_dropped(0)
+    , window_duplicated(0)
+    , window_timed(false)
+    , current(0)
+    , summary_timed(false)
+    , degraded(false)
+    , summary_reports(0)
+    , summary_elapsed(0)
+    , summary_dropped(0)
+    , summary_duplicated(0)
+{
+}
+
+void LinkAnalyzer::SetNominalInterval(std::chrono::steady_clock::duration interval)
+{
+    nominal_interval = interval;
+}
+
+std::uint64_t LinkAnalyzer::Record(std::chrono::steady_clock::time_point received, bool timed, std::uint8_t timer)
+{
+    using std::memory_order_relaxed;
+    using std::chrono::steady_clock;
+
+    if (!has_last)
+    {
+        has_last = true;
+        last_timed = timed;
+        last_timer = timer;
+        last_received = received;
+        window_start = received;
+
+        return 0;
+    }
+
+    const auto index = current.load(memory_order_relaxed);
+    const auto host_interval = received - last_received;
+    std::uint64_t dropped = 0;
+
+    intervals[index].Record(Nanoseconds(host_interval));
+    window_reports++;
+
+    if (timed && last_timed)
+    {
+        window_timed = true;
+
+        const auto ticks = UnwrapTimer(last_timer, timer, host_interval);
+
+        if (ticks == 0)
+        {
+            // nothing advanced on the controller, we got the same report twice
+            window_duplicated++;
+            stats.Increment(DEVICE_COUNTER_DUPLICATED);
+        }
+        else
+        {
+            const steady_clock::duration controller_interval = CONTROLLER_TIMER_TICK * ticks;
+
+            // anything more than half an interval past the next nominal report means reports went missing
+            const auto missing = (controller_interval + nominal_interval / 2) / nominal_interval - 1;
+
+            if (missing > 0)
+            {
+                dropped = static_cast<std::uint64_t>(missing);
+                window_dropped += dropped;
+                stats.Increment(DEVICE_COUNTER_DROPPED, dropped);
+            }
+
+            jitter[index].Record(Nanoseconds(host_interval > controller_interval ? host_interval - controller_interval : controller_interval - host_interval));
+        }
+    }
+
+    last_timed = timed;
+    last_timer = timer;
+    last_received = received;
+
+    if (received - window_start >= LINK_WINDOW)
+    {
+        FinishWindow(received);
+    }
+
+    return dropped;
+}
+
+void LinkAnalyzer::FinishWindow(std::chrono::steady_clock::time_point now)
+{
+    using std::cout;
+    using std::endl;
+    using std::memory_order_relaxed;
+
+    const auto elapsed = now - window_start;
+    const auto index = current.load(memory_order_relaxed);
+
+    summary_timed.store(window_timed, memory_order_relaxed);
+    summary_reports.store(window_reports, memory_order_relaxed);
+    summary_elapsed.store(Nanoseconds(elapsed), memory_order_relaxed);
+    summary_dropped.store(window_dropped, memory_order_relaxed);
+    summary_duplicated.store(window_duplicated, memory_order_relaxed);
+
+    // without a timer a quiet controller looks the same as a bad link, so only judge timed streams
+    const auto expected = static_cast<double>(elapsed.count()) / nominal_interval.count();
+    const bool now_degraded = window_timed && window_reports < expected * DEGRADED_RATE;
+
+    if (now_degraded != degraded.load(memory_order_relaxed))
+    {
+        cout << "LINK " << (now_degraded ? "DEGRADED" : "RECOVERED") << " ON DEVICE " << id << ": ";
+        cout << window_reports << " REPORTS IN " << (Nanoseconds(elapsed) / 1000000) << "MS, " << window_dropped << " DROPPED" << endl;
+
+        if (now_degraded)
+        {
+            stats.Increment(DEVICE_COUNTER_LINK_DEGRADED);
+        }
+
+        degraded.store(now_degraded, memory_order_relaxed);
+    }
+
+    // readers now see the window that just finished
+    intervals[index ^ 1].Reset();
+    jitter[index ^ 1].Reset();
+    current.store(index ^ 1, memory_order_relaxed);
+
+    window_start = now;
+    window_reports = 0;
+    window_dropped = 0;
+    window_duplicated = 0;
+    window_timed = false;
+}
+
+LinkSummary LinkAnalyzer::Summary() const
+{
+    using std::memory_order_relaxed;
+    using std::chrono::duration;
+
+    const auto& last_intervals = intervals[current.load(memory_order_relaxed) ^ 1];
+    const auto& last_jitter = jitter[current.load(memory_order_relaxed) ^ 1];
+    const auto elapsed = summary_elapsed.load(memory_order_relaxed);
+
+    LinkSummary summary;
+    summary.timed = summary_timed.load(memory_order_relaxed);
+    summary.degraded = degraded.load(memory_order_relaxed);
+    summary.rate = elapsed > 0 ? summary_reports.load(memory_order_relaxed) * 1e9 / elapsed : 0.0;
+    summary.nominal_rate = 1.0 / duration<double>(nominal_interval).count();
+    summary.dropped = summary_dropped.load(memory_order_relaxed);
+    summary.duplicated = summary_duplicated.load(memory_order_relaxed);
+    summary.interval_p50 = last_intervals.Percentile(50.0);
+    summary.interval_p99 = last_intervals.Percentile(99.0);
+    summary.interval_max = last_intervals.Max();
+    summary.jitter_p50 = last_jitter.Percentile(50.0);
+    summary.jitter_p99 = last_jitter.Percentile(99.0);
+    summary.jitter_max = last_jitter.Max();
+
+    return summary;
+}
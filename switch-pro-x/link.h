@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include <cstdint>
+
+#include "latency.h"
+#include "stats.h"
+
+struct LinkSummary
+{
+    // false when the reports carry no timer byte (simple reports, before a bluetooth controller
+    // is switched to full ones), then only the host side intervals are known and drops can't be
+    // told apart from idle time
+    bool timed;
+    bool degraded;
+    double rate;
+    double nominal_rate;
+    // over the last complete window
+    std::uint64_t dropped;
+    std::uint64_t duplicated;
+    std::uint64_t interval_p50;
+    std::uint64_t interval_p99;
+    std::uint64_t interval_max;
+    // difference between host and controller intervals, includes the 5ms resolution of the timer
+    std::uint64_t jitter_p50;
+    std::uint64_t jitter_p99;
+    std::uint64_t jitter_max;
+};
+
+// compares the controller's timer byte against host receive times to find dropped and
+// duplicated reports and transport jitter. statistics are kept per window and the last
+// complete window is what readers see, Record is only called from the read thread.
+class LinkAnalyzer
+{
+public:
+    LinkAnalyzer(DeviceStats& _stats, unsigned int _id);
+
+    void SetNominalInterval(std::chrono::steady_clock::duration interval);
+    // how many reports went missing right before this one
+    std::uint64_t Record(std::chrono::steady_clock::time_point received, bool timed, std::uint8_t timer);
+    LinkSummary Summary() const;
+
+private:
+    void FinishWindow(std::chrono::steady_clock::time_point now);
+
+    DeviceStats& stats;
+    const unsigned int id;
+    std::chrono::steady_clock::duration nominal_interval;
+
+    bool has_last;
+    bool last_timed;
+    std::uint8_t last_timer;
+    std::chrono::steady_clock::time_point last_received;
+
+    std::chrono::steady_clock::time_point window_start;
+    std::uint64_t window_reports;
+    std::uint64_t window_dropped;
+    std::uint64_t window_duplicated;
+    bool window_timed;
+
+    // [current] is being filled, the other one holds the last complete window
+    std::array<LatencyHistogram, 2> intervals;
+    std::array<LatencyHistogram, 2> jitter;
+    std::atomic<unsigned int> current;
+
+    std::atomic<bool> summary_timed;
+    std::atomic<bool> degraded;
+    std::atomic<std::uint64_t> summary_reports;
+    std::atomic<std::uint64_t> summary_elapsed;
+    std::atomic<std::uint64_t> summary_dropped;
+    std::atomic<std::uint64_t> summary_duplicated;
+};
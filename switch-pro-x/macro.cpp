@@ -0,0 +1,433 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include <cstdlib>
+
+#include "decode.h"
+#include "macro.h"
+#include "trace.h"
+
+namespace
+{
+    bool ParsePositive(const std::string& text, double& value)
+    {
+        using std::strtod;
+
+        char* end;
+        value = strtod(text.c_str(), &end);
+
+        return end != text.c_str() && *end == '\0' && value > 0.0;
+    }
+}
+
+bool ParseTurbo(const std::string& text, TurboConfig& config)
+{
+    using std::cerr;
+    using std::endl;
+    using std::string;
+    using std::chrono::duration;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    const auto colon = text.find(':');
+    double rate = DEFAULT_TURBO_RATE;
+
+    if (!ParseButtonNames(text.substr(0, colon), config.button) || config.button == 0 ||
+        (config.button & (config.button - 1)) != 0 ||
+        (colon != string::npos && !ParsePositive(text.substr(colon + 1), rate)))
+    {
+        cerr << "invalid turbo: " << text << endl;
+        return false;
+    }
+
+    // a press and a release per period
+    config.half_period = duration_cast<microseconds>(duration<double>(0.5 / rate));
+
+    if (config.half_period < TimerWheel::TICK)
+    {
+        cerr << "turbo rate too high: " << text << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool ParseMacro(const std::string& text, MacroConfig& config)
+{
+    using std::cerr;
+    using std::endl;
+    using std::string;
+    using std::chrono::duration;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::milli;
+
+    const auto equals = text.find('=');
+
+    if (equals == string::npos || !ParseButtonNames(text.substr(0, equals), config.trigger) || config.trigger == 0)
+    {
+        cerr << "invalid macro trigger: " << text << endl;
+        return false;
+    }
+
+    config.steps.clear();
+
+    auto pos = equals + 1;
+
+    while (pos <= text.size())
+    {
+        auto next = text.find(',', pos);
+
+        if (next == string::npos)
+        {
+            next = text.size();
+        }
+
+        const auto step_text = text.substr(pos, next - pos);
+        const auto colon = step_text.find(':');
+        MacroStep step;
+        double ms;
+
+        if (colon == string::npos || !ParseButtonNames(step_text.substr(0, colon), step.buttons) || !ParsePositive(step_text.substr(colon + 1), ms))
+        {
+            cerr << "invalid macro step: " << step_text << endl;
+            return false;
+        }
+
+        step.duration = duration_cast<microseconds>(duration<double, milli>(ms));
+
+        if (step.duration < TimerWheel::TICK)
+        {
+            cerr << "macro step too short: " << step_text << endl;
+            return false;
+        }
+
+        config.steps.push_back(step);
+        pos = next + 1;
+    }
+
+    return true;
+}
+
+MacroEngine::MacroEngine(const IoSchedulingConfig& _scheduling)
+    : scheduling(_scheduling)
+    , wheel(std::chrono::steady_clock::now())
+    , timer(nullptr)
+    , wake_event(nullptr)
+    , quit_event(nullptr)
+{
+    using std::cerr;
+    using std::endl;
+
+    // high resolution timers need windows 10 1803, older versions get the normal timer resolution
+    timer = CreateWaitableTimerEx(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+    if (timer == nullptr)
+    {
+        timer = CreateWaitableTimer(nullptr, FALSE, nullptr);
+    }
+
+    wake_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    quit_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    if (timer == nullptr || wake_event == nullptr || quit_event == nullptr)
+    {
+        cerr << "error creating macro timer (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    thread = std::thread(&MacroEngine::EngineThread, this);
+}
+
+MacroEngine::~MacroEngine()
+{
+    if (thread.joinable())
+    {
+        SetEvent(quit_event);
+        thread.join();
+    }
+
+    for (auto h : { timer, wake_event, quit_event })
+    {
+        if (h != nullptr)
+        {
+            CloseHandle(h);
+        }
+    }
+}
+
+bool MacroEngine::Valid()
+{
+    return thread.joinable();
+}
+
+std::uint64_t MacroEngine::Schedule(std::chrono::steady_clock::time_point deadline, const void* owner, TimerWheel::Callback callback)
+{
+    using std::lock_guard;
+    using std::move;
+    using std::recursive_mutex;
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::chrono::steady_clock;
+
+    lock_guard<recursive_mutex> lk(mutex);
+
+    const auto id = wheel.Schedule(deadline, owner, [this, callback = move(callback)](steady_clock::time_point due) {
+        const auto late = duration_cast<nanoseconds>(steady_clock::now() - due).count();
+        lateness.Record(late > 0 ? static_cast<std::uint64_t>(late) : 0);
+
+        callback(due);
+    });
+
+    // the engine thread picks up new timers on its own once its callbacks return
+    if (std::this_thread::get_id() != thread.get_id())
+    {
+        SetEvent(wake_event);
+    }
+
+    return id;
+}
+
+void MacroEngine::Cancel(std::uint64_t id)
+{
+    using std::lock_guard;
+    using std::recursive_mutex;
+
+    lock_guard<recursive_mutex> lk(mutex);
+
+    wheel.Cancel(id);
+}
+
+void MacroEngine::CancelOwner(const void* owner)
+{
+    using std::lock_guard;
+    using std::recursive_mutex;
+
+    lock_guard<recursive_mutex> lk(mutex);
+
+    wheel.CancelOwner(owner);
+}
+
+std::unique_lock<std::recursive_mutex> MacroEngine::Lock()
+{
+    return std::unique_lock<std::recursive_mutex>(mutex);
+}
+
+const LatencyHistogram& MacroEngine::Lateness() const
+{
+    return lateness;
+}
+
+void MacroEngine::EngineThread()
+{
+    using std::lock_guard;
+    using std::max;
+    using std::recursive_mutex;
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::chrono::steady_clock;
+
+    TraceThreadName("macro engine");
+    IoThreadScheduling thread_scheduling(scheduling);
+
+    const HANDLE handles[] = { quit_event, wake_event, timer };
+
+    for (;;)
+    {
+        steady_clock::time_point next;
+
+        {
+            lock_guard<recursive_mutex> lk(mutex);
+
+            wheel.Advance(steady_clock::now());
+            next = wheel.NextDeadline();
+        }
+
+        DWORD count = 2;
+
+        if (next != steady_clock::time_point::max())
+        {
+            const auto wait = duration_cast<nanoseconds>(next - steady_clock::now()).count();
+
+            if (wait <= 0)
+            {
+                continue;
+            }
+
+            // relative due times are negative, in 100ns units
+            LARGE_INTEGER due;
+            due.QuadPart = -max<LONGLONG>(1, wait / 100);
+
+            SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE);
+            count = 3;
+        }
+
+        if (WaitForMultipleObjects(count, handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+        {
+            break;
+        }
+    }
+}
+
+MacroPlayer::MacroPlayer(MacroEngine* _engine, const std::vector<TurboConfig>& _turbos, const std::vector<MacroConfig>& _macros, std::function<void()> _inject)
+    : engine(_engine)
+    , turbos(_turbos)
+    , macros(_macros)
+    , inject(std::move(_inject))
+    , last_buttons(0)
+    , stopped(false)
+    , turbo_timers(_turbos.size(), 0)
+    , turbo_released(0)
+    , macro_playing(_macros.size(), false)
+    , macro_buttons(_macros.size(), 0)
+    , force_on(0)
+    , force_off(0)
+{
+}
+
+MacroPlayer::~MacroPlayer()
+{
+    Stop();
+}
+
+bool MacroPlayer::Enabled() const
+{
+    return engine != nullptr && (!turbos.empty() || !macros.empty());
+}
+
+void MacroPlayer::Update(std::uint32_t buttons, std::chrono::steady_clock::time_point now)
+{
+    const auto changed = buttons ^ last_buttons;
+    const auto previous = last_buttons;
+    last_buttons = buttons;
+
+    // nothing to do until a button changes, which keeps the lock out of the common path
+    if (changed == 0 || !Enabled())
+    {
+        return;
+    }
+
+    auto lk = engine->Lock();
+
+    if (stopped)
+    {
+        return;
+    }
+
+    for (std::size_t i = 0; i < turbos.size(); i++)
+    {
+        const auto& turbo = turbos[i];
+
+        if (!(changed & turbo.button))
+        {
+            continue;
+        }
+
+        // every press starts on the pressed half
+        turbo_released &= ~turbo.button;
+
+        if (buttons & turbo.button)
+        {
+            turbo_timers[i] = engine->Schedule(now + turbo.half_period, this, [this, i](auto deadline) {
+                TurboToggle(i, deadline);
+                inject();
+            });
+        }
+        else if (turbo_timers[i] != 0)
+        {
+            engine->Cancel(turbo_timers[i]);
+            turbo_timers[i] = 0;
+        }
+    }
+
+    for (std::size_t i = 0; i < macros.size(); i++)
+    {
+        const auto trigger = macros[i].trigger;
+
+        if ((buttons & trigger) == trigger && (previous & trigger) != trigger && !macro_playing[i])
+        {
+            macro_playing[i] = true;
+            PlayStep(i, 0, now);
+        }
+    }
+
+    UpdateMasks();
+}
+
+std::uint32_t MacroPlayer::Apply(std::uint32_t buttons) const
+{
+    using std::memory_order_relaxed;
+
+    return (buttons & ~force_off.load(memory_order_relaxed)) | force_on.load(memory_order_relaxed);
+}
+
+void MacroPlayer::Stop()
+{
+    if (engine == nullptr)
+    {
+        return;
+    }
+
+    auto lk = engine->Lock();
+
+    stopped = true;
+    engine->CancelOwner(this);
+}
+
+void MacroPlayer::TurboToggle(std::size_t index, std::chrono::steady_clock::time_point deadline)
+{
+    const auto& turbo = turbos[index];
+
+    turbo_released ^= turbo.button;
+
+    // scheduled from the deadline rather than now so the rate doesn't drift
+    turbo_timers[index] = engine->Schedule(deadline + turbo.half_period, this, [this, index](auto next) {
+        TurboToggle(index, next);
+        inject();
+    });
+
+    UpdateMasks();
+}
+
+void MacroPlayer::PlayStep(std::size_t index, std::size_t step, std::chrono::steady_clock::time_point deadline)
+{
+    const auto& macro = macros[index];
+
+    if (step >= macro.steps.size())
+    {
+        macro_playing[index] = false;
+        macro_buttons[index] = 0;
+    }
+    else
+    {
+        macro_buttons[index] = macro.steps[step].buttons;
+
+        engine->Schedule(deadline + macro.steps[step].duration, this, [this, index, step](auto next) {
+            PlayStep(index, step + 1, next);
+            inject();
+        });
+    }
+
+    UpdateMasks();
+}
+
+void MacroPlayer::UpdateMasks()
+{
+    using std::memory_order_relaxed;
+
+    std::uint32_t on = 0;
+    std::uint32_t off = turbo_released;
+
+    for (std::size_t i = 0; i < macros.size(); i++)
+    {
+        on |= macro_buttons[i];
+        off |= macro_playing[i] ? macros[i].trigger : 0;
+    }
+
+    force_on.store(on, memory_order_relaxed);
+    force_off.store(off, memory_order_relaxed);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "latency.h"
+#include "scheduling.h"
+#include "timer_wheel.h"
+
+// while the button is held it's released and pressed again at this rate
+struct TurboConfig
+{
+    std::uint32_t button;
+    std::chrono::microseconds half_period;
+};
+
+struct MacroStep
+{
+    // CONTROLLER_BUTTON_* bits held for duration, 0 for a pause
+    std::uint32_t buttons;
+    // at least TimerWheel::TICK, kept in microseconds so fractional milliseconds aren't lost
+    std::chrono::microseconds duration;
+};
+
+// pressing every button of trigger plays the steps once, the trigger is hidden while it plays
+struct MacroConfig
+{
+    std::uint32_t trigger;
+    std::vector<MacroStep> steps;
+};
+
+constexpr double DEFAULT_TURBO_RATE = 10.0;
+
+// <button>[:<hz>] and <trigger>=<buttons>:<ms>,<buttons>:<ms>,... with buttons joined by +, - for none
+bool ParseTurbo(const std::string& text, TurboConfig& config);
+bool ParseMacro(const std::string& text, MacroConfig& config);
+
+// one timer wheel and one thread for every controller's turbo and macro timers. the thread sleeps
+// on a high resolution waitable timer until the next deadline, callbacks run on it with the engine
+// lock held and may schedule or cancel timers themselves.
+class MacroEngine
+{
+public:
+    explicit MacroEngine(const IoSchedulingConfig& _scheduling);
+    ~MacroEngine();
+
+    bool Valid();
+
+    std::uint64_t Schedule(std::chrono::steady_clock::time_point deadline, const void* owner, TimerWheel::Callback callback);
+    void Cancel(std::uint64_t id);
+    // once this returns none of owner's callbacks are running or will run
+    void CancelOwner(const void* owner);
+    std::unique_lock<std::recursive_mutex> Lock();
+
+    // how late callbacks ran compared to their deadline
+    const LatencyHistogram& Lateness() const;
+
+private:
+    void EngineThread();
+
+    const IoSchedulingConfig scheduling;
+    std::recursive_mutex mutex;
+    TimerWheel wheel;
+    LatencyHistogram lateness;
+
+    HANDLE timer;
+    HANDLE wake_event;
+    HANDLE quit_event;
+    std::thread thread;
+};
+
+// the turbo and macro state of one controller. Update is called by the read thread with the
+// physical buttons of every report, Apply turns them into the buttons to submit. whenever a
+// timer changes the output on its own, inject is called from the engine thread to resubmit.
+class MacroPlayer
+{
+public:
+    MacroPlayer(MacroEngine* _engine, const std::vector<TurboConfig>& _turbos, const std::vector<MacroConfig>& _macros, std::function<void()> _inject);
+    ~MacroPlayer();
+
+    bool Enabled() const;
+    void Update(std::uint32_t buttons, std::chrono::steady_clock::time_point now);
+    std::uint32_t Apply(std::uint32_t buttons) const;
+    // cancels every timer, inject won't be called after this returns
+    void Stop();
+
+private:
+    void TurboToggle(std::size_t index, std::chrono::steady_clock::time_point deadline);
+    void PlayStep(std::size_t index, std::size_t step, std::chrono::steady_clock::time_point deadline);
+    void UpdateMasks();
+
+    MacroEngine* const engine;
+    const std::vector<TurboConfig> turbos;
+    const std::vector<MacroConfig> macros;
+    const std::function<void()> inject;
+
+    // read thread only
+    std::uint32_t last_buttons;
+
+    // everything below is changed with the engine lock held
+    bool stopped;
+    std::vector<std::uint64_t> turbo_timers;
+    std::uint32_t turbo_released;
+    std::vector<bool> macro_playing;
+    std::vector<std::uint32_t> macro_buttons;
+
+    std::atomic<std::uint32_t> force_on;
+    std::atomic<std::uint32_t> force_off;
+};
@@ -0,0 +1,205 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#include "mapping.h"
+
+namespace
+{
+    struct TargetName
+    {
+        const char* name;
+        MappingTarget target;
+    };
+
+    const TargetName TARGET_NAMES[] = {
+        { "A", { XUSB_GAMEPAD_A, false, false } },
+        { "B", { XUSB_GAMEPAD_B, false, false } },
+        { "X", { XUSB_GAMEPAD_X, false, false } },
+        { "Y", { XUSB_GAMEPAD_Y, false, false } },
+        { "UP", { XUSB_GAMEPAD_DPAD_UP, false, false } },
+        { "DOWN", { XUSB_GAMEPAD_DPAD_DOWN, false, false } },
+        { "LEFT", { XUSB_GAMEPAD_DPAD_LEFT, false, false } },
+        { "RIGHT", { XUSB_GAMEPAD_DPAD_RIGHT, false, false } },
+        { "START", { XUSB_GAMEPAD_START, false, false } },
+        { "BACK", { XUSB_GAMEPAD_BACK, false, false } },
+        { "GUIDE", { XUSB_GAMEPAD_GUIDE, false, false } },
+        { "LB", { XUSB_GAMEPAD_LEFT_SHOULDER, false, false } },
+        { "RB", { XUSB_GAMEPAD_RIGHT_SHOULDER, false, false } },
+        { "LT", { 0, true, false } },
+        { "RT", { 0, false, true } },
+        { "LS", { XUSB_GAMEPAD_LEFT_THUMB, false, false } },
+        { "RS", { XUSB_GAMEPAD_RIGHT_THUMB, false, false } },
+    };
+
+    std::size_t ButtonIndex(std::uint32_t button)
+    {
+        std::size_t index = 0;
+
+        while (button > 1)
+        {
+            button >>= 1;
+            index++;
+        }
+
+        return index;
+    }
+
+    std::int16_t Invert(std::int16_t value)
+    {
+        using std::int16_t;
+        using std::numeric_limits;
+
+        return value == numeric_limits<int16_t>::min() ? numeric_limits<int16_t>::max() : static_cast<int16_t>(-value);
+    }
+}
+
+MappingSettings DefaultMappingSettings()
+{
+    MappingSettings settings = {};
+
+    const auto set = [&](std::uint32_t button, MappingTarget target) { settings.targets[ButtonIndex(button)] = target; };
+
+    // assign a/b/x/y so they match the positions on the xbox layout
+    set(CONTROLLER_BUTTON_A, { XUSB_GAMEPAD_B, false, false });
+    set(CONTROLLER_BUTTON_B, { XUSB_GAMEPAD_A, false, false });
+    set(CONTROLLER_BUTTON_X, { XUSB_GAMEPAD_Y, false, false });
+    set(CONTROLLER_BUTTON_Y, { XUSB_GAMEPAD_X, false, false });
+
+    set(CONTROLLER_BUTTON_DPAD_UP, { XUSB_GAMEPAD_DPAD_UP, false, false });
+    set(CONTROLLER_BUTTON_DPAD_DOWN, { XUSB_GAMEPAD_DPAD_DOWN, false, false });
+    set(CONTROLLER_BUTTON_DPAD_LEFT, { XUSB_GAMEPAD_DPAD_LEFT, false, false });
+    set(CONTROLLER_BUTTON_DPAD_RIGHT, { XUSB_GAMEPAD_DPAD_RIGHT, false, false });
+
+    set(CONTROLLER_BUTTON_PLUS, { XUSB_GAMEPAD_START, false, false });
+    set(CONTROLLER_BUTTON_MINUS, { XUSB_GAMEPAD_BACK, false, false });
+    set(CONTROLLER_BUTTON_HOME, { XUSB_GAMEPAD_GUIDE, false, false });
+    // share has no xbox counterpart
+    set(CONTROLLER_BUTTON_SHARE, { 0, false, false });
+
+    set(CONTROLLER_BUTTON_L, { XUSB_GAMEPAD_LEFT_SHOULDER, false, false });
+    set(CONTROLLER_BUTTON_ZL, { 0, true, false });
+    set(CONTROLLER_BUTTON_THUMB_L, { XUSB_GAMEPAD_LEFT_THUMB, false, false });
+
+    set(CONTROLLER_BUTTON_R, { XUSB_GAMEPAD_RIGHT_SHOULDER, false, false });
+    set(CONTROLLER_BUTTON_ZR, { 0, false, true });
+    set(CONTROLLER_BUTTON_THUMB_R, { XUSB_GAMEPAD_RIGHT_THUMB, false, false });
+
+    return settings;
+}
+
+MappingPlan CompileMapping(const MappingSettings& settings)
+{
+    MappingPlan plan = {};
+
+    for (std::size_t table = 0; table < MappingPlan::TABLES; table++)
+    {
+        for (std::size_t value = 0; value < 256; value++)
+        {
+            auto& entry = plan.tables[table][value];
+
+            for (std::size_t bit = 0; bit < 8; bit++)
+            {
+                const auto index = table * 8 + bit;
+
+                if (!(value & (static_cast<std::size_t>(1) << bit)) || index >= CONTROLLER_BUTTON_COUNT)
+                {
+                    continue;
+                }
+
+                const auto& target = settings.targets[index];
+
+                entry.buttons |= target.buttons;
+                entry.left_trigger |= target.left_trigger ? 0xFF : 0;
+                entry.right_trigger |= target.right_trigger ? 0xFF : 0;
+            }
+        }
+    }
+
+    plan.swap_sticks = settings.swap_sticks;
+    plan.invert = settings.invert;
+
+    return plan;
+}
+
+const MappingPlan& DefaultMappingPlan()
+{
+    static const MappingPlan plan = CompileMapping(DefaultMappingSettings());
+
+    return plan;
+}
+
+bool ParseMappingTarget(const std::string& text, MappingTarget& target)
+{
+    using std::string;
+    using std::find_if;
+    using std::begin;
+    using std::end;
+
+    target = { 0, false, false };
+
+    if (text == "-")
+    {
+        return true;
+    }
+
+    string::size_type pos = 0;
+
+    while (pos <= text.size())
+    {
+        auto next = text.find('+', pos);
+
+        if (next == string::npos)
+        {
+            next = text.size();
+        }
+
+        const auto name = text.substr(pos, next - pos);
+        auto it = find_if(begin(TARGET_NAMES), end(TARGET_NAMES), [&](const auto& t) { return name == t.name; });
+
+        if (it == end(TARGET_NAMES))
+        {
+            return false;
+        }
+
+        target.buttons |= it->target.buttons;
+        target.left_trigger |= it->target.left_trigger;
+        target.right_trigger |= it->target.right_trigger;
+        pos = next + 1;
+    }
+
+    return true;
+}
+
+XUSB_REPORT MapToXUSB(const ControllerState& state, const MappingPlan& plan)
+{
+    const auto buttons = state.buttons;
+
+    const auto& low = plan.tables[0][buttons & 0xFF];
+    const auto& mid = plan.tables[1][(buttons >> 8) & 0xFF];
+    const auto& high = plan.tables[2][(buttons >> 16) & 0xFF];
+
+    XUSB_REPORT report = { 0 };
+
+    report.wButtons = low.buttons | mid.buttons | high.buttons;
+    report.bLeftTrigger = low.left_trigger | mid.left_trigger | high.left_trigger;
+    report.bRightTrigger = low.right_trigger | mid.right_trigger | high.right_trigger;
+
+    report.sThumbLX = plan.swap_sticks ? state.rx : state.lx;
+    report.sThumbLY = plan.swap_sticks ? state.ry : state.ly;
+    report.sThumbRX = plan.swap_sticks ? state.lx : state.rx;
+    report.sThumbRY = plan.swap_sticks ? state.ly : state.ry;
+
+    // inverting comes after the swap, so it applies to the xbox sticks
+    report.sThumbLX = plan.invert[MAPPING_AXIS_LX] ? Invert(report.sThumbLX) : report.sThumbLX;
+    report.sThumbLY = plan.invert[MAPPING_AXIS_LY] ? Invert(report.sThumbLY) : report.sThumbLY;
+    report.sThumbRX = plan.invert[MAPPING_AXIS_RX] ? Invert(report.sThumbRX) : report.sThumbRX;
+    report.sThumbRY = plan.invert[MAPPING_AXIS_RY] ? Invert(report.sThumbRY) : report.sThumbRY;
+
+    return report;
+}
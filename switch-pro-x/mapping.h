@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <array>
+#include <string>
+
+#include <cstdint>
+
+#include "decode.h"
+
+enum MappingAxis
+{
+    MAPPING_AXIS_LX,
+    MAPPING_AXIS_LY,
+    MAPPING_AXIS_RX,
+    MAPPING_AXIS_RY,
+
+    MAPPING_AXIS_COUNT
+};
+
+// what a controller button presses on the xbox side, any combination of buttons and triggers
+struct MappingTarget
+{
+    USHORT buttons;
+    bool left_trigger;
+    bool right_trigger;
+};
+
+// the editable form of a mapping, targets are indexed by CONTROLLER_BUTTON_* bit number
+struct MappingSettings
+{
+    std::array<MappingTarget, CONTROLLER_BUTTON_COUNT> targets;
+    bool swap_sticks;
+    std::array<bool, MAPPING_AXIS_COUNT> invert;
+};
+
+// MappingSettings compiled down to one lookup table per byte of the button bits, so mapping a
+// report is three loads and some ors no matter how the buttons are assigned
+struct MappingPlan
+{
+    struct Entry
+    {
+        USHORT buttons;
+        std::uint8_t left_trigger;
+        std::uint8_t right_trigger;
+    };
+
+    static constexpr std::size_t TABLES = (CONTROLLER_BUTTON_COUNT + 7) / 8;
+
+    std::array<std::array<Entry, 256>, TABLES> tables;
+    bool swap_sticks;
+    std::array<bool, MAPPING_AXIS_COUNT> invert;
+};
+
+// the built in layout, with a/b/x/y placed to match the positions on the xbox layout
+MappingSettings DefaultMappingSettings();
+MappingPlan CompileMapping(const MappingSettings& settings);
+const MappingPlan& DefaultMappingPlan();
+
+// xbox names like A, LB, LT or START joined by +, or - for nothing
+bool ParseMappingTarget(const std::string& text, MappingTarget& target);
+
+XUSB_REPORT MapToXUSB(const ControllerState& state, const MappingPlan& plan);
@@ -0,0 +1,410 @@
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <cstdlib>
+
+#include "options.h"
+
+namespace
+{
+    Options options;
+
+    bool ParseDouble(const char* arg, double& value)
+    {
+        using std::strtod;
+
+        char* end;
+        value = strtod(arg, &end);
+
+        return end != arg && *end == '\0' && value >= 0.0;
+    }
+}
+
+bool ParseOptions(int argc, char* argv[])
+{
+    using std::cerr;
+    using std::endl;
+    using std::string;
+    using std::chrono::duration;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::chrono::milliseconds;
+    using std::milli;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const string arg(argv[i]);
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--help" || arg == "-h")
+        {
+            return false;
+        }
+        else if (arg == "--latency")
+        {
+            options.latency = true;
+        }
+        else if (arg == "--stick-filter")
+        {
+            options.stick_filter = true;
+        }
+        else if ((arg == "--stick-filter-cutoff" || arg == "--stick-filter-beta") && value)
+        {
+            auto& number = arg == "--stick-filter-cutoff" ? options.stick_filter_cutoff : options.stick_filter_beta;
+
+            if (!ParseDouble(value, number))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            options.stick_filter = true;
+            i++;
+        }
+        else if (arg == "--report-threshold" && value)
+        {
+            if (!ParseStickThresholds(value, options.report_gate.stick_threshold))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            i++;
+        }
+        else if ((arg == "--report-trigger-threshold" || arg == "--report-staleness") && value)
+        {
+            double number;
+
+            if (!ParseDouble(value, number) || (arg == "--report-trigger-threshold" && number > 0xFF))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            if (arg == "--report-trigger-threshold")
+            {
+                options.report_gate.trigger_threshold = static_cast<std::uint8_t>(number);
+            }
+            else
+            {
+                options.report_gate.max_staleness = duration_cast<milliseconds>(duration<double, milli>(number));
+            }
+
+            i++;
+        }
+        else if (arg == "--io-priority" && value)
+        {
+            if (!ParseThreadPriority(value, options.io_scheduling.priority))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            i++;
+        }
+        else if (arg == "--io-affinity" && value)
+        {
+            if (!ParseAffinity(value, options.io_scheduling.affinity))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            i++;
+        }
+        else if (arg == "--io-mmcss" && value)
+        {
+            options.io_scheduling.mmcss_task = value;
+            i++;
+        }
+        else if (arg == "--output-rate-control")
+        {
+            options.output_rate_control = true;
+        }
+        else if (arg == "--waveform-rumble")
+        {
+            options.waveform_rumble = true;
+        }
+        else if (arg == "--joycon-pair")
+        {
+            options.joycon_pair = true;
+        }
+        else if (arg == "--battery-alert" && value)
+        {
+            if (!ParseBatteryLevels(value, options.battery_alerts))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            i++;
+        }
+        else if (arg == "--dsu" || arg == "--dsu-client")
+        {
+            (arg == "--dsu" ? options.dsu : options.dsu_client) = true;
+        }
+        else if (arg == "--dsu-port" && value)
+        {
+            double number;
+
+            if (!ParseDouble(value, number) || number < 1 || number > 0xFFFF)
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            options.dsu_port = static_cast<std::uint16_t>(number);
+            i++;
+        }
+        else if (arg == "--shared-state" || arg == "--watch")
+        {
+            (arg == "--shared-state" ? options.shared_state : options.watch) = true;
+        }
+        else if (arg == "--stream" && value)
+        {
+            if (!ParseUdpEndpoint(value, options.stream_destination))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            options.stream = true;
+            i++;
+        }
+        else if ((arg == "--stream-redundancy" || arg == "--stream-loss" || arg == "--stream-reorder") && value)
+        {
+            double number;
+
+            if (!ParseDouble(value, number) || (arg == "--stream-redundancy" && (number < 1 || number > STREAM_MAX_REDUNDANCY)) || number > 100)
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            if (arg == "--stream-redundancy")
+            {
+                options.stream_redundancy = static_cast<std::size_t>(number);
+            }
+            else
+            {
+                (arg == "--stream-loss" ? options.stream_loss : options.stream_reorder) = number;
+            }
+
+            i++;
+        }
+        else if (arg == "--stream-receive" && value)
+        {
+            double number;
+
+            if (!ParseDouble(value, number) || number < 1 || number > 0xFFFF)
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+
+            options.stream_receive = true;
+            options.stream_receive_port = static_cast<std::uint16_t>(number);
+            i++;
+        }
+        else if (arg == "--profile" && value)
+        {
+            options.profile_file = value;
+            i++;
+        }
+        else if (arg == "--turbo" && value)
+        {
+            TurboConfig turbo;
+
+            if (!ParseTurbo(value, turbo))
+            {
+                return false;
+            }
+
+            options.turbos.push_back(turbo);
+            i++;
+        }
+        else if (arg == "--macro" && value)
+        {
+            MacroConfig macro;
+
+            if (!ParseMacro(value, macro))
+            {
+                return false;
+            }
+
+            options.macros.push_back(macro);
+            i++;
+        }
+        else if (arg == "--benchmark")
+        {
+            options.benchmark = true;
+        }
+        else if (arg == "--benchmark-filter" && value)
+        {
+            options.benchmark = true;
+            options.benchmark_filter = value;
+            i++;
+        }
+        else if (arg == "--self-test")
+        {
+            options.self_test = true;
+        }
+        else if (arg == "--daemon")
+        {
+            options.daemon = true;
+        }
+        else if (arg == "--query" && value)
+        {
+            options.query = value;
+            i++;
+        }
+        else if (arg == "--trace")
+        {
+            options.trace = true;
+        }
+        else if (arg == "--trace-file" && value)
+        {
+            options.trace_file = value;
+            i++;
+        }
+        else if (arg == "--capture" && value)
+        {
+            options.capture_directory = value;
+            i++;
+        }
+        else if (arg == "--replay" && value)
+        {
+            options.replay_file = value;
+            i++;
+        }
+        else if (arg == "--replay-fast")
+        {
+            options.replay_fast = true;
+        }
+        else if (arg == "--emulate" && value)
+        {
+            const string transport(value);
+
+            if (transport != "usb" && transport != "bt")
+            {
+                cerr << "unknown emulator transport: " << transport << endl;
+                return false;
+            }
+
+            EmulatorConfig config;
+            config.bluetooth = transport == "bt";
+            options.emulators.push_back(config);
+            i++;
+        }
+        else if ((arg == "--emulate-script" || arg == "--emulate-loss" || arg == "--emulate-jitter" || arg == "--emulate-airtime") && value)
+        {
+            // these apply to the most recent --emulate
+            if (options.emulators.empty())
+            {
+                cerr << arg << " must follow --emulate" << endl;
+                return false;
+            }
+
+            auto& config = options.emulators.back();
+            double number;
+
+            if (arg == "--emulate-script")
+            {
+                if (!LoadEmulatorScript(value, config.timeline))
+                {
+                    return false;
+                }
+            }
+            else if (!ParseDouble(value, number))
+            {
+                cerr << "invalid value for " << arg << ": " << value << endl;
+                return false;
+            }
+            else if (arg == "--emulate-loss")
+            {
+                config.loss = number;
+            }
+            else
+            {
+                (arg == "--emulate-jitter" ? config.jitter : config.airtime) = duration_cast<microseconds>(duration<double, milli>(number));
+            }
+
+            i++;
+        }
+        else
+        {
+            cerr << "unknown option: " << arg << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const Options& GetOptions()
+{
+    return options;
+}
+
+void PrintUsage()
+{
+    using std::cout;
+    using std::endl;
+
+    cout << "usage: switch-pro-x [options]" << endl;
+    cout << endl;
+    cout << "  --latency                  measure per stage latency, printed on ctrl+break and at exit" << endl;
+    cout << "  --stick-filter             smooth stick jitter with an adaptive one euro filter" << endl;
+    cout << "  --stick-filter-cutoff <hz> filter cutoff while the stick is still, 1 by default" << endl;
+    cout << "  --stick-filter-beta <n>    cutoff increase per unit/s of stick speed, 0.001 by default" << endl;
+    cout << "  --report-threshold <n>     only submit stick changes of at least n, or lx,ly,rx,ry" << endl;
+    cout << "  --report-trigger-threshold <n>  the same for analog triggers" << endl;
+    cout << "  --report-staleness <ms>    submit smaller changes once the last submit is this old, 50 by default" << endl;
+    cout << "  --io-priority <priority>   normal, above-normal, highest or time-critical for device I/O threads" << endl;
+    cout << "  --io-affinity <cpus>       pin device I/O threads to these cpus, comma separated" << endl;
+    cout << "  --io-mmcss <task>          register device I/O threads with an MMCSS task like Games" << endl;
+    cout << "  --output-rate-control      skip repeated idle rumble and back off rumble on a congested link" << endl;
+    cout << "  --waveform-rumble          ramp rumble changes and allow rumble effects" << endl;
+    cout << "  --joycon-pair              merge each left and right joy-con into one virtual controller" << endl;
+    cout << "  --battery-alert <levels>   print when the battery drops to these levels, low,critical by default or none" << endl;
+    cout << "  --dsu                      serve pad and motion data to emulators over cemuhook's DSU protocol" << endl;
+    cout << "  --dsu-port <port>          the DSU server's localhost port, 26760 by default" << endl;
+    cout << "  --dsu-client               print rate and latency of a running DSU server's packets and exit" << endl;
+    cout << "  --shared-state             publish every report into shared memory for overlays and input displays" << endl;
+    cout << "  --watch                    print the shared state of a running instance ten times a second" << endl;
+    cout << "  --stream <address:port>    forward every controller's state to another host over UDP" << endl;
+    cout << "  --stream-redundancy <n>    how many reports each packet repeats, 3 by default and at most 8" << endl;
+    cout << "  --stream-loss <percent>    drop this percentage of stream packets, for testing" << endl;
+    cout << "  --stream-reorder <percent> hold this percentage back until after the next one, for testing" << endl;
+    cout << "  --stream-receive <port>    play received streams into virtual controllers, 26761 is the default sender port" << endl;
+    cout << "  --profile <file>           load button mapping profiles, reloaded when the file changes" << endl;
+    cout << "  --turbo <button>[:<hz>]    repeat the button while it's held, 10hz by default, can be repeated" << endl;
+    cout << "  --macro <trigger>=<steps>  play steps like A:40,-:40,A+B:100 when the trigger buttons are pressed" << endl;
+    cout << "  --benchmark                run the decode and mapping microbenchmarks and exit" << endl;
+    cout << "  --benchmark-filter <text>  only run benchmarks whose name contains text" << endl;
+    cout << "  --self-test                check the filter, timers and outputs against fixed limits and exit" << endl;
+    cout << "  --daemon                   run headless without a console, controlled through --query" << endl;
+    cout << "  --query devices            list the controllers of a running instance" << endl;
+    cout << "  --query state              show what each virtual controller reports right now" << endl;
+    cout << "  --query stats              poll the counters of a running instance every second" << endl;
+    cout << "  --query link               poll report rate, drop and jitter analysis every second" << endl;
+    cout << "  --query profile:<file>     load a profile file into a running instance" << endl;
+    cout << "  --query rumble:<id>[:<ms>] rumble a controller at full strength, 500ms by default" << endl;
+    cout << "  --query rumble:<id>:<effect>  play click, bump, heartbeat, buzz or ramp with --waveform-rumble" << endl;
+    cout << "  --query shutdown           stop a running instance" << endl;
+    cout << "  --query trace-start        turn the tracer of a running instance on" << endl;
+    cout << "  --query trace-stop         turn it back off" << endl;
+    cout << "  --query trace-dump         make it write its trace file" << endl;
+    cout << "  --trace                    start with the tracer on, ctrl+break writes the trace file" << endl;
+    cout << "  --trace-file <file>        where traces are written, switch-pro-x-trace.json by default" << endl;
+    cout << "  --capture <directory>      log raw reports of every controller to a file each" << endl;
+    cout << "  --replay <file>            replay a capture file into a virtual controller and exit" << endl;
+    cout << "  --replay-fast              replay as fast as possible and report throughput" << endl;
+    cout << "  --emulate <usb|bt>         add a software pro controller, can be repeated" << endl;
+    cout << "  --emulate-script <file>    input timeline for the last emulated controller" << endl;
+    cout << "  --emulate-loss <percent>   drop this percentage of its input reports" << endl;
+    cout << "  --emulate-jitter <ms>      delay each input report by up to this much" << endl;
+    cout << "  --emulate-airtime <ms>     how long each output report blocks its input reports" << endl;
+}
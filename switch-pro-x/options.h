@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "battery.h"
+#include "dsu.h"
+#include "filter.h"
+#include "gate.h"
+#include "macro.h"
+#include "scheduling.h"
+#include "stream.h"
+#include "ProControllerEmulator.h"
+
+struct Options
+{
+    std::vector<EmulatorConfig> emulators;
+    std::string capture_directory;
+    std::string replay_file;
+    bool replay_fast = false;
+    bool latency = false;
+    bool stick_filter = false;
+    double stick_filter_cutoff = DEFAULT_STICK_FILTER_CUTOFF;
+    double stick_filter_beta = DEFAULT_STICK_FILTER_BETA;
+    // thresholds of 0 or 1 leave only the exact duplicate check
+    ReportGateParams report_gate = { { 0, 0, 0, 0 }, 0, std::chrono::milliseconds(50) };
+    std::vector<TurboConfig> turbos;
+    std::vector<MacroConfig> macros;
+    std::string profile_file;
+    IoSchedulingConfig io_scheduling;
+    bool output_rate_control = false;
+    bool waveform_rumble = false;
+    bool joycon_pair = false;
+    std::vector<std::uint8_t> battery_alerts = { BATTERY_LOW, BATTERY_CRITICAL };
+    bool dsu = false;
+    bool dsu_client = false;
+    std::uint16_t dsu_port = DSU_DEFAULT_PORT;
+    bool stream = false;
+    UdpEndpoint stream_destination = { UDP_LOOPBACK, STREAM_DEFAULT_PORT };
+    std::size_t stream_redundancy = STREAM_DEFAULT_REDUNDANCY;
+    double stream_loss = 0.0;
+    double stream_reorder = 0.0;
+    bool shared_state = false;
+    bool watch = false;
+    bool stream_receive = false;
+    std::uint16_t stream_receive_port = STREAM_DEFAULT_PORT;
+    bool benchmark = false;
+    std::string benchmark_filter;
+    bool self_test = false;
+    std::string query;
+    bool daemon = false;
+    bool trace = false;
+    std::string trace_file = "switch-pro-x-trace.json";
+};
+
+bool ParseOptions(int argc, char* argv[]);
+const Options& GetOptions();
+void PrintUsage();
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <iostream>
+
+#include <cstring>
+
+#include "output_rate.h"
+
+namespace
+{
+    constexpr std::chrono::seconds OUTPUT_WINDOW(1);
+    // added back to the interval after every clean window
+    constexpr std::chrono::milliseconds OUTPUT_RECOVERY_STEP(50);
+
+    // a window is congested past this share of missing input reports
+    constexpr double CONGESTED_LOSS = 0.05;
+    // or when writes took this long on average, a clear link completes them in a few ms
+    constexpr std::chrono::milliseconds CONGESTED_WRITE(8);
+
+    // sends of the same neutral packet before the rest are skipped
+    constexpr int NEUTRAL_REPEATS = 3;
+
+    const std::uint8_t NEUTRAL_RUMBLE[OUTPUT_RUMBLE_SIZE] = { 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00 };
+
+    bool IsNeutral(const std::uint8_t* rumble)
+    {
+        return std::memcmp(rumble, NEUTRAL_RUMBLE, OUTPUT_RUMBLE_SIZE) == 0;
+    }
+}
+
+OutputRateControl::OutputRateControl(DeviceStats& _stats, unsigned int _id, bool _enabled)
+    : stats(_stats)
+    , id(_id)
+    , enabled(_enabled)
+    , last_sent()
+    , has_sent(false)
+    , neutral_repeats(0)
+    , window_reports(0)
+    , window_dropped(0)
+    , window_writes(0)
+    , window_stalls(0)
+    , window_write_time(0)
+    , interval(std::chrono::steady_clock::duration(OUTPUT_BASE_INTERVAL).count())
+{
+}
+
+bool OutputRateControl::Enabled() const
+{
+    return enabled;
+}
+
+bool OutputRateControl::ShouldSend(const std::uint8_t* rumble, bool busy, std::chrono::steady_clock::time_point now)
+{
+    using std::copy_n;
+    using std::equal;
+
+    if (!enabled)
+    {
+        return true;
+    }
+
+    const bool neutral = IsNeutral(rumble);
+    const bool same = has_sent && equal(last_sent.begin(), last_sent.end(), rumble);
+
+    if (same && neutral)
+    {
+        if (neutral_repeats >= NEUTRAL_REPEATS)
+        {
+            stats.Increment(DEVICE_COUNTER_RUMBLE_SKIPPED);
+            return false;
+        }
+
+        neutral_repeats++;
+    }
+    else
+    {
+        // the motors starting or stopping can't wait for the backed off interval, and neither can
+        // the steps of a waveform
+        const bool onset = !has_sent || neutral != IsNeutral(last_sent.data());
+
+        if (!onset && !busy && now - last_send < Interval())
+        {
+            stats.Increment(DEVICE_COUNTER_RUMBLE_SKIPPED);
+            return false;
+        }
+
+        neutral_repeats = neutral ? 1 : 0;
+    }
+
+    copy_n(rumble, OUTPUT_RUMBLE_SIZE, last_sent.begin());
+    has_sent = true;
+    last_send = now;
+
+    return true;
+}
+
+void OutputRateControl::RecordWrite(std::chrono::steady_clock::duration completion, bool stalled)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    window_writes++;
+    window_stalls += stalled ? 1 : 0;
+    window_write_time += completion;
+}
+
+void OutputRateControl::RecordInput(std::uint64_t dropped, std::chrono::steady_clock::time_point now)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    if (window_reports == 0 && window_dropped == 0)
+    {
+        window_start = now;
+    }
+
+    window_reports++;
+    window_dropped += dropped;
+
+    if (now - window_start >= OUTPUT_WINDOW)
+    {
+        FinishWindow(now);
+    }
+}
+
+std::chrono::steady_clock::duration OutputRateControl::Interval() const
+{
+    return std::chrono::steady_clock::duration(interval.load(std::memory_order_relaxed));
+}
+
+void OutputRateControl::FinishWindow(std::chrono::steady_clock::time_point now)
+{
+    using std::cout;
+    using std::endl;
+    using std::max;
+    using std::min;
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    using std::chrono::steady_clock;
+
+    const auto loss = static_cast<double>(window_dropped) / (window_reports + window_dropped);
+    const auto write_time = window_writes > 0 ? window_write_time / static_cast<steady_clock::rep>(window_writes) : steady_clock::duration(0);
+    const bool congested = loss > CONGESTED_LOSS || write_time > CONGESTED_WRITE || window_stalls > 0;
+
+    const auto previous = Interval();
+    steady_clock::duration next;
+
+    // multiplicative back off, additive recovery, the same as tcp does for the same reason
+    if (congested)
+    {
+        next = min<steady_clock::duration>(previous * 2, OUTPUT_MAX_INTERVAL);
+    }
+    else
+    {
+        next = max<steady_clock::duration>(previous - OUTPUT_RECOVERY_STEP, OUTPUT_BASE_INTERVAL);
+    }
+
+    if (next != previous)
+    {
+        if (congested)
+        {
+            stats.Increment(DEVICE_COUNTER_OUTPUT_BACKOFFS);
+        }
+
+        // only the edges, a long congestion would flood the console otherwise
+        if (previous == steady_clock::duration(OUTPUT_BASE_INTERVAL) || next == steady_clock::duration(OUTPUT_BASE_INTERVAL))
+        {
+            cout << "OUTPUT " << (congested ? "BACKING OFF" : "RECOVERED") << " ON DEVICE " << id << ": ";
+            cout << window_dropped << " OF " << (window_reports + window_dropped) << " REPORTS MISSING, ";
+            cout << duration_cast<milliseconds>(write_time).count() << "MS WRITES" << endl;
+        }
+    }
+
+    interval.store(next.count(), std::memory_order_relaxed);
+
+    window_start = now;
+    window_reports = 0;
+    window_dropped = 0;
+    window_writes = 0;
+    window_stalls = 0;
+    window_write_time = steady_clock::duration(0);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "stats.h"
+
+// how often the read thread looks at LEDs and rumble, and the fastest rumble is ever sent
+constexpr std::chrono::milliseconds OUTPUT_BASE_INTERVAL(100);
+// the slowest the rumble refresh backs off to on a congested link
+constexpr std::chrono::milliseconds OUTPUT_MAX_INTERVAL(800);
+// the rumble bytes of an output report, after the packet type and counter
+constexpr std::size_t OUTPUT_RUMBLE_SIZE = 8;
+
+// decides which rumble packets are worth the airtime. an unchanged neutral packet is only sent a
+// few times, so a stop isn't missed, and the interval for everything else widens while input
+// reports go missing or writes are slow to complete, and narrows again once the link is clean.
+// starting and stopping the motors always goes out on the next base tick. only the read thread
+// calls in, Interval can be read from anywhere
+class OutputRateControl
+{
+public:
+    OutputRateControl(DeviceStats& _stats, unsigned int _id, bool _enabled);
+
+    bool Enabled() const;
+
+    // false if the packet can be skipped, rumble is OUTPUT_RUMBLE_SIZE bytes. busy is a waveform
+    // still changing from packet to packet, which never waits for the backed off interval, so only
+    // idle repeats are held back. a true answer assumes the packet is sent
+    bool ShouldSend(const std::uint8_t* rumble, bool busy, std::chrono::steady_clock::time_point now);
+    // every write to the device, stalled ones included
+    void RecordWrite(std::chrono::steady_clock::duration completion, bool stalled);
+    // every input report, with how many reports the link analyzer found missing before it
+    void RecordInput(std::uint64_t dropped, std::chrono::steady_clock::time_point now);
+
+    std::chrono::steady_clock::duration Interval() const;
+
+private:
+    void FinishWindow(std::chrono::steady_clock::time_point now);
+
+    DeviceStats& stats;
+    const unsigned int id;
+    const bool enabled;
+
+    std::array<std::uint8_t, OUTPUT_RUMBLE_SIZE> last_sent;
+    bool has_sent;
+    int neutral_repeats;
+    std::chrono::steady_clock::time_point last_send;
+
+    std::chrono::steady_clock::time_point window_start;
+    std::uint64_t window_reports;
+    std::uint64_t window_dropped;
+    std::uint64_t window_writes;
+    std::uint64_t window_stalls;
+    std::chrono::steady_clock::duration window_write_time;
+
+    std::atomic<std::chrono::steady_clock::rep> interval;
+};
@@ -0,0 +1,506 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <cctype>
+#include <cstdlib>
+
+#include "decode.h"
+#include "options.h"
+#include "profile.h"
+#include "trace.h"
+
+namespace
+{
+    // editors tend to write a file in several steps, reloads wait this long for them to finish
+    constexpr DWORD RELOAD_DELAY = 100;
+
+    struct ProfileSection
+    {
+        std::string name;
+        unsigned int line;
+        // key, value and line number
+        std::vector<std::tuple<std::string, std::string, unsigned int>> values;
+    };
+
+    struct ProfileSettings
+    {
+        MappingSettings mapping;
+        ReportGateParams gate;
+        bool filter_sticks;
+        double stick_filter_cutoff;
+        double stick_filter_beta;
+    };
+
+    // published sets are only ever added to, a read thread may still be mapping through an old one
+    std::mutex load_mutex;
+    std::vector<std::unique_ptr<const ProfileSet>> loaded_sets;
+    std::atomic<const ProfileSet*> active_set(nullptr);
+
+    Profile CompileProfile(const ProfileSettings& settings)
+    {
+        const auto stick_filter = MakeOneEuroParams(settings.stick_filter_cutoff, settings.stick_filter_beta, DEFAULT_STICK_FILTER_DERIVATIVE_CUTOFF);
+
+        return { CompileMapping(settings.mapping), settings.gate, settings.filter_sticks, stick_filter };
+    }
+
+    // the built in mapping and the command line, what every profile file starts from
+    ProfileSettings DefaultSettings()
+    {
+        const auto& options = GetOptions();
+
+        return { DefaultMappingSettings(), options.report_gate, options.stick_filter, options.stick_filter_cutoff, options.stick_filter_beta };
+    }
+
+    const ProfileSet& BuiltinProfiles()
+    {
+        static const ProfileSet builtin = { CompileProfile(DefaultSettings()), {} };
+
+        return builtin;
+    }
+
+    std::string Trim(const std::string& text)
+    {
+        const auto first = text.find_first_not_of(" \t\r");
+
+        if (first == std::string::npos)
+        {
+            return std::string();
+        }
+
+        return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+    }
+
+    std::string ToLower(std::string text)
+    {
+        using std::tolower;
+        using std::transform;
+
+        transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+
+        return text;
+    }
+
+    bool ParseBool(const std::string& text, bool& value)
+    {
+        const auto lower = ToLower(text);
+
+        if (lower == "true" || lower == "yes" || lower == "1")
+        {
+            value = true;
+            return true;
+        }
+
+        if (lower == "false" || lower == "no" || lower == "0")
+        {
+            value = false;
+            return true;
+        }
+
+        return false;
+    }
+
+    // comma separated lx, ly, rx and ry, or - for none
+    bool ParseAxes(const std::string& text, std::array<bool, MAPPING_AXIS_COUNT>& axes)
+    {
+        const char* const AXIS_NAMES[MAPPING_AXIS_COUNT] = { "lx", "ly", "rx", "ry" };
+
+        axes.fill(false);
+
+        if (text == "-")
+        {
+            return true;
+        }
+
+        std::string::size_type pos = 0;
+
+        while (pos <= text.size())
+        {
+            auto next = text.find(',', pos);
+
+            if (next == std::string::npos)
+            {
+                next = text.size();
+            }
+
+            const auto name = ToLower(Trim(text.substr(pos, next - pos)));
+            bool found = false;
+
+            for (int i = 0; i < MAPPING_AXIS_COUNT; i++)
+            {
+                if (name == AXIS_NAMES[i])
+                {
+                    axes[i] = true;
+                    found = true;
+                }
+            }
+
+            if (!found)
+            {
+                return false;
+            }
+
+            pos = next + 1;
+        }
+
+        return true;
+    }
+
+    bool ParseNumber(const std::string& text, long max, long& value)
+    {
+        using std::strtol;
+
+        char* end;
+        value = strtol(text.c_str(), &end, 10);
+
+        return end != text.c_str() && *end == '\0' && value >= 0 && value <= max;
+    }
+
+    bool ParseReal(const std::string& text, double& value)
+    {
+        using std::strtod;
+
+        char* end;
+        value = strtod(text.c_str(), &end);
+
+        return end != text.c_str() && *end == '\0' && value >= 0.0;
+    }
+
+    bool ApplyValue(const std::string& key, const std::string& value, ProfileSettings& settings)
+    {
+        using std::chrono::milliseconds;
+
+        long number;
+
+        if (key == "swap_sticks")
+        {
+            return ParseBool(value, settings.mapping.swap_sticks);
+        }
+        else if (key == "invert")
+        {
+            return ParseAxes(value, settings.mapping.invert);
+        }
+        else if (key == "report_threshold")
+        {
+            return ParseStickThresholds(value.c_str(), settings.gate.stick_threshold);
+        }
+        else if (key == "report_trigger_threshold")
+        {
+            if (!ParseNumber(value, 0xFF, number))
+            {
+                return false;
+            }
+
+            settings.gate.trigger_threshold = static_cast<std::uint8_t>(number);
+            return true;
+        }
+        else if (key == "report_staleness")
+        {
+            if (!ParseNumber(value, 60000, number))
+            {
+                return false;
+            }
+
+            settings.gate.max_staleness = milliseconds(number);
+            return true;
+        }
+        else if (key == "stick_filter")
+        {
+            return ParseBool(value, settings.filter_sticks);
+        }
+        else if (key == "stick_filter_cutoff" || key == "stick_filter_beta")
+        {
+            // like on the command line, tuning the filter turns it on
+            settings.filter_sticks = true;
+
+            return ParseReal(value, key == "stick_filter_cutoff" ? settings.stick_filter_cutoff : settings.stick_filter_beta);
+        }
+
+        // anything else is a controller button, or several joined by +
+        std::uint32_t buttons;
+        MappingTarget target;
+
+        if (!ParseButtonNames(key, buttons) || buttons == 0 || !ParseMappingTarget(value, target))
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < CONTROLLER_BUTTON_COUNT; i++)
+        {
+            if (buttons & (1u << i))
+            {
+                settings.mapping.targets[i] = target;
+            }
+        }
+
+        return true;
+    }
+
+    bool ApplySection(const std::string& filename, const ProfileSection& section, ProfileSettings& settings)
+    {
+        using std::cerr;
+        using std::endl;
+        using std::get;
+
+        for (const auto& value : section.values)
+        {
+            if (!ApplyValue(get<0>(value), get<1>(value), settings))
+            {
+                cerr << filename << ":" << get<2>(value) << ": invalid setting " << get<0>(value) << " = " << get<1>(value) << endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool ReadSections(const std::string& filename, std::vector<ProfileSection>& sections)
+    {
+        using std::cerr;
+        using std::endl;
+        using std::ifstream;
+        using std::string;
+
+        ifstream file(filename);
+
+        if (!file)
+        {
+            cerr << "error opening profile file " << filename << endl;
+            return false;
+        }
+
+        string line;
+        unsigned int line_number = 0;
+
+        while (getline(file, line))
+        {
+            line_number++;
+            line = Trim(line.substr(0, line.find_first_of(";#")));
+
+            if (line.empty())
+            {
+                continue;
+            }
+
+            if (line.front() == '[')
+            {
+                if (line.back() != ']')
+                {
+                    cerr << filename << ":" << line_number << ": invalid section header" << endl;
+                    return false;
+                }
+
+                sections.push_back({ Trim(line.substr(1, line.size() - 2)), line_number, {} });
+                continue;
+            }
+
+            const auto equals = line.find('=');
+
+            if (equals == string::npos || sections.empty())
+            {
+                cerr << filename << ":" << line_number << ": expected key = value inside a section" << endl;
+                return false;
+            }
+
+            sections.back().values.emplace_back(Trim(line.substr(0, equals)), Trim(line.substr(equals + 1)), line_number);
+        }
+
+        return true;
+    }
+}
+
+const Profile& ProfileSet::Find(const std::string& serial) const
+{
+    using std::find_if;
+
+    const auto lower = ToLower(serial);
+    auto it = find_if(serial_profiles.begin(), serial_profiles.end(), [&](const auto& p) { return p.first == lower; });
+
+    return it != serial_profiles.end() ? it->second : default_profile;
+}
+
+bool LoadProfiles(const std::string& filename)
+{
+    using std::cerr;
+    using std::endl;
+    using std::lock_guard;
+    using std::make_unique;
+    using std::memory_order_release;
+    using std::move;
+    using std::mutex;
+    using std::string;
+    using std::vector;
+
+    vector<ProfileSection> sections;
+
+    if (!ReadSections(filename, sections))
+    {
+        return false;
+    }
+
+    // [default] applies on top of the built in mapping and the command line, [serial:<serial>]
+    // sections apply on top of [default] no matter where they are in the file
+    const string SERIAL_PREFIX = "serial:";
+    auto defaults = DefaultSettings();
+
+    for (const auto& section : sections)
+    {
+        if (ToLower(section.name) == "default" && !ApplySection(filename, section, defaults))
+        {
+            return false;
+        }
+    }
+
+    auto set = make_unique<ProfileSet>();
+    set->default_profile = CompileProfile(defaults);
+
+    for (const auto& section : sections)
+    {
+        const auto name = ToLower(section.name);
+
+        if (name == "default")
+        {
+            continue;
+        }
+
+        if (name.compare(0, SERIAL_PREFIX.size(), SERIAL_PREFIX) != 0 || name.size() == SERIAL_PREFIX.size())
+        {
+            cerr << filename << ":" << section.line << ": unknown section " << section.name << endl;
+            return false;
+        }
+
+        auto settings = defaults;
+
+        if (!ApplySection(filename, section, settings))
+        {
+            return false;
+        }
+
+        set->serial_profiles.emplace_back(Trim(name.substr(SERIAL_PREFIX.size())), CompileProfile(settings));
+    }
+
+    lock_guard<mutex> lk(load_mutex);
+
+    active_set.store(set.get(), memory_order_release);
+    loaded_sets.push_back(move(set));
+
+    return true;
+}
+
+const ProfileSet& ActiveProfiles()
+{
+    const auto set = active_set.load(std::memory_order_acquire);
+
+    return set != nullptr ? *set : BuiltinProfiles();
+}
+
+ProfileWatcher::ProfileWatcher(const std::string& _filename)
+    : filename(_filename)
+    , change(INVALID_HANDLE_VALUE)
+    , quit_event(nullptr)
+{
+    using std::cerr;
+    using std::endl;
+    using std::string;
+
+    char full_path[MAX_PATH];
+    char* file_part = nullptr;
+
+    if (GetFullPathNameA(filename.c_str(), MAX_PATH, full_path, &file_part) == 0 || file_part == nullptr)
+    {
+        cerr << "error resolving profile path " << filename << " (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    const string directory(full_path, file_part);
+
+    change = FindFirstChangeNotificationA(directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    quit_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    if (change == INVALID_HANDLE_VALUE || quit_event == nullptr)
+    {
+        cerr << "error watching " << directory << " for profile changes (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    thread = std::thread(&ProfileWatcher::WatchThread, this);
+}
+
+ProfileWatcher::~ProfileWatcher()
+{
+    if (thread.joinable())
+    {
+        SetEvent(quit_event);
+        thread.join();
+    }
+
+    if (change != INVALID_HANDLE_VALUE)
+    {
+        FindCloseChangeNotification(change);
+    }
+
+    if (quit_event != nullptr)
+    {
+        CloseHandle(quit_event);
+    }
+}
+
+void ProfileWatcher::WatchThread()
+{
+    using std::cout;
+    using std::endl;
+
+    TraceThreadName("profile watcher");
+
+    const auto last_write = [this] {
+        WIN32_FILE_ATTRIBUTE_DATA data = {};
+        GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data);
+
+        return data.ftLastWriteTime;
+    };
+
+    const HANDLE handles[] = { quit_event, change };
+    auto loaded_time = last_write();
+
+    for (;;)
+    {
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+        {
+            break;
+        }
+
+        FindNextChangeNotification(change);
+
+        if (WaitForSingleObject(quit_event, RELOAD_DELAY) == WAIT_OBJECT_0)
+        {
+            break;
+        }
+
+        // the notification covers the whole directory
+        const auto time = last_write();
+
+        if (CompareFileTime(&time, &loaded_time) == 0)
+        {
+            continue;
+        }
+
+        loaded_time = time;
+
+        if (LoadProfiles(filename))
+        {
+            cout << "RELOADED PROFILES FROM " << filename << endl;
+        }
+    }
+}
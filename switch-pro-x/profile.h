@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "filter.h"
+#include "gate.h"
+#include "mapping.h"
+
+// everything a controller maps its reports through
+struct Profile
+{
+    MappingPlan mapping;
+    ReportGateParams gate;
+    bool filter_sticks;
+    OneEuroParams stick_filter;
+};
+
+// one profile file compiled, never modified once it has been published
+struct ProfileSet
+{
+    Profile default_profile;
+    // lowercase serial numbers
+    std::vector<std::pair<std::string, Profile>> serial_profiles;
+
+    const Profile& Find(const std::string& serial) const;
+};
+
+// parses and compiles the file and makes it the active set, on any error the active set is kept
+bool LoadProfiles(const std::string& filename);
+// the built in mapping until a profile file is loaded. this is a single atomic load, and sets
+// are never freed so the reference stays valid after a reload
+const ProfileSet& ActiveProfiles();
+
+// reloads the profile file whenever it changes on disk
+class ProfileWatcher
+{
+public:
+    explicit ProfileWatcher(const std::string& _filename);
+    ~ProfileWatcher();
+
+private:
+    void WatchThread();
+
+    const std::string filename;
+    HANDLE change;
+    HANDLE quit_event;
+    std::thread thread;
+};
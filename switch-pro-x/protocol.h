@@ -0,0 +1,150 @@
+#pragma once
+
+#include <chrono>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace
+{
+    constexpr std::uint8_t PACKET_TYPE_USB_COMMAND = 0x80;
+    constexpr std::uint8_t PACKET_TYPE_STATUS = 0x81;
+    constexpr std::uint8_t PACKET_TYPE_CONTROLLER_DATA = 0x30;
+    constexpr std::uint8_t PACKET_TYPE_SUBCOMMAND_REPLY = 0x21;
+    constexpr std::uint8_t PACKET_TYPE_SIMPLE_CONTROLLER_DATA = 0x3F;
+
+    constexpr std::uint8_t OUTPUT_TYPE_SUBCOMMAND = 0x01;
+    constexpr std::uint8_t OUTPUT_TYPE_RUMBLE = 0x10;
+
+    constexpr std::uint8_t STATUS_TYPE_SERIAL = 0x01;
+    constexpr std::uint8_t STATUS_TYPE_INIT = 0x02;
+    constexpr std::uint8_t STATUS_TYPE_START = 0x04;
+
+    constexpr std::uint8_t SUBCOMMAND_SET_INPUT_MODE = 0x03;
+    constexpr std::uint8_t SUBCOMMAND_SET_PLAYER_LIGHTS = 0x30;
+    constexpr std::uint8_t SUBCOMMAND_ENABLE_IMU = 0x40;
+
+    // where a 0x21 reply has the ack byte, the id of the subcommand it answers and its data
+    constexpr std::size_t SUBCOMMAND_REPLY_ACK_OFFSET = 13;
+    constexpr std::size_t SUBCOMMAND_REPLY_ID_OFFSET = 14;
+    constexpr std::size_t SUBCOMMAND_REPLY_DATA_OFFSET = 15;
+
+    // sizes used when there's no HID descriptor to ask (emulated devices)
+    constexpr std::uint16_t USB_INPUT_REPORT_SIZE = 64;
+    constexpr std::uint16_t USB_OUTPUT_REPORT_SIZE = 64;
+    constexpr std::uint16_t BLUETOOTH_INPUT_REPORT_SIZE = 362;
+    constexpr std::uint16_t BLUETOOTH_OUTPUT_REPORT_SIZE = 49;
+
+    // the controller's free-running timer byte advances about once every 5ms
+    constexpr std::chrono::microseconds CONTROLLER_TIMER_TICK(5000);
+
+    // nominal input report rates, 0x30 reports over bluetooth come at about 66Hz
+    constexpr std::chrono::milliseconds USB_REPORT_INTERVAL(8);
+    constexpr std::chrono::milliseconds BLUETOOTH_REPORT_INTERVAL(15);
+
+    enum {
+        SWITCH_BUTTON_USB_MASK_A = 0x00000800,
+        SWITCH_BUTTON_USB_MASK_B = 0x00000400,
+        SWITCH_BUTTON_USB_MASK_X = 0x00000200,
+        SWITCH_BUTTON_USB_MASK_Y = 0x00000100,
+
+        SWITCH_BUTTON_USB_MASK_DPAD_UP = 0x02000000,
+        SWITCH_BUTTON_USB_MASK_DPAD_DOWN = 0x01000000,
+        SWITCH_BUTTON_USB_MASK_DPAD_LEFT = 0x08000000,
+        SWITCH_BUTTON_USB_MASK_DPAD_RIGHT = 0x04000000,
+
+        SWITCH_BUTTON_USB_MASK_PLUS = 0x00020000,
+        SWITCH_BUTTON_USB_MASK_MINUS = 0x00010000,
+        SWITCH_BUTTON_USB_MASK_HOME = 0x00100000,
+        SWITCH_BUTTON_USB_MASK_SHARE = 0x00200000,
+
+        SWITCH_BUTTON_USB_MASK_L = 0x40000000,
+        SWITCH_BUTTON_USB_MASK_ZL = 0x80000000,
+        SWITCH_BUTTON_USB_MASK_THUMB_L = 0x00080000,
+
+        SWITCH_BUTTON_USB_MASK_R = 0x00004000,
+        SWITCH_BUTTON_USB_MASK_ZR = 0x00008000,
+        SWITCH_BUTTON_USB_MASK_THUMB_R = 0x00040000,
+    };
+
+    enum
+    {
+        SWITCH_BUTTON_BLUETOOTH_MASK_A = 0x0002,
+        SWITCH_BUTTON_BLUETOOTH_MASK_B = 0x0001,
+        SWITCH_BUTTON_BLUETOOTH_MASK_X = 0x0008,
+        SWITCH_BUTTON_BLUETOOTH_MASK_Y = 0x0004,
+
+        SWITCH_BUTTON_BLUETOOTH_MASK_PLUS = 0x0200,
+        SWITCH_BUTTON_BLUETOOTH_MASK_MINUS = 0x0100,
+        SWITCH_BUTTON_BLUETOOTH_MASK_HOME = 0x1000,
+        SWITCH_BUTTON_BLUETOOTH_MASK_SHARE = 0x2000,
+
+        SWITCH_BUTTON_BLUETOOTH_MASK_L = 0x0010,
+        SWITCH_BUTTON_BLUETOOTH_MASK_ZL = 0x0040,
+        SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_L = 0x0400,
+
+        SWITCH_BUTTON_BLUETOOTH_MASK_R = 0x0020,
+        SWITCH_BUTTON_BLUETOOTH_MASK_ZR = 0x0080,
+        SWITCH_BUTTON_BLUETOOTH_MASK_THUMB_R = 0x0800,
+    };
+
+    enum
+    {
+        SWITCH_HAT_UP = 0x00,
+        SWITCH_HAT_UP_RIGHT = 0x01,
+        SWITCH_HAT_RIGHT = 0x02,
+        SWITCH_HAT_DOWN_RIGHT = 0x03,
+        SWITCH_HAT_DOWN = 0x04,
+        SWITCH_HAT_DOWN_LEFT = 0x05,
+        SWITCH_HAT_LEFT = 0x06,
+        SWITCH_HAT_UP_LEFT = 0x07,
+        SWITCH_HAT_NEUTRAL = 0x08,
+    };
+
+#pragma pack(push, 1)
+    typedef struct
+    {
+        std::uint8_t type;
+        union
+        {
+            struct
+            {
+                std::uint8_t type;
+                std::uint8_t serial[8];
+            } status_response;
+            struct
+            {
+                std::uint8_t timestamp;
+                std::uint32_t buttons;
+                std::uint8_t analog[6];
+            } controller_data;
+            std::uint8_t padding[63];
+        } data;
+    } ProControllerUSBPacket;
+
+    typedef struct
+    {
+        std::uint8_t report_id;
+        union
+        {
+            struct
+            {
+                std::uint16_t buttons;
+                std::uint8_t hat;
+                std::uint16_t analog[4];
+            } controller_data;
+            struct
+            {
+                std::uint8_t timestamp;
+                std::uint32_t buttons;
+                std::uint8_t analog[6];
+                std::uint8_t vibrator;
+                std::uint8_t ack;
+                std::uint8_t subcommand;
+                std::uint8_t reply[35];
+            } subcommand_reply;
+            std::uint8_t padding[361];
+        } data;
+    } ProControllerBluetoothPacket;
+#pragma pack(pop)
+}
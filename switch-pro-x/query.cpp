@@ -0,0 +1,536 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "battery.h"
+#include "common.h"
+#include "control.h"
+#include "family.h"
+#include "query.h"
+#include "waveform.h"
+
+namespace
+{
+    using bytes = std::vector<std::uint8_t>;
+
+    constexpr std::chrono::seconds STATS_INTERVAL(1);
+    constexpr DWORD CONNECT_TIMEOUT = 1000;
+
+    HANDLE OpenControlPipe()
+    {
+        using std::cerr;
+        using std::endl;
+
+        for (;;)
+        {
+            HANDLE pipe = CreateFile(
+                CONTROL_PIPE_NAME,
+                GENERIC_READ | GENERIC_WRITE,
+                0,
+                nullptr,
+                OPEN_EXISTING,
+                0,
+                nullptr);
+
+            if (pipe != INVALID_HANDLE_VALUE)
+            {
+                DWORD mode = PIPE_READMODE_MESSAGE;
+                SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr);
+
+                return pipe;
+            }
+
+            auto err = GetLastError();
+
+            if (err == ERROR_FILE_NOT_FOUND)
+            {
+                cerr << "switch-pro-x is not running" << endl;
+                return INVALID_HANDLE_VALUE;
+            }
+
+            // another client is being served, wait for our turn
+            if (err != ERROR_PIPE_BUSY || !WaitNamedPipe(CONTROL_PIPE_NAME, CONNECT_TIMEOUT))
+            {
+                cerr << "error opening control pipe (" << err << ")" << endl;
+                return INVALID_HANDLE_VALUE;
+            }
+        }
+    }
+
+    bool Transact(HANDLE pipe, std::uint8_t opcode, bytes& response, ControlResponseHeader& header, const bytes& payload = bytes())
+    {
+        using std::cerr;
+        using std::endl;
+        using std::memcpy;
+
+        bytes request(sizeof(ControlRequest));
+        request[0] = opcode;
+        request.insert(request.end(), payload.begin(), payload.end());
+
+        DWORD transferred = 0;
+        response.resize(CONTROL_MAX_MESSAGE);
+
+        if (!TransactNamedPipe(pipe, request.data(), static_cast<DWORD>(request.size()), response.data(), static_cast<DWORD>(response.size()), &transferred, nullptr))
+        {
+            cerr << "Control request failed (" << GetLastError() << ")" << endl;
+            return false;
+        }
+
+        response.resize(transferred);
+
+        if (response.size() < sizeof(header))
+        {
+            cerr << "Control response too short" << endl;
+            return false;
+        }
+
+        memcpy(&header, response.data(), sizeof(header));
+
+        if (header.status != CONTROL_STATUS_OK)
+        {
+            cerr << "Control request failed with status " << +header.status << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    int QueryStats(HANDLE pipe)
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::left;
+        using std::map;
+        using std::memcpy;
+        using std::right;
+        using std::setprecision;
+        using std::setw;
+        using std::string;
+        using std::this_thread::sleep_for;
+
+        // last sample per device id, so report rates cover just the last interval
+        map<std::uint32_t, ControlDeviceStats> previous;
+        bytes response;
+
+        for (;;)
+        {
+            ControlResponseHeader header;
+
+            if (!Transact(pipe, CONTROL_OP_STATS, response, header))
+            {
+                return 1;
+            }
+
+            map<std::uint32_t, ControlDeviceStats> current;
+            std::size_t offset = sizeof(header);
+
+            cout << header.count << " controller(s)" << endl;
+
+            for (unsigned int i = 0; i < header.count && offset + sizeof(ControlDeviceStats) <= response.size(); i++)
+            {
+                ControlDeviceStats record;
+                memcpy(&record, response.data() + offset, sizeof(record));
+                offset += sizeof(record);
+
+                if (offset + record.path_length > response.size())
+                {
+                    break;
+                }
+
+                const string path(reinterpret_cast<const char*>(response.data() + offset), record.path_length);
+                offset += record.path_length;
+
+                // first sample of a device averages over its whole lifetime
+                auto reports = record.counters[DEVICE_COUNTER_REPORTS];
+                auto elapsed = record.uptime;
+                auto it = previous.find(record.id);
+
+                if (it != previous.end() && record.uptime > it->second.uptime)
+                {
+                    reports -= it->second.counters[DEVICE_COUNTER_REPORTS];
+                    elapsed -= it->second.uptime;
+                }
+
+                cout << "[" << record.id << "] " << (record.bluetooth ? "bluetooth " : "usb ") << path << endl;
+                cout << "  " << left << setw(20) << "reports/s" << right << setw(14) << fixed << setprecision(1);
+                cout << (elapsed > 0 ? reports * 1e9 / elapsed : 0.0) << endl;
+                cout << "  " << left << setw(20) << "battery" << right << setw(14) << DescribePowerStatus(record.power) << endl;
+
+                // every report that didn't turn into a driver call
+                const auto avoided = record.counters[DEVICE_COUNTER_DEDUPED] + record.counters[DEVICE_COUNTER_SUPPRESSED];
+                const auto handled = avoided + record.counters[DEVICE_COUNTER_SUBMITTED];
+
+                cout << "  " << left << setw(20) << "submits avoided %" << right << setw(14);
+                cout << (handled > 0 ? avoided * 100.0 / handled : 0.0) << endl;
+
+                for (int counter = 0; counter < DEVICE_COUNTER_COUNT; counter++)
+                {
+                    cout << "  " << left << setw(20) << DeviceCounterName(static_cast<DeviceCounter>(counter));
+                    cout << right << setw(14) << record.counters[counter] << endl;
+                }
+
+                current[record.id] = record;
+            }
+
+            cout << endl;
+
+            previous = current;
+            sleep_for(STATS_INTERVAL);
+        }
+    }
+
+    int QueryLink(HANDLE pipe)
+    {
+        using std::cout;
+        using std::endl;
+        using std::fixed;
+        using std::memcpy;
+        using std::setprecision;
+        using std::this_thread::sleep_for;
+
+        const auto ms = [](std::uint64_t ns) { return ns / 1000000.0; };
+        bytes response;
+
+        for (;;)
+        {
+            ControlResponseHeader header;
+
+            if (!Transact(pipe, CONTROL_OP_LINK, response, header))
+            {
+                return 1;
+            }
+
+            std::size_t offset = sizeof(header);
+
+            cout << header.count << " controller(s)" << endl;
+            cout << fixed << setprecision(1);
+
+            for (unsigned int i = 0; i < header.count && offset + sizeof(ControlLinkStats) <= response.size(); i++)
+            {
+                ControlLinkStats record;
+                memcpy(&record, response.data() + offset, sizeof(record));
+                offset += sizeof(record);
+
+                cout << "[" << record.id << "] " << (record.bluetooth ? "bluetooth" : "usb");
+                cout << " " << record.rate / 1000.0 << " reports/s (nominal " << record.nominal_rate / 1000.0 << ")";
+                cout << (record.degraded ? " DEGRADED" : "") << endl;
+
+                if (record.timed)
+                {
+                    cout << "  dropped " << record.dropped << ", duplicated " << record.duplicated << endl;
+                }
+                else
+                {
+                    cout << "  no timer in these reports, drops can't be detected" << endl;
+                }
+
+                cout << "  interval ms  p50 " << ms(record.interval_p50) << "  p99 " << ms(record.interval_p99) << "  max " << ms(record.interval_max) << endl;
+
+                if (record.timed)
+                {
+                    cout << "  jitter ms    p50 " << ms(record.jitter_p50) << "  p99 " << ms(record.jitter_p99) << "  max " << ms(record.jitter_max) << endl;
+
+                    if (record.synced)
+                    {
+                        cout << "  clock drift " << record.drift / 1000.0 << " ppm, fit error " << ms(record.clock_error) << " ms" << endl;
+                    }
+                    else
+                    {
+                        cout << "  clock not synchronized yet" << endl;
+                    }
+                }
+            }
+
+            cout << endl;
+
+            sleep_for(STATS_INTERVAL);
+        }
+    }
+
+    int QueryDevices(HANDLE pipe)
+    {
+        using std::cout;
+        using std::endl;
+        using std::memcpy;
+        using std::string;
+
+        bytes response;
+        ControlResponseHeader header;
+
+        if (!Transact(pipe, CONTROL_OP_DEVICES, response, header))
+        {
+            return 1;
+        }
+
+        std::size_t offset = sizeof(header);
+
+        cout << header.count << " controller(s)" << endl;
+
+        for (unsigned int i = 0; i < header.count && offset + sizeof(ControlDeviceInfo) <= response.size(); i++)
+        {
+            ControlDeviceInfo record;
+            memcpy(&record, response.data() + offset, sizeof(record));
+            offset += sizeof(record);
+
+            if (offset + record.serial_length + record.path_length > response.size())
+            {
+                break;
+            }
+
+            const string serial(reinterpret_cast<const char*>(response.data() + offset), record.serial_length);
+            offset += record.serial_length;
+            const string path(reinterpret_cast<const char*>(response.data() + offset), record.path_length);
+            offset += record.path_length;
+
+            cout << "[" << record.id << "] " << DeviceFamilyName(static_cast<DeviceFamily>(record.family));
+            cout << (record.bluetooth ? " bluetooth" : " usb") << (record.paired ? " paired" : "") << endl;
+            cout << "  battery " << DescribePowerStatus(record.power) << endl;
+
+            if (!serial.empty())
+            {
+                cout << "  serial " << serial << endl;
+            }
+
+            cout << "  " << path << endl;
+        }
+
+        return 0;
+    }
+
+    int QueryState(HANDLE pipe)
+    {
+        using std::cout;
+        using std::dec;
+        using std::endl;
+        using std::fixed;
+        using std::hex;
+        using std::memcpy;
+        using std::setfill;
+        using std::setprecision;
+        using std::setw;
+
+        bytes response;
+        ControlResponseHeader header;
+
+        if (!Transact(pipe, CONTROL_OP_STATE, response, header))
+        {
+            return 1;
+        }
+
+        std::size_t offset = sizeof(header);
+
+        for (unsigned int i = 0; i < header.count && offset + sizeof(ControlDeviceState) <= response.size(); i++)
+        {
+            ControlDeviceState record;
+            memcpy(&record, response.data() + offset, sizeof(record));
+            offset += sizeof(record);
+
+            cout << "[" << record.id << "] buttons 0x" << hex << setw(4) << setfill('0') << record.buttons << dec << setfill(' ');
+            cout << " lt " << +record.left_trigger << " rt " << +record.right_trigger;
+            cout << " lx " << record.lx << " ly " << record.ly << " rx " << record.rx << " ry " << record.ry;
+            cout << fixed << setprecision(1) << " (" << record.age / 1000000.0 << "ms ago)" << endl;
+        }
+
+        return 0;
+    }
+
+    bool ParseRumble(const std::string& arg, ControlRumbleRequest& rumble)
+    {
+        using std::strtoul;
+
+        char* end;
+        const auto id = strtoul(arg.c_str(), &end, 10);
+
+        if (end == arg.c_str())
+        {
+            return false;
+        }
+
+        unsigned long duration = 500;
+
+        if (*end == ':')
+        {
+            const char* start = end + 1;
+            duration = strtoul(start, &end, 10);
+
+            if (end == start || duration > 0xFFFF)
+            {
+                return false;
+            }
+        }
+
+        rumble.id = static_cast<std::uint32_t>(id);
+        rumble.large_motor = 0xFF;
+        rumble.small_motor = 0xFF;
+        rumble.duration_ms = static_cast<std::uint16_t>(duration);
+
+        return *end == '\0';
+    }
+
+    // id:effect, the effect by name
+    bool ParseRumbleEffect(const std::string& arg, ControlRumbleEffectRequest& effect)
+    {
+        using std::strtoul;
+
+        char* end;
+        const auto id = strtoul(arg.c_str(), &end, 10);
+
+        if (end == arg.c_str() || *end != ':')
+        {
+            return false;
+        }
+
+        const int index = FindRumbleEffect(end + 1);
+
+        if (index < 0)
+        {
+            return false;
+        }
+
+        effect = {};
+        effect.id = static_cast<std::uint32_t>(id);
+        effect.effect = static_cast<std::uint8_t>(index);
+
+        return true;
+    }
+}
+
+int RunQuery(const std::string& query)
+{
+    using std::cerr;
+    using std::endl;
+
+    using std::string;
+
+    // queries that take an argument look like name:argument
+    const auto colon = query.find(':');
+    const string name = query.substr(0, colon);
+    const string arg = colon == string::npos ? string() : query.substr(colon + 1);
+
+    std::uint8_t opcode;
+    bytes payload;
+
+    if (name == "profile" && !arg.empty())
+    {
+        opcode = CONTROL_OP_PROFILE;
+        payload.assign(arg.begin(), arg.end());
+    }
+    else if (name == "rumble")
+    {
+        ControlRumbleRequest rumble;
+        ControlRumbleEffectRequest effect;
+
+        if (ParseRumble(arg, rumble))
+        {
+            opcode = CONTROL_OP_RUMBLE;
+            payload.assign(reinterpret_cast<const std::uint8_t*>(&rumble), reinterpret_cast<const std::uint8_t*>(&rumble) + sizeof(rumble));
+        }
+        else if (ParseRumbleEffect(arg, effect))
+        {
+            opcode = CONTROL_OP_RUMBLE_EFFECT;
+            payload.assign(reinterpret_cast<const std::uint8_t*>(&effect), reinterpret_cast<const std::uint8_t*>(&effect) + sizeof(effect));
+        }
+        else
+        {
+            cerr << "usage: --query rumble:<id>[:<ms>|:<effect>], effects are";
+
+            for (const auto& known : RumbleEffects())
+            {
+                cerr << " " << known.name;
+            }
+
+            cerr << endl;
+            return 1;
+        }
+    }
+    else if (!arg.empty())
+    {
+        cerr << "unknown query: " << query << endl;
+        return 1;
+    }
+    else if (query == "devices")
+    {
+        opcode = CONTROL_OP_DEVICES;
+    }
+    else if (query == "state")
+    {
+        opcode = CONTROL_OP_STATE;
+    }
+    else if (query == "shutdown")
+    {
+        opcode = CONTROL_OP_SHUTDOWN;
+    }
+    else if (query == "stats")
+    {
+        opcode = CONTROL_OP_STATS;
+    }
+    else if (query == "link")
+    {
+        opcode = CONTROL_OP_LINK;
+    }
+    else if (query == "trace-start")
+    {
+        opcode = CONTROL_OP_TRACE_START;
+    }
+    else if (query == "trace-stop")
+    {
+        opcode = CONTROL_OP_TRACE_STOP;
+    }
+    else if (query == "trace-dump")
+    {
+        opcode = CONTROL_OP_TRACE_DUMP;
+    }
+    else
+    {
+        cerr << "unknown query: " << query << endl;
+        return 1;
+    }
+
+    HANDLE pipe = OpenControlPipe();
+
+    if (pipe == INVALID_HANDLE_VALUE)
+    {
+        return 1;
+    }
+
+    int ret = 0;
+
+    if (opcode == CONTROL_OP_STATS)
+    {
+        ret = QueryStats(pipe);
+    }
+    else if (opcode == CONTROL_OP_LINK)
+    {
+        ret = QueryLink(pipe);
+    }
+    else if (opcode == CONTROL_OP_DEVICES)
+    {
+        ret = QueryDevices(pipe);
+    }
+    else if (opcode == CONTROL_OP_STATE)
+    {
+        ret = QueryState(pipe);
+    }
+    else
+    {
+        bytes response;
+        ControlResponseHeader header;
+
+        ret = Transact(pipe, opcode, response, header, payload) ? 0 : 1;
+    }
+
+    CloseHandle(pipe);
+
+    return ret;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+// connects to a running instance over the control pipe and prints what it asked for
+int RunQuery(const std::string& query);
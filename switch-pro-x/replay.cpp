@@ -0,0 +1,141 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <cstdint>
+
+#include "capture.h"
+#include "common.h"
+#include "decode.h"
+#include "profile.h"
+#include "replay.h"
+
+namespace
+{
+    // a bluetooth pro controller sends simple reports until it's switched to full ones, and
+    // captures from before it was switched at all hold nothing else
+    bool DecodeCapturedBluetoothReport(const std::uint8_t* data, std::size_t size, ControllerState& state)
+    {
+        return DecodeBluetoothReport(data, size, state) || DecodeSimpleBluetoothReport(data, size, state);
+    }
+}
+
+int RunReplay(const std::string& filename, bool fast)
+{
+    using std::cerr;
+    using std::cout;
+    using std::endl;
+    using std::uint64_t;
+    using std::chrono::duration;
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::chrono::steady_clock;
+    using std::this_thread::sleep_until;
+
+    CaptureReader reader(filename);
+
+    if (!reader.Valid())
+    {
+        return 1;
+    }
+
+    const auto family = reader.Family();
+    const auto transport = reader.Bluetooth() ? TRANSPORT_BLUETOOTH : TRANSPORT_USB;
+    auto decode = SelectDecoder(family, transport);
+
+    if (decode == nullptr)
+    {
+        cerr << filename << " is a " << DeviceFamilyName(family) << " capture over a transport it can't use" << endl;
+
+        return 1;
+    }
+
+    if (family == DEVICE_FAMILY_PRO_CONTROLLER && transport == TRANSPORT_BLUETOOTH)
+    {
+        decode = DecodeCapturedBluetoothReport;
+    }
+
+    VIGEM_TARGET target;
+    VIGEM_TARGET_INIT(&target);
+
+    auto ret = vigem_target_plugin(Xbox360Wired, &target);
+
+    if (!VIGEM_SUCCESS(ret))
+    {
+        cerr << "error creating controller: " << ret << endl;
+
+        return 1;
+    }
+
+    const auto& plan = ActiveProfiles().default_profile.mapping;
+
+    XUSB_REPORT last_report = { 0 };
+    uint64_t records = 0;
+    uint64_t decoded = 0;
+    uint64_t submitted = 0;
+
+    CaptureReader::Record record;
+    const auto start = steady_clock::now();
+
+    while (reader.Next(record))
+    {
+        if (record.direction != CAPTURE_DIRECTION_INPUT)
+        {
+            continue;
+        }
+
+        records++;
+
+        if (!fast)
+        {
+            sleep_until(start + record.timestamp);
+        }
+
+        ControllerState state;
+
+        if (!decode(record.data, record.size, state))
+        {
+            continue;
+        }
+
+        decoded++;
+
+        const auto report = MapToXUSB(state, plan);
+
+        if (report != last_report)
+        {
+            ret = vigem_xusb_submit_report(target, report);
+
+            if (!VIGEM_SUCCESS(ret))
+            {
+                cerr << "error sending report: " << ret << endl;
+                break;
+            }
+
+            last_report = report;
+            submitted++;
+        }
+    }
+
+    const auto elapsed = steady_clock::now() - start;
+
+    vigem_target_unplug(&target);
+
+    cout << "replayed " << records << " input reports, " << decoded << " decoded, " << submitted << " submitted in ";
+    cout << duration_cast<duration<double, std::milli>>(elapsed).count() << "ms" << endl;
+
+    if (fast && records > 0)
+    {
+        const auto ns = duration_cast<nanoseconds>(elapsed).count();
+
+        cout << static_cast<double>(ns) / records << " ns/report, ";
+        cout << (ns > 0 ? records * 1e9 / ns : 0.0) << " reports/s" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// feeds a capture file's input reports through decode, mapping and a virtual controller,
+// either at the original timing or as fast as possible
+int RunReplay(const std::string& filename, bool fast);
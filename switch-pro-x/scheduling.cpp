@@ -0,0 +1,159 @@
+#define NOMINMAX
+#include <Windows.h>
+#include <avrt.h>
+
+#include <iostream>
+#include <sstream>
+
+#include <cstdlib>
+
+#include "common.h"
+#include "scheduling.h"
+
+namespace
+{
+    struct PriorityName
+    {
+        const char* name;
+        int priority;
+    };
+
+    const PriorityName PRIORITY_NAMES[] = {
+        { "normal", THREAD_PRIORITY_NORMAL },
+        { "above-normal", THREAD_PRIORITY_ABOVE_NORMAL },
+        { "highest", THREAD_PRIORITY_HIGHEST },
+        { "time-critical", THREAD_PRIORITY_TIME_CRITICAL },
+    };
+
+    constexpr unsigned int MAX_CPUS = 64;
+}
+
+bool ParseThreadPriority(const std::string& text, int& priority)
+{
+    for (const auto& p : PRIORITY_NAMES)
+    {
+        if (text == p.name)
+        {
+            priority = p.priority;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ParseAffinity(const std::string& text, std::uint64_t& affinity)
+{
+    using std::strtoul;
+
+    affinity = 0;
+
+    const char* pos = text.c_str();
+
+    for (;;)
+    {
+        char* end;
+        const auto cpu = strtoul(pos, &end, 10);
+
+        if (end == pos || cpu >= MAX_CPUS)
+        {
+            return false;
+        }
+
+        affinity |= static_cast<std::uint64_t>(1) << cpu;
+
+        if (*end == '\0')
+        {
+            return true;
+        }
+
+        if (*end != ',')
+        {
+            return false;
+        }
+
+        pos = end + 1;
+    }
+}
+
+std::string DescribeIoScheduling(const IoSchedulingConfig& config)
+{
+    using std::ostringstream;
+
+    ostringstream out;
+
+    out << "priority ";
+
+    for (const auto& p : PRIORITY_NAMES)
+    {
+        if (config.priority == p.priority)
+        {
+            out << p.name;
+        }
+    }
+
+    out << ", cpus ";
+
+    if (config.affinity == 0)
+    {
+        out << "any";
+    }
+    else
+    {
+        const char* separator = "";
+
+        for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++)
+        {
+            if (config.affinity & (static_cast<std::uint64_t>(1) << cpu))
+            {
+                out << separator << cpu;
+                separator = ",";
+            }
+        }
+    }
+
+    out << ", mmcss " << (config.mmcss_task.empty() ? "off" : config.mmcss_task);
+
+    return out.str();
+}
+
+IoThreadScheduling::IoThreadScheduling(const IoSchedulingConfig& config)
+    : mmcss(nullptr)
+{
+    using std::cerr;
+    using std::endl;
+
+    const auto thread = GetCurrentThread();
+
+    if (config.priority != THREAD_PRIORITY_NORMAL && !SetThreadPriority(thread, config.priority))
+    {
+        cerr << "error setting I/O thread priority (" << GetLastError() << ")" << endl;
+    }
+
+    if (config.affinity != 0 && SetThreadAffinityMask(thread, static_cast<DWORD_PTR>(config.affinity)) == 0)
+    {
+        cerr << "error setting I/O thread affinity (" << GetLastError() << ")" << endl;
+    }
+
+    // mmcss boosts the thread into the realtime range while it's registered, on top of the above
+    if (!config.mmcss_task.empty())
+    {
+        const auto task = tstring(config.mmcss_task.begin(), config.mmcss_task.end());
+        DWORD task_index = 0;
+
+        mmcss = AvSetMmThreadCharacteristics(task.c_str(), &task_index);
+
+        if (mmcss == nullptr)
+        {
+            cerr << "error joining mmcss task " << config.mmcss_task << " (" << GetLastError() << ")" << endl;
+        }
+    }
+}
+
+IoThreadScheduling::~IoThreadScheduling()
+{
+    if (mmcss != nullptr)
+    {
+        AvRevertMmThreadCharacteristics(mmcss);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <string>
+
+#include <cstdint>
+
+// how the threads doing device I/O are scheduled: the read threads and the macro engine
+struct IoSchedulingConfig
+{
+    // one of the THREAD_PRIORITY_* values
+    int priority = THREAD_PRIORITY_NORMAL;
+    // 0 leaves the threads on every cpu the process may use
+    std::uint64_t affinity = 0;
+    // multimedia class scheduler task, "Games" or "Pro Audio" for example
+    std::string mmcss_task;
+};
+
+bool ParseThreadPriority(const std::string& text, int& priority);
+bool ParseAffinity(const std::string& text, std::uint64_t& affinity);
+std::string DescribeIoScheduling(const IoSchedulingConfig& config);
+
+// applies the config to the calling thread for as long as it lives
+class IoThreadScheduling
+{
+public:
+    explicit IoThreadScheduling(const IoSchedulingConfig& config);
+    ~IoThreadScheduling();
+
+    IoThreadScheduling(const IoThreadScheduling&) = delete;
+    IoThreadScheduling& operator=(const IoThreadScheduling&) = delete;
+
+private:
+    HANDLE mmcss;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <type_traits>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// a value with one writer that readers copy out without ever making the writer wait. the value is
+// kept in relaxed atomic words, so a read that overlaps a write is simply retried
+template <typename T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied bytewise");
+
+public:
+    Seqlock()
+        : sequence(0)
+    {
+        for (auto& word : words)
+        {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Store(const T& value)
+    {
+        using std::atomic_thread_fence;
+        using std::memcpy;
+        using std::memory_order_relaxed;
+        using std::memory_order_release;
+
+        std::uint64_t buf[WORDS] = {};
+        memcpy(buf, &value, sizeof(value));
+
+        const auto seq = sequence.load(memory_order_relaxed);
+        sequence.store(seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        for (std::size_t i = 0; i < WORDS; i++)
+        {
+            words[i].store(buf[i], memory_order_relaxed);
+        }
+
+        sequence.store(seq + 2, memory_order_release);
+    }
+
+    T Load() const
+    {
+        T value;
+
+        while (!TryLoad(value))
+        {
+        }
+
+        return value;
+    }
+
+    // a single attempt, false if it overlapped a write. readers in other processes use this so a
+    // writer that died halfway through a store can't keep them spinning
+    bool TryLoad(T& value) const
+    {
+        using std::atomic_thread_fence;
+        using std::memcpy;
+        using std::memory_order_acquire;
+        using std::memory_order_relaxed;
+
+        std::uint64_t buf[WORDS];
+        const auto before = sequence.load(memory_order_acquire);
+
+        for (std::size_t i = 0; i < WORDS; i++)
+        {
+            buf[i] = words[i].load(memory_order_relaxed);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+
+        // odd while a write is in progress
+        if ((before & 1) != 0 || sequence.load(memory_order_relaxed) != before)
+        {
+            return false;
+        }
+
+        memcpy(&value, buf, sizeof(value));
+
+        return true;
+    }
+
+private:
+    static constexpr std::size_t WORDS = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+    std::atomic<std::uint32_t> sequence;
+    std::array<std::atomic<std::uint64_t>, WORDS> words;
+};
@@ -0,0 +1,253 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#include <cstring>
+
+#include "battery.h"
+#include "shared_state.h"
+
+namespace
+{
+    // a reader that loses this many races in a row to the writer gives up until the next poll
+    constexpr int READ_ATTEMPTS = 16;
+}
+
+SharedStatePublisher::SharedStatePublisher()
+    : mapping(nullptr)
+    , block(nullptr)
+    , attached()
+{
+    using std::cerr;
+    using std::endl;
+    using std::memcpy;
+
+    mapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(SharedStateBlock), SHARED_STATE_NAME);
+
+    if (mapping == nullptr)
+    {
+        cerr << "error creating shared state mapping (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    // two instances would take turns overwriting each other's slots
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        cerr << "shared state is already published by another instance" << endl;
+        return;
+    }
+
+    const auto view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(SharedStateBlock));
+
+    if (view == nullptr)
+    {
+        cerr << "error mapping shared state (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    // fresh mappings are zeroed, which is every slot free with an even sequence
+    block = new (view) SharedStateBlock();
+    block->version = SHARED_STATE_VERSION;
+    block->slot_count = SHARED_STATE_SLOTS;
+    block->slot_size = sizeof(SharedStateSlot);
+
+    // the magic goes last, readers don't trust the rest before it's there
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(block->magic, SHARED_STATE_MAGIC, sizeof(block->magic));
+}
+
+SharedStatePublisher::~SharedStatePublisher()
+{
+    if (block != nullptr)
+    {
+        UnmapViewOfFile(block);
+    }
+
+    if (mapping != nullptr)
+    {
+        CloseHandle(mapping);
+    }
+}
+
+bool SharedStatePublisher::Valid() const
+{
+    return block != nullptr;
+}
+
+int SharedStatePublisher::Attach(unsigned int id, DeviceFamily family, bool bluetooth)
+{
+    using std::lock_guard;
+    using std::mutex;
+
+    lock_guard<mutex> lk(slots_mutex);
+
+    for (std::size_t i = 0; i < SHARED_STATE_SLOTS; i++)
+    {
+        auto& state = attached[i];
+
+        if (state.connected)
+        {
+            continue;
+        }
+
+        state = SharedControllerState();
+        state.connected = 1;
+        state.family = static_cast<std::uint8_t>(family);
+        state.bluetooth = bluetooth ? 1 : 0;
+        state.power = POWER_STATUS_UNKNOWN;
+        state.id = id;
+
+        block->slots[i].state.Store(state);
+
+        return static_cast<int>(i);
+    }
+
+    return -1;
+}
+
+void SharedStatePublisher::Detach(int slot)
+{
+    using std::lock_guard;
+    using std::mutex;
+
+    lock_guard<mutex> lk(slots_mutex);
+
+    attached[slot].connected = 0;
+    block->slots[slot].state.Store(attached[slot]);
+}
+
+void SharedStatePublisher::Publish(int slot, const ControllerState& state, const ImuSample* samples, std::size_t sample_count)
+{
+    using std::memcpy;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    // the slot's writer owns its copy, Attach and Detach only touch it while nothing publishes
+    auto& shared = attached[slot];
+
+    shared.power = state.power;
+    shared.buttons = state.buttons;
+    shared.lx = state.lx;
+    shared.ly = state.ly;
+    shared.rx = state.rx;
+    shared.ry = state.ry;
+    shared.reports++;
+    shared.time_us = duration_cast<microseconds>(state.time.time_since_epoch()).count();
+
+    if (sample_count > 0)
+    {
+        memcpy(shared.accel, samples[sample_count - 1].accel, sizeof(shared.accel));
+        memcpy(shared.gyro, samples[sample_count - 1].gyro, sizeof(shared.gyro));
+    }
+
+    block->slots[slot].state.Store(shared);
+}
+
+SharedStateReader::SharedStateReader()
+    : mapping(nullptr)
+    , block(nullptr)
+{
+    using std::cerr;
+    using std::endl;
+    using std::memcmp;
+
+    mapping = OpenFileMapping(FILE_MAP_READ, FALSE, SHARED_STATE_NAME);
+
+    if (mapping == nullptr)
+    {
+        cerr << "no shared state to read, is switch-pro-x running with --shared-state? (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    const auto view = static_cast<const SharedStateBlock*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(SharedStateBlock)));
+
+    if (view == nullptr)
+    {
+        cerr << "error mapping shared state (" << GetLastError() << ")" << endl;
+        return;
+    }
+
+    if (memcmp(view->magic, SHARED_STATE_MAGIC, sizeof(view->magic)) != 0 || view->version != SHARED_STATE_VERSION)
+    {
+        cerr << "shared state is from an incompatible version" << endl;
+
+        UnmapViewOfFile(view);
+        return;
+    }
+
+    block = view;
+}
+
+SharedStateReader::~SharedStateReader()
+{
+    if (block != nullptr)
+    {
+        UnmapViewOfFile(block);
+    }
+
+    if (mapping != nullptr)
+    {
+        CloseHandle(mapping);
+    }
+}
+
+bool SharedStateReader::Valid() const
+{
+    return block != nullptr;
+}
+
+bool SharedStateReader::Read(std::size_t slot, SharedControllerState& state) const
+{
+    for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+    {
+        if (block->slots[slot].state.TryLoad(state))
+        {
+            return state.connected != 0;
+        }
+    }
+
+    return false;
+}
+
+int RunWatch()
+{
+    using std::cout;
+    using std::endl;
+    using std::setw;
+    using std::chrono::milliseconds;
+    using std::this_thread::sleep_for;
+
+    SharedStateReader reader;
+
+    if (!reader.Valid())
+    {
+        return 1;
+    }
+
+    while (true)
+    {
+        for (std::size_t slot = 0; slot < SHARED_STATE_SLOTS; slot++)
+        {
+            SharedControllerState state;
+
+            if (!reader.Read(slot, state))
+            {
+                continue;
+            }
+
+            cout << "device " << state.id << " " << DeviceFamilyName(static_cast<DeviceFamily>(state.family));
+            cout << ": " << setw(24) << FormatButtonNames(state.buttons);
+            cout << " L " << setw(6) << state.lx << " " << setw(6) << state.ly;
+            cout << " R " << setw(6) << state.rx << " " << setw(6) << state.ry;
+            cout << " gyro " << setw(6) << state.gyro[0] << " " << setw(6) << state.gyro[1] << " " << setw(6) << state.gyro[2];
+            cout << ", " << DescribePowerStatus(state.power) << ", report " << state.reports << endl;
+        }
+
+        sleep_for(milliseconds(100));
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <mutex>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "decode.h"
+#include "family.h"
+#include "seqlock.h"
+
+// every decoded report is published into this named file mapping, so overlays and input displays
+// can watch the controllers without opening them and fighting HidGuardian for the device.
+// Local\ keeps it per session, like the control pipe
+#define SHARED_STATE_NAME TEXT("Local\\switch-pro-x-state")
+
+constexpr char SHARED_STATE_MAGIC[8] = { 'S', 'P', 'X', 'S', 'T', 'A', 'T', 'E' };
+constexpr std::uint32_t SHARED_STATE_VERSION = 1;
+constexpr std::size_t SHARED_STATE_SLOTS = 16;
+
+// one controller's latest report. everything is fixed size and little endian so readers in other
+// languages can lay the same struct over the mapping
+struct SharedControllerState
+{
+    // 0 while the slot is free
+    std::uint8_t connected;
+    // DeviceFamily
+    std::uint8_t family;
+    std::uint8_t bluetooth;
+    // battery.h status byte, or 0xFF when the report didn't carry one
+    std::uint8_t power;
+    // the id the console messages and --query use
+    std::uint32_t id;
+    // CONTROLLER_BUTTON_* bits
+    std::uint32_t buttons;
+    // in the xinput range, after stick filtering
+    std::int16_t lx;
+    std::int16_t ly;
+    std::int16_t rx;
+    std::int16_t ry;
+    // counts up with every report, so readers can tell a new one from the same one read twice
+    std::uint64_t reports;
+    // when the controller sampled the report, in microseconds of QueryPerformanceCounter time
+    std::uint64_t time_us;
+    // the newest IMU sample in raw sensor units, zero for reports without one
+    std::int16_t accel[3];
+    std::int16_t gyro[3];
+};
+
+// a uint32 sequence at offset 0, odd while the writer is in the middle of an update, and the
+// state at offset 8. readers copy the state out and retry if the sequence changed meanwhile
+struct alignas(64) SharedStateSlot
+{
+    Seqlock<SharedControllerState> state;
+};
+
+struct SharedStateBlock
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t slot_count;
+    std::uint32_t slot_size;
+    std::uint8_t reserved[44];
+    SharedStateSlot slots[SHARED_STATE_SLOTS];
+};
+
+static_assert(sizeof(SharedStateSlot) == 64 && sizeof(SharedStateBlock) == 64 + 64 * SHARED_STATE_SLOTS, "the shared state layout is fixed");
+
+// the writing side. each slot has exactly one writer, its controller's sink thread, and a store
+// never waits on readers
+class SharedStatePublisher
+{
+public:
+    SharedStatePublisher();
+    ~SharedStatePublisher();
+
+    bool Valid() const;
+
+    // a free slot, or -1 if all of them are taken
+    int Attach(unsigned int id, DeviceFamily family, bool bluetooth);
+    void Detach(int slot);
+    // only called from the sink thread of the controller that has the slot
+    void Publish(int slot, const ControllerState& state, const ImuSample* samples, std::size_t sample_count);
+
+private:
+    HANDLE mapping;
+    SharedStateBlock* block;
+
+    // only taken to hand out slots, the header fields stay fixed while a slot is attached
+    std::mutex slots_mutex;
+    SharedControllerState attached[SHARED_STATE_SLOTS];
+};
+
+// the reading side, for --watch and as an example for other tools
+class SharedStateReader
+{
+public:
+    SharedStateReader();
+    ~SharedStateReader();
+
+    bool Valid() const;
+    // false if the slot is free, or kept changing for longer than a few retries
+    bool Read(std::size_t slot, SharedControllerState& state) const;
+
+private:
+    HANDLE mapping;
+    const SharedStateBlock* block;
+};
+
+// prints every connected controller's state ten times a second
+int RunWatch();
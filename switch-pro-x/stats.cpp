@@ -0,0 +1,55 @@
+#include "stats.h"
+
+namespace
+{
+    const char* COUNTER_NAMES[DEVICE_COUNTER_COUNT] = {
+        "reports",
+        "submitted",
+        "deduped",
+        "suppressed",
+        "read timeouts",
+        "read errors",
+        "write stalls",
+        "write errors",
+        "rumble sent",
+        "rumble skipped",
+        "output backoffs",
+        "handshake retries",
+        "dropped",
+        "duplicated",
+        "link degraded",
+        "battery alerts",
+        "subcommand retries",
+        "subcommand failures",
+        "capture drops",
+        "dsu drops",
+        "shared state drops",
+        "stream drops",
+    };
+}
+
+const char* DeviceCounterName(DeviceCounter counter)
+{
+    return COUNTER_NAMES[counter];
+}
+
+DeviceStats::DeviceStats()
+    : start(std::chrono::steady_clock::now())
+{
+    using std::memory_order_relaxed;
+
+    for (auto& counter : counters)
+    {
+        counter.store(0, memory_order_relaxed);
+    }
+}
+
+std::uint64_t DeviceStats::Get(DeviceCounter counter) const
+{
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+std::chrono::steady_clock::duration DeviceStats::Uptime() const
+{
+    return std::chrono::steady_clock::now() - start;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include <cstdint>
+
+enum DeviceCounter
+{
+    // input reports read from the device
+    DEVICE_COUNTER_REPORTS,
+    // reports passed on to vigem_xusb_submit_report
+    DEVICE_COUNTER_SUBMITTED,
+    // reports dropped because they matched last_report
+    DEVICE_COUNTER_DEDUPED,
+    // changed reports held back by the hysteresis gate
+    DEVICE_COUNTER_SUPPRESSED,
+    DEVICE_COUNTER_READ_TIMEOUTS,
+    DEVICE_COUNTER_READ_ERRORS,
+    // writes that didn't complete within the timeout
+    DEVICE_COUNTER_WRITE_STALLS,
+    DEVICE_COUNTER_WRITE_ERRORS,
+    DEVICE_COUNTER_RUMBLE_SENT,
+    // rumble packets --output-rate-control didn't think worth the airtime
+    DEVICE_COUNTER_RUMBLE_SKIPPED,
+    // times it widened the rumble interval because the link was congested
+    DEVICE_COUNTER_OUTPUT_BACKOFFS,
+    // handshake commands sent again because the controller didn't answer
+    DEVICE_COUNTER_HANDSHAKE_RETRIES,
+    // reports the controller's timer says were sent but never arrived
+    DEVICE_COUNTER_DROPPED,
+    DEVICE_COUNTER_DUPLICATED,
+    // times the report rate fell below nominal
+    DEVICE_COUNTER_LINK_DEGRADED,
+    // times the battery dropped to one of the --battery-alert levels
+    DEVICE_COUNTER_BATTERY_ALERTS,
+    // subcommands sent again because the controller didn't answer in time
+    DEVICE_COUNTER_SUBCOMMAND_RETRIES,
+    // subcommands that went unanswered after every retry
+    DEVICE_COUNTER_SUBCOMMAND_FAILURES,
+    // reports a sink fell too far behind to see, each sink counts its own
+    DEVICE_COUNTER_CAPTURE_DROPS,
+    DEVICE_COUNTER_DSU_DROPS,
+    DEVICE_COUNTER_SHARED_STATE_DROPS,
+    DEVICE_COUNTER_STREAM_DROPS,
+
+    DEVICE_COUNTER_COUNT
+};
+
+const char* DeviceCounterName(DeviceCounter counter);
+
+// counters are only touched with relaxed atomic adds. most are only written by the read thread and
+// the drop counters by their sink thread, but submitted, deduped and suppressed are also counted by
+// the macro engine thread and by a paired partner's read thread, which is why every write is a
+// fetch_add. anything can read them at any time without stopping the writers
+class DeviceStats
+{
+public:
+    DeviceStats();
+
+    void Increment(DeviceCounter counter, std::uint64_t count = 1)
+    {
+        counters[counter].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    std::uint64_t Get(DeviceCounter counter) const;
+    std::chrono::steady_clock::duration Uptime() const;
+
+private:
+    std::array<std::atomic<std::uint64_t>, DEVICE_COUNTER_COUNT> counters;
+    const std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,433 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <ViGEmUM.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+
+#include <cstring>
+
+#include "profile.h"
+#include "stream.h"
+
+namespace
+{
+    // version 2 added the session
+    constexpr std::uint8_t STREAM_VERSION = 2;
+
+    enum StreamField : std::uint8_t
+    {
+        STREAM_FIELD_BUTTONS = 0x01,
+        STREAM_FIELD_LX = 0x02,
+        STREAM_FIELD_LY = 0x04,
+        STREAM_FIELD_RX = 0x08,
+        STREAM_FIELD_RY = 0x10,
+        STREAM_FIELD_POWER = 0x20,
+        STREAM_FIELD_ALL = 0x3F,
+        // the frame has every field and doesn't depend on the ones before it
+        STREAM_FIELD_KEYFRAME = 0x80,
+    };
+
+    // the wire format is little endian like us, so these are plain copies
+    template <typename T>
+    void Put(std::uint8_t*& out, T value)
+    {
+        std::memcpy(out, &value, sizeof(value));
+        out += sizeof(value);
+    }
+
+    template <typename T>
+    bool Get(const std::uint8_t*& in, const std::uint8_t* end, T& value)
+    {
+        if (end - in < static_cast<std::ptrdiff_t>(sizeof(value)))
+        {
+            return false;
+        }
+
+        std::memcpy(&value, in, sizeof(value));
+        in += sizeof(value);
+
+        return true;
+    }
+
+    // each present field in mask order, true if the frame wasn't cut short
+    bool ReadFrame(const std::uint8_t*& in, const std::uint8_t* end, std::uint8_t mask, ControllerState& state)
+    {
+        return (!(mask & STREAM_FIELD_BUTTONS) || Get(in, end, state.buttons)) &&
+            (!(mask & STREAM_FIELD_LX) || Get(in, end, state.lx)) &&
+            (!(mask & STREAM_FIELD_LY) || Get(in, end, state.ly)) &&
+            (!(mask & STREAM_FIELD_RX) || Get(in, end, state.rx)) &&
+            (!(mask & STREAM_FIELD_RY) || Get(in, end, state.ry)) &&
+            (!(mask & STREAM_FIELD_POWER) || Get(in, end, state.power));
+    }
+}
+
+StreamEncoder::StreamEncoder(std::uint8_t _pad, std::size_t _redundancy)
+    : pad(_pad)
+    , redundancy(std::min(std::max<std::size_t>(_redundancy, 1), STREAM_MAX_REDUNDANCY))
+    , session(std::random_device()())
+    , sequence(0)
+    , last()
+    , frames()
+    , buffer()
+{
+}
+
+std::size_t StreamEncoder::Encode(const ControllerState& state, const std::uint8_t*& packet)
+{
+    using std::min;
+
+    sequence++;
+
+    std::uint8_t mask = 0;
+
+    if (sequence % STREAM_KEYFRAME_INTERVAL == 1)
+    {
+        mask = STREAM_FIELD_ALL | STREAM_FIELD_KEYFRAME;
+    }
+    else
+    {
+        mask |= state.buttons != last.buttons ? STREAM_FIELD_BUTTONS : 0;
+        mask |= state.lx != last.lx ? STREAM_FIELD_LX : 0;
+        mask |= state.ly != last.ly ? STREAM_FIELD_LY : 0;
+        mask |= state.rx != last.rx ? STREAM_FIELD_RX : 0;
+        mask |= state.ry != last.ry ? STREAM_FIELD_RY : 0;
+        mask |= state.power != last.power ? STREAM_FIELD_POWER : 0;
+    }
+
+    last = state;
+
+    // an unchanged report is a single byte, it's still sent so the one before it gets repeated
+    auto& frame = frames[sequence % frames.size()];
+    auto out = frame.data;
+
+    Put(out, mask);
+
+    if (mask & STREAM_FIELD_BUTTONS)
+    {
+        Put(out, state.buttons);
+    }
+
+    if (mask & STREAM_FIELD_LX)
+    {
+        Put(out, state.lx);
+    }
+
+    if (mask & STREAM_FIELD_LY)
+    {
+        Put(out, state.ly);
+    }
+
+    if (mask & STREAM_FIELD_RX)
+    {
+        Put(out, state.rx);
+    }
+
+    if (mask & STREAM_FIELD_RY)
+    {
+        Put(out, state.ry);
+    }
+
+    if (mask & STREAM_FIELD_POWER)
+    {
+        Put(out, state.power);
+    }
+
+    frame.size = static_cast<std::uint8_t>(out - frame.data);
+
+    // the header, then the frames oldest first up to this one
+    const auto count = static_cast<std::uint8_t>(min<std::size_t>(redundancy, sequence));
+    out = buffer.data();
+
+    Put(out, STREAM_VERSION);
+    Put(out, pad);
+    Put(out, count);
+    Put(out, session);
+    Put(out, sequence);
+
+    for (std::uint32_t seq = sequence - count + 1; seq != sequence + 1; seq++)
+    {
+        const auto& repeated = frames[seq % frames.size()];
+        std::memcpy(out, repeated.data, repeated.size);
+        out += repeated.size;
+    }
+
+    packet = buffer.data();
+
+    return out - buffer.data();
+}
+
+StreamDecoder::StreamDecoder(Sink _sink)
+    : sink(_sink)
+    , pads()
+    , stats()
+{
+}
+
+void StreamDecoder::Decode(const std::uint8_t* data, std::size_t size)
+{
+    const auto end = data + size;
+    std::uint8_t version;
+    std::uint8_t pad;
+    std::uint8_t count;
+    std::uint32_t session;
+    std::uint32_t newest;
+
+    if (!Get(data, end, version) || version != STREAM_VERSION || !Get(data, end, pad) || !Get(data, end, count) ||
+        !Get(data, end, session) || !Get(data, end, newest) || count == 0)
+    {
+        stats.malformed++;
+        return;
+    }
+
+    stats.packets++;
+
+    auto& stream = pads[pad];
+
+    // the sender was restarted, its sequence numbers start over and the next keyframe syncs it.
+    // a late packet from the old session costs a resync too, at most a keyframe interval
+    if (session != stream.session)
+    {
+        stream.synced = false;
+        stream.session = session;
+    }
+
+    for (std::uint32_t seq = newest - count + 1; seq != newest + 1; seq++)
+    {
+        std::uint8_t mask;
+        ControllerState state = stream.state;
+
+        if (!Get(data, end, mask) || !ReadFrame(data, end, mask, state))
+        {
+            stats.malformed++;
+            return;
+        }
+
+        // already applied, from an earlier packet or this one arriving late
+        const auto ahead = static_cast<std::int32_t>(seq - stream.sequence);
+
+        if (stream.synced && ahead <= 0)
+        {
+            continue;
+        }
+
+        // a gap only a keyframe can bridge, the frames in between are gone for good
+        if (!stream.synced || ahead > 1)
+        {
+            if (!(mask & STREAM_FIELD_KEYFRAME))
+            {
+                continue;
+            }
+
+            if (stream.synced)
+            {
+                stats.lost += ahead - 1;
+            }
+        }
+
+        if (seq != newest)
+        {
+            stats.recovered++;
+        }
+
+        stream.synced = true;
+        stream.sequence = seq;
+        stream.state = state;
+        stream.state.time = std::chrono::steady_clock::now();
+
+        sink(pad, stream.state);
+    }
+}
+
+const StreamDecoderStats& StreamDecoder::Stats() const
+{
+    return stats;
+}
+
+StreamSender::StreamSender(const UdpEndpoint& _destination, double _loss, double _reorder)
+    : socket(UDP_ANY, 0)
+    , destination(_destination)
+    , loss(_loss)
+    , reorder(_reorder)
+    , random(std::random_device()())
+    , held()
+    , held_size(0)
+{
+}
+
+bool StreamSender::Valid() const
+{
+    return socket.Valid();
+}
+
+void StreamSender::Send(const std::uint8_t* packet, std::size_t size)
+{
+    using std::lock_guard;
+    using std::uniform_real_distribution;
+
+    if (loss <= 0.0 && reorder <= 0.0)
+    {
+        socket.Send(packet, size, destination);
+        return;
+    }
+
+    lock_guard<spinlock> lk(lock);
+    uniform_real_distribution<double> percent(0.0, 100.0);
+
+    if (percent(random) < loss)
+    {
+        return;
+    }
+
+    if (held_size == 0 && percent(random) < reorder)
+    {
+        std::memcpy(held.data(), packet, size);
+        held_size = size;
+        return;
+    }
+
+    socket.Send(packet, size, destination);
+
+    if (held_size > 0)
+    {
+        socket.Send(held.data(), held_size, destination);
+        held_size = 0;
+    }
+}
+
+StreamReceiver::StreamReceiver(std::uint32_t address, std::uint16_t _port, StreamDecoder::Sink sink)
+    : socket(address, _port)
+    , decoder(sink)
+    , quitting(false)
+{
+    using std::thread;
+
+    if (!socket.Valid())
+    {
+        return;
+    }
+
+    receive_thread = thread(&StreamReceiver::ReceiveThread, this);
+}
+
+StreamReceiver::~StreamReceiver()
+{
+    quitting = true;
+
+    if (receive_thread.joinable())
+    {
+        receive_thread.join();
+    }
+}
+
+bool StreamReceiver::Valid() const
+{
+    return socket.Valid();
+}
+
+std::uint16_t StreamReceiver::Port() const
+{
+    return socket.Port();
+}
+
+const StreamDecoderStats& StreamReceiver::Stats() const
+{
+    return decoder.Stats();
+}
+
+void StreamReceiver::ReceiveThread()
+{
+    using std::chrono::milliseconds;
+
+    std::uint8_t packet[STREAM_MAX_PACKET_SIZE];
+
+    while (!quitting)
+    {
+        // wakes up now and then to notice quitting
+        if (!socket.WaitReadable(milliseconds(250)))
+        {
+            continue;
+        }
+
+        UdpEndpoint from;
+        const auto size = socket.Receive(packet, sizeof(packet), from);
+
+        if (size > 0)
+        {
+            decoder.Decode(packet, size);
+        }
+    }
+}
+
+int RunStreamReceiver(std::uint16_t port)
+{
+    using std::array;
+    using std::cerr;
+    using std::cout;
+    using std::endl;
+    using std::chrono::seconds;
+    using std::this_thread::sleep_for;
+
+    // only touched from the receive thread
+    array<bool, 256> plugged = {};
+    array<VIGEM_TARGET, 256> targets;
+    array<XUSB_REPORT, 256> last_reports;
+    const auto& plan = ActiveProfiles().default_profile.mapping;
+
+    StreamReceiver receiver(UDP_ANY, port, [&](std::uint8_t pad, const ControllerState& state) {
+        if (!plugged[pad])
+        {
+            VIGEM_TARGET_INIT(&targets[pad]);
+
+            const auto ret = vigem_target_plugin(Xbox360Wired, &targets[pad]);
+
+            if (!VIGEM_SUCCESS(ret))
+            {
+                cerr << "error creating controller: " << ret << endl;
+                return;
+            }
+
+            plugged[pad] = true;
+            last_reports[pad] = { 0 };
+            cout << "STREAM PAD " << static_cast<unsigned int>(pad) << " CONNECTED" << endl;
+        }
+
+        const auto report = MapToXUSB(state, plan);
+
+        if (report != last_reports[pad])
+        {
+            vigem_xusb_submit_report(targets[pad], report);
+            last_reports[pad] = report;
+        }
+    });
+
+    if (!receiver.Valid())
+    {
+        return 1;
+    }
+
+    cout << "receiving streams on port " << receiver.Port() << ", ctrl+c to stop" << endl;
+
+    const auto& stats = receiver.Stats();
+    std::uint64_t last_packets = 0;
+
+    while (true)
+    {
+        sleep_for(seconds(1));
+
+        const std::uint64_t packets = stats.packets;
+        cout << packets - last_packets << " packets/s, " << stats.recovered << " frames recovered, " << stats.lost << " lost";
+
+        if (stats.malformed > 0)
+        {
+            cout << ", " << stats.malformed << " malformed";
+        }
+
+        cout << endl;
+        last_packets = packets;
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <thread>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common.h"
+#include "decode.h"
+#include "udp.h"
+
+// forwards decoded pad state to another host. every report becomes one frame, the difference to
+// the frame before it, and every packet carries the newest frame along with the ones before it,
+// so a lost packet is made up for by the next one instead of waiting for a retransmit
+constexpr std::uint16_t STREAM_DEFAULT_PORT = 26761;
+constexpr std::size_t STREAM_MAX_REDUNDANCY = 8;
+constexpr std::size_t STREAM_DEFAULT_REDUNDANCY = 3;
+// a frame with the full state, so longer losses heal within this many reports
+constexpr std::uint32_t STREAM_KEYFRAME_INTERVAL = 32;
+// a mask byte, buttons, four axes and the power byte
+constexpr std::size_t STREAM_MAX_FRAME_SIZE = 1 + 4 + 4 * 2 + 1;
+constexpr std::size_t STREAM_HEADER_SIZE = 11;
+constexpr std::size_t STREAM_MAX_PACKET_SIZE = STREAM_HEADER_SIZE + STREAM_MAX_REDUNDANCY * STREAM_MAX_FRAME_SIZE;
+
+// one pad's side of the stream, only used from the thread handling that pad's reports. every
+// encoder picks a random session, so a restarted sender is told apart from the one before it
+class StreamEncoder
+{
+public:
+    StreamEncoder(std::uint8_t _pad, std::size_t _redundancy);
+
+    // the packet for this report, valid until the next call
+    std::size_t Encode(const ControllerState& state, const std::uint8_t*& packet);
+
+private:
+    struct Frame
+    {
+        std::uint8_t size;
+        std::uint8_t data[STREAM_MAX_FRAME_SIZE];
+    };
+
+    const std::uint8_t pad;
+    const std::size_t redundancy;
+    const std::uint32_t session;
+    std::uint32_t sequence;
+    ControllerState last;
+    // the newest frames, indexed by sequence
+    std::array<Frame, STREAM_MAX_REDUNDANCY> frames;
+    std::array<std::uint8_t, STREAM_MAX_PACKET_SIZE> buffer;
+};
+
+// only written by the decoding thread, readable from anywhere
+struct StreamDecoderStats
+{
+    std::atomic<std::uint64_t> packets;
+    // frames applied from a later packet's redundancy after their own packet was lost or late
+    std::atomic<std::uint64_t> recovered;
+    // frames lost past the redundancy, jumped over by the next keyframe
+    std::atomic<std::uint64_t> lost;
+    std::atomic<std::uint64_t> malformed;
+};
+
+// the receiving side for any number of pads. frames are applied strictly in sequence, so a
+// button pressed and released between two packets still reaches the sink
+class StreamDecoder
+{
+public:
+    using Sink = std::function<void(std::uint8_t pad, const ControllerState& state)>;
+
+    explicit StreamDecoder(Sink _sink);
+
+    void Decode(const std::uint8_t* data, std::size_t size);
+    const StreamDecoderStats& Stats() const;
+
+private:
+    struct PadStream
+    {
+        bool synced;
+        // a new session starts the pad over, its sequence begins again at 1
+        std::uint32_t session;
+        std::uint32_t sequence;
+        ControllerState state;
+    };
+
+    const Sink sink;
+    std::array<PadStream, 256> pads;
+    StreamDecoderStats stats;
+};
+
+// sends every controller's stream from one socket. loss and reorder simulate a bad network for
+// testing, in percent of packets dropped or held back until after the next one
+class StreamSender
+{
+public:
+    StreamSender(const UdpEndpoint& _destination, double _loss, double _reorder);
+
+    bool Valid() const;
+    void Send(const std::uint8_t* packet, std::size_t size);
+
+private:
+    UdpSocket socket;
+    const UdpEndpoint destination;
+    const double loss;
+    const double reorder;
+
+    // only taken when simulating
+    spinlock lock;
+    std::minstd_rand random;
+    std::array<std::uint8_t, STREAM_MAX_PACKET_SIZE> held;
+    std::size_t held_size;
+};
+
+class StreamReceiver
+{
+public:
+    StreamReceiver(std::uint32_t address, std::uint16_t _port, StreamDecoder::Sink sink);
+    ~StreamReceiver();
+
+    bool Valid() const;
+    std::uint16_t Port() const;
+    const StreamDecoderStats& Stats() const;
+
+private:
+    void ReceiveThread();
+
+    UdpSocket socket;
+    StreamDecoder decoder;
+    std::atomic<bool> quitting;
+    std::thread receive_thread;
+};
+
+// plugs a virtual controller for every pad the stream brings and feeds it until ctrl+c
+int RunStreamReceiver(std::uint16_t port);
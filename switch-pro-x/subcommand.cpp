@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <memory>
+
+#include "protocol.h"
+#include "subcommand.h"
+
+SubcommandEngine::SubcommandEngine(Writer _write, DeviceStats* _stats, std::size_t _depth)
+    : write(_write)
+    , stats(_stats)
+    , depth(_depth)
+    , stopped(false)
+{
+}
+
+void SubcommandEngine::Request(std::uint8_t subcommand, const bytes& args, Callback callback)
+{
+    using std::lock_guard;
+    using std::mutex;
+
+    Outstanding request = { subcommand, args, callback, 0, false, {}, {} };
+
+    {
+        lock_guard<mutex> lk(outstanding_mutex);
+
+        if (!stopped)
+        {
+            outstanding.push_back(request);
+            return;
+        }
+    }
+
+    // nothing would ever send it
+    if (callback)
+    {
+        callback(MakeReply(request, SUBCOMMAND_CANCELLED));
+    }
+}
+
+std::future<SubcommandReply> SubcommandEngine::Request(std::uint8_t subcommand, const bytes& args)
+{
+    using std::make_shared;
+    using std::promise;
+
+    const auto reply = make_shared<promise<SubcommandReply>>();
+    auto future = reply->get_future();
+
+    Request(subcommand, args, [reply](const SubcommandReply& result) {
+        reply->set_value(result);
+    });
+
+    return future;
+}
+
+bool SubcommandEngine::Pending(std::uint8_t subcommand) const
+{
+    using std::any_of;
+    using std::lock_guard;
+    using std::mutex;
+
+    lock_guard<mutex> lk(outstanding_mutex);
+
+    return any_of(outstanding.begin(), outstanding.end(), [subcommand](const auto& request) { return request.subcommand == subcommand; });
+}
+
+void SubcommandEngine::Poll(std::chrono::steady_clock::time_point now)
+{
+    using std::lock_guard;
+    using std::mutex;
+    using std::pair;
+    using std::vector;
+
+    vector<pair<std::uint8_t, bytes>> sends;
+    vector<Completion> completions;
+
+    {
+        lock_guard<mutex> lk(outstanding_mutex);
+
+        std::size_t in_flight = 0;
+
+        for (auto it = outstanding.begin(); it != outstanding.end();)
+        {
+            if (!it->in_flight || now - it->sent < SUBCOMMAND_TIMEOUT)
+            {
+                in_flight += it->in_flight ? 1 : 0;
+                ++it;
+                continue;
+            }
+
+            if (it->attempts >= SUBCOMMAND_ATTEMPTS)
+            {
+                if (stats)
+                {
+                    stats->Increment(DEVICE_COUNTER_SUBCOMMAND_FAILURES);
+                }
+
+                completions.push_back({ it->callback, MakeReply(*it, SUBCOMMAND_TIMED_OUT) });
+                it = outstanding.erase(it);
+                continue;
+            }
+
+            if (stats)
+            {
+                stats->Increment(DEVICE_COUNTER_SUBCOMMAND_RETRIES);
+            }
+
+            it->attempts++;
+            it->sent = now;
+            sends.emplace_back(it->subcommand, it->args);
+            in_flight++;
+            ++it;
+        }
+
+        // the rest go out in request order, except that an id already in flight holds back every
+        // later request with the same id, since its reply couldn't be told apart
+        std::uint8_t blocked[256] = {};
+
+        for (const auto& request : outstanding)
+        {
+            if (request.in_flight)
+            {
+                blocked[request.subcommand] = 1;
+            }
+        }
+
+        for (auto& request : outstanding)
+        {
+            if (in_flight >= depth)
+            {
+                break;
+            }
+
+            if (request.in_flight || blocked[request.subcommand])
+            {
+                // keeps the order between requests for the same id
+                blocked[request.subcommand] = 1;
+                continue;
+            }
+
+            request.in_flight = true;
+            request.attempts = 1;
+            request.first_sent = now;
+            request.sent = now;
+            blocked[request.subcommand] = 1;
+            sends.emplace_back(request.subcommand, request.args);
+            in_flight++;
+        }
+    }
+
+    // outside the lock, writes can take a while and other threads may be queueing meanwhile
+    for (const auto& send : sends)
+    {
+        write(send.first, send.second);
+    }
+
+    for (const auto& completion : completions)
+    {
+        if (completion.callback)
+        {
+            completion.callback(completion.reply);
+        }
+    }
+}
+
+bool SubcommandEngine::HandleReply(const std::uint8_t* data, std::size_t size, std::chrono::steady_clock::time_point now)
+{
+    using std::copy_n;
+    using std::find_if;
+    using std::lock_guard;
+    using std::min;
+    using std::mutex;
+
+    if (size <= SUBCOMMAND_REPLY_ID_OFFSET || data[0] != PACKET_TYPE_SUBCOMMAND_REPLY)
+    {
+        return false;
+    }
+
+    const auto subcommand = data[SUBCOMMAND_REPLY_ID_OFFSET];
+    Completion completion;
+
+    {
+        lock_guard<mutex> lk(outstanding_mutex);
+
+        const auto it = find_if(outstanding.begin(), outstanding.end(), [subcommand](const auto& request) {
+            return request.in_flight && request.subcommand == subcommand;
+        });
+
+        // a late reply to an attempt that was already answered
+        if (it == outstanding.end())
+        {
+            return false;
+        }
+
+        const auto ack = data[SUBCOMMAND_REPLY_ACK_OFFSET];
+
+        completion.callback = it->callback;
+        completion.reply = MakeReply(*it, (ack & 0x80) ? SUBCOMMAND_ACKED : SUBCOMMAND_NACKED);
+        completion.reply.ack = ack;
+        completion.reply.round_trip = now - it->first_sent;
+
+        if (size > SUBCOMMAND_REPLY_DATA_OFFSET)
+        {
+            completion.reply.size = static_cast<std::uint8_t>(min(size - SUBCOMMAND_REPLY_DATA_OFFSET, SUBCOMMAND_REPLY_DATA_SIZE));
+            copy_n(data + SUBCOMMAND_REPLY_DATA_OFFSET, completion.reply.size, completion.reply.data.begin());
+        }
+
+        outstanding.erase(it);
+    }
+
+    if (completion.callback)
+    {
+        completion.callback(completion.reply);
+    }
+
+    return true;
+}
+
+void SubcommandEngine::Cancel()
+{
+    using std::deque;
+    using std::lock_guard;
+    using std::mutex;
+
+    deque<Outstanding> cancelled;
+
+    {
+        lock_guard<mutex> lk(outstanding_mutex);
+        cancelled.swap(outstanding);
+        stopped = true;
+    }
+
+    for (const auto& request : cancelled)
+    {
+        if (request.callback)
+        {
+            request.callback(MakeReply(request, SUBCOMMAND_CANCELLED));
+        }
+    }
+}
+
+SubcommandReply SubcommandEngine::MakeReply(const Outstanding& request, SubcommandStatus status)
+{
+    SubcommandReply reply = {};
+    reply.status = status;
+    reply.subcommand = request.subcommand;
+    reply.attempts = request.attempts;
+
+    return reply;
+}
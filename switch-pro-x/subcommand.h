@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "stats.h"
+
+// requests the controller hasn't answered within this long are sent again
+constexpr std::chrono::milliseconds SUBCOMMAND_TIMEOUT(100);
+// sends per request, the first one included
+constexpr int SUBCOMMAND_ATTEMPTS = 4;
+// subcommands in flight at once. each one has its own id, so replies can't be mixed up
+constexpr std::size_t SUBCOMMAND_PIPELINE_DEPTH = 4;
+// what follows the subcommand id in a bluetooth 0x21 reply, usb replies are cut to the same size
+constexpr std::size_t SUBCOMMAND_REPLY_DATA_SIZE = 35;
+
+enum SubcommandStatus
+{
+    // the controller replied with the ack bit set
+    SUBCOMMAND_ACKED,
+    // it replied, but without the ack bit
+    SUBCOMMAND_NACKED,
+    // every attempt went unanswered
+    SUBCOMMAND_TIMED_OUT,
+    // the device went away first
+    SUBCOMMAND_CANCELLED,
+};
+
+struct SubcommandReply
+{
+    SubcommandStatus status;
+    std::uint8_t subcommand;
+    // the raw ack byte, the high bit is set for an ack and the rest says what data follows
+    std::uint8_t ack;
+    std::uint8_t size;
+    std::array<std::uint8_t, SUBCOMMAND_REPLY_DATA_SIZE> data;
+    int attempts;
+    // from the first send to the reply, zero for requests that never got one
+    std::chrono::steady_clock::duration round_trip;
+};
+
+// tracks the 0x01 subcommands a controller has been sent and pairs them with their 0x21 replies by
+// subcommand id. requests can come from any thread, but only the device's read thread writes them
+// and sees the replies, in Poll and HandleReply
+class SubcommandEngine
+{
+public:
+    using bytes = std::vector<std::uint8_t>;
+    using Callback = std::function<void(const SubcommandReply& reply)>;
+    // writes one subcommand with its arguments to the device
+    using Writer = std::function<void(std::uint8_t subcommand, const bytes& args)>;
+
+    // stats is optional, retries and failures are counted there
+    SubcommandEngine(Writer _write, DeviceStats* _stats, std::size_t _depth = SUBCOMMAND_PIPELINE_DEPTH);
+
+    // callback can be empty. it's called on the read thread and mustn't block
+    void Request(std::uint8_t subcommand, const bytes& args, Callback callback);
+    // never wait on the future from the read thread, nothing would read the reply
+    std::future<SubcommandReply> Request(std::uint8_t subcommand, const bytes& args);
+    // true while a request for subcommand is queued or in flight
+    bool Pending(std::uint8_t subcommand) const;
+
+    // sends queued requests while the pipeline has room and resends the ones that timed out
+    void Poll(std::chrono::steady_clock::time_point now);
+    // hands a 0x21 report to the request waiting for it, false if none was
+    bool HandleReply(const std::uint8_t* data, std::size_t size, std::chrono::steady_clock::time_point now);
+    // fails everything still outstanding once the read thread stops reading, and anything
+    // requested after
+    void Cancel();
+
+private:
+    struct Outstanding
+    {
+        std::uint8_t subcommand;
+        bytes args;
+        Callback callback;
+        int attempts;
+        bool in_flight;
+        std::chrono::steady_clock::time_point first_sent;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    struct Completion
+    {
+        Callback callback;
+        SubcommandReply reply;
+    };
+
+    static SubcommandReply MakeReply(const Outstanding& request, SubcommandStatus status);
+
+    const Writer write;
+    DeviceStats* const stats;
+    const std::size_t depth;
+
+    mutable std::mutex outstanding_mutex;
+    // in the order they were requested, sent ones stay until they're answered or give up
+    std::deque<Outstanding> outstanding;
+    bool stopped;
+};
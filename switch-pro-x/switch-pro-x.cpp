@@ -3,12 +3,14 @@
 
 #include <algorithm>
 #include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <cstdint>
 #include <cstdlib>
@@ -16,15 +18,56 @@
 #include <ViGEmUM.h>
 #include <HidCerberus.Lib.h>
 
+#include "benchmark.h"
 #include "common.h"
 #include "connection_callback.h"
+#include "control.h"
+#include "dsu.h"
+#include "macro.h"
+#include "options.h"
+#include "profile.h"
+#include "query.h"
+#include "replay.h"
+#include "scheduling.h"
+#include "shared_state.h"
+#include "stream.h"
 #include "switch-pro-x.h"
 #include "ProControllerDevice.h"
+#include "ProControllerEmulator.h"
+#include "trace.h"
 
 namespace
 {
     std::unordered_set<std::unique_ptr<ProControllerDevice>> proControllers;
     std::mutex controllerMapMutex;
+    std::vector<std::unique_ptr<ProControllerEmulator>> emulators;
+    std::unique_ptr<ControlServer> control_server;
+    std::unique_ptr<MacroEngine> macro_engine;
+    std::unique_ptr<DsuServer> dsu_server;
+    std::unique_ptr<StreamSender> stream_sender;
+    std::unique_ptr<SharedStatePublisher> shared_state;
+    std::unique_ptr<ProfileWatcher> profile_watcher;
+    // set by the control pipe, main returns and the atexit handler tears everything down
+    HANDLE shutdown_event = nullptr;
+
+    void StartEmulators()
+    {
+        using std::make_unique;
+        using std::move;
+
+        unsigned int index = 0;
+
+        for (const auto& config : GetOptions().emulators)
+        {
+            auto emulator = make_unique<ProControllerEmulator>(config, index++);
+
+            if (emulator->Valid())
+            {
+                AddController(emulator->Path);
+                emulators.push_back(move(emulator));
+            }
+        }
+    }
 }
 
 void AddController(const tstring &path)
@@ -42,8 +85,14 @@ void AddController(const tstring &path)
 
     if (device->Valid())
     {
-        cout << "FOUND PRO CONTROLLER: ";
+        cout << "FOUND " << DeviceFamilyName(device->Family()) << ": ";
         tcout << device->Path;
+
+        if (!device->Serial().empty())
+        {
+            cout << " (SERIAL " << device->Serial() << ")";
+        }
+
         cout << endl;
         proControllers.insert(move(device));
     }
@@ -53,23 +102,143 @@ void RemoveController(const tstring &path)
 {
     using std::cout;
     using std::endl;
+    using std::fixed;
     using std::lock_guard;
     using std::mutex;
     using std::find_if;
+    using std::move;
+    using std::setprecision;
+    using std::unique_ptr;
+    using std::chrono::duration;
+    using std::chrono::steady_clock;
+
+    unique_ptr<ProControllerDevice> device;
+
+    {
+        lock_guard<mutex> lk(controllerMapMutex);
+
+        auto it = find_if(proControllers.begin(), proControllers.end(), [path](const auto& c) { return tstring_icompare(c->Path, path); });
+
+        if (it == proControllers.end())
+        {
+            return;
+        }
+
+        device = move(proControllers.extract(it).value());
+    }
+
+    // torn down outside the lock, so the other controllers' callbacks and queries don't wait on it
+    const auto start = steady_clock::now();
+    const auto family = device->Family();
+    const auto removed_path = device->Path;
+
+    device->BeginStop(true);
+    device.reset();
+
+    const duration<double, std::milli> teardown = steady_clock::now() - start;
+
+    cout << "REMOVED " << DeviceFamilyName(family) << ": ";
+    tcout << removed_path;
+    cout << fixed << setprecision(1) << " (TORN DOWN IN " << teardown.count() << "MS)" << endl;
+}
+
+void PrintLatencyStats()
+{
+    using std::cout;
+    using std::endl;
+    using std::lock_guard;
+    using std::mutex;
 
     lock_guard<mutex> lk(controllerMapMutex);
 
-    auto it = find_if(proControllers.begin(), proControllers.end(), [path](const auto& c) { return tstring_icompare(c->Path, path); });
+    // so runs with different scheduling options can be told apart
+    cout << "device I/O threads: " << DescribeIoScheduling(GetOptions().io_scheduling) << endl;
 
-    if (it != proControllers.end())
+    for (const auto& device : proControllers)
     {
-        cout << "REMOVED PRO CONTROLLER: ";
-        tcout << (*it)->Path;
-        cout << endl;
-        proControllers.erase(it);
+        const auto& latency = device->Latency();
+
+        if (latency.Empty())
+        {
+            continue;
+        }
+
+        cout << "latency for ";
+        tcout << device->Path;
+        cout << ":" << endl;
+        latency.Print(cout);
+    }
+
+    if (macro_engine && macro_engine->Lateness().Count() > 0)
+    {
+        const auto& lateness = macro_engine->Lateness();
+
+        cout << "macro timers late by p50 " << lateness.Percentile(50.0) / 1000.0 << "us, p99 " << lateness.Percentile(99.0) / 1000.0;
+        cout << "us, max " << lateness.Max() / 1000.0 << "us" << endl;
     }
 }
 
+void VisitControllers(const std::function<void(const ProControllerDevice&)>& visit)
+{
+    using std::lock_guard;
+    using std::mutex;
+
+    lock_guard<mutex> lk(controllerMapMutex);
+
+    for (const auto& device : proControllers)
+    {
+        visit(*device);
+    }
+}
+
+bool VisitController(unsigned int id, const std::function<void(ProControllerDevice&)>& visit)
+{
+    using std::find_if;
+    using std::lock_guard;
+    using std::mutex;
+
+    lock_guard<mutex> lk(controllerMapMutex);
+
+    auto it = find_if(proControllers.begin(), proControllers.end(), [id](const auto& c) { return c->Id == id; });
+
+    if (it == proControllers.end())
+    {
+        return false;
+    }
+
+    visit(**it);
+
+    return true;
+}
+
+void RequestShutdown()
+{
+    if (shutdown_event != nullptr)
+    {
+        SetEvent(shutdown_event);
+    }
+}
+
+MacroEngine* GetMacroEngine()
+{
+    return macro_engine.get();
+}
+
+DsuServer* GetDsuServer()
+{
+    return dsu_server.get();
+}
+
+StreamSender* GetStreamSender()
+{
+    return stream_sender.get();
+}
+
+SharedStatePublisher* GetSharedState()
+{
+    return shared_state.get();
+}
+
 VOID CALLBACK XUSBCallback(VIGEM_TARGET target, UCHAR large_motor, UCHAR small_motor, UCHAR led_number)
 {
     using std::lock_guard;
@@ -89,6 +258,21 @@ BOOL WINAPI ctrl_handler(DWORD _In_ event)
 {
     using std::exit;
 
+    if (event == CTRL_BREAK_EVENT && (GetOptions().latency || TraceEnabled()))
+    {
+        if (GetOptions().latency)
+        {
+            PrintLatencyStats();
+        }
+
+        if (TraceEnabled())
+        {
+            TraceDump(GetOptions().trace_file);
+        }
+
+        return TRUE;
+    }
+
     if (event == CTRL_CLOSE_EVENT ||
         event == CTRL_C_EVENT ||
         event == CTRL_BREAK_EVENT)
@@ -99,7 +283,7 @@ BOOL WINAPI ctrl_handler(DWORD _In_ event)
     return FALSE;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
     using std::cerr;
     using std::endl;
@@ -107,19 +291,109 @@ int main()
     using std::lock_guard;
     using std::mutex;
     using std::system;
-    using std::this_thread::sleep_for;
-    using std::chrono::hours;
+    using std::make_unique;
+
+    if (!ParseOptions(argc, argv))
+    {
+        PrintUsage();
+
+        return 1;
+    }
+
+    // the benchmarks and self test don't need the bus driver or any devices
+    if (GetOptions().benchmark)
+    {
+        return RunBenchmarks(GetOptions().benchmark_filter);
+    }
+
+    if (GetOptions().self_test)
+    {
+        return RunSelfTests();
+    }
+
+    if (!GetOptions().query.empty())
+    {
+        return RunQuery(GetOptions().query);
+    }
+
+    if (GetOptions().dsu_client)
+    {
+        return RunDsuClient(GetOptions().dsu_port);
+    }
+
+    if (GetOptions().watch)
+    {
+        return RunWatch();
+    }
+
+    if (!GetOptions().profile_file.empty() && !LoadProfiles(GetOptions().profile_file))
+    {
+        return 1;
+    }
+
+    TraceEnable(GetOptions().trace);
+
+    // headless, everything goes through the control pipe from here on
+    if (GetOptions().daemon)
+    {
+        FreeConsole();
+    }
 
     SetConsoleCtrlHandler(ctrl_handler, TRUE);
 
     atexit([] {
-        // trigger deconstructors for all controllers
+        if (GetOptions().latency)
+        {
+            PrintLatencyStats();
+        }
+
+        // stop answering queries before the controllers go away
+        control_server.reset();
+
+        // every controller winds down and clears its LED and rumble at the same time, then they're
+        // destroyed outside the lock
         {
-            lock_guard<mutex> lk(controllerMapMutex);
+            using std::cout;
+            using std::endl;
+            using std::fixed;
+            using std::setprecision;
+            using std::chrono::duration;
+            using std::chrono::steady_clock;
+
+            decltype(proControllers) stopping;
+            const auto start = steady_clock::now();
+
+            {
+                lock_guard<mutex> lk(controllerMapMutex);
+
+                for (const auto& device : proControllers)
+                {
+                    device->BeginStop(false);
+                }
 
-            proControllers.clear();
+                stopping.swap(proControllers);
+            }
+
+            const auto count = stopping.size();
+            stopping.clear();
+
+            const duration<double, std::milli> teardown = steady_clock::now() - start;
+
+            if (count > 0)
+            {
+                cout << "STOPPED " << count << " CONTROLLERS IN " << fixed << setprecision(1) << teardown.count() << "MS" << endl;
+            }
         }
 
+        macro_engine.reset();
+        dsu_server.reset();
+        stream_sender.reset();
+        shared_state.reset();
+        profile_watcher.reset();
+
+        // emulated controllers are torn down after the devices reading from them
+        emulators.clear();
+
         vigem_shutdown();
 
         HidGuardianClose();
@@ -131,18 +405,81 @@ int main()
     {
         cerr << "error initializing ViGEm: " << ret << endl;
 
-        system("pause");
+        if (!GetOptions().daemon)
+        {
+            system("pause");
+        }
 
         return 1;
     }
 
     HidGuardianOpen();
 
-    SetupDeviceNotifications();
+    if (!GetOptions().replay_file.empty())
+    {
+        return RunReplay(GetOptions().replay_file, GetOptions().replay_fast);
+    }
+
+    if (GetOptions().stream_receive)
+    {
+        return RunStreamReceiver(GetOptions().stream_receive_port);
+    }
 
-    // sleep forever
-    for (;;)
+    if (!GetOptions().turbos.empty() || !GetOptions().macros.empty())
     {
-        sleep_for(hours::max());
+        macro_engine = make_unique<MacroEngine>(GetOptions().io_scheduling);
+
+        if (!macro_engine->Valid())
+        {
+            macro_engine.reset();
+        }
+    }
+
+    if (GetOptions().stream)
+    {
+        const auto& options = GetOptions();
+        stream_sender = make_unique<StreamSender>(options.stream_destination, options.stream_loss, options.stream_reorder);
+
+        if (!stream_sender->Valid())
+        {
+            stream_sender.reset();
+        }
     }
+
+    if (GetOptions().shared_state)
+    {
+        shared_state = make_unique<SharedStatePublisher>();
+
+        if (!shared_state->Valid())
+        {
+            shared_state.reset();
+        }
+    }
+
+    if (GetOptions().dsu)
+    {
+        dsu_server = make_unique<DsuServer>(GetOptions().dsu_port);
+
+        if (!dsu_server->Valid())
+        {
+            dsu_server.reset();
+        }
+    }
+
+    if (!GetOptions().profile_file.empty())
+    {
+        profile_watcher = make_unique<ProfileWatcher>(GetOptions().profile_file);
+    }
+
+    shutdown_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    control_server = make_unique<ControlServer>();
+
+    SetupDeviceNotifications();
+
+    StartEmulators();
+
+    // runs until ctrl+c, or in daemon mode until --query shutdown
+    WaitForSingleObject(shutdown_event, INFINITE);
+
+    return 0;
 }
@@ -2,8 +2,31 @@
 
 #include <Windows.h>
 
+#include <functional>
+
 #include "common.h"
 
+class DsuServer;
+class MacroEngine;
+class ProControllerDevice;
+class SharedStatePublisher;
+class StreamSender;
+
 void AddController(const tstring &path);
 void RemoveController(const tstring &path);
+void PrintLatencyStats();
+// runs visit for every connected controller while holding the controller list lock
+void VisitControllers(const std::function<void(const ProControllerDevice&)>& visit);
+// the same for the controller with this id, false if there's none
+bool VisitController(unsigned int id, const std::function<void(ProControllerDevice&)>& visit);
+// wakes main up to exit, used by the control pipe in daemon mode
+void RequestShutdown();
+// null unless turbo or macros are configured
+MacroEngine* GetMacroEngine();
+// null unless --dsu is given
+DsuServer* GetDsuServer();
+// null unless --stream is given
+StreamSender* GetStreamSender();
+// null unless --shared-state is given
+SharedStatePublisher* GetSharedState();
 VOID CALLBACK XUSBCallback(VIGEM_TARGET target, UCHAR large_motor, UCHAR small_motor, UCHAR led_number);
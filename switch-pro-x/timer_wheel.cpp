@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <utility>
+
+#include "timer_wheel.h"
+
+constexpr std::chrono::microseconds TimerWheel::TICK;
+
+TimerWheel::TimerWheel(std::chrono::steady_clock::time_point _start)
+    : start(_start)
+    , current_tick(0)
+    , next_id(1)
+    , pending(0)
+{
+}
+
+std::uint64_t TimerWheel::TickOf(std::chrono::steady_clock::time_point time) const
+{
+    if (time <= start)
+    {
+        return 0;
+    }
+
+    return static_cast<std::uint64_t>((time - start) / TICK);
+}
+
+TimerWheel::Slot& TimerWheel::SlotFor(unsigned int level, std::uint64_t tick)
+{
+    if (level == 0)
+    {
+        return level0[tick & (LEVEL0_SLOTS - 1)];
+    }
+
+    const auto shift = LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+
+    return levels[level - 1][(tick >> shift) & (LEVEL_SLOTS - 1)];
+}
+
+void TimerWheel::Insert(Entry&& entry)
+{
+    using std::max;
+    using std::min;
+    using std::move;
+
+    // anything already due goes into the slot being processed
+    const auto tick = max(TickOf(entry.deadline), current_tick);
+    auto delta = tick - current_tick;
+
+    unsigned int level = 0;
+    std::uint64_t span = LEVEL0_SLOTS;
+
+    while (level < LEVELS - 1 && delta >= span)
+    {
+        level++;
+        span <<= LEVEL_BITS;
+    }
+
+    // past the top level, park it in the furthest slot and let cascading bring it back
+    const auto slot_tick = delta >= span ? current_tick + span - 1 : tick;
+
+    SlotFor(level, min(slot_tick, tick)).push_back(move(entry));
+}
+
+void TimerWheel::Cascade(unsigned int level)
+{
+    using std::move;
+
+    auto entries = move(SlotFor(level, current_tick));
+    SlotFor(level, current_tick).clear();
+
+    for (auto& entry : entries)
+    {
+        Insert(move(entry));
+    }
+}
+
+std::uint64_t TimerWheel::Schedule(std::chrono::steady_clock::time_point deadline, const void* owner, Callback callback)
+{
+    using std::move;
+
+    const auto id = next_id++;
+
+    Insert({ deadline, id, owner, move(callback) });
+    pending++;
+
+    return id;
+}
+
+void TimerWheel::Cancel(std::uint64_t id)
+{
+    using std::find_if;
+
+    const auto remove = [&](Slot& slot) {
+        auto it = find_if(slot.begin(), slot.end(), [id](const auto& e) { return e.id == id; });
+
+        if (it == slot.end())
+        {
+            return false;
+        }
+
+        slot.erase(it);
+        pending--;
+
+        return true;
+    };
+
+    for (auto& slot : level0)
+    {
+        if (remove(slot))
+        {
+            return;
+        }
+    }
+
+    for (auto& level : levels)
+    {
+        for (auto& slot : level)
+        {
+            if (remove(slot))
+            {
+                return;
+            }
+        }
+    }
+}
+
+void TimerWheel::CancelOwner(const void* owner)
+{
+    using std::remove_if;
+
+    const auto remove = [&](Slot& slot) {
+        auto it = remove_if(slot.begin(), slot.end(), [owner](const auto& e) { return e.owner == owner; });
+        pending -= slot.end() - it;
+        slot.erase(it, slot.end());
+    };
+
+    for (auto& slot : level0)
+    {
+        remove(slot);
+    }
+
+    for (auto& level : levels)
+    {
+        for (auto& slot : level)
+        {
+            remove(slot);
+        }
+    }
+}
+
+void TimerWheel::Advance(std::chrono::steady_clock::time_point now)
+{
+    using std::move;
+    using std::vector;
+
+    const auto target = TickOf(now);
+
+    for (;;)
+    {
+        auto& slot = level0[current_tick & (LEVEL0_SLOTS - 1)];
+
+        // take the due entries out first, callbacks are free to schedule into this slot again.
+        // anything they schedule at or before the current tick lands here, so the slot is drained
+        // until nothing due is left, otherwise it would wait a full turn of the wheel
+        for (;;)
+        {
+            vector<Entry> due;
+
+            for (auto it = slot.begin(); it != slot.end();)
+            {
+                if (it->deadline <= now)
+                {
+                    due.push_back(move(*it));
+                    it = slot.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            if (due.empty())
+            {
+                break;
+            }
+
+            pending -= due.size();
+
+            for (auto& entry : due)
+            {
+                entry.callback(entry.deadline);
+            }
+        }
+
+        if (current_tick >= target)
+        {
+            break;
+        }
+
+        current_tick++;
+
+        // entering a new block of a level pulls the matching slot of the level above down,
+        // highest level first so its entries can land in the ones below
+        if ((current_tick & (LEVEL0_SLOTS - 1)) == 0)
+        {
+            unsigned int top = 1;
+
+            while (top < LEVELS - 1 && ((current_tick >> (LEVEL0_BITS + (top - 1) * LEVEL_BITS)) & (LEVEL_SLOTS - 1)) == 0)
+            {
+                top++;
+            }
+
+            for (auto level = top; level > 0; level--)
+            {
+                Cascade(level);
+            }
+        }
+    }
+}
+
+std::chrono::steady_clock::time_point TimerWheel::NextDeadline() const
+{
+    using std::chrono::steady_clock;
+
+    if (pending == 0)
+    {
+        return steady_clock::time_point::max();
+    }
+
+    // level 0 slots hold exactly one tick each, so the first non-empty one has the earliest deadline
+    for (std::size_t i = 0; i < LEVEL0_SLOTS; i++)
+    {
+        const auto& slot = level0[(current_tick + i) & (LEVEL0_SLOTS - 1)];
+
+        if (slot.empty())
+        {
+            continue;
+        }
+
+        auto earliest = slot.front().deadline;
+
+        for (const auto& entry : slot)
+        {
+            earliest = entry.deadline < earliest ? entry.deadline : earliest;
+        }
+
+        return earliest;
+    }
+
+    // everything is further out, wake at the next cascade
+    const auto next_block = (current_tick | (LEVEL0_SLOTS - 1)) + 1;
+
+    return start + TICK * next_block;
+}
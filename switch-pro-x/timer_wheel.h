@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <cstdint>
+
+// hierarchical timer wheel: level 0 has one slot per tick, every level above covers 64 slots
+// of the one below and is cascaded down as time reaches it, so scheduling and firing are O(1)
+// no matter how many timers are pending. not thread safe, the owner locks around it.
+class TimerWheel
+{
+public:
+    using Callback = std::function<void(std::chrono::steady_clock::time_point deadline)>;
+
+    static constexpr std::chrono::microseconds TICK{ 250 };
+
+    explicit TimerWheel(std::chrono::steady_clock::time_point _start);
+
+    // callbacks may schedule and cancel timers themselves, ids are never 0
+    std::uint64_t Schedule(std::chrono::steady_clock::time_point deadline, const void* owner, Callback callback);
+    void Cancel(std::uint64_t id);
+    void CancelOwner(const void* owner);
+
+    // runs every timer with a deadline at or before now, including ones its callbacks schedule
+    // on the way, so a callback has to reschedule past its own deadline
+    void Advance(std::chrono::steady_clock::time_point now);
+    // time_point::max() when nothing is pending
+    std::chrono::steady_clock::time_point NextDeadline() const;
+
+private:
+    static constexpr unsigned int LEVEL0_BITS = 8;
+    static constexpr unsigned int LEVEL_BITS = 6;
+    static constexpr unsigned int LEVELS = 4;
+    static constexpr std::size_t LEVEL0_SLOTS = 1 << LEVEL0_BITS;
+    static constexpr std::size_t LEVEL_SLOTS = 1 << LEVEL_BITS;
+
+    struct Entry
+    {
+        std::chrono::steady_clock::time_point deadline;
+        std::uint64_t id;
+        const void* owner;
+        Callback callback;
+    };
+
+    using Slot = std::vector<Entry>;
+
+    std::uint64_t TickOf(std::chrono::steady_clock::time_point time) const;
+    void Insert(Entry&& entry);
+    void Cascade(unsigned int level);
+    Slot& SlotFor(unsigned int level, std::uint64_t tick);
+
+    const std::chrono::steady_clock::time_point start;
+    std::uint64_t current_tick;
+    std::uint64_t next_id;
+    std::size_t pending;
+
+    std::array<Slot, LEVEL0_SLOTS> level0;
+    std::array<std::array<Slot, LEVEL_SLOTS>, LEVELS - 1> levels;
+};
@@ -0,0 +1,260 @@
+#define NOMINMAX
+#include <Windows.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+namespace
+{
+    // per thread, at 125 reports/s with a handful of spans each this is several seconds of history
+    constexpr std::size_t RING_SIZE = 8192;
+
+    struct TraceEvent
+    {
+        const char* name;
+        std::uint64_t start;
+        std::uint64_t duration;
+        std::uint32_t device;
+    };
+
+    struct TraceRing
+    {
+        DWORD thread_id;
+        // only touched with ring_mutex held
+        std::string thread_name;
+        std::array<TraceEvent, RING_SIZE> events;
+        // total events ever written, only the owning thread stores it
+        std::atomic<std::uint64_t> head;
+    };
+
+    const auto trace_epoch = std::chrono::steady_clock::now();
+    std::atomic<bool> trace_enabled(false);
+
+    // rings of exited threads kept for dumps, so a dump still shows devices that were just removed
+    // without every replug adding a ring for good
+    constexpr std::size_t MAX_EXITED_RINGS = 16;
+
+    std::mutex ring_mutex;
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    // oldest first
+    std::deque<std::shared_ptr<TraceRing>> exited_rings;
+
+    // a thread only gets a ring once it records something, naming it doesn't allocate one
+    struct LocalTrace
+    {
+        std::string name;
+        std::shared_ptr<TraceRing> ring;
+
+        ~LocalTrace()
+        {
+            using std::find;
+            using std::lock_guard;
+            using std::mutex;
+
+            if (!ring)
+            {
+                return;
+            }
+
+            lock_guard<mutex> lk(ring_mutex);
+
+            rings.erase(find(rings.begin(), rings.end(), ring));
+            exited_rings.push_back(ring);
+
+            if (exited_rings.size() > MAX_EXITED_RINGS)
+            {
+                exited_rings.pop_front();
+            }
+        }
+    };
+
+    thread_local LocalTrace local_trace;
+
+    TraceRing& LocalRing()
+    {
+        using std::lock_guard;
+        using std::make_shared;
+        using std::mutex;
+
+        if (!local_trace.ring)
+        {
+            local_trace.ring = make_shared<TraceRing>();
+            local_trace.ring->thread_id = GetCurrentThreadId();
+            local_trace.ring->head = 0;
+
+            lock_guard<mutex> lk(ring_mutex);
+            local_trace.ring->thread_name = local_trace.name;
+            rings.push_back(local_trace.ring);
+        }
+
+        return *local_trace.ring;
+    }
+
+    std::uint64_t SinceEpoch(std::chrono::steady_clock::time_point time)
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+
+        const auto ns = duration_cast<nanoseconds>(time - trace_epoch).count();
+
+        return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+    }
+
+    // copies whatever is still in the ring, dropping events the owner overwrote while we were copying
+    std::vector<TraceEvent> Snapshot(const TraceRing& ring)
+    {
+        using std::memory_order_acquire;
+        using std::min;
+        using std::vector;
+
+        const auto end = ring.head.load(memory_order_acquire);
+        auto begin = end > RING_SIZE ? end - RING_SIZE : 0;
+
+        vector<TraceEvent> events;
+        events.reserve(static_cast<std::size_t>(end - begin));
+
+        for (auto i = begin; i < end; i++)
+        {
+            events.push_back(ring.events[i % RING_SIZE]);
+        }
+
+        const auto after = ring.head.load(memory_order_acquire);
+
+        // index after - RING_SIZE shares its slot with after, which the owner may be writing now
+        if (after >= RING_SIZE && after - RING_SIZE >= begin)
+        {
+            const auto overwritten = static_cast<std::size_t>(after - RING_SIZE - begin + 1);
+            events.erase(events.begin(), events.begin() + min(overwritten, events.size()));
+        }
+
+        return events;
+    }
+}
+
+void TraceEnable(bool enable)
+{
+    trace_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool TraceEnabled()
+{
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+void TraceThreadName(const std::string& name)
+{
+    using std::lock_guard;
+    using std::mutex;
+
+    local_trace.name = name;
+
+    if (local_trace.ring)
+    {
+        lock_guard<mutex> lk(ring_mutex);
+        local_trace.ring->thread_name = name;
+    }
+}
+
+void TraceRecord(const char* name, std::uint32_t device, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    using std::memory_order_relaxed;
+    using std::memory_order_release;
+
+    auto& ring = LocalRing();
+    const auto head = ring.head.load(memory_order_relaxed);
+    const auto start_ns = SinceEpoch(start);
+    const auto end_ns = SinceEpoch(end);
+
+    ring.events[head % RING_SIZE] = { name, start_ns, end_ns > start_ns ? end_ns - start_ns : 0, device };
+    ring.head.store(head + 1, memory_order_release);
+}
+
+bool TraceDump(const std::string& filename)
+{
+    using std::cerr;
+    using std::cout;
+    using std::endl;
+    using std::fixed;
+    using std::lock_guard;
+    using std::mutex;
+    using std::ofstream;
+    using std::setprecision;
+    using std::shared_ptr;
+    using std::string;
+    using std::vector;
+
+    vector<shared_ptr<TraceRing>> dump_rings;
+    vector<string> names;
+
+    {
+        lock_guard<mutex> lk(ring_mutex);
+
+        dump_rings.assign(exited_rings.begin(), exited_rings.end());
+        dump_rings.insert(dump_rings.end(), rings.begin(), rings.end());
+
+        for (const auto& ring : dump_rings)
+        {
+            names.push_back(ring->thread_name);
+        }
+    }
+
+    ofstream out(filename);
+
+    if (!out)
+    {
+        cerr << "error opening trace file " << filename << endl;
+        return false;
+    }
+
+    // chrome wants microseconds, keep the nanoseconds as decimals
+    out << fixed << setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << endl;
+
+    bool first = true;
+    std::size_t count = 0;
+
+    for (std::size_t i = 0; i < dump_rings.size(); i++)
+    {
+        const auto& ring = *dump_rings[i];
+
+        if (!names[i].empty())
+        {
+            out << (first ? "" : ",\n");
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring.thread_id;
+            out << ",\"args\":{\"name\":\"" << names[i] << "\"}}";
+            first = false;
+        }
+
+        for (const auto& event : Snapshot(ring))
+        {
+            out << (first ? "" : ",\n");
+            out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring.thread_id;
+            out << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0;
+            out << ",\"args\":{\"device\":" << event.device << "}}";
+            first = false;
+            count++;
+        }
+    }
+
+    out << endl << "]}" << endl;
+
+    if (!out)
+    {
+        cerr << "error writing trace file " << filename << endl;
+        return false;
+    }
+
+    cout << "WROTE " << count << " TRACE EVENTS TO " << filename << endl;
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <cstdint>
+
+// timeline tracer, every thread records into its own fixed size ring without locking and
+// a dump merges all of them into chrome trace_event JSON (load it in chrome://tracing or perfetto)
+void TraceEnable(bool enable);
+bool TraceEnabled();
+// names the calling thread in dumps
+void TraceThreadName(const std::string& name);
+void TraceRecord(const char* name, std::uint32_t device, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+bool TraceDump(const std::string& filename);
+
+// records a span from construction until End() or destruction, name must be a string literal.
+// while tracing is off this costs one relaxed load.
+class TraceSpan
+{
+public:
+    TraceSpan(const char* _name, std::uint32_t _device)
+        : name(_name)
+        , device(_device)
+        , active(TraceEnabled())
+    {
+        if (active)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        End();
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void End()
+    {
+        if (active)
+        {
+            TraceRecord(name, device, start, std::chrono::steady_clock::now());
+            active = false;
+        }
+    }
+
+private:
+    const char* name;
+    std::uint32_t device;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,173 @@
+#define NOMINMAX
+// has to come before Windows.h, which would pull in the old winsock.h otherwise
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <Windows.h>
+
+#include <iostream>
+#include <string>
+
+#include <cstdlib>
+
+#include "udp.h"
+
+namespace
+{
+    sockaddr_in MakeAddress(const UdpEndpoint& endpoint)
+    {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(endpoint.address);
+        address.sin_port = htons(endpoint.port);
+
+        return address;
+    }
+}
+
+UdpSocket::UdpSocket(std::uint32_t address, std::uint16_t _port)
+    : sock(INVALID_SOCKET)
+    , port(_port)
+    , started(false)
+{
+    using std::cerr;
+    using std::endl;
+
+    WSADATA wsa;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+    {
+        cerr << "error starting winsock" << endl;
+        return;
+    }
+
+    started = true;
+    sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (sock == INVALID_SOCKET)
+    {
+        cerr << "error creating UDP socket (" << WSAGetLastError() << ")" << endl;
+        return;
+    }
+
+    auto bound = MakeAddress({ address, port });
+
+    if (bind(sock, reinterpret_cast<const sockaddr*>(&bound), sizeof(bound)) == SOCKET_ERROR)
+    {
+        cerr << "error binding UDP socket to port " << port << " (" << WSAGetLastError() << ")" << endl;
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+        return;
+    }
+
+    int bound_size = sizeof(bound);
+
+    if (getsockname(sock, reinterpret_cast<sockaddr*>(&bound), &bound_size) == 0)
+    {
+        port = ntohs(bound.sin_port);
+    }
+}
+
+UdpSocket::~UdpSocket()
+{
+    if (sock != INVALID_SOCKET)
+    {
+        closesocket(sock);
+    }
+
+    if (started)
+    {
+        WSACleanup();
+    }
+}
+
+bool UdpSocket::Valid() const
+{
+    return sock != INVALID_SOCKET;
+}
+
+std::uint16_t UdpSocket::Port() const
+{
+    return port;
+}
+
+bool UdpSocket::WaitReadable(std::chrono::milliseconds timeout) const
+{
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+
+    timeval tv;
+    tv.tv_sec = static_cast<long>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<long>(timeout.count() % 1000 * 1000);
+
+    // the first parameter is ignored by winsock
+    return select(static_cast<int>(sock + 1), &readable, nullptr, nullptr, &tv) > 0;
+}
+
+std::size_t UdpSocket::Receive(std::uint8_t* buf, std::size_t size, UdpEndpoint& from)
+{
+    sockaddr_in address = {};
+    int address_size = sizeof(address);
+    const int received = recvfrom(sock, reinterpret_cast<char*>(buf), static_cast<int>(size), 0, reinterpret_cast<sockaddr*>(&address), &address_size);
+
+    if (received <= 0 || address.sin_family != AF_INET)
+    {
+        return 0;
+    }
+
+    from.address = ntohl(address.sin_addr.s_addr);
+    from.port = ntohs(address.sin_port);
+
+    return received;
+}
+
+void UdpSocket::Send(const std::uint8_t* data, std::size_t size, const UdpEndpoint& to)
+{
+    const auto address = MakeAddress(to);
+
+    // best effort, whatever gets lost is made up for by the protocols on top
+    sendto(sock, reinterpret_cast<const char*>(data), static_cast<int>(size), 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+}
+
+bool ParseUdpEndpoint(const std::string& arg, UdpEndpoint& endpoint)
+{
+    using std::string;
+    using std::strtoul;
+
+    const auto colon = arg.rfind(':');
+
+    if (colon == string::npos)
+    {
+        return false;
+    }
+
+    const auto host = arg.substr(0, colon);
+    const auto port = arg.substr(colon + 1);
+
+    char* end;
+    const auto number = strtoul(port.c_str(), &end, 10);
+
+    if (port.empty() || *end != '\0' || number < 1 || number > 0xFFFF)
+    {
+        return false;
+    }
+
+    endpoint.port = static_cast<std::uint16_t>(number);
+
+    if (host == "localhost")
+    {
+        endpoint.address = UDP_LOOPBACK;
+        return true;
+    }
+
+    in_addr address;
+
+    if (InetPtonA(AF_INET, host.c_str(), &address) != 1)
+    {
+        return false;
+    }
+
+    endpoint.address = ntohl(address.s_addr);
+
+    return true;
+}
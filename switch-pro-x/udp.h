@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+// addresses and ports are in host byte order everywhere outside udp.cpp
+constexpr std::uint32_t UDP_ANY = 0x00000000;
+constexpr std::uint32_t UDP_LOOPBACK = 0x7F000001;
+
+struct UdpEndpoint
+{
+    std::uint32_t address;
+    std::uint16_t port;
+};
+
+// a bound IPv4 UDP socket, keeping winsock started for as long as it's around
+class UdpSocket
+{
+public:
+    // port 0 picks a free one, see Port
+    UdpSocket(std::uint32_t address, std::uint16_t _port);
+    ~UdpSocket();
+
+    bool Valid() const;
+    std::uint16_t Port() const;
+
+    // false if nothing arrived within timeout
+    bool WaitReadable(std::chrono::milliseconds timeout) const;
+    // 0 on errors, which for UDP are mostly ICMP port unreachables from a peer that went away
+    std::size_t Receive(std::uint8_t* buf, std::size_t size, UdpEndpoint& from);
+    void Send(const std::uint8_t* data, std::size_t size, const UdpEndpoint& to);
+
+private:
+    std::uintptr_t sock;
+    std::uint16_t port;
+    bool started;
+};
+
+// an IPv4 address or localhost, a colon and a port, like 192.168.1.20:26761
+bool ParseUdpEndpoint(const std::string& arg, UdpEndpoint& endpoint);
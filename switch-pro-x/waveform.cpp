@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cmath>
+
+#include "waveform.h"
+
+namespace
+{
+    // how fast the envelope follows a new target, in 1/256 steps per sample: silence to full
+    // in 20ms, and back in 40ms so short pulses don't just click
+    constexpr std::uint32_t ATTACK_STEP = (255 << 8) / 4;
+    constexpr std::uint32_t RELEASE_STEP = (255 << 8) / 8;
+
+    // the frequency bytes of the plain frame, per motor. discovered through trial and error
+    constexpr std::uint8_t LARGE_FREQUENCY = 0x80;
+    constexpr std::uint8_t SMALL_FREQUENCY = 0x98;
+    constexpr std::uint8_t PLAIN_BYTE_1 = 0x20;
+    constexpr std::uint8_t PLAIN_BYTE_2 = 0x62;
+
+    // the same bytes as without waveforms, so output rate control still recognizes them. the
+    // amplitude is the top 6 bits
+    void EncodeMotor(std::uint8_t frequency, std::uint8_t amplitude, std::uint8_t* out)
+    {
+        if (amplitude == 0)
+        {
+            out[0] = LARGE_FREQUENCY;
+            out[1] = 0x00;
+            out[2] = 0x00;
+            out[3] = 0x00;
+        }
+        else
+        {
+            out[0] = frequency;
+            out[1] = PLAIN_BYTE_1;
+            out[2] = PLAIN_BYTE_2;
+            out[3] = amplitude >> 2;
+        }
+    }
+
+    std::uint32_t Approach(std::uint32_t level, std::uint8_t target)
+    {
+        using std::min;
+
+        const std::uint32_t goal = target << 8;
+
+        if (level < goal)
+        {
+            return min(level + ATTACK_STEP, goal);
+        }
+
+        return level - min(level - goal, RELEASE_STEP);
+    }
+
+    std::uint8_t Amplitude(double strength)
+    {
+        using std::lround;
+        using std::max;
+        using std::min;
+
+        return static_cast<std::uint8_t>(lround(max(0.0, min(1.0, strength)) * 255));
+    }
+
+    // a single hard step on the small motor, the shortest thing the controller can play
+    RumbleEffect MakeClick()
+    {
+        return { "click", { { 0, 255 }, { 0, 96 } } };
+    }
+
+    // the large motor kicks in fast and dies away, like hitting something
+    RumbleEffect MakeBump()
+    {
+        using std::exp;
+
+        RumbleEffect effect = { "bump", {} };
+
+        for (int i = 0; i < 24; i++)
+        {
+            const double strength = i < 3 ? (i + 1) / 3.0 : exp(-(i - 2) / 5.0);
+            effect.samples.push_back({ Amplitude(strength), Amplitude(strength / 3) });
+        }
+
+        return effect;
+    }
+
+    // two bumps, the second softer
+    RumbleEffect MakeHeartbeat()
+    {
+        RumbleEffect effect = MakeBump();
+        effect.name = "heartbeat";
+
+        const auto beat = effect.samples;
+        effect.samples.resize(30, { 0, 0 });
+
+        for (const auto& sample : beat)
+        {
+            effect.samples.push_back({ static_cast<std::uint8_t>(sample.large * 2 / 3), static_cast<std::uint8_t>(sample.small * 2 / 3) });
+        }
+
+        return effect;
+    }
+
+    // the small motor switched on and off every step, a texture xinput values can't describe
+    RumbleEffect MakeBuzz()
+    {
+        RumbleEffect effect = { "buzz", {} };
+
+        for (int i = 0; i < 30; i++)
+        {
+            effect.samples.push_back({ 0, static_cast<std::uint8_t>(i % 2 == 0 ? 255 : 0) });
+        }
+
+        return effect;
+    }
+
+    // both motors swelling over half a second, then cut
+    RumbleEffect MakeRamp()
+    {
+        RumbleEffect effect = { "ramp", {} };
+
+        for (int i = 1; i <= 100; i++)
+        {
+            effect.samples.push_back({ Amplitude(i / 100.0), Amplitude(i / 200.0) });
+        }
+
+        return effect;
+    }
+}
+
+const std::vector<RumbleEffect>& RumbleEffects()
+{
+    static const std::vector<RumbleEffect> effects = { MakeClick(), MakeBump(), MakeHeartbeat(), MakeBuzz(), MakeRamp() };
+
+    return effects;
+}
+
+int FindRumbleEffect(const std::string& name)
+{
+    const auto& effects = RumbleEffects();
+
+    for (std::size_t i = 0; i < effects.size(); i++)
+    {
+        if (name == effects[i].name)
+        {
+            return static_cast<int>(i);
+        }
+    }
+
+    return -1;
+}
+
+void EncodeRumblePacket(const RumbleSample* samples, std::size_t count, std::uint8_t* rumble)
+{
+    using std::max;
+
+    RumbleSample peak = { 0, 0 };
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        peak.large = max(peak.large, samples[i].large);
+        peak.small = max(peak.small, samples[i].small);
+    }
+
+    EncodeMotor(LARGE_FREQUENCY, peak.large, rumble);
+    EncodeMotor(SMALL_FREQUENCY, peak.small, rumble + OUTPUT_RUMBLE_SIZE / 2);
+}
+
+RumbleSample DecodeRumblePacket(const std::uint8_t* rumble)
+{
+    const auto small = rumble + OUTPUT_RUMBLE_SIZE / 2;
+
+    return { static_cast<std::uint8_t>(rumble[3] << 2), static_cast<std::uint8_t>(small[3] << 2) };
+}
+
+RumbleWaveform::RumbleWaveform()
+    : target({ 0, 0 })
+    , large_level(0)
+    , small_level(0)
+    , effect(nullptr)
+    , effect_position(0)
+{
+}
+
+void RumbleWaveform::SetTarget(std::uint8_t large, std::uint8_t small)
+{
+    target = { large, small };
+}
+
+void RumbleWaveform::Play(const RumbleEffect& _effect)
+{
+    effect = &_effect;
+    effect_position = 0;
+}
+
+bool RumbleWaveform::Busy() const
+{
+    return effect != nullptr || large_level != static_cast<std::uint32_t>(target.large << 8) || small_level != static_cast<std::uint32_t>(target.small << 8);
+}
+
+void RumbleWaveform::Render(RumbleSample* samples, std::size_t count)
+{
+    using std::max;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        large_level = Approach(large_level, target.large);
+        small_level = Approach(small_level, target.small);
+
+        RumbleSample sample = { static_cast<std::uint8_t>(large_level >> 8), static_cast<std::uint8_t>(small_level >> 8) };
+
+        if (effect)
+        {
+            const auto& step = effect->samples[effect_position++];
+            sample.large = max(sample.large, step.large);
+            sample.small = max(sample.small, step.small);
+
+            if (effect_position == effect->samples.size())
+            {
+                effect = nullptr;
+            }
+        }
+
+        samples[i] = sample;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "output_rate.h"
+
+// the envelope and effects move in 5ms steps, and one output report goes out for every three
+constexpr std::chrono::milliseconds RUMBLE_SAMPLE_PERIOD(5);
+constexpr std::size_t RUMBLE_SAMPLES_PER_PACKET = 3;
+constexpr std::chrono::milliseconds RUMBLE_PACKET_PERIOD(RUMBLE_SAMPLE_PERIOD * RUMBLE_SAMPLES_PER_PACKET);
+
+// motor strengths for one 5ms step, on the same 0-255 scale as xinput
+struct RumbleSample
+{
+    std::uint8_t large;
+    std::uint8_t small;
+};
+
+struct RumbleEffect
+{
+    const char* name;
+    std::vector<RumbleSample> samples;
+};
+
+// the effects built in, computed once on first use
+const std::vector<RumbleEffect>& RumbleEffects();
+// index into RumbleEffects, -1 for unknown names
+int FindRumbleEffect(const std::string& name);
+
+// the OUTPUT_RUMBLE_SIZE bytes of an output report for count samples. the plain frame only holds
+// one amplitude per motor, so it plays the loudest of them and short effects aren't dropped
+void EncodeRumblePacket(const RumbleSample* samples, std::size_t count, std::uint8_t* rumble);
+// the amplitudes the frame holds, rounded to its 6 bits
+RumbleSample DecodeRumblePacket(const std::uint8_t* rumble);
+
+// turns the stepwise motor values from xinput into ramps, and plays effects on top of them. only
+// the read thread touches it
+class RumbleWaveform
+{
+public:
+    RumbleWaveform();
+
+    // the motor values a game asked for last, the envelope ramps toward them
+    void SetTarget(std::uint8_t large, std::uint8_t small);
+    // restarts the effect from its first step, an effect already playing is cut off
+    void Play(const RumbleEffect& effect);
+    // true while the output still changes from step to step, when packets are worth sending at
+    // the full rate
+    bool Busy() const;
+    // the next count steps, each the louder of the envelope and the effect per motor
+    void Render(RumbleSample* samples, std::size_t count);
+
+private:
+    RumbleSample target;
+    // in 1/256 steps, so slow ramps don't round away
+    std::uint32_t large_level;
+    std::uint32_t small_level;
+
+    const RumbleEffect* effect;
+    std::size_t effect_position;
+};